@@ -0,0 +1,629 @@
+/*
+ * archive.c: columnar results archive
+ * 
+ * results pile up in memory until there is a block's worth (or the
+ * scan ends), then get sorted and written out with one append.  the
+ * columns are squeezed with nothing fancier than varints and run
+ * lengths, which is most of the win for sorted addresses and the
+ * handful of distinct ports, outcomes and scan ids in a block.  a
+ * block cut short by a crash (or a full disk) is where readers stop, so
+ * it gets cut off before anything more is appended after it.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "args.h"
+#include "targets.h"
+#include "archive.h"
+
+/* the scanner's side */
+static int afd = -1;
+static unsigned int scan_id;
+static arow_t *rows = NULL;
+static unsigned int nrows = 0;
+static unsigned long long written = 0;
+static unsigned long long bytes = 0;
+static off_t aend = 0;			/* where the last whole block ends */
+
+static int archive_flush(void);
+static int archive_fail(void);
+static off_t archive_tail(off_t);
+static int decode_cols(abhdr_t *, arow_t *, unsigned int *);
+static int cmp_row(const void *, const void *);
+static unsigned char *put_varint(unsigned char *, unsigned long long);
+static unsigned char *get_varint(unsigned char *, unsigned char *, unsigned long long *);
+static unsigned char *put_run(unsigned char *, unsigned int *, unsigned int);
+static unsigned char *get_run(unsigned char *, unsigned char *, unsigned int *, unsigned int);
+
+
+/*
+ * open (or start) an archive, everything added goes in under scan id
+ */
+int
+archive_open(fn, id)
+   char *fn;
+   unsigned int id;
+{
+   struct stat st;
+   ahdr_t h;
+   
+   if ((afd = open(fn, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1 || fstat(afd, &st) == -1)
+     {
+	fprintf(stderr, "Unable to open archive \"%s\": %s\n", fn, strerror(errno));
+	return archive_fail();
+     }
+   if (st.st_size == 0)
+     {
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ARCH_MAGIC, sizeof(ARCH_MAGIC));
+	h.version = ARCH_VERSION;
+	if (write(afd, &h, sizeof(h)) != sizeof(h))
+	  {
+	     fprintf(stderr, "Unable to write archive header: %s\n", strerror(errno));
+	     return archive_fail();
+	  }
+     }
+   else if (pread(afd, &h, sizeof(h), 0) != sizeof(h)
+	    || memcmp(h.magic, ARCH_MAGIC, sizeof(ARCH_MAGIC))
+	    || h.version != ARCH_VERSION)
+     {
+	fprintf(stderr, "\"%s\" is not a results archive.\n", fn);
+	return archive_fail();
+     }
+   /* a torn last block would hide everything appended after it */
+   aend = st.st_size ? archive_tail(st.st_size) : (off_t)sizeof(h);
+   if (aend < st.st_size)
+     {
+	if (ftruncate(afd, aend) == -1)
+	  {
+	     fprintf(stderr, "Unable to cut the torn block off archive \"%s\": %s\n", fn, strerror(errno));
+	     return archive_fail();
+	  }
+	if (options.verbose >= 1)
+	  fprintf(stderr, "cut a torn block (%llu bytes) off archive \"%s\".\n",
+		  (unsigned long long)(st.st_size - aend), fn);
+     }
+   if (!(rows = (arow_t *)malloc(ARCH_BLOCK_ROWS * sizeof(arow_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for the archive block.\n");
+	return archive_fail();
+     }
+   scan_id = id;
+   if (options.verbose >= 1)
+     fprintf(stderr, "appending results to archive \"%s\" as scan %u.\n", fn, id);
+   return 0;
+}
+
+/*
+ * add a finished target
+ */
+void
+archive_add(t, outcome, when, ms)
+   target_t *t;
+   unsigned int outcome;
+   time_t when;
+   unsigned int ms;
+{
+   arow_t *r;
+   
+   if (afd == -1)
+     return;
+   r = &rows[nrows++];
+   r->ip = t->ip;
+   r->port = t->port;
+   r->outcome = outcome;
+   if (t->state & SPSS_5_AUTH_NONE_OK)
+     r->auth = 0;
+   else if (t->state & SPSS_5_AUTH_PASS_OK)
+     r->auth = 2;
+   else
+     r->auth = ARCH_NO_AUTH;
+   r->ms = ms;
+   r->when = (unsigned int)when;
+   r->scan = scan_id;
+   if (nrows == ARCH_BLOCK_ROWS)
+     archive_flush();
+}
+
+void
+archive_close()
+{
+   if (afd == -1)
+     return;
+   archive_flush();
+   if (options.verbose >= 1)
+     fprintf(stderr, "archived %llu results in %llu bytes.\n", written, bytes);
+   close(afd);
+   afd = -1;
+   free(rows);
+   rows = NULL;
+}
+
+
+/*
+ * give up on the archive we were opening
+ */
+static int
+archive_fail()
+{
+   if (afd != -1)
+     close(afd);
+   afd = -1;
+   return -1;
+}
+
+
+/*
+ * walk the blocks of the archive being opened (size bytes), returns
+ * where the last whole one ends
+ */
+static off_t
+archive_tail(size)
+   off_t size;
+{
+   off_t off = sizeof(ahdr_t);
+   abhdr_t h;
+   
+   while (off + (off_t)sizeof(h) <= size
+	  && pread(afd, &h, sizeof(h), off) == sizeof(h)
+	  && !memcmp(h.magic, ARCH_BLOCK_MAGIC, 4)
+	  && h.nrows > 0 && h.nrows <= ARCH_BLOCK_ROWS
+	  && (off_t)h.len <= size - off - (off_t)sizeof(h))
+     off += sizeof(h) + h.len;
+   return off;
+}
+
+
+/*
+ * sort, encode and append the rows collected so far
+ */
+static int
+archive_flush()
+{
+   abhdr_t *h;
+   unsigned char *buf, *p, *col;
+   unsigned int i, j;
+   unsigned int *tmp;
+   size_t len;
+   ssize_t n;
+   
+   if (nrows == 0)
+     return 0;
+   qsort(rows, nrows, sizeof(arow_t), cmp_row);
+   
+   /* the worst case is a v6 ip, 4 runs and 2 varints per row */
+   len = sizeof(abhdr_t) + (size_t)nrows * (17 + 4 * 10 + 2 * 5) + 8;
+   if (!(buf = (unsigned char *)calloc(1, len)) || !(tmp = (unsigned int *)malloc(nrows * sizeof(unsigned int))))
+     {
+	fprintf(stderr, "Unable to allocate memory to write an archive block.\n");
+	free(buf);
+	nrows = 0;
+	return -1;
+     }
+   
+   /* the index */
+   h = (abhdr_t *)buf;
+   memcpy(h->magic, ARCH_BLOCK_MAGIC, 4);
+   h->nrows = nrows;
+   h->ip_min = rows[0].ip;
+   h->ip_max = rows[nrows - 1].ip;
+   h->scan_min = h->scan_max = rows[0].scan;
+   h->when_min = h->when_max = rows[0].when;
+   h->port_min = h->port_max = rows[0].port;
+   h->out_and = 0xff;
+   h->v4 = 1;
+   for (i = 0; i < nrows; i++)
+     {
+	arow_t *r = &rows[i];
+   
+	if (r->scan < h->scan_min)
+	  h->scan_min = r->scan;
+	if (r->scan > h->scan_max)
+	  h->scan_max = r->scan;
+	if (r->when < h->when_min)
+	  h->when_min = r->when;
+	if (r->when > h->when_max)
+	  h->when_max = r->when;
+	if (r->port < h->port_min)
+	  h->port_min = r->port;
+	if (r->port > h->port_max)
+	  h->port_max = r->port;
+	h->out_or |= r->outcome;
+	h->out_and &= r->outcome;
+	if (!taddr_is_v4(&r->ip))
+	  h->v4 = 0;
+     }
+   
+   /* the columns */
+   p = col = buf + sizeof(abhdr_t);
+   if (h->v4)
+     {
+	unsigned int last = 0, a;
+   
+	for (i = 0; i < nrows; i++)
+	  {
+	     a = (rows[i].ip.b[12] << 24) | (rows[i].ip.b[13] << 16) | (rows[i].ip.b[14] << 8) | rows[i].ip.b[15];
+	     p = put_varint(p, a - last);
+	     last = a;
+	  }
+     }
+   else
+     {
+	/* how many bytes it shares with the one before, then the rest */
+	for (i = 0; i < nrows; i++)
+	  {
+	     j = 0;
+	     if (i > 0)
+	       while (j < 16 && rows[i].ip.b[j] == rows[i - 1].ip.b[j])
+		 j++;
+	     *p++ = j;
+	     memcpy(p, rows[i].ip.b + j, 16 - j);
+	     p += 16 - j;
+	  }
+     }
+   h->collen[AC_IP] = p - col;
+   
+   for (i = 0; i < nrows; i++)
+     tmp[i] = rows[i].port;
+   col = p;
+   p = put_run(p, tmp, nrows);
+   h->collen[AC_PORT] = p - col;
+   
+   for (i = 0; i < nrows; i++)
+     tmp[i] = rows[i].outcome;
+   col = p;
+   p = put_run(p, tmp, nrows);
+   h->collen[AC_OUTCOME] = p - col;
+   
+   for (i = 0; i < nrows; i++)
+     tmp[i] = rows[i].auth;
+   col = p;
+   p = put_run(p, tmp, nrows);
+   h->collen[AC_AUTH] = p - col;
+   
+   col = p;
+   for (i = 0; i < nrows; i++)
+     p = put_varint(p, rows[i].ms);
+   h->collen[AC_MS] = p - col;
+   
+   col = p;
+   for (i = 0; i < nrows; i++)
+     p = put_varint(p, rows[i].when - h->when_min);
+   h->collen[AC_WHEN] = p - col;
+   
+   for (i = 0; i < nrows; i++)
+     tmp[i] = rows[i].scan;
+   col = p;
+   p = put_run(p, tmp, nrows);
+   h->collen[AC_SCAN] = p - col;
+   
+   /* keep the next header aligned */
+   while ((p - buf) % 8)
+     *p++ = 0;
+   h->len = (p - buf) - sizeof(abhdr_t);
+   
+   /* one append, so a crash leaves at worst a short last block */
+   len = p - buf;
+   n = write(afd, buf, len);
+   if (n != (ssize_t)len)
+     {
+	fprintf(stderr, "Unable to append %u results to the archive: %s\n", nrows,
+		n == -1 ? strerror(errno) : "short write");
+	/* don't leave a partial block for the next ones to hide behind */
+	if (n > 0 && ftruncate(afd, aend) == -1)
+	  fprintf(stderr, "Unable to cut the partial block off the archive: %s\n", strerror(errno));
+     }
+   else
+     {
+	written += nrows;
+	bytes += len;
+	aend += len;
+     }
+   free(tmp);
+   free(buf);
+   nrows = 0;
+   return n == (ssize_t)len ? 0 : -1;
+}
+
+
+/*
+ * map an archive for reading
+ */
+archive_t *
+archive_map(fn)
+   char *fn;
+{
+   struct stat st;
+   archive_t *a;
+   ahdr_t *h;
+   void *p;
+   int fd;
+   
+   if ((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+     {
+	fprintf(stderr, "Unable to open archive \"%s\": %s\n", fn, strerror(errno));
+	if (fd != -1)
+	  close(fd);
+	return NULL;
+     }
+   if (st.st_size < (off_t)sizeof(ahdr_t)
+       || (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+     {
+	fprintf(stderr, "\"%s\" is not a results archive.\n", fn);
+	close(fd);
+	return NULL;
+     }
+   h = (ahdr_t *)p;
+   if (memcmp(h->magic, ARCH_MAGIC, sizeof(ARCH_MAGIC)) || h->version != ARCH_VERSION)
+     {
+	fprintf(stderr, "\"%s\" is not a results archive.\n", fn);
+	munmap(p, st.st_size);
+	close(fd);
+	return NULL;
+     }
+   if (!(a = (archive_t *)calloc(1, sizeof(archive_t))))
+     {
+	munmap(p, st.st_size);
+	close(fd);
+	return NULL;
+     }
+   a->fd = fd;
+   a->map = (unsigned char *)p;
+   a->len = st.st_size;
+   return a;
+}
+
+/*
+ * the block after prev (or the first one if prev is NULL), only the
+ * header is looked at
+ */
+abhdr_t *
+archive_next(a, prev)
+   archive_t *a;
+   abhdr_t *prev;
+{
+   size_t off;
+   abhdr_t *h;
+   
+   if (!prev)
+     off = sizeof(ahdr_t);
+   else
+     off = ((unsigned char *)prev - a->map) + sizeof(abhdr_t) + prev->len;
+   if (off + sizeof(abhdr_t) > a->len)
+     return NULL;
+   h = (abhdr_t *)(a->map + off);
+   if (memcmp(h->magic, ARCH_BLOCK_MAGIC, 4)
+       || h->nrows == 0 || h->nrows > ARCH_BLOCK_ROWS
+       || h->len > a->len - off - sizeof(abhdr_t))
+     return NULL;
+   return h;
+}
+
+/*
+ * unpack a block into rows (room for h->nrows of them)
+ * 
+ * returns the number of rows or -1 if the block is damaged
+ */
+long
+archive_decode(h, out)
+   abhdr_t *h;
+   arow_t *out;
+{
+   unsigned int *tmp, i;
+   size_t tot = 0;
+   long ret;
+   
+   for (i = 0; i < ARCH_NCOLS; i++)
+     tot += h->collen[i];
+   if (tot > h->len || !(tmp = (unsigned int *)malloc(h->nrows * sizeof(unsigned int))))
+     return -1;
+   memset(out, 0, h->nrows * sizeof(arow_t));
+   ret = decode_cols(h, out, tmp) == -1 ? -1 : (long)h->nrows;
+   free(tmp);
+   return ret;
+}
+
+void
+archive_unmap(a)
+   archive_t *a;
+{
+   munmap(a->map, a->len);
+   close(a->fd);
+   free(a);
+}
+
+
+/*
+ * the column by column part of archive_decode(), tmp has room for a
+ * block's worth of values
+ */
+static int
+decode_cols(h, out, tmp)
+   abhdr_t *h;
+   arow_t *out;
+   unsigned int *tmp;
+{
+   unsigned char *p = (unsigned char *)(h + 1), *end;
+   unsigned long long v;
+   unsigned int i, j;
+   
+   end = p + h->collen[AC_IP];
+   if (h->v4)
+     {
+	unsigned int a = 0;
+   
+	for (i = 0; i < h->nrows; i++)
+	  {
+	     if (!(p = get_varint(p, end, &v)))
+	       return -1;
+	     a += (unsigned int)v;
+	     out[i].ip.b[10] = out[i].ip.b[11] = 0xff;
+	     out[i].ip.b[12] = a >> 24;
+	     out[i].ip.b[13] = a >> 16;
+	     out[i].ip.b[14] = a >> 8;
+	     out[i].ip.b[15] = a;
+	  }
+     }
+   else
+     {
+	for (i = 0; i < h->nrows; i++)
+	  {
+	     if (p >= end || (j = *p++) > 16 || (i == 0 && j > 0) || p + 16 - j > end)
+	       return -1;
+	     if (j > 0)
+	       memcpy(out[i].ip.b, out[i - 1].ip.b, j);
+	     memcpy(out[i].ip.b + j, p, 16 - j);
+	     p += 16 - j;
+	  }
+     }
+   
+   p = end;
+   end = p + h->collen[AC_PORT];
+   if (!get_run(p, end, tmp, h->nrows))
+     return -1;
+   for (i = 0; i < h->nrows; i++)
+     out[i].port = tmp[i];
+   
+   p = end;
+   end = p + h->collen[AC_OUTCOME];
+   if (!get_run(p, end, tmp, h->nrows))
+     return -1;
+   for (i = 0; i < h->nrows; i++)
+     out[i].outcome = tmp[i];
+   
+   p = end;
+   end = p + h->collen[AC_AUTH];
+   if (!get_run(p, end, tmp, h->nrows))
+     return -1;
+   for (i = 0; i < h->nrows; i++)
+     out[i].auth = tmp[i];
+   
+   p = end;
+   end = p + h->collen[AC_MS];
+   for (i = 0; i < h->nrows; i++)
+     {
+	if (!(p = get_varint(p, end, &v)))
+	  return -1;
+	out[i].ms = v;
+     }
+   
+   p = end;
+   end = p + h->collen[AC_WHEN];
+   for (i = 0; i < h->nrows; i++)
+     {
+	if (!(p = get_varint(p, end, &v)))
+	  return -1;
+	out[i].when = h->when_min + v;
+     }
+   
+   p = end;
+   end = p + h->collen[AC_SCAN];
+   if (!get_run(p, end, tmp, h->nrows))
+     return -1;
+   for (i = 0; i < h->nrows; i++)
+     out[i].scan = tmp[i];
+   
+   return 0;
+}
+
+
+/*
+ * by ip, then port
+ */
+static int
+cmp_row(a, b)
+   const void *a, *b;
+{
+   const arow_t *ra = (const arow_t *)a, *rb = (const arow_t *)b;
+   int c;
+   
+   if ((c = memcmp(ra->ip.b, rb->ip.b, 16)))
+     return c;
+   return (int)ra->port - (int)rb->port;
+}
+
+
+/*
+ * 7 bits at a time, low bits first
+ */
+static unsigned char *
+put_varint(p, v)
+   unsigned char *p;
+   unsigned long long v;
+{
+   while (v >= 0x80)
+     {
+	*p++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+     }
+   *p++ = v;
+   return p;
+}
+
+static unsigned char *
+get_varint(p, end, v)
+   unsigned char *p, *end;
+   unsigned long long *v;
+{
+   int shift = 0;
+   
+   *v = 0;
+   while (p < end && shift < 64)
+     {
+	*v |= (unsigned long long)(*p & 0x7f) << shift;
+	if (!(*p++ & 0x80))
+	  return p;
+	shift += 7;
+     }
+   return NULL;
+}
+
+
+/*
+ * (count, value) pairs
+ */
+static unsigned char *
+put_run(p, v, n)
+   unsigned char *p;
+   unsigned int *v, n;
+{
+   unsigned int i, j;
+   
+   for (i = 0; i < n; i = j)
+     {
+	for (j = i + 1; j < n && v[j] == v[i]; j++)
+	  ;
+	p = put_varint(p, j - i);
+	p = put_varint(p, v[i]);
+     }
+   return p;
+}
+
+static unsigned char *
+get_run(p, end, v, n)
+   unsigned char *p, *end;
+   unsigned int *v, n;
+{
+   unsigned long long cnt, val;
+   unsigned int i = 0;
+   
+   while (i < n)
+     {
+	if (!(p = get_varint(p, end, &cnt)) || !(p = get_varint(p, end, &val))
+	    || cnt == 0 || cnt > n - i)
+	  return NULL;
+	while (cnt--)
+	  v[i++] = (unsigned int)val;
+     }
+   return p;
+}
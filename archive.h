@@ -0,0 +1,97 @@
+/*
+ * archive.h: columnar results archive
+ * 
+ * the file is a small header followed by blocks.  each block holds up
+ * to ARCH_BLOCK_ROWS results sorted by (ip, port), stored one column
+ * after another, with the ranges of its ips, ports, times and scan ids
+ * up front so a query can skip the blocks it has no use for without
+ * decoding them.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __archive_h
+#define __archive_h
+
+#include <stddef.h>
+#include <time.h>
+
+#include "targets.h"
+
+#define ARCH_MAGIC 		"SSARCH"
+#define ARCH_VERSION 		1
+#define ARCH_BLOCK_MAGIC 	"SSAB"
+
+/* results per block */
+#define ARCH_BLOCK_ROWS 	65536
+
+/* the columns, in the order they are stored */
+#define AC_IP 			0	/* delta varints, or shared prefix + rest */
+#define AC_PORT 		1	/* run length */
+#define AC_OUTCOME 		2	/* run length, CO_* bits */
+#define AC_AUTH 		3	/* run length, socks5 method */
+#define AC_MS 			4	/* varints */
+#define AC_WHEN 		5	/* varints, from when_min */
+#define AC_SCAN 		6	/* run length */
+#define ARCH_NCOLS 		7
+
+/* no socks5 method was agreed on */
+#define ARCH_NO_AUTH 		0xff
+
+/* the file header */
+typedef struct
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int pad;
+} ahdr_t;
+
+/* in front of every block */
+typedef struct
+{
+   char magic[4];
+   unsigned int nrows;
+   unsigned int len;		/* bytes of column data after this */
+   unsigned int scan_min, scan_max;
+   unsigned int when_min, when_max;
+   unsigned short port_min, port_max;
+   unsigned char out_or;	/* every outcome bit seen */
+   unsigned char out_and;	/* bits every row has */
+   unsigned char v4;		/* all IPv4, ips are 32 bit deltas */
+   unsigned char pad;
+   taddr_t ip_min, ip_max;
+   unsigned int collen[ARCH_NCOLS];
+} abhdr_t;
+
+/* one result */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   unsigned char outcome;
+   unsigned char auth;
+   unsigned int ms;
+   unsigned int when;
+   unsigned int scan;
+} arow_t;
+
+/* a mapped archive */
+typedef struct
+{
+   int fd;
+   unsigned char *map;
+   size_t len;
+} archive_t;
+
+/* prototypes */
+int archive_open(char *, unsigned int);
+void archive_add(target_t *, unsigned int, time_t, unsigned int);
+void archive_close(void);
+
+/* for readers */
+archive_t *archive_map(char *);
+abhdr_t *archive_next(archive_t *, abhdr_t *);
+long archive_decode(abhdr_t *, arow_t *);
+void archive_unmap(archive_t *);
+
+#endif
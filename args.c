@@ -7,17 +7,106 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#include <sys/types.h>
-#include <pwd.h>
-
-#include <netdb.h>
+#include <errno.h>
+#include <getopt.h>
+#include <arpa/inet.h>
 
 #include "targets.h"
 #include "args.h"
+#include "scan.h"
+#include "exclude.h"
+#include "dist.h"
+#include "socksscan.h"
+#include "trace.h"
 
-#include "nsock_tcp.h"
-#include "nsock_resolve.h"
+/* options that only have a long form */
+#define OPT_SOURCE 		256
+#define OPT_EXCLUDE_FILE 	257
+#define OPT_CACHE 		258
+#define OPT_CACHE_TTL 		259
+#define OPT_CACHE_SIZE 		260
+#define OPT_COORDINATOR 	261
+#define OPT_WORKER 		262
+#define OPT_CHUNK_SIZE 		263
+#define OPT_LEASE_TIME 		264
+#define OPT_RECORD 		265
+#define OPT_REPLAY 		266
+#define OPT_REPLY_TIMEOUT 	267
+#define OPT_MIN_TIMEOUT 	268
+#define OPT_FIXED_TIMEOUTS 	269
+#define OPT_CONNECT_RETRIES 	270
+#define OPT_RESET_RETRIES 	271
+#define OPT_RETRY_DELAY 	272
+#define OPT_RETRY_BUDGET 	273
+#define OPT_RING 		274
+#define OPT_RING_SIZE 		275
+#define OPT_RING_WAIT 		276
+#define OPT_ARCHIVE 		277
+#define OPT_SCAN_ID 		278
+#define OPT_MINUS 		279
+#define OPT_INTERSECT 		280
+#define OPT_DONE 		281
+#define OPT_STATS 		282
+#define OPT_UDP 		283
+#define OPT_MONITOR 		284
+#define OPT_MONITOR_MAX 	285
+#define OPT_MONITOR_SHARE 	286
+#define OPT_COMPILE_TARGETS 	287
+#define OPT_MAX_MEMORY 		288
+#define OPT_ORDER 		289
+#define OPT_JOBS 		290
+#define OPT_PROBES 		291
+#define OPT_DEST 		292
+#define OPT_DEST_SLOTS 		293
+#define OPT_MATRIX 		294
+
+static struct option long_opts[] =
+{
+     { "source", required_argument, NULL, OPT_SOURCE },
+     { "exclude-file", required_argument, NULL, OPT_EXCLUDE_FILE },
+     { "minus", required_argument, NULL, OPT_MINUS },
+     { "intersect", required_argument, NULL, OPT_INTERSECT },
+     { "done", required_argument, NULL, OPT_DONE },
+     { "compile-targets", required_argument, NULL, OPT_COMPILE_TARGETS },
+     { "cache", required_argument, NULL, OPT_CACHE },
+     { "cache-ttl", required_argument, NULL, OPT_CACHE_TTL },
+     { "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+     { "coordinator", required_argument, NULL, OPT_COORDINATOR },
+     { "worker", required_argument, NULL, OPT_WORKER },
+     { "chunk-size", required_argument, NULL, OPT_CHUNK_SIZE },
+     { "lease-time", required_argument, NULL, OPT_LEASE_TIME },
+     { "record", required_argument, NULL, OPT_RECORD },
+     { "replay", required_argument, NULL, OPT_REPLAY },
+     { "reply-timeout", required_argument, NULL, OPT_REPLY_TIMEOUT },
+     { "min-timeout", required_argument, NULL, OPT_MIN_TIMEOUT },
+     { "fixed-timeouts", no_argument, NULL, OPT_FIXED_TIMEOUTS },
+     { "connect-retries", required_argument, NULL, OPT_CONNECT_RETRIES },
+     { "reset-retries", required_argument, NULL, OPT_RESET_RETRIES },
+     { "retry-delay", required_argument, NULL, OPT_RETRY_DELAY },
+     { "retry-budget", required_argument, NULL, OPT_RETRY_BUDGET },
+     { "ring", required_argument, NULL, OPT_RING },
+     { "ring-size", required_argument, NULL, OPT_RING_SIZE },
+     { "ring-wait", no_argument, NULL, OPT_RING_WAIT },
+     { "archive", required_argument, NULL, OPT_ARCHIVE },
+     { "scan-id", required_argument, NULL, OPT_SCAN_ID },
+     { "stats", required_argument, NULL, OPT_STATS },
+     { "max-memory", required_argument, NULL, OPT_MAX_MEMORY },
+     { "udp", required_argument, NULL, OPT_UDP },
+     { "monitor", required_argument, NULL, OPT_MONITOR },
+     { "monitor-max", required_argument, NULL, OPT_MONITOR_MAX },
+     { "monitor-share", required_argument, NULL, OPT_MONITOR_SHARE },
+     { "order", required_argument, NULL, OPT_ORDER },
+     { "jobs", required_argument, NULL, OPT_JOBS },
+     { "probes", required_argument, NULL, OPT_PROBES },
+     { "dest", required_argument, NULL, OPT_DEST },
+     { "dest-slots", required_argument, NULL, OPT_DEST_SLOTS },
+     { "matrix", required_argument, NULL, OPT_MATRIX },
+     { NULL, 0, NULL, 0 }
+};
+
+static int load_sources(char *);
+static int load_dests(char *);
+static int combine_file(targlist_t *, char *, int, int);
 
 /*
  * show the help! 
@@ -30,64 +119,135 @@ show_usage(v0)
 	   "usage: %s [<options>] [<host/ip/cidr>] ...\n"
 	   "\n"
 	   "valid options:\n"
-	   "  -f <file>           read targets from <file>\n"
+	   "  -b <backend>        use the <backend> i/o backend (epoll, select, uring)\n"
+	   "  -f <file>           read targets from <file> (a list, or compiled)\n"
 	   "  -r <host>[:<port>]  change the remote host to connect to\n"
+	   "                      (use [<ipv6>]:<port> for IPv6 addresses)\n"
 	   "  -s <slots>          set the # of parallel scans to <slots>\n"
 	   "  -t <secs>           set connect timeout to <secs>\n"
 	   "  -u <username>       set username reported to remote to <username>\n"
 	   "  -v                  increase verbosity level once per use\n"
-	   , v0);
+	   "  --probes <list>     probe for the comma separated protocols in <list>\n"
+	   "                      (v4, v4a, v5, http or all, default %s) in turn, a\n"
+	   "                      reply in another protocol settling the others\n"
+	   "  --dest <host>[:<port>][,...] ask every proxy found for these too\n"
+	   "                      (names go to the proxy unresolved, v4 only\n"
+	   "                      asks for IPv4 ones)\n"
+	   "  --dest-slots <n>    check at most <n> of them at once per proxy\n"
+	   "                      (default %u)\n"
+	   "  --matrix <file>     write a row per proxy of what it reached to <file>\n"
+	   "  --max-memory <size>[k|m|g] stay under <size> bytes: fewer slots, big\n"
+	   "                      target lists read from a temporary file (moved\n"
+	   "                      there as they load, for -f after this option),\n"
+	   "                      and less remembered about the networks scanned.\n"
+	   "                      --jobs lists share the targets' quarter of it,\n"
+	   "                      a --coordinator's list is read the same way\n"
+	   "  --udp <ip>[:<port>] try socks5 UDP ASSOCIATE instead of CONNECT, relaying\n"
+	   "                      a datagram to the echo endpoint <ip>:<port> (default\n"
+	   "                      port %u, answered here if <ip> is ours)\n"
+	   "  --reply-timeout <secs> give up on a connected target that hasn't\n"
+	   "                      replied after <secs> (default %u, or -t if less)\n"
+	   "  --min-timeout <ms>  never cut a connect or reply shorter than <ms>\n"
+	   "                      (default %u) when timing it from its network\n"
+	   "  --fixed-timeouts    always use -t and --reply-timeout as they are\n"
+	   "  --connect-retries <n> retry a connect that timed out <n> times\n"
+	   "                      (default %u)\n"
+	   "  --reset-retries <n> start a pass over up to <n> times after a\n"
+	   "                      connection reset (default %u)\n"
+	   "  --retry-delay <ms>  wait about <ms> before the first retry, doubling\n"
+	   "                      each time after (default %u)\n"
+	   "  --retry-budget <pct> never retry more than <pct>%% of the targets\n"
+	   "                      (default %u)\n"
+	   "  --source <ips>      bind outgoing connections to the comma separated\n"
+	   "                      <ips>/cidrs in turn\n"
+	   "  --exclude-file <file> never scan the ips/cidrs listed in <file>\n"
+	   "  --minus <file>      don't scan the targets listed in <file>\n"
+	   "  --intersect <file>  only scan targets also listed in <file>\n"
+	   "  --done <file>       keep track of finished targets in <file> and\n"
+	   "                      skip the ones already in it\n"
+	   "  --compile-targets <file> write the targets, as they are after all of\n"
+	   "                      the above, to <file> for -f to load instantly\n"
+	   "                      (read-only, shared between processes) and quit\n"
+	   "  --cache <file>      remember results in <file>, skip recently scanned\n"
+	   "                      targets and scan previously open ones first\n"
+	   "  --cache-ttl <secs>  rescan targets after <secs> (default %u, 0 = always)\n"
+	   "  --cache-size <n>    start a new cache with room for <n> entries\n"
+	   "  --order <file>      scan the targets likeliest to be open first, going\n"
+	   "                      by the hit rates of their networks and ports in\n"
+	   "                      the archive <file> (see --archive)\n"
+	   "  --coordinator [<ip>:]<port>\n"
+	   "                      hand the targets out to workers instead of\n"
+	   "                      scanning them (default port %u)\n"
+	   "  --worker <host>[:<port>]\n"
+	   "                      scan targets handed out by a coordinator\n"
+	   "  --chunk-size <n>    lease <n> targets to a worker at a time\n"
+	   "  --lease-time <secs> take chunks back from workers silent for <secs>\n"
+	   "  --record <file>     write every connect/send/receive/timeout to <file>\n"
+	   "  --replay <file>     re-run a recorded scan without the network\n"
+	   "  --ring <file>       write binary results to a shared memory ring in\n"
+	   "                      <file> instead of printing them (see ring.h)\n"
+	   "  --ring-size <n>     make the ring <n> results big (default %u)\n"
+	   "  --ring-wait         wait for the reader when the ring is full instead\n"
+	   "                      of dropping results\n"
+	   "  --archive <file>    append the results to a columnar archive in <file>\n"
+	   "                      (see socks_query)\n"
+	   "  --scan-id <n>       archive this scan as <n> (default the start time)\n"
+	   "  --stats <file>      write what the probes cost, by outcome, to <file>\n"
+	   "  --monitor <file>    keep going: track the open proxies found (and the\n"
+	   "                      ones in <file>) and probe them again as they come\n"
+	   "                      due, printing only changes, until interrupted\n"
+	   "  --monitor-max <n>   track at most <n> proxies (default %u)\n"
+	   "  --monitor-share <pct> give the targets <pct>%% of each batch while\n"
+	   "                      tracked proxies are due (default %u)\n"
+	   "  --jobs <file>       run the scans in <file>, one per line, together,\n"
+	   "                      sharing the slots by weight (see jobs.c)\n"
+	   , v0, DEFAULT_PROBES, DEFAULT_DEST_SLOTS, DEFAULT_UDP_ECHO_PORT, DEFAULT_REPLY_TIMEOUT, DEFAULT_MIN_TIMEOUT, DEFAULT_CONNECT_RETRIES,
+	   DEFAULT_RESET_RETRIES, DEFAULT_RETRY_DELAY, DEFAULT_RETRY_BUDGET,
+	   DEFAULT_CACHE_TTL, DEFAULT_COORD_PORT, DEFAULT_RING_SIZE,
+	   DEFAULT_MONITOR_MAX, DEFAULT_MONITOR_SHARE);
 }
 
 /*
  * parse the command line paramters into the options structure
  */
-int
+long
 parse_args(c, v, tlist)
    int c;
    char *v[];
-   targlist_t **tlist;
+   targlist_t *tlist;
 {
    unsigned int ch;
-   unsigned long tl, ntargs = 0;
+   unsigned long tl;
+   int n;
+   unsigned long long ull;
    char *p;
-   struct passwd *pw;
-   struct sockaddr_in tin;
+   struct sockaddr_storage tin;
+   char defremote[256];
    
    /* initialize the options */
-   memset(&options, 0, sizeof(options));
-   options.timeout = DEFAULT_CONNECT_TIMEOUT;
-   options.connects = DEFAULT_PARALLEL_CONNECTS;
-   switch (nsock_resolve(nsock_tcp_host(DEFAULT_TARGET_HOST, DEFAULT_TARGET_PORT), &options.remote))
-     {
-      case NSOCK_R_SUCCESS:
-	break;
-      default:
-	fprintf(stderr, "unable to resolve default target host/port\n");
-	return -1;
-     }
-   if (!(pw = getpwuid(getuid())))
-     {
-	fprintf(stderr, "unable to figure out who i am\n");
-	return -1;
-     }
-   options.username = strdup(pw->pw_name);
-
+   if (ss_options_init(&options) == -1)
+     return -1;
+   
    /* check out the command line params */
-   while ((ch = getopt(c, v, "f:r:s:t:u:v")) != -1)
+   while ((ch = getopt_long(c, v, "b:f:r:s:t:u:v", long_opts, NULL)) != -1)
      {
 	switch (ch)
 	  {
+	   case 'b':
+	     if (!scan_backend(optarg))
+	       {
+		  fprintf(stderr, "-%c: unknown i/o backend: %s\n", ch, optarg);
+		  return -1;
+	       }
+	     options.backend = optarg;
+	     break;
 	   case 'f':
-	     ntargs += load_targets_from_file(tlist, optarg);
+	     load_targets_from_file(tlist, optarg);
 	     break;
 	   case 'r':
 	     /* check out the hostname */
-	     switch (nsock_resolve(optarg, &tin))
+	     if (!ss_resolve(optarg, &tin, DEFAULT_TARGET_PORT))
 	       {
-		case NSOCK_R_SUCCESS:
-		  break;
-		default:
 		  fprintf(stderr, "-%c: unable to resolve target host/port: %s\n", ch, optarg);
 		  return -1;
 	       }
@@ -96,7 +256,7 @@ parse_args(c, v, tlist)
 	     break;
 	   case 's':
 	     tl = strtoul(optarg, &p, 0);
-	     if (*p || p == optarg || tl < 1 || tl > 300)
+	     if (*p || p == optarg || tl < 1 || tl > MAX_PARALLEL_CONNECTS)
 	       {
 		  fprintf(stderr, "-%c: invalid slot count value: %s\n", ch, optarg);
 		  return -1;
@@ -120,6 +280,253 @@ parse_args(c, v, tlist)
 	   case 'v':
 	     options.verbose++;
 	     break;
+	   case OPT_EXCLUDE_FILE:
+	     load_excludes(optarg);
+	     break;
+	   case OPT_MINUS:
+	     options.minus = optarg;
+	     break;
+	   case OPT_INTERSECT:
+	     options.intersect = optarg;
+	     break;
+	   case OPT_DONE:
+	     options.done = optarg;
+	     break;
+	   case OPT_COMPILE_TARGETS:
+	     options.compile = optarg;
+	     break;
+	   case OPT_CACHE:
+	     options.cache = optarg;
+	     break;
+	   case OPT_CACHE_TTL:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg)
+	       {
+		  fprintf(stderr, "--cache-ttl: invalid ttl value: %s\n", optarg);
+		  return -1;
+	       }
+	     options.cache_ttl = tl;
+	     break;
+	   case OPT_CACHE_SIZE:
+	     options.cache_size = strtoull(optarg, &p, 0);
+	     if (*p || p == optarg || options.cache_size < 1)
+	       {
+		  fprintf(stderr, "--cache-size: invalid entry count: %s\n", optarg);
+		  return -1;
+	       }
+	     break;
+	   case OPT_COORDINATOR:
+	     /* just a port listens everywhere */
+	     snprintf(defremote, sizeof(defremote), "%s%s",
+		      strspn(optarg, "0123456789") == strlen(optarg) ? "0.0.0.0:" : "", optarg);
+	     if (!ss_resolve(defremote, &options.coord, DEFAULT_COORD_PORT))
+	       {
+		  fprintf(stderr, "--coordinator: invalid listen address: %s\n", optarg);
+		  return -1;
+	       }
+	     options.dist = DIST_COORDINATOR;
+	     break;
+	   case OPT_WORKER:
+	     if (!ss_resolve(optarg, &options.coord, DEFAULT_COORD_PORT))
+	       {
+		  fprintf(stderr, "--worker: unable to resolve coordinator: %s\n", optarg);
+		  return -1;
+	       }
+	     options.dist = DIST_WORKER;
+	     break;
+	   case OPT_CHUNK_SIZE:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > TRANGE_MAX_COUNT)
+	       {
+		  fprintf(stderr, "--chunk-size: invalid chunk size: %s\n", optarg);
+		  return -1;
+	       }
+	     options.chunk_size = tl;
+	     break;
+	   case OPT_LEASE_TIME:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 3)
+	       {
+		  fprintf(stderr, "--lease-time: invalid lease time: %s\n", optarg);
+		  return -1;
+	       }
+	     options.lease_time = tl;
+	     break;
+	   case OPT_REPLY_TIMEOUT:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > 600)
+	       {
+		  fprintf(stderr, "--reply-timeout: invalid timeout: %s\n", optarg);
+		  return -1;
+	       }
+	     options.reply_timeout = tl;
+	     break;
+	   case OPT_MIN_TIMEOUT:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > 600000)
+	       {
+		  fprintf(stderr, "--min-timeout: invalid timeout: %s\n", optarg);
+		  return -1;
+	       }
+	     options.min_timeout = tl;
+	     break;
+	   case OPT_FIXED_TIMEOUTS:
+	     options.fixed_timeouts = 1;
+	     break;
+	   case OPT_CONNECT_RETRIES:
+	   case OPT_RESET_RETRIES:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl > 16)
+	       {
+		  fprintf(stderr, "--%s: invalid retry count: %s\n",
+			  ch == OPT_CONNECT_RETRIES ? "connect-retries" : "reset-retries", optarg);
+		  return -1;
+	       }
+	     if (ch == OPT_CONNECT_RETRIES)
+	       options.connect_retries = tl;
+	     else
+	       options.reset_retries = tl;
+	     break;
+	   case OPT_RETRY_DELAY:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > 600000)
+	       {
+		  fprintf(stderr, "--retry-delay: invalid delay: %s\n", optarg);
+		  return -1;
+	       }
+	     options.retry_delay = tl;
+	     break;
+	   case OPT_RETRY_BUDGET:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl > 100)
+	       {
+		  fprintf(stderr, "--retry-budget: invalid percentage: %s\n", optarg);
+		  return -1;
+	       }
+	     options.retry_budget = tl;
+	     break;
+	   case OPT_RING:
+	     options.ring = optarg;
+	     break;
+	   case OPT_RING_SIZE:
+	     ull = strtoull(optarg, &p, 0);
+	     if (*p || p == optarg || ull < 1 || ull > (1ULL << 32))
+	       {
+		  fprintf(stderr, "--ring-size: invalid ring size: %s\n", optarg);
+		  return -1;
+	       }
+	     options.ring_size = ull;
+	     break;
+	   case OPT_RING_WAIT:
+	     options.ring_wait = 1;
+	     break;
+	   case OPT_ARCHIVE:
+	     options.archive = optarg;
+	     break;
+	   case OPT_ORDER:
+	     options.order = optarg;
+	     break;
+	   case OPT_JOBS:
+	     options.jobs = optarg;
+	     break;
+	   case OPT_PROBES:
+	     if ((n = probe_list(optarg, options.probes)) < 1)
+	       {
+		  fprintf(stderr, "--probes: invalid probe list: %s\n", optarg);
+		  return -1;
+	       }
+	     options.nprobes = n;
+	     break;
+	   case OPT_DEST:
+	     if (!load_dests(optarg))
+	       {
+		  fprintf(stderr, "--dest: invalid destination list: %s\n", optarg);
+		  return -1;
+	       }
+	     break;
+	   case OPT_DEST_SLOTS:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > MAX_PARALLEL_CONNECTS)
+	       {
+		  fprintf(stderr, "--dest-slots: invalid slot count: %s\n", optarg);
+		  return -1;
+	       }
+	     options.dest_slots = tl;
+	     break;
+	   case OPT_MATRIX:
+	     options.matrix = optarg;
+	     break;
+	   case OPT_SCAN_ID:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl == 0 || tl > 0xffffffffUL)
+	       {
+		  fprintf(stderr, "--scan-id: invalid scan id: %s\n", optarg);
+		  return -1;
+	       }
+	     options.scan_id = tl;
+	     break;
+	   case OPT_STATS:
+	     options.stats = optarg;
+	     break;
+	   case OPT_MAX_MEMORY:
+	     ull = strtoull(optarg, &p, 0);
+	     if (*p == 'k' || *p == 'K')
+	       ull <<= 10, p++;
+	     else if (*p == 'm' || *p == 'M')
+	       ull <<= 20, p++;
+	     else if (*p == 'g' || *p == 'G')
+	       ull <<= 30, p++;
+	     if (*p || p == optarg || ull < (1ULL << 20))
+	       {
+		  fprintf(stderr, "--max-memory: invalid size (at least 1m): %s\n", optarg);
+		  return -1;
+	       }
+	     options.max_memory = ull;
+	     /* any -f before it had to load without it */
+	     budget_targets(tlist);
+	     break;
+	   case OPT_UDP:
+	     if (!ss_resolve(optarg, &options.udp_echo, DEFAULT_UDP_ECHO_PORT))
+	       {
+		  fprintf(stderr, "--udp: unable to resolve echo endpoint: %s\n", optarg);
+		  return -1;
+	       }
+	     options.udp = 1;
+	     break;
+	   case OPT_MONITOR:
+	     options.monitor = optarg;
+	     break;
+	   case OPT_MONITOR_MAX:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl < 1 || tl > 0x7fffffffUL)
+	       {
+		  fprintf(stderr, "--monitor-max: invalid proxy count: %s\n", optarg);
+		  return -1;
+	       }
+	     options.monitor_max = tl;
+	     break;
+	   case OPT_MONITOR_SHARE:
+	     tl = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || tl > 100)
+	       {
+		  fprintf(stderr, "--monitor-share: invalid percentage: %s\n", optarg);
+		  return -1;
+	       }
+	     options.monitor_share = tl;
+	     break;
+	   case OPT_RECORD:
+	     options.record = optarg;
+	     break;
+	   case OPT_REPLAY:
+	     options.replay = optarg;
+	     break;
+	   case OPT_SOURCE:
+	     if (!load_sources(optarg))
+	       {
+		  fprintf(stderr, "--source: invalid source address list: %s\n", optarg);
+		  return -1;
+	       }
+	     break;
 	   case '?':
 	     show_usage(v[0]);
 	     return -1;
@@ -140,7 +547,228 @@ parse_args(c, v, tlist)
 	int i;
 	
 	for (i = 0; i < c; i++)
-	  ntargs += add_target(tlist, v[i]);
+	  {
+	     add_target(tlist, v[i]);
+	     budget_targets(tlist);
+	  }
+     }
+   
+   /* traces don't have the datagrams in them */
+   if (options.replay && options.udp)
+     {
+	fprintf(stderr, "--udp: can't be replayed\n");
+	return -1;
+     }
+   
+   /* something has to be able to probe */
+   if (!probe_usable(&options))
+     {
+	fprintf(stderr, "--probes: none of them can be used (v4 only reaches IPv4 remotes, only v5 does --udp)\n");
+	return -1;
+     }
+   
+   /* destinations get checked on proxies found here and now */
+   if (options.ndests && (options.monitor || options.udp || options.replay || options.dist != DIST_NONE))
+     {
+	fprintf(stderr, "--dest: can't be used with --monitor, --udp, --replay, --coordinator or --worker\n");
+	return -1;
+     }
+   if (options.matrix && !options.ndests)
+     {
+	fprintf(stderr, "--matrix: no --dest to fill it with\n");
+	return -1;
+     }
+   
+   /* monitoring keeps its own schedule, on its own */
+   if (options.monitor && (options.replay || options.cache || options.dist != DIST_NONE))
+     {
+	fprintf(stderr, "--monitor: can't be used with --replay, --cache, --coordinator or --worker\n");
+	return -1;
+     }
+   
+   /* jobs bring their own targets, and share the engine only */
+   if (options.jobs && (!TL_EMPTY(tlist) || options.monitor || options.order
+			|| options.replay || options.dist != DIST_NONE))
+     {
+	fprintf(stderr, "--jobs: the targets go in the job file, and it can't be used with\n"
+		"--monitor, --order, --replay, --coordinator or --worker\n");
+	return -1;
+     }
+   
+   /* the order is for targets we have */
+   if (options.order && (options.monitor || options.dist != DIST_NONE))
+     {
+	fprintf(stderr, "--order: can't be used with --monitor, --coordinator or --worker\n");
+	return -1;
+     }
+   
+   /* no targets with a trace?  scan whatever it recorded */
+   if (options.replay && TL_EMPTY(tlist)
+       && trace_targets(options.replay, tlist) == 0)
+     {
+	fprintf(stderr, "--replay: no events in %s\n", options.replay);
+	return -1;
+     }
+   
+   /* sort/merge everything we got, which also removes duplicates
+    * and anything excluded */
+   sort_excludes();
+   (void) sort_targets(tlist);
+   
+   /* then the set operations, and whatever is already done */
+   if (options.intersect && combine_file(tlist, options.intersect, 1, 0) == -1)
+     return -1;
+   if (options.minus && combine_file(tlist, options.minus, 0, 0) == -1)
+     return -1;
+   if (options.done && combine_file(tlist, options.done, 0, 1) == -1)
+     return -1;
+   return (long)tlist->total;
+}
+
+
+/*
+ * keep only the targets that are (or aren't) in a target file, or a
+ * file from save_targets()
+ */
+static int
+combine_file(tlist, fn, inside, saved)
+   targlist_t *tlist;
+   char *fn;
+   int inside, saved;
+{
+   unsigned long long before = tlist->total;
+   targlist_t o;
+   FILE *fp;
+   
+   memset(&o, 0, sizeof(o));
+   if (saved)
+     {
+	if (load_targets(&o, fn) == -1)
+	  return -1;
+     }
+   else
+     {
+	/* load_targets_from_file() doesn't mind a missing file, we do */
+	if (!(fp = fopen(fn, "r")))
+	  {
+	     fprintf(stderr, "Unable to load targets from \"%s\": %s\n", fn, strerror(errno));
+	     return -1;
+	  }
+	fclose(fp);
+	load_targets_from_file(&o, fn);
+     }
+   sort_targets(&o);
+   combine_targets(tlist, &o, inside);
+   free_targets(&o);
+   /* that brought them all back in */
+   budget_targets(tlist);
+   if (options.verbose >= 1)
+     fprintf(stderr, "%s %s: %llu targets left (%llu taken out).\n", inside ? "intersecting with" : "subtracting", fn,
+	     tlist->total, before - tlist->total);
+   return 0;
+}
+
+
+/*
+ * add a comma separated list of local ips/cidrs to bind to
+ * 
+ * the target parser does the work, so the usual forms are accepted.
+ */
+static int
+load_sources(str)
+   char *str;
+{
+   targlist_t tl;
+   target_t t;
+   struct sockaddr_storage *ss;
+   unsigned long long n;
+   char *p;
+   
+   memset(&tl, 0, sizeof(tl));
+   for (p = strtok(str, ","); p; p = strtok(NULL, ","))
+     if (!add_target(&tl, p))
+       {
+	  free_targets(&tl);
+	  return 0;
+       }
+   n = sort_targets(&tl);
+   if (n == 0 || options.nsources + n > MAX_SOURCE_ADDRS)
+     {
+	free_targets(&tl);
+	return 0;
+     }
+   ss = (struct sockaddr_storage *)realloc(options.sources, (options.nsources + n) * sizeof(*ss));
+   if (!ss)
+     {
+	free_targets(&tl);
+	return 0;
+     }
+   options.sources = ss;
+   while (next_target(&tl, &t))
+     taddr_to_sockaddr(&t.ip, 0, &options.sources[options.nsources++]);
+   free_targets(&tl);
+   return 1;
+}
+
+
+/*
+ * add a comma separated list of relay destinations (--dest)
+ * 
+ * addresses go in like -r, anything else is kept as a name for the
+ * proxy to resolve (v4a, v5 and http can ask for one)
+ */
+static int
+load_dests(str)
+   char *str;
+{
+   struct in6_addr a6;
+   dest_t *d;
+   char host[256], *p, *q;
+   unsigned long port;
+   
+   for (p = strtok(str, ","); p; p = strtok(NULL, ","))
+     {
+	if (options.ndests >= 0xffff)
+	  return 0;
+	d = (dest_t *)realloc(options.dests, (options.ndests + 1) * sizeof(dest_t));
+	if (!d)
+	  return 0;
+	options.dests = d;
+	d = &options.dests[options.ndests];
+	memset(d, 0, sizeof(*d));
+	
+	/* split it up like ss_resolve() does */
+	snprintf(host, sizeof(host), "%s", *p == '[' ? p + 1 : p);
+	port = DEFAULT_TARGET_PORT;
+	if (*p == '[')
+	  {
+	     if (!(q = strchr(host, ']')) || (q[1] && q[1] != ':'))
+	       return 0;
+	     *q++ = '\0';
+	  }
+	else if (!(q = strrchr(host, ':')) || q != strchr(host, ':'))
+	  q = NULL;
+	if (q && *q == ':')
+	  {
+	     *q++ = '\0';
+	     port = strtoul(q, &q, 0);
+	     if (*q || port < 1 || port > 0xffff)
+	       return 0;
+	  }
+	if (!*host)
+	  return 0;
+	
+	if (inet_pton(AF_INET, host, &a6) == 1 || inet_pton(AF_INET6, host, &a6) == 1)
+	  {
+	     if (!ss_resolve(p, &d->sa, DEFAULT_TARGET_PORT))
+	       return 0;
+	  }
+	else if (!(d->host = strdup(host)))
+	  return 0;
+	d->port = (unsigned short)port;
+	if (!(d->name = strdup(p)))
+	  return 0;
+	options.ndests++;
      }
-   return ntargs;
+   return 1;
 }
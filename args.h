@@ -9,22 +9,66 @@
 
 #include "defs.h"
 #include "targets.h"
+#include "probe.h"
 
 /* options structure */
 typedef struct
 {
    unsigned int verbose;	/* verbosity level */
    unsigned int timeout;	/* tcp connection timeout */
+   unsigned int reply_timeout;	/* how long to wait for replies, 0 for the default */
+   unsigned int min_timeout;	/* floor for the per-prefix timeouts, in ms */
+   int fixed_timeouts;		/* don't adapt them at all */
+   unsigned int connect_retries; /* tries after a connect timed out */
+   unsigned int reset_retries;	/* tries after a reset mid-pass */
+   unsigned int retry_delay;	/* ms before the first retry, doubling */
+   unsigned int retry_budget;	/* retries allowed, percent of targets */
    unsigned int connects;	/* number of simultaneous tests */
-   struct sockaddr_in remote;	/* the remote host to try to get to */
+   unsigned long long max_memory; /* stay under this many bytes, 0 for no limit */
+   struct sockaddr_storage remote; /* the remote host to try to get to */
+   dest_t *dests;		/* more, checked for every proxy found */
+   unsigned int ndests;
+   unsigned int dest_slots;	/* checks going per proxy, at most */
+   char *matrix;		/* the rows of what they reached go here */
    char *username; 		/* socks4 username */
    char *password;		/* socks5 password */
+   unsigned char probes[PR_COUNT]; /* the protocols probed for, in order */
+   unsigned int nprobes;
+   char *backend;		/* i/o backend name */
+   struct sockaddr_storage *sources; /* local addresses to bind to */
+   unsigned int nsources;
+   char *cache;			/* persistent result cache file */
+   unsigned int cache_ttl;	/* don't rescan for this many seconds */
+   unsigned long long cache_size; /* initial cache entries */
+   int dist;			/* coordinator/worker mode, see dist.h */
+   struct sockaddr_storage coord; /* where the coordinator listens */
+   unsigned int chunk_size;	/* targets per leased chunk */
+   unsigned int lease_time;	/* give up on a silent worker after this */
+   char *record;		/* write a trace of the scan here */
+   char *replay;		/* scan a trace instead of the network */
+   char *ring;			/* write binary results to a shared ring */
+   unsigned long long ring_size;	/* records it has room for */
+   int ring_wait;		/* wait for the reader instead of dropping */
+   char *archive;		/* append results to a columnar archive */
+   unsigned int scan_id;	/* what to archive them as, 0 = start time */
+   char *minus;			/* don't scan the targets in this file */
+   char *intersect;		/* only scan the targets in this file */
+   char *done;			/* finished targets are kept track of here */
+   char *compile;		/* write the targets here compiled, and quit */
+   char *stats;			/* write what the probes cost here */
+   int udp;			/* try UDP ASSOCIATE instead of CONNECT */
+   struct sockaddr_storage udp_echo; /* where the datagrams are relayed to */
+   char *monitor;		/* keep probing, tracked proxies are kept here */
+   unsigned int monitor_max;	/* proxies tracked, at most */
+   unsigned int monitor_share;	/* percent of each batch for discovery */
+   char *order;			/* scan by the hit rates in this archive */
+   char *jobs;			/* run the scan jobs in this file together */
 } opts_t;
 
 /* external global options structure */
 extern opts_t options;
 
 /* prototypes */
-extern int parse_args(int, char **, targlist_t **);
+extern long parse_args(int, char **, targlist_t *);
 
 #endif
@@ -0,0 +1,395 @@
+/*
+ * cache.c: persistent result cache
+ * 
+ * remembers when each (ip, port) was last probed and what came of it,
+ * so daily rescans can skip what was seen recently and go after the
+ * previously open proxies first.
+ * 
+ * the cache is an open addressing hash table in a memory mapped file,
+ * so a lookup touches one or two pages no matter how many hundreds of
+ * millions of entries there are, and only entries that change get
+ * written back.  open entries are also chained together so they can
+ * be found without walking the whole table.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "args.h"
+#include "targets.h"
+#include "cache.h"
+
+/* the used byte */
+#define CU_USED 		0x01
+#define CU_CHAINED 		0x02	/* on the open chain */
+
+/* the chain uses 32 bit indexes */
+#define CACHE_MAX_CAPACITY 	0x80000000ULL
+
+static int cfd = -1;
+static char *cfn = NULL;
+static chdr_t *chdr = NULL;
+static cent_t *cents = NULL;
+static size_t cmaplen = 0;
+
+static int cache_map(int, unsigned long long, int);
+static cent_t *cache_slot(taddr_t *, unsigned short, int);
+static int cache_grow(void);
+static void chain_open(cent_t *);
+
+
+/*
+ * open (or create) the cache file
+ * 
+ * size is the number of entries a new cache starts with, it doubles
+ * whenever it gets 3/4 full.
+ */
+int
+cache_open(fn, size)
+   char *fn;
+   unsigned long long size;
+{
+   struct stat st;
+   chdr_t hdr;
+   unsigned long long cap = 1024;
+   int fd;
+   
+   if ((fd = open(fn, O_RDWR | O_CREAT, 0644)) == -1
+       || fstat(fd, &st) == -1)
+     {
+	fprintf(stderr, "Unable to open cache \"%s\": %s\n", fn, strerror(errno));
+	if (fd != -1)
+	  close(fd);
+	return -1;
+     }
+   free(cfn);
+   cfn = strdup(fn);
+   
+   /* a new one? */
+   if (st.st_size == 0)
+     {
+	while (cap < size && cap < CACHE_MAX_CAPACITY)
+	  cap <<= 1;
+	if (cache_map(fd, cap, 1) == -1)
+	  {
+	     close(fd);
+	     return -1;
+	  }
+	if (options.verbose >= 1)
+	  fprintf(stderr, "created cache \"%s\" with room for %llu entries.\n", fn, cap);
+	return 0;
+     }
+   
+   if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+       || memcmp(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))
+       || hdr.version != CACHE_VERSION
+       || hdr.entsize != sizeof(cent_t)
+       || (hdr.capacity & (hdr.capacity - 1)) != 0
+       || st.st_size < CACHE_HDR_SIZE + hdr.capacity * sizeof(cent_t))
+     {
+	fprintf(stderr, "\"%s\" is not a usable cache file.\n", fn);
+	close(fd);
+	return -1;
+     }
+   if (cache_map(fd, hdr.capacity, 0) == -1)
+     {
+	close(fd);
+	return -1;
+     }
+   if (options.verbose >= 1)
+     fprintf(stderr, "opened cache \"%s\" with %llu of %llu entries used.\n",
+	     fn, chdr->count, chdr->capacity);
+   return 0;
+}
+
+void
+cache_close()
+{
+   free(cfn);
+   cfn = NULL;
+   if (!chdr)
+     return;
+   munmap(chdr, cmaplen);
+   close(cfd);
+   chdr = NULL;
+   cents = NULL;
+   cfd = -1;
+}
+
+
+/*
+ * map a cache file of cap entries, initializing it if asked
+ */
+static int
+cache_map(fd, cap, init)
+   int fd;
+   unsigned long long cap;
+   int init;
+{
+   size_t len = CACHE_HDR_SIZE + cap * sizeof(cent_t);
+   void *p;
+   
+   /* ftruncate leaves it sparse, untouched pages cost nothing */
+   if (init && ftruncate(fd, len) == -1)
+     {
+	fprintf(stderr, "Unable to size the cache: %s\n", strerror(errno));
+	return -1;
+     }
+   p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (p == MAP_FAILED)
+     {
+	fprintf(stderr, "Unable to map the cache: %s\n", strerror(errno));
+	return -1;
+     }
+   /* lookups are all over the place */
+   (void) madvise(p, len, MADV_RANDOM);
+   
+   cfd = fd;
+   cmaplen = len;
+   chdr = (chdr_t *)p;
+   cents = (cent_t *)((char *)p + CACHE_HDR_SIZE);
+   if (init)
+     {
+	memset(chdr, 0, sizeof(*chdr));
+	memcpy(chdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	chdr->version = CACHE_VERSION;
+	chdr->entsize = sizeof(cent_t);
+	chdr->capacity = cap;
+     }
+   return 0;
+}
+
+
+/*
+ * should this target be probed, now, if results stay good for ttl
+ * seconds?  (the engine's clock and settings, which needn't be ours)
+ */
+int
+cache_check(ip, port, now, ttl)
+   taddr_t *ip;
+   unsigned short port;
+   time_t now;
+   unsigned int ttl;
+{
+   cent_t *e;
+   
+   if (!chdr || !(e = cache_slot(ip, port, 0)) || !e->last_seen)
+     return CACHE_PROBE;
+   if (ttl && now - e->last_seen < ttl)
+     return CACHE_FRESH;
+   return CACHE_PROBE;
+}
+
+/*
+ * record the outcome of a probe
+ */
+void
+cache_update(ip, port, outcome, now)
+   taddr_t *ip;
+   unsigned short port;
+   unsigned int outcome;
+   time_t now;
+{
+   cent_t *e;
+   
+   if (!chdr || !(e = cache_slot(ip, port, 1)))
+     return;
+   /* don't dirty the page for nothing */
+   if (e->outcome != outcome)
+     e->outcome = outcome;
+   if (e->last_seen != (unsigned int)now)
+     e->last_seen = now;
+   if ((outcome & CO_OPEN) && !(e->used & CU_CHAINED))
+     chain_open(e);
+}
+
+
+/*
+ * collect the previously open targets (that are due to be probed, see
+ * cache_check()) into prio, dropping entries that aren't open anymore
+ * from the chain
+ * 
+ * returns the number of targets found
+ */
+unsigned long
+cache_open_targets(targets, prio, now, ttl)
+   targlist_t *targets, *prio;
+   time_t now;
+   unsigned int ttl;
+{
+   unsigned int *link, idx;
+   cent_t *e;
+   
+   if (!chdr)
+     return 0;
+   for (link = &chdr->open_head; (idx = *link); )
+     {
+	e = &cents[idx - 1];
+	if (!(e->outcome & CO_OPEN))
+	  {
+	     *link = e->next_open;
+	     e->next_open = 0;
+	     e->used &= ~CU_CHAINED;
+	     continue;
+	  }
+	if (find_target(targets, &e->ip, e->port)
+	    && cache_check(&e->ip, e->port, now, ttl) == CACHE_PROBE)
+	  add_target_range(prio, &e->ip, 1, e->port);
+	link = &e->next_open;
+     }
+   return (unsigned long)sort_targets(prio);
+}
+
+
+/*
+ * map a target's state bits to a cache outcome
+ */
+unsigned int
+cache_outcome(state)
+   unsigned long state;
+{
+   unsigned int o = 0;
+   
+   if (state & SPSS_ANY_CONNECTED)
+     o |= CO_CONNECTED;
+   if (state & SPSS_4_SUCCESSFUL)
+     o |= CO_V4_OK;
+   if (state & SPSS_5_SUCCESSFUL)
+     o |= CO_V5_OK;
+   if (state & SPSS_5_AUTH_PASS_OK)
+     o |= CO_V5_AUTH;
+   if (state & SPSS_5_UDP_OK)
+     o |= CO_UDP_OK;
+   if (state & SPSS_4A_SUCCESSFUL)
+     o |= CO_V4A_OK;
+   if (state & SPSS_H_SUCCESSFUL)
+     o |= CO_HTTP_OK;
+   if (state & SPSS_H_AUTH)
+     o |= CO_HTTP_AUTH;
+   return o;
+}
+
+
+/*
+ * find the entry for (ip, port), creating it if asked
+ */
+static cent_t *
+cache_slot(ip, port, create)
+   taddr_t *ip;
+   unsigned short port;
+   int create;
+{
+   unsigned long long mask, i;
+   cent_t *e;
+   
+ again:
+   mask = chdr->capacity - 1;
+   for (i = taddr_hash(ip, port) & mask; ; i = (i + 1) & mask)
+     {
+	e = &cents[i];
+	if (!e->used)
+	  break;
+	if (e->port == port && !memcmp(e->ip.b, ip->b, 16))
+	  return e;
+     }
+   if (!create)
+     return NULL;
+   if ((chdr->count + 1) * 4 > chdr->capacity * 3)
+     {
+	if (cache_grow() == -1)
+	  return NULL;
+	goto again;
+     }
+   e->ip = *ip;
+   e->port = port;
+   e->used = CU_USED;
+   chdr->count++;
+   return e;
+}
+
+
+/*
+ * double the table.  the new one is built beside the old one and
+ * renamed over it, so a crash leaves the old cache intact.
+ */
+static int
+cache_grow()
+{
+   static int warned = 0;
+   unsigned long long ocap = chdr->capacity, i, mask, j;
+   char tmp[4096];
+   chdr_t *ohdr = chdr;
+   cent_t *oents = cents, *e;
+   size_t olen = cmaplen;
+   int ofd = cfd, fd;
+   
+   if (ocap >= CACHE_MAX_CAPACITY)
+     {
+	if (!warned++)
+	  fprintf(stderr, "the cache is full, new results will not be saved.\n");
+	return -1;
+     }
+   snprintf(tmp, sizeof(tmp), "%s.grow", cfn);
+   if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+     {
+	fprintf(stderr, "Unable to grow the cache: %s\n", strerror(errno));
+	return -1;
+     }
+   if (cache_map(fd, ocap * 2, 1) == -1)
+     {
+	close(fd);
+	unlink(tmp);
+	chdr = ohdr;
+	cents = oents;
+	cmaplen = olen;
+	cfd = ofd;
+	return -1;
+     }
+   if (options.verbose >= 1)
+     fprintf(stderr, "growing the cache to %llu entries.\n", chdr->capacity);
+   
+   /* rehash everything, rebuilding the open chain as we go */
+   mask = chdr->capacity - 1;
+   (void) madvise(oents, ocap * sizeof(cent_t), MADV_SEQUENTIAL);
+   for (i = 0; i < ocap; i++)
+     {
+	if (!oents[i].used)
+	  continue;
+	for (j = taddr_hash(&oents[i].ip, oents[i].port) & mask; cents[j].used; j = (j + 1) & mask)
+	  ;
+	e = &cents[j];
+	*e = oents[i];
+	e->used = CU_USED;
+	e->next_open = 0;
+	if (e->outcome & CO_OPEN)
+	  chain_open(e);
+	chdr->count++;
+     }
+   munmap(ohdr, olen);
+   close(ofd);
+   if (rename(tmp, cfn) == -1)
+     fprintf(stderr, "Unable to replace the cache: %s\n", strerror(errno));
+   return 0;
+}
+
+
+/*
+ * put an entry on the open chain
+ */
+static void
+chain_open(e)
+   cent_t *e;
+{
+   e->next_open = chdr->open_head;
+   chdr->open_head = (unsigned int)(e - cents) + 1;
+   e->used |= CU_CHAINED;
+}
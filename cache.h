@@ -0,0 +1,66 @@
+/*
+ * cache.h: persistent result cache
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __cache_h
+#define __cache_h
+
+#include <time.h>
+
+#include "targets.h"
+
+#define CACHE_MAGIC 		"SSCACHE"
+#define CACHE_VERSION 		1
+
+/* where the entries start in the file */
+#define CACHE_HDR_SIZE 		4096
+
+/* outcome bits */
+#define CO_CONNECTED 		0x01	/* the tcp connection worked */
+#define CO_V4_OK 		0x02
+#define CO_V5_OK 		0x04
+#define CO_V5_AUTH 		0x08	/* v5, but wants user/pass */
+#define CO_UDP_OK 		0x10	/* v5 relays udp too */
+#define CO_V4A_OK 		0x20
+#define CO_HTTP_OK 		0x40
+#define CO_HTTP_AUTH 		0x80	/* http, but wants a password */
+#define CO_OPEN 		(CO_V4_OK | CO_V5_OK | CO_V5_AUTH \
+				 | CO_V4A_OK | CO_HTTP_OK | CO_HTTP_AUTH)
+
+/* what cache_check() thinks of a target */
+#define CACHE_PROBE 		0	/* go ahead */
+#define CACHE_FRESH 		1	/* probed within the ttl, skip it */
+
+/* the file header */
+typedef struct
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int entsize;
+   unsigned long long capacity;	/* a power of 2 */
+   unsigned long long count;
+   unsigned int open_head;	/* first of the open entries, index + 1 */
+} chdr_t;
+
+/* one (ip, port) */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   unsigned char outcome;
+   unsigned char used;
+   unsigned int last_seen;
+   unsigned int next_open;	/* chain of open entries, index + 1 */
+} cent_t;
+
+/* prototypes */
+int cache_open(char *, unsigned long long);
+void cache_close(void);
+int cache_check(taddr_t *, unsigned short, time_t, unsigned int);
+void cache_update(taddr_t *, unsigned short, unsigned int, time_t);
+unsigned long cache_open_targets(targlist_t *, targlist_t *, time_t, unsigned int);
+unsigned int cache_outcome(unsigned long);
+
+#endif
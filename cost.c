@@ -0,0 +1,221 @@
+/*
+ * cost.c: what the probes cost, by how they turned out
+ * 
+ * the backends count the system calls they make for each slot (and
+ * the ones made for all of them, like waiting), the engine counts the
+ * bytes and how long each target held its slot, and when a target is
+ * done with all of that is charged to its outcome.  cpu time is the
+ * thread's, read once per trip around the main loop, and shared out
+ * over the probes by the system calls they made.  whatever isn't
+ * shared out that way went on waiting and housekeeping.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "cost.h"
+#include "cache.h"
+
+static char *cc_names[CC_NCLASSES] =
+{
+   "refused", "timeout", "v4", "v5", "http", "bad-reply", "retried"
+};
+
+static unsigned long long thread_cpu_ns(void);
+static unsigned long long tv_us(struct timeval *);
+
+
+/*
+ * start keeping accounts, now_ms is the engine's clock
+ */
+void
+cost_start(c, now_ms)
+   cost_t *c;
+   unsigned long long now_ms;
+{
+   struct rusage ru;
+   
+   memset(c, 0, sizeof(*c));
+   c->start_ms = now_ms;
+   c->cpu_start = thread_cpu_ns();
+   if (getrusage(RUSAGE_SELF, &ru) == 0)
+     {
+	c->utime = ru.ru_utime;
+	c->stime = ru.ru_stime;
+     }
+}
+
+/*
+ * once per trip around the loop, see how much cpu it has used
+ */
+void
+cost_sample(c)
+   cost_t *c;
+{
+   c->cpu_ns = thread_cpu_ns() - c->cpu_start;
+   c->trips++;
+}
+
+/*
+ * charge a finished (or given up on) probe to class cls.  its share
+ * of the cpu is what the system calls so far cost on average.
+ */
+void
+cost_charge(c, cls, nsys, out, in, ms)
+   cost_t *c;
+   int cls;
+   unsigned int nsys, out, in, ms;
+{
+   ccount_t *cc = &c->c[cls];
+   
+   cc->probes++;
+   cc->nsys += nsys;
+   cc->out += out;
+   cc->in += in;
+   cc->slot_ms += ms;
+   if (c->nsys > 0)
+     cc->cpu_ns += (unsigned long long)((double)c->cpu_ns * nsys / c->nsys);
+}
+
+/*
+ * stop the clocks
+ */
+void
+cost_finish(c, now_ms)
+   cost_t *c;
+   unsigned long long now_ms;
+{
+   struct rusage ru;
+   
+   cost_sample(c);
+   c->wall_ms = now_ms - c->start_ms;
+   if (getrusage(RUSAGE_SELF, &ru) == 0)
+     {
+	timersub(&ru.ru_utime, &c->utime, &c->utime);
+	timersub(&ru.ru_stime, &c->stime, &c->stime);
+     }
+}
+
+
+/*
+ * which class a target with the CO_* outcome bits belongs in
+ */
+int
+cost_class(outcome, timedout)
+   unsigned int outcome;
+   int timedout;
+{
+   if (outcome & (CO_V5_OK | CO_V5_AUTH))
+     return CC_V5;
+   if (outcome & (CO_V4_OK | CO_V4A_OK))
+     return CC_V4;
+   if (outcome & (CO_HTTP_OK | CO_HTTP_AUTH))
+     return CC_HTTP;
+   if (timedout)
+     return CC_TIMEOUT;
+   if (outcome & CO_CONNECTED)
+     return CC_BAD_REPLY;
+   return CC_REFUSED;
+}
+
+
+/*
+ * print the per probe averages
+ */
+void
+cost_report(c, fp, backend)
+   cost_t *c;
+   FILE *fp;
+   char *backend;
+{
+   unsigned long long probes = 0, cpu = 0;
+   ccount_t *cc;
+   double n;
+   int i;
+   
+   fprintf(fp, "cost per probe (%s backend, %llu trips around the loop):\n", backend, c->trips);
+   fprintf(fp, "  %-10s %10s %9s %9s %9s %9s %9s\n", "outcome", "probes", "syscalls", "cpu us", "bytes out", "bytes in", "slot ms");
+   for (i = 0; i < CC_NCLASSES; i++)
+     {
+	cc = &c->c[i];
+	cpu += cc->cpu_ns;
+	if (i != CC_RETRY)
+	  probes += cc->probes;
+	if (!cc->probes)
+	  continue;
+	n = (double)cc->probes;
+	fprintf(fp, "  %-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", cc_names[i], cc->probes,
+		cc->nsys / n, cc->cpu_ns / n / 1000.0, cc->out / n, cc->in / n, cc->slot_ms / n);
+     }
+   if (!probes)
+     return;
+   /* and everything, waiting included, over the targets finished */
+   n = (double)probes;
+   fprintf(fp, "  %-10s %10llu %9.1f %9.1f   (%.1f syscalls and %.1f cpu us each were shared)\n", "all", probes,
+	   c->nsys / n, c->cpu_ns / n / 1000.0, c->shared_sys / n,
+	   (c->cpu_ns > cpu ? c->cpu_ns - cpu : 0) / n / 1000.0);
+   fprintf(fp, "cpu %.1fms (user %.1fms, system %.1fms) in %.1fs.\n", c->cpu_ns / 1e6,
+	   tv_us(&c->utime) / 1000.0, tv_us(&c->stime) / 1000.0, c->wall_ms / 1000.0);
+}
+
+/*
+ * write the totals to fn, a line of key=value pairs for the scan and
+ * one for each outcome
+ */
+int
+cost_write(c, fn, backend)
+   cost_t *c;
+   char *fn, *backend;
+{
+   unsigned long long cpu = 0;
+   ccount_t *cc;
+   FILE *fp;
+   int i;
+   
+   if (!(fp = fopen(fn, "w")))
+     {
+	fprintf(stderr, "Unable to write stats to \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   for (i = 0; i < CC_NCLASSES; i++)
+     cpu += c->c[i].cpu_ns;
+   fprintf(fp, "scan backend=%s wall_ms=%llu cpu_ns=%llu user_us=%llu sys_us=%llu trips=%llu syscalls=%llu shared_syscalls=%llu shared_cpu_ns=%llu\n",
+	   backend, c->wall_ms, c->cpu_ns, tv_us(&c->utime), tv_us(&c->stime), c->trips,
+	   c->nsys, c->shared_sys, c->cpu_ns > cpu ? c->cpu_ns - cpu : 0);
+   for (i = 0; i < CC_NCLASSES; i++)
+     {
+	cc = &c->c[i];
+	fprintf(fp, "outcome=%s probes=%llu syscalls=%llu cpu_ns=%llu bytes_out=%llu bytes_in=%llu slot_ms=%llu\n",
+		cc_names[i], cc->probes, cc->nsys, cc->cpu_ns, cc->out, cc->in, cc->slot_ms);
+     }
+   if (fclose(fp) == EOF)
+     {
+	fprintf(stderr, "Unable to write stats to \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   return 0;
+}
+
+
+static unsigned long long
+thread_cpu_ns()
+{
+   struct timespec ts;
+   
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+     return 0;
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long
+tv_us(tv)
+   struct timeval *tv;
+{
+   return (unsigned long long)tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
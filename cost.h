@@ -0,0 +1,55 @@
+/*
+ * cost.h: what the probes cost, by how they turned out
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __cost_h
+#define __cost_h
+
+#include <stdio.h>
+#include <sys/time.h>
+
+/* outcome classes */
+#define CC_REFUSED 		0	/* couldn't connect (refused, unreachable, ..) */
+#define CC_TIMEOUT 		1	/* the connect or a reply timed out */
+#define CC_V4 			2	/* only socks4 (or 4a) worked */
+#define CC_V5 			3	/* socks5 worked (or wants a password) */
+#define CC_HTTP 		4	/* only http CONNECT worked (or wants one) */
+#define CC_BAD_REPLY 		5	/* connected, no usable reply (bad, rejected, reset) */
+#define CC_RETRY 		6	/* attempts given up on to be tried again */
+#define CC_NCLASSES 		7
+
+/* what the probes in one class cost */
+typedef struct
+{
+   unsigned long long probes;
+   unsigned long long nsys;	/* system calls */
+   unsigned long long cpu_ns;	/* estimated, see cost_charge() */
+   unsigned long long out, in;	/* bytes sent and received */
+   unsigned long long slot_ms;	/* time they held a slot */
+} ccount_t;
+
+/* an engine's accounts */
+typedef struct
+{
+   ccount_t c[CC_NCLASSES];
+   unsigned long long nsys;	/* every system call, shared ones too */
+   unsigned long long shared_sys; /* made for all the slots (waiting) */
+   unsigned long long cpu_ns;	/* thread cpu time spent scanning */
+   unsigned long long cpu_start;
+   unsigned long long trips;	/* times around the main loop */
+   unsigned long long start_ms, wall_ms;
+   struct timeval utime, stime;	/* getrusage() at the start, then the difference */
+} cost_t;
+
+/* prototypes */
+void cost_start(cost_t *, unsigned long long);
+void cost_sample(cost_t *);
+void cost_charge(cost_t *, int, unsigned int, unsigned int, unsigned int, unsigned int);
+void cost_finish(cost_t *, unsigned long long);
+int cost_class(unsigned int, int);
+void cost_report(cost_t *, FILE *, char *);
+int cost_write(cost_t *, char *, char *);
+
+#endif
@@ -10,9 +10,54 @@
 /* a minute should be more than enough time to connect */
 #define DEFAULT_CONNECT_TIMEOUT		60
 
+/* a proxy that connected should answer well before this, unless -t
+ * is even shorter */
+#define DEFAULT_REPLY_TIMEOUT		10
+
+/* no adaptive timeout goes below this many milliseconds */
+#define DEFAULT_MIN_TIMEOUT		250
+
+/* one more go after a lost SYN or a reset, starting about a second
+ * later and doubling, as long as retries stay under 10% of the probes */
+#define DEFAULT_CONNECT_RETRIES		1
+#define DEFAULT_RESET_RETRIES		1
+#define DEFAULT_RETRY_DELAY		1000
+#define DEFAULT_RETRY_BUDGET		10
+
+/* results a new --ring has room for */
+#define DEFAULT_RING_SIZE 	65536
+
 /* 5 simultaneous connection attempts should be good.. */
 #define DEFAULT_PARALLEL_CONNECTS 	5
 
+/* beyond this you are out of file descriptors anyway */
+#define MAX_PARALLEL_CONNECTS 	1000000
+
+/* plenty of local addresses to spread connections over */
+#define MAX_SOURCE_ADDRS 	65536
+
+/* with --cache, skip targets probed within the last day */
+#define DEFAULT_CACHE_TTL 	86400
+
+/* entries a new cache starts out with, it grows as needed */
+#define DEFAULT_CACHE_SIZE 	(1ULL << 20)
+
+/* coordinator/worker mode */
+#define DEFAULT_COORD_PORT 	1090
+#define DEFAULT_CHUNK_SIZE 	16384
+#define DEFAULT_LEASE_TIME 	300
+
+/* --udp datagrams go to the echo service unless told otherwise */
+#define DEFAULT_UDP_ECHO_PORT 	7
+
+/* --monitor keeps track of at most this many proxies, and gives the
+ * targets still to be discovered this percent of each batch */
+#define DEFAULT_MONITOR_MAX 	1000000
+#define DEFAULT_MONITOR_SHARE 	50
+
+/* each open proxy is asked for at most this many --dest at once */
+#define DEFAULT_DEST_SLOTS 	2
+
 /* make sure these are set to something that will connect */
 #define DEFAULT_TARGET_HOST 	"198.108.130.5"
 #define DEFAULT_TARGET_PORT	53
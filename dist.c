@@ -0,0 +1,968 @@
+/*
+ * dist.c: coordinator/worker mode
+ * 
+ * the coordinator holds the whole target space and hands it out in
+ * leased chunks to workers over tcp.  workers scan with their own
+ * settings (-r, -s, -t, -b ...) and send back whatever they found.
+ * a chunk's results are only printed once it is done, so a chunk
+ * taken back from a dead or stalled worker and leased out again never
+ * shows up twice.
+ * 
+ * a chunk is up to --chunk-size targets, made of as many runs of
+ * consecutive ones as it takes, so sparse lists go out in chunks as
+ * big as dense ones.
+ * 
+ * the protocol is lines of text, the worker asks and the coordinator
+ * answers (the worker keeps scanning while it waits, and asks for the
+ * next chunk before it's done with the last one, see worker_tick()):
+ * 
+ *   worker                           coordinator
+ *   G                                C <id>.<lease> <runs>
+ *                                    + <hexip> <port> <count>  (per run)
+ *                                    W  (nothing right now, ask again)
+ *                                    E  (all done)
+ *   R <id>.<lease> <hexip> <port> <state>
+ *   D <id>.<lease> <scanned> <connected> <open>
+ *   P  (still alive)
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "args.h"
+#include "targets.h"
+#include "scan.h"
+#include "dist.h"
+
+/* at most this many workers at once */
+#define MAX_WORKERS 		256
+
+/* a worker with nothing in flight waits this long (ms) for a chunk
+ * each time the engine asks, the engine's own wait covers the rest */
+#define WORKER_GET_WAIT 	100
+
+/* no chunk, the end of the free list */
+#define NO_CHUNK 		(~0UL)
+
+/*
+ * a piece of the target space.  only the ones out with a worker or
+ * waiting to go out again are kept, a finished one's slot is reused
+ * (and the lease, unique over all of them, tells them apart).
+ */
+typedef struct
+{
+   trange_t *r;			/* its runs */
+   unsigned int nr, count;
+   int worker;			/* who has it, -1 if nobody */
+   unsigned int lease;		/* a new one every time it goes out */
+   unsigned long next;		/* the next free slot, while it's free */
+   char *res;			/* results, held until the chunk is done */
+   size_t rlen, ralloc;
+} chunk_t;
+
+/* a connected worker */
+typedef struct
+{
+   int sd;
+   char name[64];
+   char rbuf[4096];
+   int rlen;
+   time_t last_heard;
+   unsigned int nleased;
+   unsigned long ndone;
+} worker_t;
+
+/* a chunk on the worker side */
+typedef struct
+{
+   unsigned long id;
+   unsigned int lease;
+   trange_t *r;			/* sorted by port and address */
+   unsigned int nr, count;
+   unsigned int left;
+   unsigned int scanned, connected, open;
+} wchunk_t;
+
+/* coordinator state */
+static targlist_t *ctl;
+static chunk_t *chunks = NULL;
+static unsigned long nchunks = 0, ndone = 0, nout = 0;
+static unsigned long nslots = 0, nchalloc = 0, freec = NO_CHUNK;
+static unsigned int leases = 0;
+static unsigned long *requeue = NULL, nreq = 0, nreqalloc = 0;
+static worker_t workers[MAX_WORKERS];
+static unsigned int nworkers_seen = 0;
+static unsigned long long tot_scanned = 0, tot_connected = 0, tot_open = 0;
+
+/* worker state */
+static FILE *cwr = NULL;
+static int crd = -1;			/* the coordinator's answers come in here */
+static char cline[256];			/* a partial one */
+static int clen = 0;
+static int get_pending = 0;		/* a G went out, no answer yet */
+static time_t next_get = 0, last_sent = 0;
+static wchunk_t *wch = NULL;
+static unsigned int nwch = 0, nwchalloc = 0;
+static wchunk_t nextc;			/* the one after, as it comes in */
+static unsigned int nextc_runs = 0;	/* runs of it still to come */
+static int have_next = 0, coord_done = 0;
+
+static chunk_t *next_chunk(void);
+static int send_chunk(int, chunk_t *);
+static int take_connection(int);
+static void drop_worker(int, char *);
+static int worker_line(int, char *);
+static int coord_send(int, char *, ...);
+static char *outcome_str(unsigned long);
+static int coord_answer(char *, int, int);
+static int coord_poll(int);
+static void worker_get(void);
+static long worker_refill(scan_t *);
+static void worker_finished(scan_t *, target_t *);
+static int in_chunk(wchunk_t *, target_t *);
+static void worker_tick(scan_t *);
+static void taddr_to_hex(taddr_t *, char *);
+static int taddr_from_hex(taddr_t *, char *);
+
+static scanhook_t worker_hook = { worker_refill, worker_finished, worker_tick };
+
+
+/*
+ * hand out the targets until they have all been scanned
+ */
+int
+coord_run(tl, nt)
+   targlist_t *tl;
+   unsigned long nt;
+{
+   socklen_t sl;
+   struct timeval tv;
+   fd_set rfds;
+   time_t now;
+   int lsd, i, n, max, on = 1;
+   
+   signal(SIGPIPE, SIG_IGN);
+   ctl = tl;
+   for (i = 0; i < MAX_WORKERS; i++)
+     workers[i].sd = -1;
+   
+   sl = options.coord.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+   if ((lsd = socket(options.coord.ss_family, SOCK_STREAM, 0)) == -1
+       || setsockopt(lsd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+       || bind(lsd, (struct sockaddr *)&options.coord, sl) == -1
+       || listen(lsd, 64) == -1)
+     {
+	fprintf(stderr, "Unable to listen for workers: %s\n", strerror(errno));
+	if (lsd != -1)
+	  close(lsd);
+	return -1;
+     }
+   if (options.verbose >= 1)
+     fprintf(stderr, "waiting for workers, %lu targets in chunks of %u.\n", nt, options.chunk_size);
+   
+   /* until everything is done.. */
+   while (more_targets(ctl) || nreq > 0 || nout > 0)
+     {
+	FD_ZERO(&rfds);
+	FD_SET(lsd, &rfds);
+	max = lsd;
+	for (i = 0; i < MAX_WORKERS; i++)
+	  if (workers[i].sd != -1)
+	    {
+	       FD_SET(workers[i].sd, &rfds);
+	       if (workers[i].sd > max)
+		 max = workers[i].sd;
+	    }
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	if (select(max + 1, &rfds, NULL, NULL, &tv) == -1)
+	  {
+	     if (errno == EINTR)
+	       continue;
+	     fprintf(stderr, "select failed: %s\n", strerror(errno));
+	     break;
+	  }
+	
+	if (FD_ISSET(lsd, &rfds))
+	  take_connection(lsd);
+	
+	now = time(NULL);
+	for (i = 0; i < MAX_WORKERS; i++)
+	  {
+	     worker_t *w = &workers[i];
+	     char *p, *q;
+	     
+	     if (w->sd == -1)
+	       continue;
+	     if (FD_ISSET(w->sd, &rfds))
+	       {
+		  n = read(w->sd, w->rbuf + w->rlen, sizeof(w->rbuf) - w->rlen - 1);
+		  if (n <= 0)
+		    {
+		       drop_worker(i, n == 0 ? "went away" : strerror(errno));
+		       continue;
+		    }
+		  w->rlen += n;
+		  w->rbuf[w->rlen] = '\0';
+		  w->last_heard = now;
+		  
+		  /* handle all the complete lines */
+		  for (p = w->rbuf; (q = strchr(p, '\n')); p = q + 1)
+		    {
+		       *q = '\0';
+		       if (worker_line(i, p) == -1)
+			 break;
+		    }
+		  if (w->sd == -1)
+		    continue;
+		  w->rlen -= p - w->rbuf;
+		  memmove(w->rbuf, p, w->rlen);
+		  if (w->rlen == sizeof(w->rbuf) - 1)
+		    {
+		       drop_worker(i, "sent garbage");
+		       continue;
+		    }
+	       }
+	     /* sitting on chunks without a peep? */
+	     if (w->nleased > 0 && now - w->last_heard > options.lease_time)
+	       drop_worker(i, "stopped responding");
+	  }
+     }
+   
+   /* let anyone still around know we're done */
+   for (i = 0; i < MAX_WORKERS; i++)
+     if (workers[i].sd != -1)
+       {
+	  coord_send(i, "E\n");
+	  close(workers[i].sd);
+	  workers[i].sd = -1;
+       }
+   close(lsd);
+   
+   fprintf(stderr, "scanned %llu targets in %lu chunks on %u workers, %llu connected, %llu open.\n",
+	   tot_scanned, nchunks, nworkers_seen, tot_connected, tot_open);
+   for (i = 0; i < (int)nslots; i++)
+     {
+	free(chunks[i].r);
+	free(chunks[i].res);
+     }
+   free(chunks);
+   free(requeue);
+   return 0;
+}
+
+
+/*
+ * accept a new worker
+ */
+static int
+take_connection(lsd)
+   int lsd;
+{
+   struct sockaddr_storage ss;
+   socklen_t sl = sizeof(ss);
+   taddr_t a;
+   int sd, i, on = 1;
+   
+   if ((sd = accept(lsd, (struct sockaddr *)&ss, &sl)) == -1)
+     return -1;
+   for (i = 0; i < MAX_WORKERS; i++)
+     if (workers[i].sd == -1)
+       break;
+   if (i == MAX_WORKERS)
+     {
+	fprintf(stderr, "too many workers, turning one away.\n");
+	close(sd);
+	return -1;
+     }
+   setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   
+   memset(&workers[i], 0, sizeof(workers[i]));
+   workers[i].sd = sd;
+   workers[i].last_heard = time(NULL);
+   taddr_from_sockaddr(&a, (struct sockaddr *)&ss);
+   snprintf(workers[i].name, sizeof(workers[i].name), "%s:%u", taddr_ntoa(&a),
+	    ntohs(((struct sockaddr_in *)&ss)->sin_port));
+   nworkers_seen++;
+   if (options.verbose >= 1)
+     fprintf(stderr, "worker %s connected.\n", workers[i].name);
+   return i;
+}
+
+
+/*
+ * a worker is gone (or we gave up on it), put its chunks back
+ */
+static void
+drop_worker(wi, why)
+   int wi;
+   char *why;
+{
+   worker_t *w = &workers[wi];
+   unsigned long i;
+   
+   fprintf(stderr, "worker %s %s, %u chunks go back in the queue.\n", w->name, why, w->nleased);
+   close(w->sd);
+   w->sd = -1;
+   for (i = 0; w->nleased > 0 && i < nslots; i++)
+     {
+	chunk_t *c = &chunks[i];
+	
+	if (c->worker != wi)
+	  continue;
+	c->worker = -1;
+	c->rlen = 0;
+	w->nleased--;
+	nout--;
+	if (nreq == nreqalloc)
+	  {
+	     unsigned long na = nreqalloc ? nreqalloc * 2 : 64;
+	     unsigned long *p = (unsigned long *)realloc(requeue, na * sizeof(unsigned long));
+	     
+	     if (!p)
+	       {
+		  fprintf(stderr, "Unable to allocate memory to requeue chunks.\n");
+		  exit(1);
+	       }
+	     requeue = p;
+	     nreqalloc = na;
+	  }
+	requeue[nreq++] = i;
+     }
+}
+
+
+/*
+ * deal with one line from a worker
+ */
+static int
+worker_line(wi, line)
+   int wi;
+   char *line;
+{
+   worker_t *w = &workers[wi];
+   unsigned long id, state, scanned, connected, open;
+   unsigned int lease, port;
+   char hex[40], out[128];
+   chunk_t *c;
+   taddr_t ip;
+   
+   switch (*line)
+     {
+      case 'G':
+	if ((c = next_chunk()))
+	  {
+	     c->worker = wi;
+	     c->lease = ++leases;
+	     w->nleased++;
+	     nout++;
+	     if (options.verbose >= 2)
+	       fprintf(stderr, "chunk %lu.%u (%s:%u, %u targets in %u runs) to %s\n", (unsigned long)(c - chunks),
+		       c->lease, taddr_ntoa(&c->r[0].base), c->r[0].port, c->count, c->nr, w->name);
+	     return send_chunk(wi, c);
+	  }
+	if (!more_targets(ctl) && nreq == 0 && nout == 0)
+	  return coord_send(wi, "E\n");
+	return coord_send(wi, "W\n");
+	
+      case 'R':
+	if (sscanf(line, "R %lu.%u %39s %u %lx", &id, &lease, hex, &port, &state) != 5
+	    || !taddr_from_hex(&ip, hex))
+	  break;
+	if (id >= nslots || chunks[id].worker != wi || chunks[id].lease != lease)
+	  return 0;
+	c = &chunks[id];
+	snprintf(out, sizeof(out), "%-18s %-5u %s\n", taddr_ntoa(&ip), port, outcome_str(state));
+	if (c->rlen + strlen(out) + 1 > c->ralloc)
+	  {
+	     size_t na = c->ralloc ? c->ralloc * 2 : 1024;
+	     char *p = (char *)realloc(c->res, na);
+	     
+	     if (!p)
+	       {
+		  fprintf(stderr, "Unable to allocate memory for chunk results.\n");
+		  exit(1);
+	       }
+	     c->res = p;
+	     c->ralloc = na;
+	  }
+	strcpy(c->res + c->rlen, out);
+	c->rlen += strlen(out);
+	return 0;
+	
+      case 'D':
+	if (sscanf(line, "D %lu.%u %lu %lu %lu", &id, &lease, &scanned, &connected, &open) != 5)
+	  break;
+	if (id >= nslots || chunks[id].worker != wi || chunks[id].lease != lease)
+	  return 0;
+	c = &chunks[id];
+	if (c->rlen > 0)
+	  fwrite(c->res, 1, c->rlen, stdout);
+	fflush(stdout);
+	/* all that's left of it is in the counts */
+	free(c->res);
+	c->res = NULL;
+	free(c->r);
+	c->r = NULL;
+	c->rlen = c->ralloc = 0;
+	c->worker = -1;
+	c->next = freec;
+	freec = id;
+	w->nleased--;
+	w->ndone++;
+	nout--;
+	ndone++;
+	tot_scanned += scanned;
+	tot_connected += connected;
+	tot_open += open;
+	if (options.verbose >= 1)
+	  fprintf(stderr, "[%lu chunks done, %llu of %llu targets scanned]\n", ndone, tot_scanned, ctl->total);
+	return 0;
+	
+      case 'P':
+	return 0;
+     }
+   drop_worker(wi, "sent garbage");
+   return -1;
+}
+
+
+/*
+ * get the next chunk to lease out, taken back ones first
+ */
+static chunk_t *
+next_chunk()
+{
+   unsigned int nralloc = 0;
+   trange_t *r;
+   chunk_t *c;
+   
+   if (nreq > 0)
+     return &chunks[requeue[--nreq]];
+   
+   if (!more_targets(ctl))
+     return NULL;
+   
+   /* a finished one's slot, or a new one */
+   if (freec != NO_CHUNK)
+     {
+	c = &chunks[freec];
+	freec = c->next;
+     }
+   else
+     {
+	if (nslots == nchalloc)
+	  {
+	     unsigned long na = nchalloc ? nchalloc * 2 : 64;
+	     
+	     if (!(c = (chunk_t *)realloc(chunks, na * sizeof(chunk_t))))
+	       {
+		  fprintf(stderr, "Unable to allocate memory for %lu chunks.\n", na);
+		  return NULL;
+	       }
+	     chunks = c;
+	     nchalloc = na;
+	  }
+	c = &chunks[nslots++];
+     }
+   
+   /* cut a new one off the target list, a run at a time */
+   memset(c, 0, sizeof(*c));
+   c->worker = -1;
+   while (c->count < options.chunk_size)
+     {
+	if (c->nr == nralloc)
+	  {
+	     unsigned int na = nralloc ? nralloc * 2 : 8;
+	     
+	     /* short of memory, it's a smaller chunk */
+	     if (!(r = (trange_t *)realloc(c->r, na * sizeof(trange_t))))
+	       {
+		  fprintf(stderr, "Unable to allocate memory for %u runs.\n", na);
+		  break;
+	       }
+	     c->r = r;
+	     nralloc = na;
+	  }
+	r = &c->r[c->nr];
+	if (!next_target_run(ctl, &r->base, &r->count, &r->port, options.chunk_size - c->count))
+	  break;
+	c->count += r->count;
+	c->nr++;
+     }
+   if (c->nr == 0)
+     {
+	free(c->r);
+	c->r = NULL;
+	c->next = freec;
+	freec = c - chunks;
+	return NULL;
+     }
+   nchunks++;
+   return c;
+}
+
+
+/*
+ * lease c out to a worker, all of its runs in one go
+ */
+static int
+send_chunk(wi, c)
+   int wi;
+   chunk_t *c;
+{
+   char *buf, hex[40];
+   size_t len;
+   unsigned int i;
+   int ret = 0;
+   
+   /* a run's line is never more than 64 */
+   if (!(buf = (char *)malloc(64 * (c->nr + 1))))
+     {
+	fprintf(stderr, "Unable to allocate memory to send a chunk.\n");
+	exit(1);
+     }
+   len = sprintf(buf, "C %lu.%u %u\n", (unsigned long)(c - chunks), c->lease, c->nr);
+   for (i = 0; i < c->nr; i++)
+     {
+	taddr_to_hex(&c->r[i].base, hex);
+	len += sprintf(buf + len, "+ %s %u %u\n", hex, c->r[i].port, c->r[i].count);
+     }
+   if (write(workers[wi].sd, buf, len) != (ssize_t)len)
+     {
+	drop_worker(wi, "can't be written to");
+	ret = -1;
+     }
+   free(buf);
+   return ret;
+}
+
+
+/*
+ * send a line to a worker
+ * 
+ * (varargs need a prototype style definition)
+ */
+static int
+coord_send(int wi, char *fmt, ...)
+{
+   char buf[256];
+   va_list ap;
+   int len;
+   
+   va_start(ap, fmt);
+   len = vsnprintf(buf, sizeof(buf), fmt, ap);
+   va_end(ap);
+   if (write(workers[wi].sd, buf, len) != len)
+     {
+	drop_worker(wi, "can't be written to");
+	return -1;
+     }
+   return 0;
+}
+
+
+/*
+ * what we found, in words
+ */
+static char *
+outcome_str(state)
+   unsigned long state;
+{
+   static char buf[64];
+   
+   buf[0] = '\0';
+   if (state & SPSS_4_SUCCESSFUL)
+     strcat(buf, "v4 ");
+   if (state & SPSS_5_SUCCESSFUL)
+     strcat(buf, "v5 ");
+   if (state & SPSS_5_AUTH_PASS_OK)
+     strcat(buf, "v5-auth ");
+   if (state & SPSS_4A_SUCCESSFUL)
+     strcat(buf, "v4a ");
+   if (state & SPSS_H_SUCCESSFUL)
+     strcat(buf, "http ");
+   if (state & SPSS_H_AUTH)
+     strcat(buf, "http-auth ");
+   if (buf[0])
+     buf[strlen(buf) - 1] = '\0';
+   return buf;
+}
+
+
+/*
+ * scan chunks from the coordinator until it runs out
+ */
+int
+worker_run()
+{
+   targlist_t tl;
+   socklen_t sl;
+   int sd, on = 1;
+   
+   signal(SIGPIPE, SIG_IGN);
+   sl = options.coord.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+   if ((sd = socket(options.coord.ss_family, SOCK_STREAM, 0)) == -1
+       || connect(sd, (struct sockaddr *)&options.coord, sl) == -1)
+     {
+	fprintf(stderr, "Unable to connect to the coordinator: %s\n", strerror(errno));
+	if (sd != -1)
+	  close(sd);
+	return -1;
+     }
+   setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   crd = sd;
+   if (!(cwr = fdopen(dup(sd), "w")))
+     {
+	fprintf(stderr, "Unable to set up the coordinator connection: %s\n", strerror(errno));
+	return -1;
+     }
+   if (options.verbose >= 1)
+     fprintf(stderr, "connected to the coordinator.\n");
+   last_sent = time(NULL);
+   
+   memset(&tl, 0, sizeof(tl));
+   scan_targets(&tl, 0, &worker_hook);
+   
+   close(crd);
+   crd = -1;
+   if (cwr)
+     fclose(cwr);
+   free_targets(&tl);
+   while (nwch > 0)
+     free(wch[--nwch].r);
+   free(wch);
+   free(nextc.r);
+   return 0;
+}
+
+
+/*
+ * read the coordinator's answer into line, waiting up to ms for it
+ * 
+ * returns 1 for a line, 0 if it isn't all here yet, -1 if the
+ * connection is gone (or the line too long to be an answer)
+ */
+static int
+coord_answer(line, lsz, ms)
+   char *line;
+   int lsz, ms;
+{
+   struct pollfd pfd;
+   char *nl;
+   ssize_t n;
+   
+   while (!(nl = memchr(cline, '\n', clen)))
+     {
+	if (clen == sizeof(cline))
+	  return -1;
+	pfd.fd = crd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, ms) <= 0)
+	  return 0;
+	if ((n = recv(crd, cline + clen, sizeof(cline) - clen, MSG_DONTWAIT)) == 0)
+	  return -1;
+	if (n == -1)
+	  return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	clen += n;
+     }
+   n = nl - cline + 1;
+   snprintf(line, lsz, "%.*s", (int)n, cline);
+   clen -= n;
+   memmove(cline, cline + n, clen);
+   return 1;
+}
+
+/*
+ * take in whatever the coordinator has answered, waiting up to ms for
+ * the first of it.  a chunk's runs are put together in nextc.
+ * 
+ * returns -1 once the coordinator is gone
+ */
+static int
+coord_poll(ms)
+   int ms;
+{
+   char line[256], hex[40];
+   unsigned int lease, nr, port, count;
+   unsigned long id;
+   trange_t *r;
+   int n;
+   
+   while (cwr && !coord_done && (n = coord_answer(line, sizeof(line), ms)) != 0)
+     {
+	ms = 0;
+	if (n == -1)
+	  {
+	     fprintf(stderr, "lost the coordinator, finishing up.\n");
+	     goto gone;
+	  }
+	
+	/* one of the runs of the chunk that's coming in? */
+	if (nextc_runs > 0)
+	  {
+	     r = &nextc.r[nextc.nr];
+	     if (sscanf(line, "+ %39s %u %u", hex, &port, &count) != 3
+		 || !taddr_from_hex(&r->base, hex) || port > 0xffff || count == 0)
+	       goto garbage;
+	     r->port = port;
+	     r->count = count;
+	     nextc.count += count;
+	     nextc.nr++;
+	     /* all here?  sorted, so worker_finished() can find them */
+	     if (--nextc_runs == 0)
+	       {
+		  qsort(nextc.r, nextc.nr, sizeof(trange_t), compare_ranges);
+		  have_next = 1;
+	       }
+	     continue;
+	  }
+	
+	get_pending = 0;
+	if (*line == 'W')
+	  next_get = time(NULL) + 1;
+	else if (*line == 'E')
+	  coord_done = 1;
+	else if (sscanf(line, "C %lu.%u %u", &id, &lease, &nr) == 3 && nr > 0)
+	  {
+	     memset(&nextc, 0, sizeof(nextc));
+	     if (!(nextc.r = (trange_t *)malloc(nr * sizeof(trange_t))))
+	       {
+		  fprintf(stderr, "Unable to allocate memory for %u runs.\n", nr);
+		  goto gone;
+	       }
+	     nextc.id = id;
+	     nextc.lease = lease;
+	     nextc_runs = nr;
+	  }
+	else
+	  goto garbage;
+     }
+   return cwr ? 0 : -1;
+   
+ garbage:
+   fprintf(stderr, "the coordinator sent garbage, finishing up.\n");
+ gone:
+   fclose(cwr);
+   cwr = NULL;
+   return -1;
+}
+
+/*
+ * ask for the next chunk, unless there's one already or on its way,
+ * or we were told to wait
+ */
+static void
+worker_get()
+{
+   if (!cwr || get_pending || nextc_runs || have_next || coord_done
+       || time(NULL) < next_get)
+     return;
+   fputs("G\n", cwr);
+   fflush(cwr);
+   last_sent = time(NULL);
+   get_pending = 1;
+}
+
+/*
+ * start on the next chunk.  it was normally asked for while the last
+ * one was still going, when it wasn't this never blocks the engine for
+ * longer than WORKER_GET_WAIT (and then only with nothing in flight).
+ */
+static long
+worker_refill(sc)
+   scan_t *sc;
+{
+   targlist_t *tl = sc->targets;
+   unsigned int i;
+   wchunk_t *c;
+   
+   if (!have_next)
+     {
+	worker_get();
+	if (coord_poll(sc->nbusy || sc->nrq ? 0 : WORKER_GET_WAIT) == -1)
+	  return -1;
+	if (!have_next)
+	  return coord_done ? -1 : 0;
+     }
+   
+   /* keep track of it until all its targets are done */
+   if (nwch == nwchalloc)
+     {
+	unsigned int na = nwchalloc ? nwchalloc * 2 : 8;
+	
+	if (!(c = (wchunk_t *)realloc(wch, na * sizeof(wchunk_t))))
+	  {
+	     fprintf(stderr, "Unable to allocate memory for %u chunks.\n", na);
+	     return -1;
+	  }
+	wch = c;
+	nwchalloc = na;
+     }
+   c = &wch[nwch++];
+   *c = nextc;
+   c->left = c->count;
+   memset(&nextc, 0, sizeof(nextc));
+   have_next = 0;
+   if (options.verbose >= 2)
+     fprintf(stderr, "got chunk %lu (%s:%u, %u targets in %u runs)\n", c->id, taddr_ntoa(&c->r[0].base),
+	     c->r[0].port, c->count, c->nr);
+   
+   /* the slots have their own copies of their targets, start over */
+   free_targets(tl);
+   for (i = 0; i < c->nr; i++)
+     if (add_target_range(tl, &c->r[i].base, c->r[i].count, c->r[i].port) != c->r[i].count)
+       return -1;
+   tl->cur = 0;
+   tl->off = 0;
+   tl->total = c->count;
+   
+   /* and have the one after it ready by the time this one's out */
+   worker_get();
+   return c->count;
+}
+
+
+/*
+ * a target is done, report it if it's interesting and finish off
+ * its chunk when it was the last one
+ */
+static void
+worker_finished(sc, t)
+   scan_t *sc;
+   target_t *t;
+{
+   wchunk_t *c;
+   unsigned int i;
+   char hex[40];
+   
+   for (i = 0; i < nwch; i++)
+     if (in_chunk(&wch[i], t))
+       break;
+   if (i == nwch)
+     return;
+   c = &wch[i];
+   
+   if (t->state & SPSS_STARTED)
+     c->scanned++;
+   if (t->state & SPSS_ANY_CONNECTED)
+     c->connected++;
+   if (t->state & SPSS_ANY_OPEN)
+     {
+	c->open++;
+	if (cwr)
+	  {
+	     taddr_to_hex(&t->ip, hex);
+	     fprintf(cwr, "R %lu.%u %s %u %lx\n", c->id, c->lease, hex, t->port, t->state);
+	  }
+     }
+   if (--c->left > 0)
+     return;
+   
+   if (cwr)
+     {
+	fprintf(cwr, "D %lu.%u %u %u %u\n", c->id, c->lease, c->scanned, c->connected, c->open);
+	fflush(cwr);
+	last_sent = time(NULL);
+     }
+   free(c->r);
+   wch[i] = wch[--nwch];
+}
+
+/*
+ * is t one of c's?  the runs are sorted, the last one that starts at
+ * or before it is the only one it can be in
+ */
+static int
+in_chunk(c, t)
+   wchunk_t *c;
+   target_t *t;
+{
+   unsigned int lo = 0, hi = c->nr, mid;
+   trange_t *r;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	r = &c->r[mid];
+	if (r->port < t->port || (r->port == t->port && memcmp(r->base.b, t->ip.b, 16) <= 0))
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   if (lo == 0)
+     return 0;
+   r = &c->r[lo - 1];
+   return r->port == t->port && taddr_diff(&t->ip, &r->base) < r->count;
+}
+
+
+/*
+ * let the coordinator know we're still alive, and keep the next chunk
+ * coming
+ */
+static void
+worker_tick(sc)
+   scan_t *sc;
+{
+   if (nwch > 0)
+     {
+	worker_get();
+	if (get_pending || nextc_runs)
+	  coord_poll(0);
+     }
+   if (cwr && time(NULL) - last_sent >= options.lease_time / 3)
+     {
+	fputs("P\n", cwr);
+	fflush(cwr);
+	last_sent = time(NULL);
+     }
+}
+
+
+/*
+ * addresses go over the wire as 32 hex digits
+ */
+static void
+taddr_to_hex(a, hex)
+   taddr_t *a;
+   char *hex;
+{
+   int i;
+   
+   for (i = 0; i < 16; i++)
+     sprintf(hex + i * 2, "%02x", a->b[i]);
+}
+
+static int
+taddr_from_hex(a, hex)
+   taddr_t *a;
+   char *hex;
+{
+   unsigned int v;
+   int i;
+   
+   if (strlen(hex) != 32)
+     return 0;
+   for (i = 0; i < 16; i++)
+     {
+	if (sscanf(hex + i * 2, "%2x", &v) != 1)
+	  return 0;
+	a->b[i] = v;
+     }
+   return 1;
+}
@@ -0,0 +1,21 @@
+/*
+ * dist.h: coordinator/worker mode
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __dist_h
+#define __dist_h
+
+#include "targets.h"
+
+/* what options.dist can be */
+#define DIST_NONE 		0
+#define DIST_COORDINATOR 	1
+#define DIST_WORKER 		2
+
+/* prototypes */
+int coord_run(targlist_t *, unsigned long);
+int worker_run(void);
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * exclude.c: exclusion list (opt-outs, bogons, our own ranges)
+ * 
+ * excluded CIDRs are kept as a sorted array of merged intervals, so a
+ * lookup is a binary search and subtracting them from the (equally
+ * sorted) target ranges is a single sweep.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "args.h"
+#include "targets.h"
+#include "exclude.h"
+
+static xrange_t *xr = NULL;
+static unsigned long nxr = 0, nxalloc = 0;
+static int xsorted = 0;
+static taddr_t taddr_zero;
+
+static unsigned long find_exclude(taddr_t *);
+static int compare_excludes(const void *, const void *);
+static int emit_range(trange_t **, unsigned long *, unsigned long *, taddr_t *, unsigned long long, unsigned short);
+
+/*
+ * load exclusions from a file, one ip or cidr per line.  blank lines
+ * and anything after a '#' are ignored.
+ */
+unsigned long
+load_excludes(fn)
+   char *fn;
+{
+   FILE *fp;
+   char buf[512], *p, *q;
+   unsigned long n = 0, lineno = 0;
+   
+   if (!(fp = fopen(fn, "r")))
+     {
+	fprintf(stderr, "Unable to load exclusions from \"%s\": %s\n", fn, strerror(errno));
+	return 0;
+     }
+   while (fgets(buf, sizeof(buf), fp))
+     {
+	lineno++;
+	if ((p = strchr(buf, '#')))
+	  *p = '\0';
+	/* trim surrounding whitespace */
+	for (p = buf; isspace((unsigned char)*p); p++)
+	  ;
+	for (q = p + strlen(p); q > p && isspace((unsigned char)q[-1]); q--)
+	  ;
+	*q = '\0';
+	if (!*p)
+	  continue;
+	if (!add_exclude(p))
+	  {
+	     fprintf(stderr, "%s:%lu: invalid exclusion: %s\n", fn, lineno, p);
+	     continue;
+	  }
+	n++;
+     }
+   fclose(fp);
+   if (options.verbose >= 1)
+     fprintf(stderr, "loaded %lu exclusions from \"%s\".\n", n, fn);
+   return n;
+}
+
+
+/*
+ * add a single ip or cidr (IPv4 or IPv6) to the exclusions
+ */
+int
+add_exclude(str)
+   char *str;
+{
+   xrange_t x;
+   
+   if (!parse_cidr(str, &x.lo, &x.hi))
+     return 0;
+   
+   if (nxr == nxalloc)
+     {
+	unsigned long na = nxalloc ? nxalloc * 2 : 1024;
+	xrange_t *t = (xrange_t *)realloc(xr, na * sizeof(xrange_t));
+	
+	if (!t)
+	  {
+	     fprintf(stderr, "Unable to allocate memory for %lu exclusions.\n", na);
+	     return 0;
+	  }
+	xr = t;
+	nxalloc = na;
+     }
+   xr[nxr++] = x;
+   xsorted = 0;
+   return 1;
+}
+
+
+/*
+ * sort the exclusions and merge overlapping/adjacent ones
+ * 
+ * returns the number of intervals left
+ */
+unsigned long
+sort_excludes()
+{
+   unsigned long i, n = 0;
+   taddr_t next;
+   
+   if (nxr == 0)
+     return 0;
+   qsort(xr, nxr, sizeof(xrange_t), compare_excludes);
+   for (i = 1; i < nxr; i++)
+     {
+	/* the address just past the current interval (0 on wrap) */
+	next = xr[n].hi;
+	taddr_add(&next, 1);
+	if (memcmp(xr[i].lo.b, next.b, 16) <= 0
+	    || memcmp(next.b, taddr_zero.b, 16) == 0)
+	  {
+	     if (memcmp(xr[i].hi.b, xr[n].hi.b, 16) > 0)
+	       xr[n].hi = xr[i].hi;
+	     continue;
+	  }
+	xr[++n] = xr[i];
+     }
+   nxr = n + 1;
+   xsorted = 1;
+   if (options.verbose >= 2)
+     fprintf(stderr, "%lu excluded intervals after merging.\n", nxr);
+   return nxr;
+}
+
+
+/*
+ * anything excluded at all?
+ */
+int
+have_excludes()
+{
+   return nxr > 0;
+}
+
+/*
+ * is this address excluded?
+ */
+int
+excluded(a)
+   taddr_t *a;
+{
+   unsigned long i;
+   
+   if (!xsorted)
+     return 0;
+   i = find_exclude(a);
+   return i < nxr && memcmp(xr[i].lo.b, a->b, 16) <= 0;
+}
+
+
+/*
+ * remove all the excluded addresses from a sorted target store
+ * 
+ * nothing happens until sort_excludes() has been called, so the
+ * exclusions only apply once they are all loaded.
+ * 
+ * returns the number of targets removed
+ */
+unsigned long long
+subtract_excludes(tl)
+   targlist_t *tl;
+{
+   trange_t *out = NULL, *r;
+   unsigned long nout = 0, nalloc = 0, i, j;
+   unsigned long long removed = 0, left, n;
+   taddr_t cur, last, v4lo, v4hi;
+   unsigned int lo, hi;
+   long long nr;
+   
+   if (!xsorted || nxr == 0 || TL_EMPTY(tl))
+     return 0;
+   
+   for (i = 0; i < tl->nr; i++)
+     {
+	r = &tl->r[i];
+	cur = r->base;
+	left = r->count;
+	last = cur;
+	taddr_add(&last, left - 1);
+	
+	/* walk the exclusions that overlap this range */
+	for (j = find_exclude(&cur);
+	     left > 0 && j < nxr && memcmp(xr[j].lo.b, last.b, 16) <= 0;
+	     j++)
+	  {
+	     /* keep whatever comes before this exclusion */
+	     if (memcmp(xr[j].lo.b, cur.b, 16) > 0)
+	       {
+		  n = taddr_diff(&xr[j].lo, &cur);
+		  if (!emit_range(&out, &nout, &nalloc, &cur, n, r->port))
+		    goto fail;
+		  taddr_add(&cur, n);
+		  left -= n;
+	       }
+	     /* then drop everything it covers */
+	     if (memcmp(xr[j].hi.b, last.b, 16) >= 0)
+	       {
+		  removed += left;
+		  left = 0;
+		  break;
+	       }
+	     n = taddr_diff(&xr[j].hi, &cur) + 1;
+	     removed += n;
+	     left -= n;
+	     taddr_add(&cur, n);
+	  }
+	if (left > 0 && !emit_range(&out, &nout, &nalloc, &cur, left, r->port))
+	  goto fail;
+     }
+   
+   /* the IPv4 sets just get the covered part of each exclusion taken out */
+   memset(&v4lo, 0, sizeof(v4lo));
+   v4lo.b[10] = v4lo.b[11] = 0xff;
+   v4hi = v4lo;
+   memset(v4hi.b + 12, 0xff, 4);
+   for (j = find_exclude(&v4lo); tl->nv4 > 0 && j < nxr && memcmp(xr[j].lo.b, v4hi.b, 16) <= 0; j++)
+     {
+	lo = memcmp(xr[j].lo.b, v4lo.b, 16) < 0 ? 0
+	  : (xr[j].lo.b[12] << 24) | (xr[j].lo.b[13] << 16) | (xr[j].lo.b[14] << 8) | xr[j].lo.b[15];
+	hi = memcmp(xr[j].hi.b, v4hi.b, 16) > 0 ? 0xffffffffU
+	  : (xr[j].hi.b[12] << 24) | (xr[j].hi.b[13] << 16) | (xr[j].hi.b[14] << 8) | xr[j].hi.b[15];
+	for (i = 0; i < tl->nv4; i++)
+	  {
+	     /* out of memory splitting a container, it stays in */
+	     if (tl->map && tset_own(&tl->v4[i].set, lo, hi) == -1)
+	       continue;
+	     if ((nr = tset_remove_range(&tl->v4[i].set, lo, hi)) > 0)
+	       removed += nr;
+	  }
+     }
+   
+   /* compiled ones have theirs in the mapping */
+   if (!tl->map || tl->nalloc)
+     free(tl->r);
+   tl->r = out;
+   tl->nr = tl->nalloc = nout;
+   tl->total -= removed;
+   if (options.verbose >= 1 && removed > 0)
+     fprintf(stderr, "%llu targets excluded.\n", removed);
+   return removed;
+   
+ fail:
+   fprintf(stderr, "Unable to allocate memory to apply exclusions.\n");
+   free(out);
+   return 0;
+}
+
+
+/*
+ * find the first interval that ends at or after a
+ */
+static unsigned long
+find_exclude(a)
+   taddr_t *a;
+{
+   unsigned long lo = 0, hi = nxr, mid;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	if (memcmp(xr[mid].hi.b, a->b, 16) < 0)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   return lo;
+}
+
+
+/*
+ * append a piece of a target range to the output array
+ */
+static int
+emit_range(out, nout, nalloc, base, count, port)
+   trange_t **out;
+   unsigned long *nout, *nalloc;
+   taddr_t *base;
+   unsigned long long count;
+   unsigned short port;
+{
+   trange_t *t;
+   
+   if (*nout == *nalloc)
+     {
+	unsigned long na = *nalloc ? *nalloc * 2 : 1024;
+	
+	if (!(t = (trange_t *)realloc(*out, na * sizeof(trange_t))))
+	  return 0;
+	*out = t;
+	*nalloc = na;
+     }
+   t = &(*out)[(*nout)++];
+   t->base = *base;
+   t->count = (unsigned int)count;
+   t->port = port;
+   return 1;
+}
+
+
+static int
+compare_excludes(a, b)
+   const void *a, *b;
+{
+   return memcmp(((const xrange_t *)a)->lo.b, ((const xrange_t *)b)->lo.b, 16);
+}
+
+
+/*
+ * turn an ip or cidr (IPv4 or IPv6) into its first and last address
+ */
+int
+parse_cidr(str, lo, hi)
+   char *str;
+   taddr_t *lo, *hi;
+{
+   char buf[128], *p, *q;
+   unsigned long bits = 128, len;
+   struct in_addr in4;
+   struct in6_addr in6;
+   int i;
+   
+   strncpy(buf, str, sizeof(buf) - 1);
+   buf[sizeof(buf) - 1] = '\0';
+   if ((p = strchr(buf, '/')))
+     *p++ = '\0';
+   
+   memset(lo, 0, sizeof(*lo));
+   if (inet_pton(AF_INET, buf, &in4) == 1)
+     {
+	/* v4-mapped, the first 96 bits are fixed */
+	lo->b[10] = lo->b[11] = 0xff;
+	memcpy(lo->b + 12, &in4, 4);
+	bits = 32;
+     }
+   else if (inet_pton(AF_INET6, buf, &in6) == 1)
+     memcpy(lo->b, &in6, 16);
+   else
+     return 0;
+   
+   len = bits;
+   if (p)
+     {
+	len = strtoul(p, &q, 10);
+	if (*q || q == p || len > bits)
+	  return 0;
+     }
+   /* make it a 128 bit prefix length */
+   len += 128 - bits;
+   
+   *hi = *lo;
+   for (i = len; i < 128; i++)
+     {
+	lo->b[i / 8] &= ~(0x80 >> (i % 8));
+	hi->b[i / 8] |= 0x80 >> (i % 8);
+     }
+   return 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * exclude.h: addresses that must never be scanned
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __exclude_h
+#define __exclude_h
+
+#include "targets.h"
+
+/* an inclusive interval of excluded addresses */
+typedef struct
+{
+   taddr_t lo, hi;
+} xrange_t;
+
+/* prototypes */
+unsigned long load_excludes(char *);
+int add_exclude(char *);
+unsigned long sort_excludes(void);
+int have_excludes(void);
+int excluded(taddr_t *);
+unsigned long long subtract_excludes(targlist_t *);
+int parse_cidr(char *, taddr_t *, taddr_t *);
+
+#endif
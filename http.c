@@ -0,0 +1,99 @@
+/*
+ * http.c: HTTP CONNECT proxy negotiation code
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ * 
+ * 2026-10-19 	started, buffer based like the socks ones
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "http.h"
+
+
+/*
+ * build a CONNECT request for host (a name or an address) and port
+ * into req
+ * 
+ * returns the length of the request, or 0 if it didn't fit
+ */
+int
+http_build_connect_req(req, rsz, host, port)
+   char *req;
+   int rsz;
+   char *host;
+   unsigned short port;
+{
+   char *lb = "", *rb = "";
+   int rl;
+   
+   /* IPv6 addresses go in brackets */
+   if (strchr(host, ':'))
+     {
+	lb = "[";
+	rb = "]";
+     }
+   rl = snprintf(req, rsz, "CONNECT %s%s%s:%u HTTP/1.0\r\nHost: %s%s%s:%u\r\n\r\n",
+		 lb, host, rb, port, lb, host, rb, port);
+   if (rl < 0 || rl >= rsz)
+     return 0;
+   return rl;
+}
+
+
+/*
+ * check the status line of a CONNECT reply of rl bytes
+ * 
+ * rl <= 0 means the read failed (errno is used when it is -1).
+ * returns the status code, or 0 if there wasn't one.  anything but
+ * a 2xx leaves the reason in eb.
+ */
+int
+http_parse_connect_rep(rep, rl, eb, ebl)
+   char *rep;
+   int rl;
+   char *eb;
+   unsigned int ebl;
+{
+   char line[64], *p;
+   int code, n;
+   
+   if (rl <= 0)
+     {
+	if (eb)
+	  {
+	     snprintf(eb, ebl-1, "error reading connect reply: %s", 
+		      rl == 0 ? "Remote end closed connection" : strerror(errno));
+	     eb[ebl-1] = '\0';
+	  }
+	return 0;
+     }
+   /* just the status line: HTTP/1.x nnn reason */
+   n = rl < (int)sizeof(line) - 1 ? rl : (int)sizeof(line) - 1;
+   memcpy(line, rep, n);
+   line[n] = '\0';
+   if ((p = strpbrk(line, "\r\n")))
+     *p = '\0';
+   if (strncmp(line, "HTTP/", 5) || !(p = strchr(line, ' '))
+       || (code = (int)strtol(p + 1, NULL, 10)) < 100 || code > 999)
+     {
+	if (eb)
+	  {
+	     snprintf(eb, ebl-1, "unable to connect through proxy: %s", "Not an HTTP reply");
+	     eb[ebl-1] = '\0';
+	  }
+	return 0;
+     }
+   if (code / 100 != 2 && eb)
+     {
+	if (code == HTTP_PROXY_AUTH)
+	  snprintf(eb, ebl-1, "proxy authentication required!");
+	else
+	  snprintf(eb, ebl-1, "unable to connect through proxy: %s", p + 1);
+	eb[ebl-1] = '\0';
+     }
+   return code;
+}
@@ -0,0 +1,19 @@
+/*
+ * http.h: HTTP CONNECT proxy defines and prototypes
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __http_h
+#define __http_h
+
+/* status codes that mean something to us */
+#define HTTP_PROXY_AUTH 	407
+#define HTTP_BAD_GATEWAY 	502	/* through 504, it couldn't get there */
+#define HTTP_GATEWAY_TIMEOUT 	504
+
+/* function prototypes */
+	int	http_build_connect_req(char *, int, char *, unsigned short);
+	int	http_parse_connect_rep(char *, int, char *, unsigned int);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * io_epoll.c: readiness based (epoll) i/o backend
+ * 
+ * like the select backend, but without the FD_SETSIZE ceiling or the
+ * walk over every slot on each trip around the loop.  it also leaves
+ * a single descriptor for an outside event loop to wait on.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "args.h"
+#include "scan.h"
+#include "net.h"
+
+/* most events handled per wait */
+#define EP_MAX_EVENTS 		1024
+
+/* event data is the slot generation and index, this one is stdin */
+#define EP_STATUS 		(~0ULL)
+#define EP_DATA(sl) 		(((unsigned long long)(sl)->gen << 32) | (sl)->idx)
+
+typedef struct
+{
+   int epfd;
+   int status_armed;
+   struct epoll_event evs[EP_MAX_EVENTS];
+} epoll_t;
+
+static int ep_init(scan_t *);
+static void ep_fini(scan_t *);
+static int ep_connect(scan_t *, scanslot_t *);
+static int ep_request(scan_t *, scanslot_t *);
+static void ep_close(scan_t *, scanslot_t *);
+static void ep_park(scan_t *, scanslot_t *);
+static int ep_wait(scan_t *, int);
+static int ep_fd(scan_t *);
+static int ep_watch(epoll_t *, scanslot_t *, int, unsigned int);
+
+scanio_t scanio_epoll =
+{
+   "epoll", 0,
+   ep_init, ep_fini,
+   ep_connect, ep_request, ep_close, ep_park,
+   ep_wait, ep_fd
+};
+
+
+static int
+ep_init(sc)
+   scan_t *sc;
+{
+   epoll_t *e;
+   
+   if (!(e = (epoll_t *)calloc(1, sizeof(epoll_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for epoll.\n");
+	return -1;
+     }
+   if ((e->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+     {
+	if (sc->opts->verbose >= 1)
+	  fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+	free(e);
+	return -1;
+     }
+   sc->iop = e;
+   return 0;
+}
+
+static void
+ep_fini(sc)
+   scan_t *sc;
+{
+   epoll_t *e = sc->iop;
+   
+   if (!e)
+     return;
+   close(e->epfd);
+   free(e);
+   sc->iop = NULL;
+}
+
+
+/*
+ * start a non-blocking connection to the slot's target
+ */
+static int
+ep_connect(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   unsigned int tries = 0;
+   int sd, err;
+   
+ again:
+   if ((sd = scan_socket(sc, sl, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1)
+     return -1;
+   SCAN_SYS(sc, sl, 1);
+   if (connect(sd, (struct sockaddr *)&sl->sa, sl->salen) == -1
+       && errno != EINPROGRESS)
+     {
+	err = errno;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "%s", strerror(err));
+	sc->eno = err;
+	close(sd);
+	SCAN_SYS(sc, sl, 1);
+	/* out of ports on that source address?  try the next one */
+	if (err == EADDRNOTAVAIL && ++tries < sc->opts->nsources)
+	  goto again;
+	return -1;
+     }
+   sl->sd = sd;
+   SCAN_SYS(sc, sl, 1);
+   if (ep_watch(sc->iop, sl, EPOLL_CTL_ADD, EPOLLOUT) == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "epoll_ctl: %s", strerror(errno));
+	close(sd);
+	SCAN_SYS(sc, sl, 1);
+	sl->sd = -1;
+	return -1;
+     }
+   sl->io_state = SIO_CONNECTING;
+   return 0;
+}
+
+/*
+ * the request goes out when the socket is writable
+ */
+static int
+ep_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   /* still watching for writable from the connect? */
+   if (sl->io_state != SIO_CONNECTING)
+     {
+	SCAN_SYS(sc, sl, 1);
+	if (ep_watch(sc->iop, sl, EPOLL_CTL_MOD, EPOLLOUT) == -1)
+	  {
+	     snprintf(sc->ebuf, sizeof(sc->ebuf), "epoll_ctl: %s", strerror(errno));
+	     return -1;
+	  }
+     }
+   sl->io_state = SIO_SENDING;
+   return 0;
+}
+
+/*
+ * closing takes it out of the epoll set too
+ */
+static void
+ep_close(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   if (sl->sd >= 0)
+     {
+	close(sl->sd);
+	SCAN_SYS(sc, sl, 1);
+     }
+   sl->sd = -1;
+   sl->io_state = SIO_IDLE;
+}
+
+/*
+ * the socket stays open but has nothing more to say
+ */
+static void
+ep_park(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   epoll_t *e = sc->iop;
+   
+   SCAN_SYS(sc, sl, 1);
+   (void) epoll_ctl(e->epfd, EPOLL_CTL_DEL, sl->sd, NULL);
+}
+
+
+/*
+ * wait for events on the slots and do whatever i/o is ready
+ */
+static int
+ep_wait(sc, ms)
+   scan_t *sc;
+   int ms;
+{
+   epoll_t *e = sc->iop;
+   struct epoll_event *ev;
+   scanslot_t *sl;
+   unsigned int idx;
+   int n, i, rl, err;
+   
+   /* watch the status descriptor (stdin) too */
+   if (sc->status_fd != -1 && !e->status_armed)
+     {
+	struct epoll_event sev;
+	
+	sev.events = EPOLLIN;
+	sev.data.u64 = EP_STATUS;
+	SCAN_SHARED_SYS(sc, 1);
+	if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, sc->status_fd, &sev) == 0)
+	  e->status_armed = 1;
+	else
+	  /* a regular file or /dev/null, don't bother again */
+	  e->status_armed = -1;
+     }
+   
+   n = epoll_wait(e->epfd, e->evs, EP_MAX_EVENTS, ms);
+   SCAN_SHARED_SYS(sc, 1);
+   if (n == -1)
+     {
+	if (errno == EINTR)
+	  return 0;
+	perror("epoll_wait failed");
+	return -1;
+     }
+   
+   for (i = 0; i < n; i++)
+     {
+	ev = &e->evs[i];
+	if (ev->data.u64 == EP_STATUS)
+	  {
+	     char tmp[1024];
+	     
+	     scan_status(sc);
+	     /* clear stdin */
+	     SCAN_SHARED_SYS(sc, 1);
+	     if (read(sc->status_fd, tmp, sizeof(tmp)) <= 0)
+	       {
+		  (void) epoll_ctl(e->epfd, EPOLL_CTL_DEL, sc->status_fd, NULL);
+		  SCAN_SHARED_SYS(sc, 1);
+		  e->status_armed = -1;
+	       }
+	     continue;
+	  }
+	
+	/* is this for what the slot is doing right now? */
+	idx = (unsigned int)(ev->data.u64 & 0xffffffff);
+	if (idx >= sc->nslots)
+	  continue;
+	sl = &sc->slots[idx];
+	if (!sl->targ || sl->io_state == SIO_IDLE
+	    || sl->gen != (unsigned int)(ev->data.u64 >> 32))
+	  continue;
+	
+	switch (sl->io_state)
+	  {
+	   case SIO_CONNECTING:
+	     /* the connection finished, the event says how.  only a
+	      * failure needs a trip to the kernel for the reason */
+	     err = 0;
+	     if (ev->events & (EPOLLERR | EPOLLHUP))
+	       {
+		  err = net_error(sl->sd);
+		  SCAN_SYS(sc, sl, 1);
+		  if (!err)
+		    err = ECONNRESET;
+	       }
+	     /* scan_connected queued the request, it goes out next time */
+	     scan_connected(sc, sl, err);
+	     break;
+	     
+	   case SIO_SENDING:
+	     rl = write(sl->sd, sl->wbuf, sl->wlen);
+	     err = errno;
+	     SCAN_SYS(sc, sl, 2);
+	     if (ep_watch(e, sl, EPOLL_CTL_MOD, EPOLLIN) == -1 && rl != -1)
+	       {
+		  rl = -1;
+		  err = errno;
+	       }
+	     sl->io_state = SIO_RECVING;
+	     scan_sent(sc, sl, rl, err);
+	     break;
+	     
+	   case SIO_RECVING:
+	     rl = read(sl->sd, sl->rbuf, sizeof(sl->rbuf));
+	     SCAN_SYS(sc, sl, 1);
+	     scan_received(sc, sl, rl, errno);
+	     break;
+	  }
+     }
+   return 0;
+}
+
+
+/*
+ * the epoll descriptor is readable whenever a slot has something
+ */
+static int
+ep_fd(sc)
+   scan_t *sc;
+{
+   epoll_t *e = sc->iop;
+   
+   return e->epfd;
+}
+
+
+/*
+ * (re)register the slot's socket for events
+ */
+static int
+ep_watch(e, sl, op, events)
+   epoll_t *e;
+   scanslot_t *sl;
+   int op;
+   unsigned int events;
+{
+   struct epoll_event ev;
+   
+   ev.events = events;
+   ev.data.u64 = EP_DATA(sl);
+   return epoll_ctl(e->epfd, op, sl->sd, &ev);
+}
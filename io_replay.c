@@ -0,0 +1,424 @@
+/*
+ * io_replay.c: plays a recorded trace back through the engine
+ * 
+ * no sockets, no waiting.  each target gets the events it got when it
+ * was recorded, at the same offsets on a virtual clock, so the only
+ * thing being measured is the engine itself.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "args.h"
+#include "scan.h"
+#include "trace.h"
+
+/* an event waiting for its time */
+typedef struct
+{
+   unsigned long long due;
+   unsigned long seq;		/* ties go in the order they were queued */
+   unsigned int idx, gen;
+} rpev_t;
+
+/* where a slot's target is in the trace */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   int have;
+   long cur;			/* its next event, -1 if it had none */
+   unsigned long long op;	/* when the current connect/request started */
+} rpslot_t;
+
+typedef struct
+{
+   trace_t *t;
+   unsigned char *used;		/* events already played, for retried targets */
+   rpslot_t *rs;
+   rpev_t *heap;
+   unsigned long nheap, naheap, seq;
+   unsigned long ntargets, nevents, ndiverged;
+   struct rusage ru;
+} replay_t;
+
+static int rp_init(scan_t *);
+static void rp_fini(scan_t *);
+static int rp_connect(scan_t *, scanslot_t *);
+static int rp_request(scan_t *, scanslot_t *);
+static void rp_close(scan_t *, scanslot_t *);
+static int rp_wait(scan_t *, int);
+
+static trec_t *next_rec(replay_t *, rpslot_t *);
+static void consume(replay_t *, rpslot_t *);
+static void deliver(scan_t *, scanslot_t *);
+static int schedule(replay_t *, scanslot_t *, unsigned long long);
+static void diverged(scan_t *, scanslot_t *, char *);
+
+scanio_t scanio_replay =
+{
+   "replay", 1,
+   rp_init, rp_fini,
+   rp_connect, rp_request, rp_close, NULL,
+   rp_wait, NULL
+};
+
+
+static int
+rp_init(sc)
+   scan_t *sc;
+{
+   replay_t *rp;
+   
+   if (!sc->opts->replay)
+     return -1;
+   if (!(rp = (replay_t *)calloc(1, sizeof(replay_t)))
+       || !(rp->rs = (rpslot_t *)calloc(sc->nslots, sizeof(rpslot_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for the replay.\n");
+	free(rp);
+	return -1;
+     }
+   if (!(rp->t = trace_load(sc->opts->replay))
+       || !(rp->used = (unsigned char *)calloc(rp->t->nrecs + 1, 1)))
+     {
+	free(rp->rs);
+	free(rp);
+	return -1;
+     }
+   sc->iop = rp;
+   
+   /* the engine runs on our clock now */
+   sc->vclock = 1;
+   sc->vnow = 0;
+   sc->vbase = time(NULL);
+   (void) getrusage(RUSAGE_SELF, &rp->ru);
+   return 0;
+}
+
+/*
+ * say how much the engine cost
+ */
+static void
+rp_fini(sc)
+   scan_t *sc;
+{
+   replay_t *rp = sc->iop;
+   struct rusage ru;
+   double cpu;
+   
+   if (!rp)
+     return;
+   (void) getrusage(RUSAGE_SELF, &ru);
+   cpu = (ru.ru_utime.tv_sec - rp->ru.ru_utime.tv_sec)
+     + (ru.ru_stime.tv_sec - rp->ru.ru_stime.tv_sec)
+     + ((ru.ru_utime.tv_usec - rp->ru.ru_utime.tv_usec)
+	+ (ru.ru_stime.tv_usec - rp->ru.ru_stime.tv_usec)) / 1000000.0;
+   fprintf(stderr, "replayed %lu targets, %lu events (%lu diverged) covering %llu.%03llu seconds\n",
+	   rp->ntargets, rp->nevents, rp->ndiverged, sc->vnow / 1000, sc->vnow % 1000);
+   fprintf(stderr, "engine cpu: %.3f seconds, %.2f usec per target\n",
+	   cpu, rp->ntargets ? cpu * 1000000.0 / rp->ntargets : 0.0);
+   free(rp->heap);
+   free(rp->used);
+   free(rp->rs);
+   free(rp);
+   sc->iop = NULL;
+}
+
+
+/*
+ * a connect gets whatever its target got the first time
+ */
+static int
+rp_connect(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   replay_t *rp = sc->iop;
+   rpslot_t *rs = &rp->rs[sl->idx];
+   target_t *t = sl->targ;
+   trec_t *r;
+   
+   /* a new target in this slot? */
+   if (!rs->have || rs->port != t->port || memcmp(rs->ip.b, t->ip.b, 16))
+     {
+	rs->ip = t->ip;
+	rs->port = t->port;
+	rs->have = 1;
+	rs->cur = trace_find(rp->t, &t->ip, t->port);
+	/* a retry picks up where the last slot left off */
+	if (t->ctries || t->rtries)
+	  while (next_rec(rp, rs) && rp->used[rs->cur])
+	    rs->cur++;
+	else
+	  rp->ntargets++;
+     }
+   rs->op = sc->vnow;
+   
+   if (!(r = next_rec(rp, rs)))
+     {
+	rp->ndiverged++;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "not in the trace");
+	return -1;
+     }
+   if (r->ev == TR_OPFAIL)
+     {
+	consume(rp, rs);
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "%.*s", (int)r->dlen, (char *)(r + 1));
+	return -1;
+     }
+   if (r->ev != TR_CONNECTED && r->ev != TR_TIMEOUT)
+     {
+	rp->ndiverged++;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "the trace has something else here");
+	return -1;
+     }
+   sl->io_state = SIO_CONNECTING;
+   return schedule(rp, sl, rs->op + r->ms);
+}
+
+/*
+ * as does a request
+ */
+static int
+rp_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   replay_t *rp = sc->iop;
+   rpslot_t *rs = &rp->rs[sl->idx];
+   trec_t *r;
+   
+   rs->op = sc->vnow;
+   r = next_rec(rp, rs);
+   if (r && r->ev == TR_OPFAIL)
+     {
+	consume(rp, rs);
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "%.*s", (int)r->dlen, (char *)(r + 1));
+	return -1;
+     }
+   if (!r || r->ev != TR_SENT)
+     {
+	rp->ndiverged++;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "the trace has something else here");
+	return -1;
+     }
+   sl->io_state = SIO_SENDING;
+   return schedule(rp, sl, rs->op + r->ms);
+}
+
+/*
+ * whatever is still queued for the slot goes stale with its generation
+ */
+static void
+rp_close(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   sl->io_state = SIO_IDLE;
+}
+
+
+/*
+ * jump the clock to the next event(s) and deliver them
+ */
+static int
+rp_wait(sc, ms)
+   scan_t *sc;
+   int ms;
+{
+   replay_t *rp = sc->iop;
+   unsigned long long due;
+   unsigned long i, c;
+   rpev_t ev, tmp;
+   scanslot_t *sl;
+   
+   /* nothing due before the engine wants to look around again? */
+   if (rp->nheap == 0 || rp->heap[0].due > sc->vnow + ms)
+     {
+	sc->vnow += ms;
+	return 0;
+     }
+   due = rp->heap[0].due;
+   if (due > sc->vnow)
+     sc->vnow = due;
+   while (rp->nheap > 0 && rp->heap[0].due == due)
+     {
+	/* pop the top */
+	ev = rp->heap[0];
+	rp->heap[0] = rp->heap[--rp->nheap];
+	for (i = 0; (c = i * 2 + 1) < rp->nheap; i = c)
+	  {
+	     if (c + 1 < rp->nheap
+		 && (rp->heap[c + 1].due < rp->heap[c].due
+		     || (rp->heap[c + 1].due == rp->heap[c].due && rp->heap[c + 1].seq < rp->heap[c].seq)))
+	       c++;
+	     if (rp->heap[i].due < rp->heap[c].due
+		 || (rp->heap[i].due == rp->heap[c].due && rp->heap[i].seq < rp->heap[c].seq))
+	       break;
+	     tmp = rp->heap[i];
+	     rp->heap[i] = rp->heap[c];
+	     rp->heap[c] = tmp;
+	  }
+	
+	sl = &sc->slots[ev.idx];
+	if (!sl->targ || sl->gen != ev.gen || sl->io_state == SIO_IDLE)
+	  continue;
+	deliver(sc, sl);
+     }
+   return 0;
+}
+
+
+/*
+ * hand the slot's next recorded event to the engine
+ */
+static void
+deliver(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   replay_t *rp = sc->iop;
+   rpslot_t *rs = &rp->rs[sl->idx];
+   unsigned int gen = sl->gen;
+   trec_t *r;
+   int n;
+   
+   if (!(r = next_rec(rp, rs)))
+     {
+	diverged(sc, sl, "ran out of events");
+	return;
+     }
+   consume(rp, rs);
+   
+   switch (sl->io_state)
+     {
+      case SIO_CONNECTING:
+	if (r->ev == TR_TIMEOUT)
+	  scan_timeout(sc, sl);
+	else
+	  scan_connected(sc, sl, r->err);
+	break;
+	
+      case SIO_SENDING:
+	sl->io_state = SIO_RECVING;
+	scan_sent(sc, sl, r->res, r->err);
+	/* still waiting on a reply?  queue that up too */
+	if (sl->targ && sl->gen == gen && sl->io_state == SIO_RECVING)
+	  {
+	     if (!(r = next_rec(rp, rs)) || (r->ev != TR_RECEIVED && r->ev != TR_TIMEOUT))
+	       diverged(sc, sl, "no reply in the trace");
+	     else
+	       (void) schedule(rp, sl, rs->op + r->ms);
+	  }
+	break;
+	
+      case SIO_RECVING:
+	if (r->ev == TR_TIMEOUT)
+	  {
+	     scan_timeout(sc, sl);
+	     break;
+	  }
+	n = r->dlen < sizeof(sl->rbuf) ? r->dlen : sizeof(sl->rbuf);
+	memcpy(sl->rbuf, r + 1, n);
+	scan_received(sc, sl, r->res, r->err);
+	break;
+     }
+}
+
+
+/*
+ * the slot's next event, if it is still for the slot's target
+ */
+static trec_t *
+next_rec(rp, rs)
+   replay_t *rp;
+   rpslot_t *rs;
+{
+   trec_t *r;
+   
+   if (rs->cur < 0 || (unsigned long)rs->cur >= rp->t->nrecs)
+     return NULL;
+   r = rp->t->recs[rs->cur];
+   if (r->port != rs->port || memcmp(r->ip.b, rs->ip.b, 16))
+     return NULL;
+   return r;
+}
+
+/*
+ * the slot's event has been played
+ */
+static void
+consume(rp, rs)
+   replay_t *rp;
+   rpslot_t *rs;
+{
+   rp->used[rs->cur++] = 1;
+   rp->nevents++;
+}
+
+/*
+ * queue the slot's next event for virtual time due
+ */
+static int
+schedule(rp, sl, due)
+   replay_t *rp;
+   scanslot_t *sl;
+   unsigned long long due;
+{
+   unsigned long i, p;
+   rpev_t ev;
+   
+   if (rp->nheap == rp->naheap)
+     {
+	unsigned long na = rp->naheap ? rp->naheap * 2 : 1024;
+	rpev_t *h = (rpev_t *)realloc(rp->heap, na * sizeof(rpev_t));
+	
+	if (!h)
+	  {
+	     fprintf(stderr, "Unable to allocate memory for replay events.\n");
+	     return -1;
+	  }
+	rp->heap = h;
+	rp->naheap = na;
+     }
+   ev.due = due;
+   ev.seq = rp->seq++;
+   ev.idx = sl->idx;
+   ev.gen = sl->gen;
+   
+   /* sift it up */
+   for (i = rp->nheap++; i > 0; i = p)
+     {
+	p = (i - 1) / 2;
+	if (rp->heap[p].due <= due)
+	  break;
+	rp->heap[i] = rp->heap[p];
+     }
+   rp->heap[i] = ev;
+   return 0;
+}
+
+/*
+ * the engine went somewhere the recording didn't, call it a timeout
+ */
+static void
+diverged(sc, sl, why)
+   scan_t *sc;
+   scanslot_t *sl;
+   char *why;
+{
+   replay_t *rp = sc->iop;
+   
+   rp->ndiverged++;
+   if (sc->opts->verbose >= 2)
+     fprintf(stderr, "%3d   %-18s replay diverged: %s\n", sl->idx, taddr_ntoa(&sl->targ->ip), why);
+   scan_timeout(sc, sl);
+}
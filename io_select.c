@@ -0,0 +1,221 @@
+/*
+ * io_select.c: readiness based (select) i/o backend
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "args.h"
+#include "scan.h"
+#include "net.h"
+
+static int sel_init(scan_t *);
+static void sel_fini(scan_t *);
+static int sel_connect(scan_t *, scanslot_t *);
+static int sel_request(scan_t *, scanslot_t *);
+static void sel_close(scan_t *, scanslot_t *);
+static int sel_wait(scan_t *, int);
+
+scanio_t scanio_select =
+{
+   "select", 0,
+   sel_init, sel_fini,
+   sel_connect, sel_request, sel_close, NULL,
+   sel_wait, NULL
+};
+
+
+static int
+sel_init(sc)
+   scan_t *sc;
+{
+   if (sc->nslots + 4 > FD_SETSIZE)
+     {
+	fprintf(stderr, "select can't handle %u slots, try -b uring.\n", sc->nslots);
+	return -1;
+     }
+   return 0;
+}
+
+static void
+sel_fini(sc)
+   scan_t *sc;
+{
+}
+
+
+/*
+ * start a non-blocking connection to the slot's target
+ */
+static int
+sel_connect(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   unsigned int tries = 0;
+   int sd, err;
+   
+ again:
+   if ((sd = scan_socket(sc, sl, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1)
+     return -1;
+   SCAN_SYS(sc, sl, 1);
+   if (connect(sd, (struct sockaddr *)&sl->sa, sl->salen) == -1
+       && errno != EINPROGRESS)
+     {
+	err = errno;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "%s", strerror(err));
+	sc->eno = err;
+	close(sd);
+	SCAN_SYS(sc, sl, 1);
+	/* out of ports on that source address?  try the next one */
+	if (err == EADDRNOTAVAIL && ++tries < sc->opts->nsources)
+	  goto again;
+	return -1;
+     }
+   sl->sd = sd;
+   sl->io_state = SIO_CONNECTING;
+   return 0;
+}
+
+/*
+ * the request goes out when the socket is writable
+ */
+static int
+sel_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   sl->io_state = SIO_SENDING;
+   return 0;
+}
+
+static void
+sel_close(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   if (sl->sd >= 0)
+     {
+	close(sl->sd);
+	SCAN_SYS(sc, sl, 1);
+     }
+   sl->sd = -1;
+   sl->io_state = SIO_IDLE;
+}
+
+
+/*
+ * select on the slots, then do whatever i/o is ready
+ */
+static int
+sel_wait(sc, ms)
+   scan_t *sc;
+   int ms;
+{
+   scanslot_t *sl;
+   fd_set rd, wd;
+   int maxs, sret, rl;
+   struct timeval tv;
+   unsigned int i;
+   
+   /* zero the FD sets, timeval struct */
+   FD_ZERO(&rd);
+   FD_ZERO(&wd);
+   tv.tv_sec = ms / 1000;
+   tv.tv_usec = (ms % 1000) * 1000;
+   
+   /* select the status descriptor (stdin) if there is one.. */
+   maxs = -1;
+   if (sc->status_fd != -1)
+     {
+	FD_SET(sc->status_fd, &rd);
+	maxs = sc->status_fd;
+     }
+   
+   /* check the slots for selection.. */
+   for (i = 0; i < sc->nslots; i++)
+     {
+	sl = &sc->slots[i];
+	if (!sl->targ || sl->io_state == SIO_IDLE || sl->io_state == SIO_UDP)
+	  continue;
+	if (sl->sd > maxs)
+	  maxs = sl->sd;
+	if (sl->io_state == SIO_RECVING)
+	  FD_SET(sl->sd, &rd);
+	else
+	  FD_SET(sl->sd, &wd);
+     }
+   
+   /* select! */
+   sret = select(maxs+1, &rd, &wd, NULL, &tv);
+   SCAN_SHARED_SYS(sc, 1);
+   if (sret == -1)
+     {
+	if (errno == EINTR)
+	  return 0;
+	perror("select failed");
+	return -1;
+     }
+   
+#ifdef SELECT_DEBUG
+   printf("select says %d sockets are ready\n", sret);
+#endif
+   
+   /* if stdin is set, we give some status.. */
+   if (sc->status_fd != -1 && FD_ISSET(sc->status_fd, &rd))
+     {
+	char tmp[1024];
+	
+	scan_status(sc);
+	/* clear stdin */
+	(void) read(sc->status_fd, tmp, sizeof(tmp));
+	SCAN_SHARED_SYS(sc, 1);
+     }
+   
+   for (i = 0; i < sc->nslots; i++)
+     {
+	sl = &sc->slots[i];
+	if (!sl->targ || sl->io_state == SIO_IDLE || sl->io_state == SIO_UDP)
+	  continue;
+	
+	/* the connection finished? */
+	if (sl->io_state == SIO_CONNECTING)
+	  {
+	     if (!FD_ISSET(sl->sd, &wd))
+	       continue;
+	     /* writable means it's done, select can't say how it went */
+	     SCAN_SYS(sc, sl, 1);
+	     scan_connected(sc, sl, net_error(sl->sd));
+	     /* scan_connected queued the request, it goes out next time */
+	     continue;
+	  }
+	
+	/* ready to send the request? */
+	if (sl->io_state == SIO_SENDING)
+	  {
+	     if (!FD_ISSET(sl->sd, &wd))
+	       continue;
+	     rl = write(sl->sd, sl->wbuf, sl->wlen);
+	     SCAN_SYS(sc, sl, 1);
+	     sl->io_state = SIO_RECVING;
+	     scan_sent(sc, sl, rl, errno);
+	     continue;
+	  }
+	
+	/* a reply is here? */
+	if (sl->io_state == SIO_RECVING && FD_ISSET(sl->sd, &rd))
+	  {
+	     rl = read(sl->sd, sl->rbuf, sizeof(sl->rbuf));
+	     SCAN_SYS(sc, sl, 1);
+	     scan_received(sc, sl, rl, errno);
+	  }
+     }
+   return 0;
+}
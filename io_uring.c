@@ -0,0 +1,526 @@
+/*
+ * io_uring.c: io_uring based i/o backend
+ * 
+ * connects, request writes, reply reads and closes are queued as
+ * submission entries and handed to the kernel in batches, one
+ * io_uring_enter() per trip around the main loop.  timeouts are linked
+ * to the connect and read operations so the kernel enforces them too.
+ * 
+ * this talks to the kernel directly rather than through liburing.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include "args.h"
+#include "scan.h"
+
+/* what a completion is for, the low byte of user_data */
+#define UOP_CONNECT 		1
+#define UOP_SEND 		2
+#define UOP_RECV 		3
+#define UOP_TIMEOUT 		4	/* linked timeouts, ignored */
+#define UOP_CLOSE 		5	/* ignored */
+#define UOP_STDIN 		6
+
+/* user_data is generation:32 | slot index:24 | op:8 */
+#define UDATA(sl, op) 		(((unsigned long long)(sl)->gen << 32) | ((sl)->idx << 8) | (op))
+#define UDATA_OP(u) 		((u) & 0xff)
+#define UDATA_IDX(u) 		(((u) >> 8) & 0xffffff)
+#define UDATA_GEN(u) 		((unsigned int)((u) >> 32))
+
+typedef struct
+{
+   int fd;
+   /* submission ring */
+   unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+   struct io_uring_sqe *sqes;
+   unsigned int sq_entries, to_submit;
+   /* completion ring */
+   unsigned int *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_cqe *cqes;
+   /* the mappings */
+   void *sq_ptr, *cq_ptr;
+   size_t sq_sz, cq_sz, sqes_sz;
+   /* each slot's linked timeout, read by the kernel at submit time */
+   struct __kernel_timespec *tos;
+   int stdin_armed;		/* -1 once stdin is at EOF */
+   unsigned int nenter;		/* io_uring_enter() calls not counted yet */
+} uring_t;
+
+static int ur_init(scan_t *);
+static void ur_fini(scan_t *);
+static int ur_connect(scan_t *, scanslot_t *);
+static int ur_request(scan_t *, scanslot_t *);
+static void ur_close(scan_t *, scanslot_t *);
+static int ur_wait(scan_t *, int);
+static int ur_fd(scan_t *);
+
+static int sq_reserve(uring_t *, unsigned int);
+static struct __kernel_timespec *slot_timeout(uring_t *, scanslot_t *);
+static struct io_uring_sqe *get_sqe(uring_t *);
+static int ur_enter(uring_t *, unsigned int, unsigned int, int);
+static int ops_supported(int);
+
+scanio_t scanio_uring =
+{
+   "uring", 1,
+   ur_init, ur_fini,
+   ur_connect, ur_request, ur_close, NULL,
+   ur_wait, ur_fd
+};
+
+
+/*
+ * set up the rings, returns -1 (and the caller falls back) when the
+ * kernel can't do what we need
+ */
+static int
+ur_init(sc)
+   scan_t *sc;
+{
+   struct io_uring_params p;
+   unsigned int entries = 64;
+   uring_t *u;
+   
+   if (!(u = (uring_t *)calloc(1, sizeof(uring_t))))
+     return -1;
+   if (!(u->tos = (struct __kernel_timespec *)calloc(sc->nslots, sizeof(*u->tos))))
+     {
+	free(u);
+	return -1;
+     }
+   
+   /* a connect or a send/recv chain is at most 3 entries per slot */
+   while (entries < sc->nslots * 4 && entries < 4096)
+     entries <<= 1;
+   memset(&p, 0, sizeof(p));
+   u->fd = syscall(__NR_io_uring_setup, entries, &p);
+   if (u->fd == -1)
+     {
+	if (sc->opts->verbose >= 1)
+	  fprintf(stderr, "io_uring_setup: %s\n", strerror(errno));
+	free(u->tos);
+	free(u);
+	return -1;
+     }
+   if (!(p.features & IORING_FEAT_EXT_ARG)
+       || !(p.features & IORING_FEAT_NODROP)
+       || !ops_supported(u->fd))
+     {
+	if (sc->opts->verbose >= 1)
+	  fprintf(stderr, "io_uring is missing required features.\n");
+	close(u->fd);
+	free(u->tos);
+	free(u);
+	return -1;
+     }
+   
+   /* map the rings */
+   u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+   u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+   u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    u->fd, IORING_OFF_SQ_RING);
+   u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    u->fd, IORING_OFF_CQ_RING);
+   u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  u->fd, IORING_OFF_SQES);
+   if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED || u->sqes == MAP_FAILED)
+     {
+	perror("io_uring mmap");
+	sc->iop = u;
+	ur_fini(sc);
+	return -1;
+     }
+   u->sq_head = (unsigned int *)((char *)u->sq_ptr + p.sq_off.head);
+   u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+   u->sq_mask = (unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+   u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+   u->sq_entries = p.sq_entries;
+   u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+   u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+   u->cq_mask = (unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+   u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+   
+   sc->iop = u;
+   return 0;
+}
+
+static void
+ur_fini(sc)
+   scan_t *sc;
+{
+   uring_t *u = sc->iop;
+   
+   if (!u)
+     return;
+   /* get the last closes out the door */
+   if (u->sqes && u->sqes != MAP_FAILED && u->to_submit > 0)
+     (void) ur_enter(u, u->to_submit, 0, 0);
+   if (u->sqes && u->sqes != MAP_FAILED)
+     munmap(u->sqes, u->sqes_sz);
+   if (u->cq_ptr && u->cq_ptr != MAP_FAILED)
+     munmap(u->cq_ptr, u->cq_sz);
+   if (u->sq_ptr && u->sq_ptr != MAP_FAILED)
+     munmap(u->sq_ptr, u->sq_sz);
+   close(u->fd);
+   free(u->tos);
+   free(u);
+   sc->iop = NULL;
+}
+
+
+/*
+ * make sure the kernel knows all the opcodes we use
+ */
+static int
+ops_supported(fd)
+   int fd;
+{
+   static const int need[] = { IORING_OP_CONNECT, IORING_OP_SEND, IORING_OP_RECV,
+	IORING_OP_LINK_TIMEOUT, IORING_OP_CLOSE, IORING_OP_POLL_ADD };
+   struct io_uring_probe *pr;
+   size_t len = sizeof(*pr) + 256 * sizeof(struct io_uring_probe_op);
+   int i, ok = 1;
+   
+   if (!(pr = (struct io_uring_probe *)calloc(1, len)))
+     return 0;
+   if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, pr, 256) == -1)
+     ok = 0;
+   for (i = 0; ok && i < sizeof(need) / sizeof(need[0]); i++)
+     if (need[i] > pr->last_op || !(pr->ops[need[i]].flags & IO_URING_OP_SUPPORTED))
+       ok = 0;
+   free(pr);
+   return ok;
+}
+
+
+/*
+ * the slot's timeout for its next linked op, as the kernel wants it
+ */
+static struct __kernel_timespec *
+slot_timeout(u, sl)
+   uring_t *u;
+   scanslot_t *sl;
+{
+   struct __kernel_timespec *ts = &u->tos[sl->idx];
+   
+   ts->tv_sec = sl->tmo / 1000;
+   ts->tv_nsec = (long long)(sl->tmo % 1000) * 1000000;
+   return ts;
+}
+
+/*
+ * make sure n submission entries are free, flushing the queue to the
+ * kernel if needed.  linked chains must not be split across a flush.
+ */
+static int
+sq_reserve(u, n)
+   uring_t *u;
+   unsigned int n;
+{
+   if (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + n <= u->sq_entries)
+     return 0;
+   if (ur_enter(u, u->to_submit, 0, -1) == -1)
+     return -1;
+   if (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + n <= u->sq_entries)
+     return 0;
+   errno = EBUSY;
+   return -1;
+}
+
+/*
+ * get a submission entry, sq_reserve() must have been called first
+ */
+static struct io_uring_sqe *
+get_sqe(u)
+   uring_t *u;
+{
+   struct io_uring_sqe *sqe;
+   unsigned int tail, idx;
+   
+   tail = *u->sq_tail;
+   idx = tail & *u->sq_mask;
+   sqe = &u->sqes[idx];
+   memset(sqe, 0, sizeof(*sqe));
+   u->sq_array[idx] = idx;
+   __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   u->to_submit++;
+   return sqe;
+}
+
+/*
+ * submit whatever is queued, optionally waiting for completions
+ */
+static int
+ur_enter(u, submit, wait, ms)
+   uring_t *u;
+   unsigned int submit, wait;
+   int ms;
+{
+   struct io_uring_getevents_arg arg;
+   struct __kernel_timespec ts;
+   unsigned int flags = 0;
+   int ret;
+   
+   memset(&arg, 0, sizeof(arg));
+   if (wait)
+     {
+	flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	arg.ts = (unsigned long long)&ts;
+     }
+   ret = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags,
+		 wait ? (void *)&arg : NULL, wait ? sizeof(arg) : 0);
+   u->nenter++;
+   if (ret >= 0)
+     {
+	u->to_submit -= ret;
+	return ret;
+     }
+   if (errno == ETIME || errno == EINTR)
+     return 0;
+   perror("io_uring_enter");
+   return -1;
+}
+
+
+/*
+ * queue a connect to the slot's target, with a linked timeout
+ */
+static int
+ur_connect(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   uring_t *u = sc->iop;
+   struct io_uring_sqe *sqe;
+   int sd;
+   
+   /* the socket itself is still a plain syscall */
+   if ((sd = scan_socket(sc, sl, SOCK_CLOEXEC)) == -1)
+     return -1;
+   if (sq_reserve(u, 2) == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "io_uring submission queue: %s", strerror(errno));
+	close(sd);
+	SCAN_SYS(sc, sl, 1);
+	return -1;
+     }
+   sqe = get_sqe(u);
+   sqe->opcode = IORING_OP_CONNECT;
+   sqe->fd = sd;
+   sqe->addr = (unsigned long long)&sl->sa;
+   sqe->off = sl->salen;
+   sqe->flags = IOSQE_IO_LINK;
+   sqe->user_data = UDATA(sl, UOP_CONNECT);
+   
+   sqe = get_sqe(u);
+   sqe->opcode = IORING_OP_LINK_TIMEOUT;
+   sqe->fd = -1;
+   sqe->addr = (unsigned long long)slot_timeout(u, sl);
+   sqe->len = 1;
+   sqe->user_data = UDATA(sl, UOP_TIMEOUT);
+   
+   sl->sd = sd;
+   sl->io_state = SIO_CONNECTING;
+   return 0;
+}
+
+/*
+ * queue the request write and the reply read as one linked chain,
+ * the read gets a linked timeout of its own
+ */
+static int
+ur_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   uring_t *u = sc->iop;
+   struct io_uring_sqe *sqe;
+   
+   if (sq_reserve(u, 3) == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "io_uring submission queue: %s", strerror(errno));
+	return -1;
+     }
+   sqe = get_sqe(u);
+   sqe->opcode = IORING_OP_SEND;
+   sqe->fd = sl->sd;
+   sqe->addr = (unsigned long long)sl->wbuf;
+   sqe->len = sl->wlen;
+   sqe->msg_flags = MSG_NOSIGNAL;
+   sqe->flags = IOSQE_IO_LINK;
+   sqe->user_data = UDATA(sl, UOP_SEND);
+   
+   sqe = get_sqe(u);
+   sqe->opcode = IORING_OP_RECV;
+   sqe->fd = sl->sd;
+   sqe->addr = (unsigned long long)sl->rbuf;
+   sqe->len = sizeof(sl->rbuf);
+   sqe->flags = IOSQE_IO_LINK;
+   sqe->user_data = UDATA(sl, UOP_RECV);
+   
+   sqe = get_sqe(u);
+   sqe->opcode = IORING_OP_LINK_TIMEOUT;
+   sqe->fd = -1;
+   sqe->addr = (unsigned long long)slot_timeout(u, sl);
+   sqe->len = 1;
+   sqe->user_data = UDATA(sl, UOP_TIMEOUT);
+   
+   sl->io_state = SIO_SENDING;
+   return 0;
+}
+
+/*
+ * queue a close, nobody waits for it
+ */
+static void
+ur_close(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   uring_t *u = sc->iop;
+   struct io_uring_sqe *sqe;
+   
+   if (sl->sd >= 0)
+     {
+	if (sq_reserve(u, 1) == 0)
+	  {
+	     sqe = get_sqe(u);
+	     sqe->opcode = IORING_OP_CLOSE;
+	     sqe->fd = sl->sd;
+	     sqe->user_data = UOP_CLOSE;
+	  }
+	else
+	  {
+	     close(sl->sd);
+	     SCAN_SYS(sc, sl, 1);
+	  }
+     }
+   sl->sd = -1;
+   sl->io_state = SIO_IDLE;
+}
+
+
+/*
+ * submit everything queued, wait for completions and hand them to
+ * the engine
+ */
+static int
+ur_wait(sc, ms)
+   scan_t *sc;
+   int ms;
+{
+   uring_t *u = sc->iop;
+   struct io_uring_sqe *sqe;
+   struct io_uring_cqe *cqe;
+   scanslot_t *sl;
+   unsigned int head, tail, idx;
+   unsigned long long ud;
+   int res;
+   
+   /* watch stdin for status requests */
+   if (sc->status_fd != -1 && !u->stdin_armed && sq_reserve(u, 1) == 0)
+     {
+	sqe = get_sqe(u);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sc->status_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = UOP_STDIN;
+	u->stdin_armed = 1;
+     }
+   
+   if (ur_enter(u, u->to_submit, 1, ms) == -1)
+     return -1;
+   /* the submits and waits were for everyone */
+   SCAN_SHARED_SYS(sc, u->nenter);
+   u->nenter = 0;
+   
+   head = *u->cq_head;
+   tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+   for (; head != tail; head++)
+     {
+	cqe = &u->cqes[head & *u->cq_mask];
+	ud = cqe->user_data;
+	res = cqe->res;
+	/* let the kernel reuse the entry before we queue more */
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	
+	if (UDATA_OP(ud) == UOP_STDIN)
+	  {
+	     char tmp[1024];
+	     
+	     /* closed or at EOF?  stop watching it for good */
+	     if (res < 0)
+	       {
+		  u->stdin_armed = -1;
+		  continue;
+	       }
+	     scan_status(sc);
+	     /* clear stdin */
+	     SCAN_SHARED_SYS(sc, 1);
+	     u->stdin_armed = read(sc->status_fd, tmp, sizeof(tmp)) <= 0 ? -1 : 0;
+	     continue;
+	  }
+	if (UDATA_OP(ud) == UOP_TIMEOUT || UDATA_OP(ud) == UOP_CLOSE)
+	  continue;
+	
+	/* is this for what the slot is doing right now? */
+	idx = UDATA_IDX(ud);
+	if (idx >= sc->nslots)
+	  continue;
+	sl = &sc->slots[idx];
+	if (!sl->targ || sl->gen != UDATA_GEN(ud))
+	  continue;
+	
+	switch (UDATA_OP(ud))
+	  {
+	   case UOP_CONNECT:
+	     /* a cancelled connect means the linked timeout fired */
+	     if (res == -ECANCELED)
+	       scan_timeout(sc, sl);
+	     else
+	       scan_connected(sc, sl, res < 0 ? -res : 0);
+	     break;
+	   case UOP_SEND:
+	     sl->io_state = SIO_RECVING;
+	     scan_sent(sc, sl, res < 0 ? -1 : res, res < 0 ? -res : 0);
+	     break;
+	   case UOP_RECV:
+	     if (res == -ECANCELED)
+	       scan_timeout(sc, sl);
+	     else
+	       scan_received(sc, sl, res < 0 ? -1 : res, res < 0 ? -res : 0);
+	     break;
+	  }
+     }
+   return 0;
+}
+
+
+/*
+ * the ring becomes readable when there are completions to reap
+ */
+static int
+ur_fd(sc)
+   scan_t *sc;
+{
+   uring_t *u = sc->iop;
+   
+   return u->fd;
+}
@@ -0,0 +1,329 @@
+/*
+ * jobs.c: several scans sharing one engine
+ * 
+ * a job file has a job per line: a name, then its targets and settings
+ * in any order, separated by blanks.  blank lines and ones starting
+ * with # are skipped.
+ * 
+ *    teama weight=3 out=teama.txt remote=10.1.1.1:80 10.0.0.0/16:1080
+ *    teamb slots=200 rate=500 timeout=5 file=teamb.lst
+ * 
+ * the settings are
+ * 
+ *    weight=<n>          its share of the slots against the others (1)
+ *    slots=<n>           never more than <n> slots
+ *    rate=<n>            never more than <n> new targets a second
+ *    out=<file>          results are appended to <file> (- for stdout)
+ *    remote=<host:port>  -r, user=<name> -u, timeout=<secs> -t
+ *    reply-timeout=<secs>, min-timeout=<ms>  as --reply-timeout/--min-timeout
+ *    probes=<list>       as --probes
+ *    file=<file>         targets from <file>, as -f
+ * 
+ * anything else is a target.  settings left out come from the command
+ * line, as does everything that isn't per job (-s, --cache, ..).  a
+ * job with fewer slots than its share leaves the rest to the others.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "args.h"
+#include "targets.h"
+#include "scan.h"
+#include "socksscan.h"
+#include "jobs.h"
+
+static int load_jobs(char *, scanjob_t *, int *);
+static void budget_jobs(scanjob_t *, int);
+static int job_setting(scanjob_t *, char *, char *);
+static int num_setting(char *, unsigned long, unsigned long, unsigned long *);
+static void free_jobs(scanjob_t *, int);
+
+
+/*
+ * run the jobs in the job file fn to the end
+ */
+int
+jobs_run(fn)
+   char *fn;
+{
+   scanjob_t *jobs;
+   targlist_t none;
+   unsigned long total = 0;
+   scan_t sc;
+   int n = 0, i;
+   
+   if (!(jobs = (scanjob_t *)calloc(JOBS_MAX, sizeof(scanjob_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for the jobs.\n");
+	return -1;
+     }
+   if (load_jobs(fn, jobs, &n) == -1 || n == 0)
+     {
+	if (n == 0)
+	  fprintf(stderr, "no jobs with targets in %s.\n", fn);
+	free_jobs(jobs, n);
+	free(jobs);
+	return -1;
+     }
+   budget_jobs(jobs, n);
+   for (i = 0; i < n; i++)
+     {
+	total += (unsigned long)jobs[i].targets.total;
+	if (options.verbose >= 1)
+	  fprintf(stderr, "job %s: %llu targets, weight %u.\n", jobs[i].name, jobs[i].targets.total, jobs[i].weight);
+     }
+   
+   memset(&none, 0, sizeof(none));
+   if (scan_init(&sc, &options, &none, total, NULL) == -1)
+     {
+	free_jobs(jobs, n);
+	free(jobs);
+	return -1;
+     }
+   sc.out = options.ring ? NULL : stdout;
+   sc.status_fd = fileno(stdin);
+   scan_jobs(&sc, jobs, n);
+   while (scan_step(&sc, 500) > 0)
+     ;
+   scan_fini(&sc);
+   free_jobs(jobs, n);
+   free(jobs);
+   return 0;
+}
+
+
+/*
+ * read the job file into jobs, *np of them (even on error)
+ */
+static int
+load_jobs(fn, jobs, np)
+   char *fn;
+   scanjob_t *jobs;
+   int *np;
+{
+   char line[JOBS_LINE_MAX], *tok, *eq, *sp;
+   unsigned int lno = 0;
+   scanjob_t *j;
+   FILE *fp;
+   
+   if (!(fp = fopen(fn, "r")))
+     {
+	fprintf(stderr, "Unable to open \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   while (fgets(line, sizeof(line), fp))
+     {
+	lno++;
+	if (!(tok = strtok_r(line, " \t\r\n", &sp)) || *tok == '#')
+	  continue;
+	if (*np == JOBS_MAX)
+	  {
+	     fprintf(stderr, "%s:%u: only %u jobs to a file.\n", fn, lno, JOBS_MAX);
+	     goto bad;
+	  }
+	j = &jobs[(*np)++];
+	j->opts = options;
+	j->opts.username = NULL;
+	j->name = strdup(tok);
+	j->weight = 1;
+	j->out = options.ring ? NULL : stdout;
+	while ((tok = strtok_r(NULL, " \t\r\n", &sp)))
+	  {
+	     if (!(eq = strchr(tok, '=')))
+	       {
+		  if (!add_target(&j->targets, tok))
+		    goto bad;
+		  continue;
+	       }
+	     *eq++ = '\0';
+	     if (job_setting(j, tok, eq) == -1)
+	       {
+		  fprintf(stderr, "%s:%u: job %s: bad %s setting: %s\n", fn, lno, j->name, tok, eq);
+		  goto bad;
+	       }
+	  }
+	if (!j->opts.username && options.username)
+	  j->opts.username = strdup(options.username);
+	if (!probe_usable(&j->opts))
+	  {
+	     fprintf(stderr, "%s:%u: job %s: none of its probes can be used with its remote.\n", fn, lno, j->name);
+	     goto bad;
+	  }
+	
+	/* sorting drops the duplicates and the excluded ones */
+	if (sort_targets(&j->targets) == 0)
+	  {
+	     fprintf(stderr, "%s:%u: job %s has no targets, skipping it.\n", fn, lno, j->name);
+	     free_jobs(j, 1);
+	     memset(j, 0, sizeof(*j));
+	     (*np)--;
+	  }
+     }
+   fclose(fp);
+   return 0;
+   
+ bad:
+   fclose(fp);
+   return -1;
+}
+
+/*
+ * each job's targets were kept inside the targets' share of
+ * --max-memory as they loaded, all of them together have to be too:
+ * the biggest go out to temporary files until they are
+ */
+static void
+budget_jobs(jobs, n)
+   scanjob_t *jobs;
+   int n;
+{
+   unsigned long long sum, b, most;
+   int i, big;
+   
+   while (options.max_memory)
+     {
+	sum = most = 0;
+	big = -1;
+	for (i = 0; i < n; i++)
+	  {
+	     b = targets_bytes(&jobs[i].targets);
+	     sum += b;
+	     /* the ones that won't come out any smaller don't count */
+	     if (b > most && b > 2 * jobs[i].targets.kept)
+	       {
+		  most = b;
+		  big = i;
+	       }
+	  }
+	if (sum <= options.max_memory / MEM_TARGET_SHARE || big == -1)
+	  return;
+	if (spill_targets(&jobs[big].targets) == -1)
+	  return;
+	if (options.verbose >= 2)
+	  fprintf(stderr, "job %s: moved %lluMB of targets out to a temporary file.\n", jobs[big].name, most >> 20);
+     }
+}
+
+/*
+ * apply a key=value setting to a job, -1 if it's no good
+ */
+static int
+job_setting(j, key, val)
+   scanjob_t *j;
+   char *key, *val;
+{
+   unsigned long v;
+   int n;
+   
+   if (!strcmp(key, "weight"))
+     {
+	if (num_setting(val, 1, 1000000, &v) == -1)
+	  return -1;
+	j->weight = v;
+     }
+   else if (!strcmp(key, "slots"))
+     {
+	if (num_setting(val, 1, MAX_PARALLEL_CONNECTS, &v) == -1)
+	  return -1;
+	j->max = v;
+     }
+   else if (!strcmp(key, "rate"))
+     {
+	if (num_setting(val, 1, 1000000, &v) == -1)
+	  return -1;
+	j->rate = v;
+     }
+   else if (!strcmp(key, "timeout"))
+     {
+	if (num_setting(val, 1, 600, &v) == -1)
+	  return -1;
+	j->opts.timeout = v;
+     }
+   else if (!strcmp(key, "reply-timeout"))
+     {
+	if (num_setting(val, 1, 600, &v) == -1)
+	  return -1;
+	j->opts.reply_timeout = v;
+     }
+   else if (!strcmp(key, "min-timeout"))
+     {
+	if (num_setting(val, 1, 600000, &v) == -1)
+	  return -1;
+	j->opts.min_timeout = v;
+     }
+   else if (!strcmp(key, "remote"))
+     {
+	if (!ss_resolve(val, &j->opts.remote, DEFAULT_TARGET_PORT))
+	  return -1;
+     }
+   else if (!strcmp(key, "probes"))
+     {
+	if ((n = probe_list(val, j->opts.probes)) < 1)
+	  return -1;
+	j->opts.nprobes = n;
+     }
+   else if (!strcmp(key, "user"))
+     {
+	free(j->opts.username);
+	j->opts.username = strdup(val);
+     }
+   else if (!strcmp(key, "file"))
+     {
+	if (!load_targets_from_file(&j->targets, val))
+	  return -1;
+     }
+   else if (!strcmp(key, "out"))
+     {
+	if (j->out && j->out != stdout)
+	  fclose(j->out);
+	j->out = stdout;
+	if (strcmp(val, "-") && !(j->out = fopen(val, "a")))
+	  {
+	     fprintf(stderr, "Unable to open \"%s\": %s\n", val, strerror(errno));
+	     return -1;
+	  }
+     }
+   else
+     return -1;
+   return 0;
+}
+
+/*
+ * a number from min to max
+ */
+static int
+num_setting(val, min, max, v)
+   char *val;
+   unsigned long min, max, *v;
+{
+   char *p;
+   
+   *v = strtoul(val, &p, 0);
+   if (*p || p == val || *v < min || *v > max)
+     return -1;
+   return 0;
+}
+
+/*
+ * let go of what n jobs have, not the jobs themselves
+ */
+static void
+free_jobs(jobs, n)
+   scanjob_t *jobs;
+   int n;
+{
+   int i;
+   
+   for (i = 0; i < n; i++)
+     {
+	if (jobs[i].out && jobs[i].out != stdout)
+	  fclose(jobs[i].out);
+	free_targets(&jobs[i].targets);
+	free(jobs[i].opts.username);
+	free(jobs[i].name);
+     }
+}
@@ -0,0 +1,19 @@
+/*
+ * jobs.h: several scans sharing one engine
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __jobs_h
+#define __jobs_h
+
+/* jobs in a job file, at most */
+#define JOBS_MAX 		256
+
+/* longest line in one */
+#define JOBS_LINE_MAX 		4096
+
+/* prototypes */
+int jobs_run(char *);
+
+#endif
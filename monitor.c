@@ -0,0 +1,777 @@
+/*
+ * monitor.c: keeping a set of known proxies fresh
+ * 
+ * instead of scanning the targets once and quitting, keep going:
+ * every open proxy found is tracked and probed again when it comes
+ * due.  the tracked ones sit in a heap on when they're due, so ones
+ * that just changed come around every minute or so, steady open ones
+ * about hourly and steady dead ones about weekly.  the engine gets
+ * them in batches, mixed with the targets still to be discovered,
+ * which get --monitor-share percent of each batch while they last.
+ * only changes are printed.
+ * 
+ * a tracked proxy takes about 50 bytes (the entry plus its heap and
+ * hash slots) and there are never more than --monitor-max of them.
+ * when full, a dead one that hasn't changed in a while makes room, or
+ * failing that the new one is let go.
+ * 
+ * the set is written to the state file every few minutes and on the
+ * way out.  SIGINT/SIGTERM finish what's in flight first, a second one
+ * doesn't wait.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "args.h"
+#include "targets.h"
+#include "exclude.h"
+#include "cache.h"
+#include "scan.h"
+#include "monitor.h"
+
+/* not in the heap (out being probed), or not tracked */
+#define MON_NONE 		0xffffffffU
+
+typedef struct
+{
+   ment_t *e;
+   unsigned int n, nalloc;
+   unsigned int *heap;		/* entries, soonest due first */
+   unsigned int nheap;
+   unsigned int *hash;		/* entry + 1, 0 for none */
+   unsigned int hmask;
+   targlist_t *disc;		/* the targets, for discovery */
+   unsigned int seed;
+   unsigned long nup;		/* open right now */
+   unsigned long changes, added, evicted, dropped, reprobes;
+   time_t saved;
+} mon_t;
+
+static mon_t mon;
+static volatile sig_atomic_t stopping = 0;
+
+static long mon_refill(scan_t *);
+static void mon_finished(scan_t *, target_t *);
+static void mon_tick(scan_t *);
+static void on_signal(int);
+static unsigned int take_due(targlist_t *, unsigned int, unsigned int);
+static void update(ment_t *, unsigned int, unsigned int);
+static void schedule(unsigned int, unsigned int);
+static void report(ment_t *, unsigned int, unsigned int);
+static char *mon_str(unsigned int);
+static int mon_load(char *);
+static int mon_save(char *);
+static unsigned int mon_find(taddr_t *, unsigned short);
+static unsigned int mon_add(taddr_t *, unsigned short);
+static void mon_del(unsigned int);
+static int mon_room(void);
+static int mon_grow(void);
+static unsigned int hash_slot(taddr_t *, unsigned short);
+static void hash_del(unsigned int);
+static void heap_push(unsigned int);
+static unsigned int heap_pop(void);
+static void heap_del(unsigned int);
+static void heap_up(unsigned int);
+static void heap_down(unsigned int);
+
+static scanhook_t mon_hook =
+{
+   mon_refill,
+   mon_finished,
+   mon_tick
+};
+
+
+/*
+ * keep the proxies in the state file (and whatever turns up among the
+ * targets) fresh until told to stop
+ */
+int
+monitor_run(tlist, ntarg)
+   targlist_t *tlist;
+   unsigned long ntarg;
+{
+   targlist_t batch;
+   scan_t sc;
+   int ret;
+   
+   memset(&mon, 0, sizeof(mon));
+   /* an entry, its heap index and up to four hash buckets */
+   if (options.max_memory)
+     {
+	unsigned long long m = options.max_memory / MEM_TARGET_SHARE / (sizeof(ment_t) + 5 * sizeof(unsigned int));
+	
+	if (m < options.monitor_max)
+	  {
+	     if (options.verbose >= 1)
+	       fprintf(stderr, "tracking at most %llu proxies to stay in --max-memory.\n", m);
+	     options.monitor_max = (unsigned int)m;
+	  }
+     }
+   mon.seed = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+   if (mon_load(options.monitor) == -1)
+     return -1;
+   if (mon.n == 0 && ntarg == 0)
+     {
+	fprintf(stderr, "nothing to monitor, no proxies in %s and no targets.\n", options.monitor);
+	return -1;
+     }
+   if (options.verbose >= 1)
+     fprintf(stderr, "monitoring %u proxies (%lu open), %lu targets to discover.\n", mon.n, mon.nup, ntarg);
+   mon.disc = tlist;
+   mon.saved = time(NULL);
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+   
+   memset(&batch, 0, sizeof(batch));
+   if (scan_init(&sc, &options, &batch, 0, &mon_hook) == -1)
+     {
+	free(mon.e);
+	free(mon.heap);
+	free(mon.hash);
+	return -1;
+     }
+   /* changes only, those come from here */
+   sc.out = NULL;
+   sc.status_fd = fileno(stdin);
+   while (scan_step(&sc, 500) > 0)
+     ;
+   scan_fini(&sc);
+   free_targets(&batch);
+   
+   ret = mon_save(options.monitor);
+   if (options.verbose >= 1)
+     fprintf(stderr, "%u proxies tracked (%lu open), %lu changes, %lu probed again, %lu added, %lu made room, %lu didn't fit.\n",
+	     mon.n, mon.nup, mon.changes, mon.reprobes, mon.added, mon.evicted, mon.dropped);
+   free(mon.e);
+   free(mon.heap);
+   free(mon.hash);
+   return ret;
+}
+
+
+/*
+ * the engine wants more: the tracked ones that are due get their share
+ * of a batch, the targets get the rest, and if they're all out the
+ * tracked ones get that too
+ */
+static long
+mon_refill(sc)
+   scan_t *sc;
+{
+   static int said = 0;
+   targlist_t *tl = sc->targets;
+   unsigned int room = sc->nslots, now = (unsigned int)scan_time(sc), n, count;
+   unsigned short port;
+   taddr_t base;
+   
+   if (stopping)
+     {
+	if (!said++)
+	  fprintf(stderr, "finishing what's in flight, then saving %s.\n", options.monitor);
+	return -1;
+     }
+   
+   free_targets(tl);
+   n = take_due(tl, room - room * options.monitor_share / 100, now);
+   while (n < room && next_target_run(mon.disc, &base, &count, &port, room - n))
+     {
+	if (add_target_range(tl, &base, count, port) != count)
+	  break;
+	n += count;
+     }
+   if (n < room)
+     n += take_due(tl, room - n, now);
+   if (n == 0)
+     return 0;
+   return (long)sort_targets(tl);
+}
+
+/*
+ * a target is done with, track it if it's new and open, reschedule it
+ * if it was already
+ */
+static void
+mon_finished(sc, t)
+   scan_t *sc;
+   target_t *t;
+{
+   unsigned int now = (unsigned int)scan_time(sc), outcome = cache_outcome(t->state), i;
+   ment_t *e;
+   
+   if ((i = mon_find(&t->ip, t->port)) == MON_NONE)
+     {
+	/* only open ones are worth keeping track of */
+	if (!(outcome & CO_OPEN) || (i = mon_add(&t->ip, t->port)) == MON_NONE)
+	  return;
+	e = &mon.e[i];
+	report(e, outcome, now);
+	e->outcome = outcome;
+	e->changed = now;
+	e->interval = MON_FLAP_INTERVAL;
+	mon.nup++;
+	schedule(i, now);
+	return;
+     }
+   
+   /* discovery got to it while it was waiting its turn? */
+   e = &mon.e[i];
+   if (e->hpos != MON_NONE)
+     heap_del(e->hpos);
+   if (t->state & SPSS_STARTED)
+     update(e, outcome, now);
+   schedule(i, now);
+}
+
+/*
+ * write the state out now and then
+ */
+static void
+mon_tick(sc)
+   scan_t *sc;
+{
+   if (time(NULL) - mon.saved < MON_SAVE_INTERVAL)
+     return;
+   (void) mon_save(options.monitor);
+   mon.saved = time(NULL);
+   if (options.verbose >= 1)
+     fprintf(stderr, "[%u proxies tracked, %lu open, %lu changes, %lu probed again]\n",
+	     mon.n, mon.nup, mon.changes, mon.reprobes);
+}
+
+static void
+on_signal(sig)
+   int sig;
+{
+   stopping = 1;
+   signal(sig, SIG_DFL);
+}
+
+
+/*
+ * put up to max of the tracked proxies that are due in tl
+ */
+static unsigned int
+take_due(tl, max, now)
+   targlist_t *tl;
+   unsigned int max, now;
+{
+   unsigned int n = 0, i;
+   ment_t *e;
+   
+   while (n < max && mon.nheap > 0 && mon.e[mon.heap[0]].due <= now)
+     {
+	i = heap_pop();
+	e = &mon.e[i];
+	/* excluded since it was found?  forget it */
+	if (excluded(&e->ip))
+	  {
+	     mon_del(i);
+	     continue;
+	  }
+	if (add_target_range(tl, &e->ip, 1, e->port) != 1)
+	  {
+	     heap_push(i);
+	     break;
+	  }
+	e->due = 0;
+	mon.reprobes++;
+	n++;
+     }
+   return n;
+}
+
+/*
+ * a tracked proxy was probed again.  a change brings it around again
+ * soon and counts as a flap, finding it the same backs off up to the
+ * ceiling, which the flaps lower.
+ */
+static void
+update(e, outcome, now)
+   ment_t *e;
+   unsigned int outcome, now;
+{
+   unsigned int ceil;
+   
+   if (MON_STATE(outcome) != MON_STATE(e->outcome))
+     {
+	report(e, outcome, now);
+	if ((outcome & CO_OPEN) && !(e->outcome & CO_OPEN))
+	  mon.nup++;
+	else if (!(outcome & CO_OPEN) && (e->outcome & CO_OPEN))
+	  mon.nup--;
+	e->changed = now;
+	e->interval = MON_FLAP_INTERVAL;
+	if (e->flaps < MON_MAX_FLAPS)
+	  e->flaps++;
+     }
+   else
+     {
+	ceil = ((outcome & CO_OPEN) ? MON_UP_INTERVAL : MON_DOWN_INTERVAL) >> e->flaps;
+	if (ceil < MON_FLAP_INTERVAL)
+	  ceil = MON_FLAP_INTERVAL;
+	/* steady at the ceiling, the flaps wear off */
+	if (e->interval >= ceil)
+	  {
+	     e->interval = ceil;
+	     if (e->flaps > 0)
+	       e->flaps--;
+	  }
+	else
+	  e->interval = e->interval * 2 < ceil ? e->interval * 2 : ceil;
+     }
+   e->outcome = outcome;
+}
+
+/*
+ * back in the heap, due an interval from now less up to an eighth of
+ * it so the ones found together don't stay together
+ */
+static void
+schedule(i, now)
+   unsigned int i, now;
+{
+   ment_t *e = &mon.e[i];
+   
+   mon.seed = mon.seed * 1103515245 + 12345;
+   e->due = now + e->interval - (mon.seed >> 8) % (e->interval / 8 + 1);
+   if (e->due == 0)
+     e->due = 1;
+   heap_push(i);
+}
+
+/*
+ * print a change, outcome is what it is now
+ */
+static void
+report(e, outcome, now)
+   ment_t *e;
+   unsigned int outcome, now;
+{
+   char was[32];
+   
+   mon.changes++;
+   if (!MON_STATE(e->outcome))
+     printf("%u %s:%u up %s\n", now, taddr_ntoa(&e->ip), e->port, mon_str(outcome));
+   else if (!MON_STATE(outcome))
+     printf("%u %s:%u down, was %s\n", now, taddr_ntoa(&e->ip), e->port, mon_str(e->outcome));
+   else
+     {
+	strcpy(was, mon_str(e->outcome));
+	printf("%u %s:%u %s -> %s\n", now, taddr_ntoa(&e->ip), e->port, was, mon_str(outcome));
+     }
+   fflush(stdout);
+}
+
+/*
+ * what a proxy does, in words
+ */
+static char *
+mon_str(outcome)
+   unsigned int outcome;
+{
+   static char buf[64];
+   
+   buf[0] = '\0';
+   if (outcome & CO_V4_OK)
+     strcat(buf, "+v4");
+   if (outcome & CO_V5_OK)
+     strcat(buf, "+v5");
+   if (outcome & CO_V5_AUTH)
+     strcat(buf, "+v5-auth");
+   if (outcome & CO_UDP_OK)
+     strcat(buf, "+udp");
+   if (outcome & CO_V4A_OK)
+     strcat(buf, "+v4a");
+   if (outcome & CO_HTTP_OK)
+     strcat(buf, "+http");
+   if (outcome & CO_HTTP_AUTH)
+     strcat(buf, "+http-auth");
+   return buf[0] ? buf + 1 : "closed";
+}
+
+
+/*
+ * read the state file, a missing one is an empty one
+ */
+static int
+mon_load(fn)
+   char *fn;
+{
+   unsigned int now = (unsigned int)time(NULL), i;
+   unsigned long long n;
+   monhdr_t h;
+   ment_t e;
+   FILE *fp;
+   
+   if (!(fp = fopen(fn, "r")))
+     {
+	if (errno == ENOENT)
+	  return 0;
+	fprintf(stderr, "Unable to open \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   if (fread(&h, sizeof(h), 1, fp) != 1
+       || memcmp(h.magic, MON_MAGIC, sizeof(MON_MAGIC))
+       || h.version != MON_VERSION)
+     {
+	fprintf(stderr, "\"%s\" is not a monitor state file.\n", fn);
+	fclose(fp);
+	return -1;
+     }
+   for (n = 0; n < h.count; n++)
+     {
+	if (fread(&e, sizeof(e), 1, fp) != 1)
+	  break;
+	if (mon_find(&e.ip, e.port) != MON_NONE
+	    || (i = mon_add(&e.ip, e.port)) == MON_NONE)
+	  continue;
+	/* whatever was out when it was saved goes again */
+	if (e.due == 0)
+	  e.due = now;
+	e.hpos = MON_NONE;
+	mon.e[i] = e;
+	if (e.outcome & CO_OPEN)
+	  mon.nup++;
+	heap_push(i);
+     }
+   fclose(fp);
+   if (n < h.count)
+     {
+	fprintf(stderr, "\"%s\" is damaged.\n", fn);
+	return -1;
+     }
+   if (mon.dropped > 0 || mon.evicted > 0)
+     fprintf(stderr, "%s has %llu proxies, only room for %u (--monitor-max).\n", fn, h.count, options.monitor_max);
+   mon.added = mon.dropped = mon.evicted = 0;
+   return 0;
+}
+
+/*
+ * write the state file, by way of a temporary one so there's always a
+ * whole one there
+ */
+static int
+mon_save(fn)
+   char *fn;
+{
+   char tmp[1024];
+   monhdr_t h;
+   FILE *fp;
+   
+   snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+   if (!(fp = fopen(tmp, "w")))
+     {
+	fprintf(stderr, "Unable to create \"%s\": %s\n", tmp, strerror(errno));
+	return -1;
+     }
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, MON_MAGIC, sizeof(MON_MAGIC));
+   h.version = MON_VERSION;
+   h.count = mon.n;
+   if (fwrite(&h, sizeof(h), 1, fp) != 1
+       || (mon.n > 0 && fwrite(mon.e, sizeof(ment_t), mon.n, fp) != mon.n))
+     goto fail;
+   if (fclose(fp) != 0)
+     {
+	fp = NULL;
+	goto fail;
+     }
+   if (rename(tmp, fn) == -1)
+     {
+	fprintf(stderr, "Unable to replace \"%s\": %s\n", fn, strerror(errno));
+	unlink(tmp);
+	return -1;
+     }
+   return 0;
+   
+ fail:
+   fprintf(stderr, "Unable to write \"%s\": %s\n", tmp, strerror(errno));
+   if (fp)
+     fclose(fp);
+   unlink(tmp);
+   return -1;
+}
+
+
+/*
+ * the entry for (ip, port), MON_NONE if it isn't tracked
+ */
+static unsigned int
+mon_find(ip, port)
+   taddr_t *ip;
+   unsigned short port;
+{
+   unsigned int h;
+   
+   if (!mon.hash)
+     return MON_NONE;
+   h = hash_slot(ip, port);
+   return mon.hash[h] ? mon.hash[h] - 1 : MON_NONE;
+}
+
+/*
+ * start tracking (ip, port), making room if it's full.  the new entry
+ * isn't in the heap yet.
+ */
+static unsigned int
+mon_add(ip, port)
+   taddr_t *ip;
+   unsigned short port;
+{
+   unsigned int i;
+   ment_t *e;
+   
+   if ((mon.n >= options.monitor_max && mon_room() == -1)
+       || (mon.n == mon.nalloc && mon_grow() == -1))
+     {
+	mon.dropped++;
+	return MON_NONE;
+     }
+   i = mon.n++;
+   e = &mon.e[i];
+   memset(e, 0, sizeof(*e));
+   e->ip = *ip;
+   e->port = port;
+   e->hpos = MON_NONE;
+   mon.hash[hash_slot(ip, port)] = i + 1;
+   mon.added++;
+   return i;
+}
+
+/*
+ * stop tracking entry i, the last one takes its place
+ */
+static void
+mon_del(i)
+   unsigned int i;
+{
+   unsigned int last = mon.n - 1;
+   ment_t *e = &mon.e[i];
+   
+   hash_del(i);
+   if (e->hpos != MON_NONE)
+     heap_del(e->hpos);
+   if (e->outcome & CO_OPEN)
+     mon.nup--;
+   if (i != last)
+     {
+	mon.hash[hash_slot(&mon.e[last].ip, mon.e[last].port)] = i + 1;
+	*e = mon.e[last];
+	if (e->hpos != MON_NONE)
+	  mon.heap[e->hpos] = i;
+     }
+   mon.n--;
+}
+
+/*
+ * full, let a dead one go.  of a few picked at random, the one that has
+ * been dead the longest without a change goes.  returns -1 if none of
+ * them were dead.
+ */
+static int
+mon_room()
+{
+   unsigned int i, j, best = MON_NONE;
+   ment_t *e, *b;
+   
+   for (j = 0; j < MON_EVICT_SAMPLE && mon.n > 0; j++)
+     {
+	mon.seed = mon.seed * 1103515245 + 12345;
+	i = (mon.seed >> 4) % mon.n;
+	e = &mon.e[i];
+	if ((e->outcome & CO_OPEN) || e->hpos == MON_NONE)
+	  continue;
+	b = best == MON_NONE ? NULL : &mon.e[best];
+	if (!b || e->interval > b->interval
+	    || (e->interval == b->interval && e->changed < b->changed))
+	  best = i;
+     }
+   if (best == MON_NONE)
+     return -1;
+   if (options.verbose >= 2)
+     fprintf(stderr, "no longer tracking %s:%u, dead since %u.\n", taddr_ntoa(&mon.e[best].ip),
+	     mon.e[best].port, mon.e[best].changed);
+   mon_del(best);
+   mon.evicted++;
+   return 0;
+}
+
+/*
+ * double the entries (and the heap with them), and the hash table when
+ * it gets over half full
+ */
+static int
+mon_grow()
+{
+   unsigned int na = mon.nalloc ? mon.nalloc * 2 : 1024, hcap, i;
+   unsigned int *hash;
+   ment_t *e;
+   unsigned int *heap;
+   
+   if (na > options.monitor_max)
+     na = options.monitor_max;
+   if (!(e = (ment_t *)realloc(mon.e, na * sizeof(ment_t))))
+     goto nomem;
+   mon.e = e;
+   if (!(heap = (unsigned int *)realloc(mon.heap, na * sizeof(unsigned int))))
+     goto nomem;
+   mon.heap = heap;
+   mon.nalloc = na;
+   
+   for (hcap = 1024; hcap < na * 2; hcap <<= 1)
+     ;
+   if (mon.hash && hcap <= mon.hmask + 1)
+     return 0;
+   if (!(hash = (unsigned int *)calloc(hcap, sizeof(unsigned int))))
+     goto nomem;
+   free(mon.hash);
+   mon.hash = hash;
+   mon.hmask = hcap - 1;
+   for (i = 0; i < mon.n; i++)
+     mon.hash[hash_slot(&mon.e[i].ip, mon.e[i].port)] = i + 1;
+   return 0;
+   
+ nomem:
+   fprintf(stderr, "Unable to allocate memory to track %u proxies.\n", na);
+   return -1;
+}
+
+
+/*
+ * where (ip, port) is in the hash table, or the empty slot it would go
+ * in
+ */
+static unsigned int
+hash_slot(ip, port)
+   taddr_t *ip;
+   unsigned short port;
+{
+   unsigned int h;
+   ment_t *e;
+   
+   for (h = (unsigned int)taddr_hash(ip, port) & mon.hmask; mon.hash[h]; h = (h + 1) & mon.hmask)
+     {
+	e = &mon.e[mon.hash[h] - 1];
+	if (e->port == port && !memcmp(e->ip.b, ip->b, 16))
+	  break;
+     }
+   return h;
+}
+
+/*
+ * take entry i out of the hash table, moving the ones after it in its
+ * run back so they can still be found
+ */
+static void
+hash_del(i)
+   unsigned int i;
+{
+   unsigned int h, j, k;
+   ment_t *e;
+   
+   h = hash_slot(&mon.e[i].ip, mon.e[i].port);
+   for (j = h; ; )
+     {
+	mon.hash[h] = 0;
+	for (;;)
+	  {
+	     j = (j + 1) & mon.hmask;
+	     if (!mon.hash[j])
+	       return;
+	     e = &mon.e[mon.hash[j] - 1];
+	     k = (unsigned int)taddr_hash(&e->ip, e->port) & mon.hmask;
+	     /* stays put if its home is between the hole and it */
+	     if (h <= j ? (h < k && k <= j) : (h < k || k <= j))
+	       continue;
+	     break;
+	  }
+	mon.hash[h] = mon.hash[j];
+	h = j;
+     }
+}
+
+
+/*
+ * the heap of tracked entries, on when they're due.  every entry knows
+ * where it is in it, so it can be taken out from the middle.
+ */
+static void
+heap_push(i)
+   unsigned int i;
+{
+   mon.heap[mon.nheap] = i;
+   heap_up(mon.nheap++);
+}
+
+static unsigned int
+heap_pop()
+{
+   unsigned int i = mon.heap[0];
+   
+   heap_del(0);
+   return i;
+}
+
+static void
+heap_del(pos)
+   unsigned int pos;
+{
+   unsigned int i = mon.heap[pos], last = mon.heap[--mon.nheap];
+   
+   mon.e[i].hpos = MON_NONE;
+   if (pos == mon.nheap)
+     return;
+   mon.heap[pos] = last;
+   heap_up(pos);
+   heap_down(mon.e[last].hpos);
+}
+
+static void
+heap_up(pos)
+   unsigned int pos;
+{
+   unsigned int i = mon.heap[pos], p;
+   
+   while (pos > 0)
+     {
+	p = (pos - 1) / 2;
+	if (mon.e[mon.heap[p]].due <= mon.e[i].due)
+	  break;
+	mon.heap[pos] = mon.heap[p];
+	mon.e[mon.heap[pos]].hpos = pos;
+	pos = p;
+     }
+   mon.heap[pos] = i;
+   mon.e[i].hpos = pos;
+}
+
+static void
+heap_down(pos)
+   unsigned int pos;
+{
+   unsigned int i = mon.heap[pos], c;
+   
+   for (;;)
+     {
+	c = pos * 2 + 1;
+	if (c >= mon.nheap)
+	  break;
+	if (c + 1 < mon.nheap && mon.e[mon.heap[c + 1]].due < mon.e[mon.heap[c]].due)
+	  c++;
+	if (mon.e[i].due <= mon.e[mon.heap[c]].due)
+	  break;
+	mon.heap[pos] = mon.heap[c];
+	mon.e[mon.heap[pos]].hpos = pos;
+	pos = c;
+     }
+   mon.heap[pos] = i;
+   mon.e[i].hpos = pos;
+}
@@ -0,0 +1,61 @@
+/*
+ * monitor.h: keeping a set of known proxies fresh
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __monitor_h
+#define __monitor_h
+
+#include "targets.h"
+
+/*
+ * how often a tracked proxy is probed again, in seconds.  a change
+ * brings it back down to MON_FLAP_INTERVAL, and every probe that finds
+ * it the same doubles it, up to the ceiling for what it is.
+ */
+#define MON_FLAP_INTERVAL 	60
+#define MON_UP_INTERVAL 	3600		/* open proxies, at most */
+#define MON_DOWN_INTERVAL 	(7 * 86400)	/* dead ones, at most */
+
+/* each recent flap (up to this many) halves the ceiling */
+#define MON_MAX_FLAPS 		4
+
+/* entries looked at for a dead one to make room */
+#define MON_EVICT_SAMPLE 	16
+
+/* how often the state file is written out, in seconds */
+#define MON_SAVE_INTERVAL 	300
+
+/* what counts as a change */
+#define MON_STATE(o) 		((o) & (CO_OPEN | CO_UDP_OK))
+
+/* state files: the header, then the entries */
+#define MON_MAGIC 		"SSMON"
+#define MON_VERSION 		1
+
+typedef struct
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int pad;
+   unsigned long long count;
+} monhdr_t;
+
+/* one tracked proxy */
+typedef struct
+{
+   taddr_t ip;
+   unsigned int due;		/* next probe, 0 while it is out */
+   unsigned int interval;
+   unsigned int changed;	/* when its state last changed */
+   unsigned int hpos;		/* in the heap */
+   unsigned short port;
+   unsigned char outcome;	/* CO_* bits, see cache.h */
+   unsigned char flaps;
+} ment_t;
+
+/* prototypes */
+int monitor_run(targlist_t *, unsigned long);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * net.c: the little bit of socket code the scanner needs
+ * 
+ * this replaces libnsock.  sockets are created non-blocking (and
+ * close-on-exec) in one go and tuned for a short exchange of tiny
+ * messages with a host that may never answer.  icmp errors are queued
+ * on them so an unreachable one can say how much was unreachable.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+#include "net.h"
+
+
+/* the socket, SO_LINGER and SO_RCVBUF, then the tcp timeouts and
+ * IP_RECVERR */
+const int net_socket_calls = 3
+#ifdef TCP_SYNCNT
+   + 1
+#endif
+#ifdef TCP_USER_TIMEOUT
+   + 1
+#endif
+#ifdef IP_RECVERR
+   + 1
+#endif
+   ;
+
+
+/*
+ * make a tcp socket for a probe that gives up after timeout seconds
+ * 
+ * flags are or'd into the type (SOCK_NONBLOCK, SOCK_CLOEXEC).  the
+ * socket resets on close instead of sitting in TIME_WAIT.
+ */
+int
+net_socket(family, flags, timeout)
+   int family, flags;
+   unsigned int timeout;
+{
+   struct linger lg;
+   int sd, v;
+   
+   if ((sd = socket(family, SOCK_STREAM | flags, 0)) == -1)
+     return -1;
+   lg.l_onoff = 1;
+   lg.l_linger = 0;
+   (void) setsockopt(sd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+   
+   /* has to be set before connecting to shrink the window */
+   v = NET_RCVBUF;
+   (void) setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+   
+#ifdef TCP_SYNCNT
+   /* don't retransmit SYNs past the timeout, the syn backoff starts
+    * at 1 second and doubles, so n retries take 2^(n+1)-1 seconds */
+   for (v = 1; v < 30 && (1U << (v + 1)) - 1 < timeout; v++)
+     ;
+   (void) setsockopt(sd, IPPROTO_TCP, TCP_SYNCNT, &v, sizeof(v));
+#endif
+#ifdef TCP_USER_TIMEOUT
+   /* and don't sit on unacknowledged requests any longer either */
+   v = timeout * 1000;
+   (void) setsockopt(sd, IPPROTO_TCP, TCP_USER_TIMEOUT, &v, sizeof(v));
+#endif
+#ifdef IP_RECVERR
+   /* keep the icmp errors around for net_unreach() */
+   v = 1;
+   if (family == AF_INET6)
+     (void) setsockopt(sd, IPPROTO_IPV6, IPV6_RECVERR, &v, sizeof(v));
+   else
+     (void) setsockopt(sd, IPPROTO_IP, IP_RECVERR, &v, sizeof(v));
+#endif
+   return sd;
+}
+
+
+/*
+ * get (and clear) the error pending on a socket, 0 if there isn't one
+ */
+int
+net_error(sd)
+   int sd;
+{
+   socklen_t el;
+   int err = 0;
+   
+   el = sizeof(err);
+   if (getsockopt(sd, SOL_SOCKET, SO_ERROR, &err, &el) == -1)
+     return errno;
+   return err;
+}
+
+
+/*
+ * how much of the network a connect that failed with err couldn't
+ * reach: NET_UR_NET for all of it (no route, filtered), NET_UR_HOST
+ * for just that host, 0 when something answered.  the icmp error
+ * queued on sd says, when there is one, otherwise err has to do.
+ */
+int
+net_unreach(sd, err)
+   int sd, err;
+{
+#if defined(IP_RECVERR) && defined(SO_EE_ORIGIN_ICMP)
+   struct sock_extended_err *ee;
+   struct cmsghdr *cm;
+   struct msghdr mh;
+   char cbuf[512];
+   
+   memset(&mh, 0, sizeof(mh));
+   mh.msg_control = cbuf;
+   mh.msg_controllen = sizeof(cbuf);
+   /* no icmp came?  err has to do (below) */
+   if (sd >= 0 && recvmsg(sd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+     mh.msg_controllen = 0;
+   for (cm = sd >= 0 ? CMSG_FIRSTHDR(&mh) : NULL; cm; cm = CMSG_NXTHDR(&mh, cm))
+     {
+	if (!(cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR)
+	    && !(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+	  continue;
+	ee = (struct sock_extended_err *)CMSG_DATA(cm);
+	if (ee->ee_origin == SO_EE_ORIGIN_LOCAL)
+	  return NET_UR_NET;
+	if (ee->ee_origin == SO_EE_ORIGIN_ICMP && ee->ee_type == 3)
+	  switch (ee->ee_code)
+	    {
+	     case 2:		/* protocol and port unreachable, */
+	     case 3:		/* the host answered */
+	     case 4:		/* and so did a router, fragmentation needed */
+	       return 0;
+	     case 1:		/* host */
+	     case 7:		/* host unknown */
+	     case 10:		/* host prohibited */
+	     case 12:		/* host for tos */
+	       return NET_UR_HOST;
+	     default:		/* network, unknown, prohibited, filtered */
+	       return NET_UR_NET;
+	    }
+	if (ee->ee_origin == SO_EE_ORIGIN_ICMP6 && ee->ee_type == 1)
+	  switch (ee->ee_code)
+	    {
+	     case 4:		/* port unreachable */
+	       return 0;
+	     case 3:		/* address unreachable */
+	       return NET_UR_HOST;
+	     default:		/* no route, prohibited, policy, rejected */
+	       return NET_UR_NET;
+	    }
+     }
+#endif
+   /* no route is all of it, a host that didn't answer arp just itself */
+   if (err == ENETUNREACH)
+     return NET_UR_NET;
+   if (err == EHOSTUNREACH)
+     return NET_UR_HOST;
+   return 0;
+}
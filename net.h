@@ -0,0 +1,25 @@
+/*
+ * net.h: the little bit of socket code the scanner needs
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __net_h
+#define __net_h
+
+/* replies are a few bytes, don't let the kernel set aside more */
+#define NET_RCVBUF 		4096
+
+/* how much net_unreach() says was unreachable */
+#define NET_UR_HOST 		1
+#define NET_UR_NET 		2
+
+/* system calls a net_socket() that worked made */
+extern const int net_socket_calls;
+
+/* prototypes */
+int net_socket(int, int, unsigned int);
+int net_error(int);
+int net_unreach(int, int);
+
+#endif
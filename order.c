@@ -0,0 +1,292 @@
+/*
+ * order.c: scanning the likeliest targets first
+ * 
+ * open proxies bunch up, by network and by port.  given an archive of
+ * earlier results, every /24 (/48 for IPv6) gets a hit rate for each
+ * port from how its targets turned out, pulled toward the rate of the
+ * /16 (/32) around it when it has few results of its own, which is in
+ * turn pulled toward the rate of the port everywhere.  the targets are
+ * then split into tiers by that rate and scanned a tier at a time, so
+ * most of what is there turns up early and everything still gets done.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "targets.h"
+#include "prefix.h"
+#include "cache.h"
+#include "archive.h"
+#include "order.h"
+
+/* the results for one prefix on one port, or a port everywhere */
+typedef struct
+{
+   taddr_t pfx;
+   unsigned short port;
+   unsigned char lvl;		/* see ostat() */
+   unsigned char used;
+   unsigned int n, open;
+} ostat_t;
+
+typedef struct
+{
+   ostat_t *e;
+   unsigned long size, used;
+   unsigned long long n, open;	/* everything */
+} otab_t;
+
+/* what goes in the hash with an entry's prefix */
+#define OT_SEED(port, lvl) 	(((unsigned long long)(port) << 8) | (lvl))
+
+static int count_row(otab_t *, arow_t *);
+static ostat_t *ostat(otab_t *, taddr_t *, unsigned short, int, int);
+static int ot_grow(otab_t *);
+static void wide_mask(taddr_t *, taddr_t *);
+static double smooth(ostat_t *, double);
+static int tier_of(otab_t *, taddr_t *, unsigned short);
+
+
+/*
+ * split tl into tiers by the hit rates in the archive fn.  tl is used
+ * up (and freed), the tiers get all of its targets between them.
+ * 
+ * returns the number of results the rates came from, -1 on error
+ */
+long
+order_targets(tl, fn, tiers, verbose)
+   targlist_t *tl;
+   char *fn;
+   targlist_t *tiers;
+   int verbose;
+{
+   otab_t ot;
+   archive_t *a;
+   abhdr_t *h;
+   arow_t *rows;
+   taddr_t base, run;
+   unsigned long long left[ORD_TIERS];
+   unsigned int count, piece, rcount = 0;
+   unsigned short port, rport = 0;
+   long n, i;
+   int t, rtier = -1;
+   
+   if (!(a = archive_map(fn)))
+     return -1;
+   if (!(rows = (arow_t *)malloc(ARCH_BLOCK_ROWS * sizeof(arow_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for a block.\n");
+	archive_unmap(a);
+	return -1;
+     }
+   memset(&ot, 0, sizeof(ot));
+   for (h = archive_next(a, NULL); h; h = archive_next(a, h))
+     {
+	if ((n = archive_decode(h, rows)) == -1)
+	  {
+	     fprintf(stderr, "skipping a damaged block.\n");
+	     continue;
+	  }
+	for (i = 0; i < n; i++)
+	  if (count_row(&ot, &rows[i]) == -1)
+	    {
+	       free(ot.e);
+	       free(rows);
+	       archive_unmap(a);
+	       return -1;
+	    }
+     }
+   free(rows);
+   archive_unmap(a);
+   
+   /* hand out the targets a prefix at a time, keeping runs that land in
+    * the same tier together */
+   while (next_target_run(tl, &base, &count, &port, TRANGE_MAX_COUNT))
+     while (count > 0)
+       {
+	  /* IPv6 runs go by the prefix they start in */
+	  piece = taddr_is_v4(&base) && 256U - base.b[15] < count ? 256U - base.b[15] : count;
+	  t = tier_of(&ot, &base, port);
+	  if (rtier != -1 && (t != rtier || port != rport || rcount + piece < rcount))
+	    {
+	       add_target_range(&tiers[rtier], &run, rcount, rport);
+	       rtier = -1;
+	    }
+	  if (rtier == -1)
+	    {
+	       run = base;
+	       rcount = 0;
+	       rport = port;
+	       rtier = t;
+	    }
+	  rcount += piece;
+	  taddr_add(&base, piece);
+	  count -= piece;
+       }
+   if (rtier != -1)
+     add_target_range(&tiers[rtier], &run, rcount, rport);
+   free(ot.e);
+   free_targets(tl);
+   
+   for (t = 0; t < ORD_TIERS; t++)
+     left[t] = sort_targets(&tiers[t]);
+   if (verbose >= 1)
+     {
+	fprintf(stderr, "ordered by %llu results in %s, targets per tier:", ot.n, fn);
+	for (t = 0; t < ORD_TIERS; t++)
+	  fprintf(stderr, " %llu", left[t]);
+	fprintf(stderr, "\n");
+     }
+   return (long)ot.n;
+}
+
+
+/*
+ * count a result for its port, its prefix and the one around that
+ */
+static int
+count_row(ot, r)
+   otab_t *ot;
+   arow_t *r;
+{
+   unsigned int hit = (r->outcome & CO_OPEN) ? 1 : 0;
+   ostat_t *e;
+   int lvl;
+   
+   ot->n++;
+   ot->open += hit;
+   for (lvl = 0; lvl < 3; lvl++)
+     {
+	if (!(e = ostat(ot, &r->ip, r->port, lvl, 1)))
+	  return -1;
+	e->n++;
+	e->open += hit;
+     }
+   return 0;
+}
+
+/*
+ * the entry for ip's prefix at level lvl (0 the port everywhere, 1 the
+ * wide prefix, 2 the /24 or /48) on port, making it if asked to
+ */
+static ostat_t *
+ostat(ot, ip, port, lvl, create)
+   otab_t *ot;
+   taddr_t *ip;
+   unsigned short port;
+   int lvl, create;
+{
+   taddr_t pfx;
+   ostat_t *e;
+   unsigned long i;
+   
+   memset(&pfx, 0, sizeof(pfx));
+   if (lvl == 1)
+     wide_mask(ip, &pfx);
+   else if (lvl == 2)
+     pfx_mask(ip, &pfx);
+   if (ot->size == 0 && (!create || ot_grow(ot) == -1))
+     return NULL;
+   for (i = taddr_hash(&pfx, OT_SEED(port, lvl)) & (ot->size - 1); ; i = (i + 1) & (ot->size - 1))
+     {
+	e = &ot->e[i];
+	if (!e->used)
+	  break;
+	if (e->port == port && e->lvl == lvl && !memcmp(e->pfx.b, pfx.b, 16))
+	  return e;
+     }
+   if (!create)
+     return NULL;
+   
+   /* keep it at most half full */
+   if ((ot->used + 1) * 2 > ot->size)
+     {
+	if (ot_grow(ot) == -1)
+	  return NULL;
+	return ostat(ot, ip, port, lvl, create);
+     }
+   e->pfx = pfx;
+   e->port = port;
+   e->lvl = lvl;
+   e->used = 1;
+   ot->used++;
+   return e;
+}
+
+static int
+ot_grow(ot)
+   otab_t *ot;
+{
+   unsigned long nsize = ot->size ? ot->size * 2 : 4096, i, j;
+   ostat_t *ne;
+   
+   if (!(ne = (ostat_t *)calloc(nsize, sizeof(ostat_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for %lu hit rates.\n", nsize);
+	return -1;
+     }
+   for (i = 0; i < ot->size; i++)
+     {
+	if (!ot->e[i].used)
+	  continue;
+	for (j = taddr_hash(&ot->e[i].pfx, OT_SEED(ot->e[i].port, ot->e[i].lvl)) & (nsize - 1); ne[j].used; j = (j + 1) & (nsize - 1))
+	  ;
+	ne[j] = ot->e[i];
+     }
+   free(ot->e);
+   ot->e = ne;
+   ot->size = nsize;
+   return 0;
+}
+
+/*
+ * the /16 (/32 for IPv6) ip is in
+ */
+static void
+wide_mask(ip, pfx)
+   taddr_t *ip, *pfx;
+{
+   int bits = taddr_is_v4(ip) ? 96 + ORD_V4_WIDE_BITS : ORD_V6_WIDE_BITS;
+   
+   memset(pfx, 0, sizeof(*pfx));
+   memcpy(pfx->b, ip->b, bits / 8);
+}
+
+/*
+ * an entry's hit rate, pulled toward prior when it has few results
+ */
+static double
+smooth(e, prior)
+   ostat_t *e;
+   double prior;
+{
+   if (!e)
+     return prior;
+   return (e->open + ORD_PRIOR_WEIGHT * prior) / (e->n + ORD_PRIOR_WEIGHT);
+}
+
+/*
+ * which tier ip:port goes in
+ */
+static int
+tier_of(ot, ip, port)
+   otab_t *ot;
+   taddr_t *ip;
+   unsigned short port;
+{
+   double rate, top = ORD_TOP_RATE;
+   int t;
+   
+   rate = (ot->open + 1.0) / (ot->n + 2.0);
+   if (ot->size > 0)
+     {
+	rate = smooth(ostat(ot, ip, port, 0, 0), rate);
+	rate = smooth(ostat(ot, ip, port, 1, 0), rate);
+	rate = smooth(ostat(ot, ip, port, 2, 0), rate);
+     }
+   for (t = 0; t < ORD_TIERS - 1 && rate < top; t++)
+     top /= 4;
+   return t;
+}
@@ -0,0 +1,30 @@
+/*
+ * order.h: scanning the likeliest targets first
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __order_h
+#define __order_h
+
+#include "targets.h"
+
+/* the targets are split into this many tiers, scanned in order */
+#define ORD_TIERS 		8
+
+/* the first tier is a hit rate of at least this, each one after it a
+ * quarter of the one before */
+#define ORD_TOP_RATE 		0.25
+
+/* how many results a prefix is worth before its own rate counts for
+ * more than the one around it */
+#define ORD_PRIOR_WEIGHT 	16.0
+
+/* the coarser prefixes rates are backed off to */
+#define ORD_V4_WIDE_BITS 	16
+#define ORD_V6_WIDE_BITS 	32
+
+/* prototypes */
+long order_targets(targlist_t *, char *, targlist_t *, int);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * prefix.c: what we've learned about each network prefix
+ * 
+ * targets are grouped into /24s (/48s for IPv6) and each one keeps
+ * track of two things:
+ * 
+ * tarpits.  some networks answer every SYN and then never say a word,
+ * which holds a slot for the whole reply timeout.  once enough of a
+ * prefix's hosts do that, the engine puts the rest of it off until
+ * the end and gives it a short deadline.
+ * 
+ * reachability.  when icmp says a network (or enough of its hosts) is
+ * unreachable and nothing in it has answered, the rest of its targets
+ * are written off without a probe.
+ * 
+ * round trip times.  connects and replies are timed and smoothed the
+ * way tcp does it, so a probe into a nearby network can give up after
+ * a few milliseconds while a far away one gets the time it needs.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "targets.h"
+#include "prefix.h"
+
+static prefix_t *pfx_net(pfxtab_t *, taddr_t *, int);
+static int pfx_grow(pfxtab_t *);
+static int pfx_prune(pfxtab_t *);
+static void pfx_alive(pfxtab_t *, prefix_t *);
+
+
+/*
+ * a host in ip's prefix accepted a connection
+ */
+void
+pfx_connected(pt, ip)
+   pfxtab_t *pt;
+   taddr_t *ip;
+{
+   prefix_t *n;
+   
+   if ((n = pfx_net(pt, ip, 1)))
+     {
+	n->conns++;
+	pfx_alive(pt, n);
+     }
+}
+
+
+/*
+ * a host in ip's prefix refused a connection, so it's there
+ */
+void
+pfx_refused(pt, ip)
+   pfxtab_t *pt;
+   taddr_t *ip;
+{
+   prefix_t *n;
+   
+   if ((n = pfx_net(pt, ip, 1)))
+     {
+	n->refused++;
+	pfx_alive(pt, n);
+     }
+}
+
+
+/*
+ * a host in ip's prefix accepted a connection and never replied
+ * 
+ * returns 1 when that makes the prefix a tarpit
+ */
+int
+pfx_silent(pt, ip)
+   pfxtab_t *pt;
+   taddr_t *ip;
+{
+   prefix_t *n;
+   
+   if (!(n = pfx_net(pt, ip, 1)))
+     return 0;
+   n->silent++;
+   if (n->flagged || n->silent < TARPIT_MIN_SILENT || n->silent * 2 < n->conns)
+     return 0;
+   n->flagged = 1;
+   pt->nflagged++;
+   return 1;
+}
+
+
+/*
+ * is ip in a known tarpit?
+ */
+int
+pfx_tarpit(pt, ip)
+   pfxtab_t *pt;
+   taddr_t *ip;
+{
+   prefix_t *n;
+   
+   if (pt->nflagged == 0)
+     return 0;
+   n = pfx_net(pt, ip, 0);
+   return n && n->flagged;
+}
+
+
+/*
+ * ip was reported unreachable, net if its whole network was
+ * 
+ * returns 1 when that makes the prefix unreachable
+ */
+int
+pfx_unreachable(pt, ip, net)
+   pfxtab_t *pt;
+   taddr_t *ip;
+   int net;
+{
+   prefix_t *n;
+   
+   if (!(n = pfx_net(pt, ip, 1)))
+     return 0;
+   n->unreach++;
+   if (n->dead || n->conns > 0 || n->refused > 0
+       || (!net && n->unreach < UNREACH_MIN_HOSTS))
+     return 0;
+   n->dead = 1;
+   pt->ndead++;
+   return 1;
+}
+
+
+/*
+ * is ip in a prefix known to be unreachable?
+ */
+int
+pfx_dead(pt, ip)
+   pfxtab_t *pt;
+   taddr_t *ip;
+{
+   prefix_t *n;
+   
+   if (pt->ndead == 0)
+     return 0;
+   n = pfx_net(pt, ip, 0);
+   return n && n->dead;
+}
+
+
+/*
+ * something in ip's prefix took ms milliseconds to answer
+ */
+void
+pfx_rtt_sample(pt, ip, which, ms)
+   pfxtab_t *pt;
+   taddr_t *ip;
+   int which;
+   unsigned int ms;
+{
+   prefix_t *n;
+   rtt_t *r;
+   unsigned int d;
+   
+   if (!(n = pfx_net(pt, ip, 1)))
+     return;
+   r = &n->rtt[which];
+   if (r->n++ == 0)
+     {
+	r->srtt = ms;
+	r->rttvar = ms / 2;
+	return;
+     }
+   /* rttvar = 3/4 rttvar + 1/4 |srtt - r|, srtt = 7/8 srtt + 1/8 r */
+   d = r->srtt > ms ? r->srtt - ms : ms - r->srtt;
+   r->rttvar = (3 * r->rttvar + d) / 4;
+   r->srtt = (7 * r->srtt + ms) / 8;
+}
+
+
+/*
+ * how long to wait on something in ip's prefix, in milliseconds.
+ * 0 if there isn't enough to go on yet.
+ */
+unsigned int
+pfx_rto(pt, ip, which)
+   pfxtab_t *pt;
+   taddr_t *ip;
+   int which;
+{
+   prefix_t *n;
+   rtt_t *r;
+   
+   if (!(n = pfx_net(pt, ip, 0)))
+     return 0;
+   r = &n->rtt[which];
+   if (r->n < PFX_MIN_SAMPLES)
+     return 0;
+   return r->srtt + (r->rttvar > 0 ? 4 * r->rttvar : 1);
+}
+
+
+/*
+ * mask ip down to its prefix, returns the prefix length
+ */
+int
+pfx_mask(ip, pfx)
+   taddr_t *ip, *pfx;
+{
+   int bits = taddr_is_v4(ip) ? 96 + PFX_V4_BITS : PFX_V6_BITS;
+   
+   memset(pfx, 0, sizeof(*pfx));
+   memcpy(pfx->b, ip->b, bits / 8);
+   return taddr_is_v4(ip) ? PFX_V4_BITS : PFX_V6_BITS;
+}
+
+
+void
+pfx_free(pt)
+   pfxtab_t *pt;
+{
+   free(pt->nets);
+   memset(pt, 0, sizeof(*pt));
+}
+
+
+/*
+ * find the entry for ip's prefix, making one if asked to
+ */
+static prefix_t *
+pfx_net(pt, ip, create)
+   pfxtab_t *pt;
+   taddr_t *ip;
+   int create;
+{
+   taddr_t pfx;
+   prefix_t *n;
+   unsigned long i;
+   
+   if (pt->size == 0 && (!create || pfx_grow(pt) == -1))
+     return NULL;
+   pfx_mask(ip, &pfx);
+   for (i = taddr_hash(&pfx, 0) & (pt->size - 1); ; i = (i + 1) & (pt->size - 1))
+     {
+	n = &pt->nets[i];
+	if (!n->used)
+	  break;
+	if (!memcmp(n->pfx.b, pfx.b, 16))
+	  return n;
+     }
+   if (!create)
+     return NULL;
+   
+   /* keep it at most half full */
+   if ((pt->used + 1) * 2 > pt->size)
+     {
+	if (pt->max && pt->size * 2 > pt->max)
+	  {
+	     /* as big as it gets, start over */
+	     if (pfx_prune(pt) == -1 || (pt->used + 1) * 2 > pt->size)
+	       return NULL;
+	  }
+	else if (pfx_grow(pt) == -1)
+	  return NULL;
+	return pfx_net(pt, ip, create);
+     }
+   pt->used++;
+   n->used = 1;
+   n->pfx = pfx;
+   return n;
+}
+
+
+/*
+ * something in the prefix answered after all, it's not unreachable
+ */
+static void
+pfx_alive(pt, n)
+   pfxtab_t *pt;
+   prefix_t *n;
+{
+   if (!n->dead)
+     return;
+   n->dead = 0;
+   pt->ndead--;
+}
+
+
+/*
+ * forget everything but the tarpits and unreachable prefixes.  the
+ * prefixes come by in target order, so the ones learned about so far
+ * are mostly behind us.
+ */
+static int
+pfx_prune(pt)
+   pfxtab_t *pt;
+{
+   prefix_t *keep = NULL;
+   unsigned long i, j, n = 0, nkeep = pt->nflagged + pt->ndead;
+   
+   if (nkeep > 0 && !(keep = (prefix_t *)malloc(nkeep * sizeof(prefix_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for %lu tarpit and unreachable prefixes.\n", nkeep);
+	return -1;
+     }
+   for (i = 0; i < pt->size && n < nkeep; i++)
+     if (pt->nets[i].used && (pt->nets[i].flagged || pt->nets[i].dead))
+       keep[n++] = pt->nets[i];
+   memset(pt->nets, 0, pt->size * sizeof(prefix_t));
+   for (i = 0; i < n; i++)
+     {
+	for (j = taddr_hash(&keep[i].pfx, 0) & (pt->size - 1); pt->nets[j].used; j = (j + 1) & (pt->size - 1))
+	  ;
+	pt->nets[j] = keep[i];
+     }
+   pt->used = n;
+   pt->npruned++;
+   free(keep);
+   return 0;
+}
+
+
+/*
+ * double the table (or start it)
+ */
+static int
+pfx_grow(pt)
+   pfxtab_t *pt;
+{
+   unsigned long ns = pt->size ? pt->size * 2 : 256, i, j;
+   prefix_t *nn;
+   
+   if (!(nn = (prefix_t *)calloc(ns, sizeof(prefix_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for %lu network prefixes.\n", ns);
+	return -1;
+     }
+   for (i = 0; i < pt->size; i++)
+     {
+	if (!pt->nets[i].used)
+	  continue;
+	for (j = taddr_hash(&pt->nets[i].pfx, 0) & (ns - 1); nn[j].used; j = (j + 1) & (ns - 1))
+	  ;
+	nn[j] = pt->nets[i];
+     }
+   free(pt->nets);
+   pt->nets = nn;
+   pt->size = ns;
+   return 0;
+}
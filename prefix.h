@@ -0,0 +1,81 @@
+/*
+ * prefix.h: what we've learned about each network prefix
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __prefix_h
+#define __prefix_h
+
+#include "targets.h"
+
+/* prefixes are tracked as /24s for IPv4 and /48s for IPv6 */
+#define PFX_V4_BITS 		24
+#define PFX_V6_BITS 		48
+
+/* a prefix is a tarpit once this many of its hosts went silent on us,
+ * and at least half of the ones that accepted a connection did */
+#define TARPIT_MIN_SILENT 	3
+
+/* the reply deadline for targets in a tarpit prefix */
+#define TARPIT_REPLY_TIMEOUT 	2
+
+/* a prefix is unreachable once this many of its hosts were reported
+ * unreachable and none of them answered, or right away when the whole
+ * network was */
+#define UNREACH_MIN_HOSTS 	3
+
+/* round trip estimators */
+#define PFX_RTT_NET 		0	/* handshakes and auth replies */
+#define PFX_RTT_RELAY 		1	/* connect replies, includes the proxy's own connect */
+#define PFX_NRTT 		2
+
+/* samples needed before an estimate is trusted */
+#define PFX_MIN_SAMPLES 	3
+
+/* smoothed round trip time, in milliseconds (RFC 6298 style) */
+typedef struct
+{
+   unsigned int srtt;
+   unsigned int rttvar;
+   unsigned int n;
+} rtt_t;
+
+/* one prefix */
+typedef struct
+{
+   taddr_t pfx;
+   int used;
+   unsigned int conns;		/* connections it accepted */
+   unsigned int silent;		/* connections that never got a reply */
+   int flagged;			/* looks like a tarpit */
+   unsigned int refused;	/* connections it refused */
+   unsigned int unreach;	/* hosts reported unreachable */
+   int dead;			/* can't be reached at all */
+   rtt_t rtt[PFX_NRTT];
+} prefix_t;
+
+/* the table, an open addressing hash */
+typedef struct
+{
+   prefix_t *nets;
+   unsigned long size, used;
+   unsigned long nflagged;
+   unsigned long ndead;
+   unsigned long max;		/* never bigger than this, 0 for no limit */
+   unsigned long npruned;
+} pfxtab_t;
+
+/* prototypes */
+void pfx_connected(pfxtab_t *, taddr_t *);
+int pfx_silent(pfxtab_t *, taddr_t *);
+int pfx_tarpit(pfxtab_t *, taddr_t *);
+void pfx_refused(pfxtab_t *, taddr_t *);
+int pfx_unreachable(pfxtab_t *, taddr_t *, int);
+int pfx_dead(pfxtab_t *, taddr_t *);
+void pfx_rtt_sample(pfxtab_t *, taddr_t *, int, unsigned int);
+unsigned int pfx_rto(pfxtab_t *, taddr_t *, int);
+int pfx_mask(taddr_t *, taddr_t *);
+void pfx_free(pfxtab_t *);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * probe.c: the probe modules
+ * 
+ * a module knows one protocol: it builds the requests into the slot's
+ * wbuf and makes what it can of the replies in rbuf, the engine
+ * (scan.c) does the connecting, moving bytes and timing.  a target gets
+ * a pass (a connection) per module, in the order of --probes, but a
+ * reply that came back in some other protocol than it was asked in
+ * settles the others too, see end_probe().  a proxy found relaying
+ * gets asked for the --dest destinations too, see reach_add().
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "socks4.h"
+#include "socks5.h"
+#include "http.h"
+
+#include "args.h"
+#include "scan.h"
+#include "probe.h"
+
+static struct sockaddr *slot_dest(scan_t *, scanslot_t *, char *, int, unsigned short *);
+static int v4_usable(opts_t *);
+static int v4_request(scan_t *, scanslot_t *);
+static int v4_reply(scan_t *, scanslot_t *, int);
+static int v4a_usable(opts_t *);
+static int v4a_request(scan_t *, scanslot_t *);
+static int v4a_reply(scan_t *, scanslot_t *, int);
+static int v5_usable(opts_t *);
+static int v5_request(scan_t *, scanslot_t *);
+static int v5_reply(scan_t *, scanslot_t *, int);
+static int http_usable(opts_t *);
+static int http_request(scan_t *, scanslot_t *);
+static int http_reply(scan_t *, scanslot_t *, int);
+
+/* the requests, the connect ones wait on the proxy's own connect */
+static probestep_t v4_connect = { "connect", SPSS_4_REQ_SENT, 1 };
+static probestep_t v4a_connect = { "connect", 0, 1 };
+static probestep_t v5_auth = { "auth", SPSS_5_AUTH_REQ_SENT, 0 };
+static probestep_t v5_connect = { "connect", SPSS_5_REQ_SENT, 1 };
+static probestep_t http_connect = { "connect", 0, 1 };
+
+static probe_t probe_v4 =
+{
+   "v4", PF_SOCKS4, PD_V4,
+   SPSS_4_CONNECTING, SPSS_4_CONNECTED, SPSS_4_DONE, SPSS_4_ALL,
+   v4_usable, v4_request, v4_reply
+};
+
+static probe_t probe_v4a =
+{
+   "v4a", PF_SOCKS4, PD_ANY,
+   0, SPSS_4A_CONNECTED, SPSS_4A_DONE, SPSS_4A_ALL,
+   v4a_usable, v4a_request, v4a_reply
+};
+
+static probe_t probe_v5 =
+{
+   "v5", PF_SOCKS5, PD_ANY,
+   SPSS_5_CONNECTING, SPSS_5_CONNECTED, SPSS_5_DONE, SPSS_5_ALL,
+   v5_usable, v5_request, v5_reply
+};
+
+static probe_t probe_http =
+{
+   "http", PF_HTTP, PD_ANY,
+   0, SPSS_H_CONNECTED, SPSS_H_DONE, SPSS_H_ALL,
+   http_usable, http_request, http_reply
+};
+
+/* by PR_* */
+probe_t *probe_mods[PR_COUNT] =
+{
+   &probe_v4,
+   &probe_v4a,
+   &probe_v5,
+   &probe_http
+};
+
+
+/*
+ * parse a comma separated list of probe names (or "all") into ids,
+ * returns how many there are or -1 if one is unknown
+ */
+int
+probe_list(str, ids)
+   char *str;
+   unsigned char *ids;
+{
+   char buf[256], *p, *q;
+   int n = 0, i, j;
+   
+   if (!strcmp(str, "all"))
+     {
+	for (i = 0; i < PR_COUNT; i++)
+	  ids[i] = i;
+	return PR_COUNT;
+     }
+   strncpy(buf, str, sizeof(buf) - 1);
+   buf[sizeof(buf) - 1] = '\0';
+   for (p = strtok_r(buf, ",", &q); p; p = strtok_r(NULL, ",", &q))
+     {
+	for (i = 0; i < PR_COUNT; i++)
+	  if (!strcmp(p, probe_mods[i]->name))
+	    break;
+	if (i == PR_COUNT)
+	  return -1;
+	/* the same one twice does nothing more */
+	for (j = 0; j < n; j++)
+	  if (ids[j] == i)
+	    break;
+	if (j == n)
+	  ids[n++] = i;
+     }
+   return n;
+}
+
+/*
+ * can any of o's probes do anything with its settings?
+ */
+int
+probe_usable(o)
+   opts_t *o;
+{
+   unsigned int i;
+   
+   for (i = 0; i < o->nprobes; i++)
+     if (probe_mods[o->probes[i]]->usable(o))
+       return 1;
+   return 0;
+}
+
+/*
+ * which protocol a reply is in, whatever it was a reply to
+ */
+int
+probe_family(rep, rl)
+   char *rep;
+   int rl;
+{
+   if (rl >= 5 && !memcmp(rep, "HTTP/", 5))
+     return PF_HTTP;
+   if (rl >= 2 && rep[0] == SOCKS5_VERSION)
+     return PF_SOCKS5;
+   /* the version byte is meant to be 0, some send 4 */
+   if (rl >= 2 && (rep[0] == 0 || rep[0] == SOCKS4_VERSION)
+       && (unsigned char)rep[1] >= 90 && (unsigned char)rep[1] <= 93)
+     return PF_SOCKS4;
+   return PF_NONE;
+}
+
+
+/*
+ * where the slot's request asks to go: an address (returned), or a
+ * name (NULL).  host gets it written out either way, port its port.
+ */
+static struct sockaddr *
+slot_dest(sc, sl, host, hsz, port)
+   scan_t *sc;
+   scanslot_t *sl;
+   char *host;
+   int hsz;
+   unsigned short *port;
+{
+   opts_t *o = SLOT_OPTS(sc, sl);
+   struct sockaddr *sa = (struct sockaddr *)&o->remote;
+   dest_t *d;
+   
+   if (sl->targ->dest)
+     {
+	d = &o->dests[sl->targ->dest - 1];
+	if (d->host)
+	  {
+	     snprintf(host, hsz, "%s", d->host);
+	     *port = d->port;
+	     return NULL;
+	  }
+	sa = (struct sockaddr *)&d->sa;
+     }
+   if (sa->sa_family == AF_INET6)
+     {
+	inet_ntop(AF_INET6, &((struct sockaddr_in6 *)sa)->sin6_addr, host, hsz);
+	*port = ntohs(((struct sockaddr_in6 *)sa)->sin6_port);
+     }
+   else
+     {
+	inet_ntop(AF_INET, &((struct sockaddr_in *)sa)->sin_addr, host, hsz);
+	*port = ntohs(((struct sockaddr_in *)sa)->sin_port);
+     }
+   return sa;
+}
+
+
+/*
+ * SOCKS v4, a connect to an IPv4 remote
+ */
+static int
+v4_usable(o)
+   opts_t *o;
+{
+   return o->remote.ss_family == AF_INET && !o->udp;
+}
+
+static int
+v4_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   struct sockaddr *sa;
+   char host[256];
+   unsigned short port;
+   
+   sl->step = &v4_connect;
+   if (!(sa = slot_dest(sc, sl, host, sizeof(host), &port)))
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "SOCKS v4 cannot connect to names");
+	return 0;
+     }
+   return socks4_build_connect_req(sl->wbuf, sizeof(sl->wbuf), sa,
+				   SLOT_OPTS(sc, sl)->username, sc->ebuf, sizeof(sc->ebuf));
+}
+
+static int
+v4_reply(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   sl->targ->state |= SPSS_4_REP_RECVD;
+   if (!socks4_parse_connect_rep(sl->rbuf, rl, sc->ebuf, sizeof(sc->ebuf)))
+     return probe_family(sl->rbuf, rl) == PF_SOCKS4 ? PV_REFUSED : PV_FAIL;
+   sl->targ->state |= SPSS_4_SUCCESSFUL;
+   return PV_OPEN;
+}
+
+
+/*
+ * SOCKS v4a, the same with the remote by name (an address is written
+ * out) so the proxy has to resolve it
+ */
+static int
+v4a_usable(o)
+   opts_t *o;
+{
+   return !o->udp;
+}
+
+static int
+v4a_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   char host[256];
+   unsigned short port;
+   
+   sl->step = &v4a_connect;
+   (void) slot_dest(sc, sl, host, sizeof(host), &port);
+   return socks4a_build_connect_req(sl->wbuf, sizeof(sl->wbuf), host, port,
+				    SLOT_OPTS(sc, sl)->username, sc->ebuf, sizeof(sc->ebuf));
+}
+
+static int
+v4a_reply(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   if (!socks4_parse_connect_rep(sl->rbuf, rl, sc->ebuf, sizeof(sc->ebuf)))
+     return probe_family(sl->rbuf, rl) == PF_SOCKS4 ? PV_REFUSED : PV_FAIL;
+   sl->targ->state |= SPSS_4A_SUCCESSFUL;
+   return PV_OPEN;
+}
+
+
+/*
+ * SOCKS v5, the auth proposal and then a connect (or udp associate)
+ * on the same connection
+ */
+static int
+v5_usable(o)
+   opts_t *o;
+{
+   return 1;
+}
+
+static int
+v5_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   sl->step = &v5_auth;
+   return socks5_build_auth_req(sl->wbuf, sizeof(sl->wbuf));
+}
+
+static int
+v5_reply(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   target_t *t = sl->targ;
+   struct sockaddr *sa;
+   char host[256];
+   unsigned short port;
+   int atyp;
+   
+   /* the auth type reply */
+   if (!(t->state & SPSS_5_AUTH_REP_RECVD))
+     {
+	if ((atyp = socks5_parse_auth_rep(sl->rbuf, rl, sc->ebuf, sizeof(sc->ebuf))) == 0)
+	  return PV_FAIL;
+	t->state |= SPSS_5_AUTH_REP_RECVD;
+	if (atyp == 2)
+	  {
+	     snprintf(sc->ebuf, sizeof(sc->ebuf), "user/pass authentication required!");
+	     t->state |= SPSS_5_AUTH_PASS_OK;
+	     return PV_FAIL;
+	  }
+	t->state |= SPSS_5_AUTH_NONE_OK;
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "no authentication required!");
+   
+	/* on to the connection (or udp associate) request.. */
+	sl->step = &v5_connect;
+	if (SLOT_OPTS(sc, sl)->udp)
+	  {
+	     struct sockaddr_storage any;
+   
+	     /* we can't say where the datagrams will come from */
+	     memset(&any, 0, sizeof(any));
+	     any.ss_family = sl->sa.ss_family;
+	     sl->wlen = socks5_build_udp_req(sl->wbuf, sizeof(sl->wbuf), (struct sockaddr *)&any);
+	  }
+	else if ((sa = slot_dest(sc, sl, host, sizeof(host), &port)))
+	  sl->wlen = socks5_build_connect_req(sl->wbuf, sizeof(sl->wbuf), sa);
+	else
+	  sl->wlen = socks5_build_connect_name_req(sl->wbuf, sizeof(sl->wbuf), host, port);
+	return PV_MORE;
+     }
+   
+   /* the connect reply */
+   t->state |= SPSS_5_DONE;
+   if (SLOT_OPTS(sc, sl)->udp)
+     return PV_UDP;
+   if (!socks5_parse_connect_rep(sl->rbuf, rl, sc->ebuf, sizeof(sc->ebuf)))
+     return rl >= 2 && sl->rbuf[0] == SOCKS5_VERSION ? PV_REFUSED : PV_FAIL;
+   t->state |= SPSS_5_REP_RECVD;
+   t->state |= SPSS_5_SUCCESSFUL;
+   return PV_OPEN;
+}
+
+
+/*
+ * HTTP CONNECT
+ */
+static int
+http_usable(o)
+   opts_t *o;
+{
+   return !o->udp;
+}
+
+static int
+http_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   char host[256];
+   unsigned short port;
+   int rl;
+   
+   sl->step = &http_connect;
+   (void) slot_dest(sc, sl, host, sizeof(host), &port);
+   if (!(rl = http_build_connect_req(sl->wbuf, sizeof(sl->wbuf), host, port)))
+     snprintf(sc->ebuf, sizeof(sc->ebuf), "HTTP connect request too long");
+   return rl;
+}
+
+static int
+http_reply(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   int code = http_parse_connect_rep(sl->rbuf, rl, sc->ebuf, sizeof(sc->ebuf));
+   
+   if (code / 100 == 2)
+     {
+	sl->targ->state |= SPSS_H_SUCCESSFUL;
+	return PV_OPEN;
+     }
+   if (code == HTTP_PROXY_AUTH)
+     {
+	sl->targ->state |= SPSS_H_AUTH;
+	return PV_FAIL;
+     }
+   /* a web server says no too, only a gateway error is a proxy's */
+   if (code >= HTTP_BAD_GATEWAY && code <= HTTP_GATEWAY_TIMEOUT)
+     return PV_REFUSED;
+   return PV_FAIL;
+}
@@ -0,0 +1,66 @@
+/*
+ * probe.h: the protocols a target is probed for
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __probe_h
+#define __probe_h
+
+#include <sys/socket.h>
+
+/* the probe modules (see probe.c), in their default order */
+#define PR_V4 			0
+#define PR_V4A 			1
+#define PR_V5 			2
+#define PR_HTTP 		3
+#define PR_COUNT 		4
+
+/* what gets probed for unless --probes says otherwise */
+#define DEFAULT_PROBES 		"v4,v5"
+
+/*
+ * protocol families, as far as a reply can tell them apart.  a server
+ * answering in a different one than it was asked in only speaks that
+ * one, and the probes of the others needn't bother.
+ */
+#define PF_NONE 		0	/* can't tell */
+#define PF_SOCKS4 		1
+#define PF_SOCKS5 		2
+#define PF_HTTP 		3
+
+/* what a module makes of a reply */
+#define PV_MORE 		0	/* its next request is in wbuf */
+#define PV_OPEN 		1	/* it relays for us */
+#define PV_FAIL 		2	/* no, ebuf says why (or what it wants) */
+#define PV_UDP 			3	/* udp associated, see start_udp() */
+#define PV_REFUSED 		4	/* it relays, but not there (ebuf) */
+
+/* the kinds of destinations a module can ask for */
+#define PD_V4 			0x01
+#define PD_V6 			0x02
+#define PD_NAME 		0x04
+#define PD_ANY 			(PD_V4 | PD_V6 | PD_NAME)
+
+/* a relay destination (-r, --dest) */
+typedef struct
+{
+   char *name;			/* as given */
+   char *host;			/* a name for the proxy to resolve, or NULL */
+   unsigned short port;		/* goes with host */
+   struct sockaddr_storage sa;	/* if it's an address */
+} dest_t;
+
+#define DEST_KIND(d) 		((d)->host ? PD_NAME : (d)->sa.ss_family == AF_INET6 ? PD_V6 : PD_V4)
+
+/* what a proxy's destinations came to (in the --matrix rows) */
+#define REACH_YES 		'+'	/* relayed */
+#define REACH_NO 		'-'	/* refused */
+#define REACH_UNKNOWN 		'?'	/* no answer either way */
+#define REACH_CANT 		'.'	/* its protocol can't ask for it */
+
+/* prototypes */
+int probe_list(char *, unsigned char *);
+int probe_family(char *, int);
+
+#endif
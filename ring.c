@@ -0,0 +1,234 @@
+/*
+ * ring.c: binary results in a shared memory ring
+ * 
+ * the scanner is the only writer of head and the reader the only
+ * writer of tail, so neither side needs a lock or a syscall per
+ * record, just a release store after the record and an acquire load
+ * before reading the other side's counter.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "args.h"
+#include "targets.h"
+#include "ring.h"
+
+/* the scanner's side */
+static ring_t out = { -1, NULL, NULL, 0 };
+static unsigned long long written = 0;
+
+static int ring_map(ring_t *, int, size_t, int);
+
+
+/*
+ * create the ring file with room for size records (rounded up to a
+ * power of 2), anything already there is thrown away
+ */
+int
+ring_open(fn, size)
+   char *fn;
+   unsigned long long size;
+{
+   unsigned long long cap = 1024;
+   int fd;
+   
+   while (cap < size)
+     cap <<= 1;
+   if ((fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+     {
+	fprintf(stderr, "Unable to create ring \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   if (ftruncate(fd, RING_HDR_SIZE + cap * sizeof(rrec_t)) == -1)
+     {
+	fprintf(stderr, "Unable to size the ring: %s\n", strerror(errno));
+	close(fd);
+	return -1;
+     }
+   if (ring_map(&out, fd, RING_HDR_SIZE + cap * sizeof(rrec_t), 1) == -1)
+     {
+	close(fd);
+	return -1;
+     }
+   memcpy(out.hdr->magic, RING_MAGIC, sizeof(RING_MAGIC));
+   out.hdr->recsize = sizeof(rrec_t);
+   out.hdr->capacity = cap;
+   /* readers check the version last */
+   __atomic_store_n(&out.hdr->version, RING_VERSION, __ATOMIC_RELEASE);
+   if (options.verbose >= 1)
+     fprintf(stderr, "writing results to ring \"%s\" with room for %llu of them.\n", fn, cap);
+   return 0;
+}
+
+/*
+ * add a finished target, waiting for the reader to make room if told to
+ */
+void
+ring_put(t, outcome, when, ms)
+   target_t *t;
+   unsigned int outcome;
+   time_t when;
+   unsigned int ms;
+{
+   rhdr_t *h = out.hdr;
+   rrec_t *r;
+   unsigned long long head;
+   
+   if (!h)
+     return;
+   head = h->head;
+   while (head - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE) >= h->capacity)
+     {
+	if (!options.ring_wait)
+	  {
+	     __atomic_store_n(&h->dropped, h->dropped + 1, __ATOMIC_RELAXED);
+	     return;
+	  }
+	usleep(1000);
+     }
+   r = &out.recs[head & (h->capacity - 1)];
+   memset(r, 0, sizeof(*r));
+   r->ip = t->ip;
+   r->port = t->port;
+   r->outcome = outcome;
+   r->state = (unsigned int)t->state;
+   r->when = (unsigned int)when;
+   r->ms = ms;
+   __atomic_store_n(&h->head, head + 1, __ATOMIC_RELEASE);
+   written++;
+}
+
+void
+ring_close()
+{
+   if (!out.hdr)
+     return;
+   __atomic_store_n(&out.hdr->done, 1, __ATOMIC_RELEASE);
+   if (options.verbose >= 1)
+     fprintf(stderr, "wrote %llu results to the ring, %llu dropped.\n", written, out.hdr->dropped);
+   munmap(out.hdr, out.len);
+   close(out.fd);
+   out.hdr = NULL;
+   out.recs = NULL;
+   out.fd = -1;
+}
+
+
+/*
+ * map a ring someone else is writing
+ */
+ring_t *
+ring_attach(fn)
+   char *fn;
+{
+   struct stat st;
+   rhdr_t hdr;
+   ring_t *rg;
+   int fd;
+   
+   if ((fd = open(fn, O_RDWR)) == -1 || fstat(fd, &st) == -1)
+     {
+	fprintf(stderr, "Unable to open ring \"%s\": %s\n", fn, strerror(errno));
+	if (fd != -1)
+	  close(fd);
+	return NULL;
+     }
+   if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+       || memcmp(hdr.magic, RING_MAGIC, sizeof(RING_MAGIC))
+       || hdr.version != RING_VERSION
+       || hdr.recsize != sizeof(rrec_t)
+       || (hdr.capacity & (hdr.capacity - 1)) != 0
+       || st.st_size < RING_HDR_SIZE + hdr.capacity * sizeof(rrec_t))
+     {
+	fprintf(stderr, "\"%s\" is not a usable ring file.\n", fn);
+	close(fd);
+	return NULL;
+     }
+   if (!(rg = (ring_t *)calloc(1, sizeof(ring_t))))
+     {
+	close(fd);
+	return NULL;
+     }
+   if (ring_map(rg, fd, RING_HDR_SIZE + hdr.capacity * sizeof(rrec_t), 0) == -1)
+     {
+	close(fd);
+	free(rg);
+	return NULL;
+     }
+   return rg;
+}
+
+/*
+ * copy out up to max records
+ * 
+ * returns how many, 0 if there are none right now or -1 if there
+ * will never be any more
+ */
+long
+ring_read(rg, recs, max)
+   ring_t *rg;
+   rrec_t *recs;
+   long max;
+{
+   rhdr_t *h = rg->hdr;
+   unsigned long long head, tail = h->tail;
+   long n = 0;
+   
+   head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+   if (head == tail)
+     {
+	/* done is stored after the last head, so look at head again */
+	if (!__atomic_load_n(&h->done, __ATOMIC_ACQUIRE))
+	  return 0;
+	return __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) == tail ? -1 : 0;
+     }
+   for (; n < max && tail != head; n++, tail++)
+     recs[n] = rg->recs[tail & (h->capacity - 1)];
+   __atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE);
+   return n;
+}
+
+void
+ring_detach(rg)
+   ring_t *rg;
+{
+   munmap(rg->hdr, rg->len);
+   close(rg->fd);
+   free(rg);
+}
+
+
+/*
+ * map a ring file of len bytes
+ */
+static int
+ring_map(rg, fd, len, populate)
+   ring_t *rg;
+   int fd;
+   size_t len;
+   int populate;
+{
+   void *p;
+   
+   p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+   if (p == MAP_FAILED)
+     {
+	fprintf(stderr, "Unable to map the ring: %s\n", strerror(errno));
+	return -1;
+     }
+   rg->fd = fd;
+   rg->len = len;
+   rg->hdr = (rhdr_t *)p;
+   rg->recs = (rrec_t *)((char *)p + RING_HDR_SIZE);
+   return 0;
+}
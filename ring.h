@@ -0,0 +1,80 @@
+/*
+ * ring.h: binary results in a shared memory ring
+ * 
+ * the file is a 4k header followed by a power of 2 number of fixed
+ * size records.  the scanner writes records and bumps head, a reader
+ * on the same box maps the file, copies out whatever is between tail
+ * and head and bumps tail.  head and tail only ever grow, a record
+ * lives at index & (capacity - 1).  when the reader falls a whole ring
+ * behind, new results are dropped (and counted) unless the scanner was
+ * told to wait for it.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __ring_h
+#define __ring_h
+
+#include <time.h>
+
+#include "targets.h"
+
+#define RING_MAGIC 		"SSRING"
+#define RING_VERSION 		1
+
+/* where the records start in the file */
+#define RING_HDR_SIZE 		4096
+
+/* head and tail get a cache line each */
+#define RING_LINE 		64
+
+/* the file header */
+typedef struct
+{
+   /* set up once by the scanner */
+   char magic[8];
+   unsigned int version;
+   unsigned int recsize;
+   unsigned long long capacity;	/* a power of 2 */
+   char pad1[RING_LINE - 24];
+   /* only the scanner writes these */
+   unsigned long long head;	/* records ever written */
+   unsigned long long dropped;	/* results lost to a full ring */
+   unsigned int done;		/* nothing more is coming */
+   char pad2[RING_LINE - 20];
+   /* only the reader writes this */
+   unsigned long long tail;	/* records ever read */
+} rhdr_t;
+
+/* one finished target */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   unsigned char outcome;	/* CO_* bits, see cache.h */
+   unsigned char pad;
+   unsigned int state;		/* SPSS_* bits, see targets.h */
+   unsigned int when;		/* when it finished, unix time */
+   unsigned int ms;		/* how long it took */
+} rrec_t;
+
+/* a mapped ring */
+typedef struct
+{
+   int fd;
+   rhdr_t *hdr;
+   rrec_t *recs;
+   size_t len;
+} ring_t;
+
+/* prototypes */
+int ring_open(char *, unsigned long long);
+void ring_put(target_t *, unsigned int, time_t, unsigned int);
+void ring_close(void);
+
+/* for readers */
+ring_t *ring_attach(char *);
+long ring_read(ring_t *, rrec_t *, long);
+void ring_detach(ring_t *);
+
+#endif
@@ -0,0 +1,1747 @@
+/*
+ * scan.c: the scan engine
+ * 
+ * this is the probing state machine.  it does no socket i/o of its
+ * own, a backend (io_select.c, io_uring.c) moves the bytes and reports
+ * back through the scan_* event functions, and it knows no protocols,
+ * the probe modules (probe.c) build the requests and judge the replies.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include "socks5.h"
+
+#include "targets.h"
+#include "args.h"
+#include "scan.h"
+#include "cache.h"
+#include "net.h"
+#include "trace.h"
+#include "ring.h"
+#include "archive.h"
+#include "udp.h"
+#include "probe.h"
+
+
+/* which pass is this slot on? */
+#define SLOT_VSTR(sl) 		((sl)->probe->name)
+
+
+/* function prototypes */
+static int init_slot(scan_t *, scanslot_t *);
+static int next_tier(scan_t *, target_t *);
+static void finish_target(scan_t *, scanjob_t *, target_t *, unsigned int);
+static void target_gone(scan_t *, scanjob_t *);
+static int job_target(scan_t *, scanslot_t *);
+static unsigned int reply_timeout(opts_t *);
+static void slot_print(scan_t *, scanslot_t *, char *, ...);
+static void unreachable(scan_t *, taddr_t *, int);
+static probe_t *next_probe(opts_t *, target_t *);
+static void start_pass(scan_t *, scanslot_t *);
+static void end_probe(scan_t *, scanslot_t *, int);
+static void end_pass(scan_t *, scanslot_t *);
+static void clear_slot(scan_t *, scanslot_t *);
+static void charge_slot(scan_t *, scanslot_t *, int);
+static void send_request(scan_t *, scanslot_t *);
+static void start_udp(scan_t *, scanslot_t *, int);
+static void check_timeouts(scan_t *);
+static unsigned int raise_fd_limit(scan_t *, unsigned int);
+static unsigned int budget_slots(scan_t *, unsigned int);
+static void check_memory(scan_t *);
+static unsigned long long anon_memory(void);
+static void record(scan_t *, scanslot_t *, int, int, int, char *, int);
+static int defer_target(scan_t *, targlist_t *, target_t *);
+static void save_done(scan_t *);
+static unsigned int phase_timeout(scan_t *, scanslot_t *, int);
+static int retry_slot(scan_t *, scanslot_t *, int, char *);
+static int rq_push(scan_t *, target_t *, scanjob_t *, unsigned long long);
+static void rq_pop(scan_t *, target_t *, scanjob_t **);
+static void reach_add(scan_t *, scanslot_t *, int);
+static int reach_target(scan_t *, scanslot_t *);
+static reach_t *reach_find(scan_t *, scanslot_t *);
+static void reach_done(scan_t *, scanslot_t *);
+static void reach_write(scan_t *, reach_t *);
+
+
+/* the backends, the first one that works is the default */
+static scanio_t *backends[] =
+{
+   &scanio_epoll,
+   &scanio_select,
+   &scanio_uring,
+   NULL
+};
+
+
+/*
+ * scan the targets..
+ * 
+ * attempt to scan X at a time..
+ */
+void
+scan_targets(targets, nt, hook)
+   targlist_t *targets;
+   unsigned long nt;
+   scanhook_t *hook;
+{
+   scan_t sc;
+   
+   if (scan_init(&sc, &options, targets, nt, hook) == -1)
+     return;
+   sc.out = options.ring ? NULL : stdout;
+   sc.status_fd = fileno(stdin);
+   
+   /* until all targets have been tested.. */
+   while (scan_step(&sc, 500) > 0)
+     ;
+   scan_fini(&sc);
+}
+
+
+/*
+ * set up an engine to scan nt targets (or whatever the hook comes up
+ * with) using the settings in opts
+ */
+int
+scan_init(sc, opts, targets, nt, hook)
+   scan_t *sc;
+   opts_t *opts;
+   targlist_t *targets;
+   unsigned long nt;
+   scanhook_t *hook;
+{
+   scanio_t *want;
+   unsigned int i;
+   
+   memset(sc, 0, sizeof(*sc));
+   sc->opts = opts;
+   sc->status_fd = -1;
+   sc->targets = targets;
+   sc->nt = sc->tleft = nt;
+   sc->nslots = opts->connects;
+   sc->hook = hook;
+   sc->seed = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+   sc->rto = reply_timeout(opts);
+   /* the prefix table gets its share of the memory, doubling as it goes */
+   if (opts->max_memory)
+     for (sc->pfx.max = 512; sc->pfx.max * 2 * sizeof(prefix_t) <= opts->max_memory / MEM_PFX_SHARE; sc->pfx.max *= 2)
+       ;
+   
+   /* less targets than slots?  (each might want --dest checks too) */
+   if (!hook && nt * (opts->ndests ? opts->dest_slots + 1 : 1) < sc->nslots)
+     sc->nslots = nt * (opts->ndests ? opts->dest_slots + 1 : 1);
+   /* more slots than we can have descriptors? */
+   sc->nslots = raise_fd_limit(sc, sc->nslots);
+   /* or than there's memory for? */
+   if (opts->max_memory)
+     sc->nslots = budget_slots(sc, sc->nslots);
+   sc->slot_limit = sc->nslots;
+   /* get memory for the connection attempts */
+   sc->slots = (scanslot_t *)calloc(sc->nslots, sizeof(scanslot_t));
+   if (!sc->slots)
+     {
+	fprintf(stderr, "Unable to allocate memory for %d scan slots.\n", sc->nslots);
+	return -1;
+     }
+   for (i = 0; i < sc->nslots; i++)
+     {
+	sc->slots[i].idx = i;
+	sc->slots[i].sd = -1;
+     }
+   
+   /* replaying a trace?  there is nothing to fall back on */
+   if (opts->replay)
+     {
+	sc->io = &scanio_replay;
+	if (sc->io->init(sc) == -1)
+	  {
+	     free(sc->slots);
+	     return -1;
+	  }
+     }
+   
+   /* pick the i/o backend, falling back on the others */
+   want = opts->backend ? scan_backend(opts->backend) : backends[0];
+   if (!opts->replay)
+     sc->io = want;
+   if (!opts->replay && (!sc->io || sc->io->init(sc) == -1))
+     {
+	for (i = 0; (sc->io = backends[i]); i++)
+	  if (sc->io != want && sc->io->init(sc) == 0)
+	    break;
+	if (!sc->io)
+	  {
+	     free(sc->slots);
+	     return -1;
+	  }
+	if (opts->verbose >= 1)
+	  fprintf(stderr, "%s i/o backend unavailable, using %s\n", want ? want->name : "requested", sc->io->name);
+     }
+   if (opts->verbose >= 1)
+     fprintf(stderr, "using the %s i/o backend.\n", sc->io->name);
+   
+   /* the sockets the udp probes share */
+   if (opts->udp && udp_init(sc) == -1)
+     {
+	sc->io->fini(sc);
+	free(sc->slots);
+	return -1;
+     }
+   
+   sc->start_time = scan_time(sc);
+   cost_start(&sc->cost, scan_ms(sc));
+   if (opts->cache)
+     {
+	unsigned long np = cache_open_targets(targets, &sc->prio, sc->start_time, opts->cache_ttl);
+	
+	if (opts->verbose >= 1 && np > 0)
+	  fprintf(stderr, "%lu previously open targets will be scanned first.\n", np);
+     }
+   /* likeliest first?  the tiers take the targets over */
+   if (opts->order && !hook && order_targets(targets, opts->order, sc->tier, opts->verbose) == -1)
+     goto fail;
+   /* what's done gets added to what was done before */
+   if (opts->done && load_targets(&sc->done, opts->done) == -1)
+     goto fail;
+   sc->done_saved = time(NULL);
+   /* the reachability matrix, headed by what its columns are */
+   if (opts->matrix)
+     {
+	if (!(sc->matrix = fopen(opts->matrix, "w")))
+	  {
+	     fprintf(stderr, "Unable to open \"%s\": %s\n", opts->matrix, strerror(errno));
+	     goto fail;
+	  }
+	fprintf(sc->matrix, "# ip port probe -r");
+	for (i = 0; i < opts->ndests; i++)
+	  fprintf(sc->matrix, " %s", opts->dests[i].name);
+	fprintf(sc->matrix, "\n");
+     }
+   return 0;
+   
+ fail:
+   /* undo all of the above */
+   udp_fini(sc);
+   sc->io->fini(sc);
+   free(sc->slots);
+   free_targets(&sc->prio);
+   for (i = 0; i < ORD_TIERS; i++)
+     free_targets(&sc->tier[i]);
+   free_targets(&sc->done);
+   return -1;
+}
+
+
+/*
+ * share the engine out between jobs.  their targets should be sorted
+ * and counted in the nt given to scan_init().
+ */
+void
+scan_jobs(sc, jobs, njobs)
+   scan_t *sc;
+   scanjob_t *jobs;
+   unsigned int njobs;
+{
+   scanjob_t *j;
+   unsigned int i;
+   
+   sc->jobs = jobs;
+   sc->njobs = njobs;
+   for (i = 0; i < njobs; i++)
+     {
+	j = &jobs[i];
+	j->rto = reply_timeout(&j->opts);
+	j->nt = j->tleft = (unsigned long)j->targets.total;
+	j->start_time = scan_time(sc);
+	j->tok_ms = scan_ms(sc);
+	j->tokens = j->rate * 1000ULL;
+	if (!j->weight)
+	  j->weight = 1;
+     }
+}
+
+
+/*
+ * replies get their own (shorter) deadline unless told otherwise
+ */
+static unsigned int
+reply_timeout(o)
+   opts_t *o;
+{
+   if (o->reply_timeout)
+     return o->reply_timeout;
+   return o->timeout < DEFAULT_REPLY_TIMEOUT ? o->timeout : DEFAULT_REPLY_TIMEOUT;
+}
+
+
+/*
+ * one trip around the loop: fill the empty slots, then wait up to ms
+ * milliseconds for i/o and deal with it
+ * 
+ * returns 1 while there is more to do, 0 when done, -1 on error
+ */
+int
+scan_step(sc, ms)
+   scan_t *sc;
+   int ms;
+{
+   scanslot_t *sl;
+   unsigned long long now, next = 0;
+   unsigned int i;
+   
+   /* getting near the memory budget? */
+   if (sc->opts->max_memory && time(NULL) != sc->mem_checked)
+     check_memory(sc);
+   
+   /* check the slots.. */
+   for (i = 0; i < sc->nslots; i++)
+     {
+	sl = &sc->slots[i];
+	
+	/* nothing here??  we can fix that! (unless short on memory) */
+	if (!sl->targ)
+	  {
+	     if (sc->nbusy >= sc->slot_limit || !init_slot(sc, sl))
+	       continue;
+	     if (sc->opts->verbose >= 2)
+	       slot_print(sc, sl, "%3d   %-18s now occupied\n", i, taddr_ntoa(&sl->targ->ip));
+	  }
+	
+	/* if this slot is not yet connecting, initiate the connection.. */
+	if (sl->io_state == SIO_IDLE)
+	  start_pass(sc, sl);
+	/* the soonest something could time out */
+	if (!sc->io->timeouts && sl->targ
+	    && (sl->io_state == SIO_CONNECTING || sl->io_state == SIO_RECVING)
+	    && (!next || sl->deadline < next))
+	  next = sl->deadline;
+     }
+   if (sc->tleft == 0 && sc->nreach == 0 && (!sc->hook || sc->hook_done))
+     return 0;
+   /* or a retry comes due */
+   if (sc->nrq > 0 && (!next || sc->rq[0].due < next))
+     next = sc->rq[0].due;
+   /* or a job that was held back by its rate may go again */
+   if (sc->job_due && sc->nbusy < sc->slot_limit && sc->nbusy < sc->nslots
+       && (!next || sc->job_due < next))
+     next = sc->job_due;
+   
+   /* don't sleep past it */
+   if (next)
+     {
+	now = scan_ms(sc);
+	if (next <= now)
+	  ms = 0;
+	else if (next - now < (unsigned long long)ms)
+	  ms = (int)(next - now);
+     }
+   /* datagrams out?  look for them coming back often */
+   if (sc->nudp > 0 && ms > UDP_TICK_MS)
+     ms = UDP_TICK_MS;
+   if (sc->udp)
+     udp_flush(sc);
+   
+   /* wait for something to happen */
+   if (sc->io->wait(sc, ms) == -1)
+     return -1;
+   cost_sample(&sc->cost);
+   if (sc->udp)
+     udp_poll(sc);
+   if (!sc->io->timeouts || sc->nudp > 0)
+     check_timeouts(sc);
+   if (sc->hook && sc->hook->tick)
+     sc->hook->tick(sc);
+   if (sc->opts->done && time(NULL) - sc->done_saved >= DONE_SAVE_INTERVAL)
+     save_done(sc);
+   return 1;
+}
+
+
+/*
+ * tear an engine down
+ */
+void
+scan_fini(sc)
+   scan_t *sc;
+{
+   unsigned int i;
+   
+   /* anything still in flight is abandoned */
+   for (i = 0; i < sc->nslots; i++)
+     if (sc->slots[i].targ && sc->slots[i].io_state != SIO_IDLE)
+       sc->io->close(sc, &sc->slots[i]);
+   cost_finish(&sc->cost, scan_ms(sc));
+   sc->io->fini(sc);
+   udp_fini(sc);
+   free(sc->slots);
+   free_targets(&sc->prio);
+   for (i = 0; i < ORD_TIERS; i++)
+     free_targets(&sc->tier[i]);
+   free_targets(&sc->later);
+   for (i = 0; i < sc->njobs; i++)
+     free_targets(&sc->jobs[i].later);
+   if (sc->opts->done)
+     save_done(sc);
+   free_targets(&sc->done);
+   free(sc->rq);
+   /* proxies cut short still get their rows, with what is known */
+   for (i = 0; i < sc->nreach; i++)
+     {
+	reach_write(sc, sc->reach[i]);
+	free(sc->reach[i]);
+     }
+   free(sc->reach);
+   if (sc->matrix)
+     fclose(sc->matrix);
+   if (sc->opts->cache && sc->opts->verbose >= 1)
+     fprintf(stderr, "skipped %lu targets scanned in the last %u seconds.\n", sc->skipped, sc->opts->cache_ttl);
+   if (sc->opts->verbose >= 1 && sc->nsilent > 0)
+     fprintf(stderr, "%lu hosts accepted a connection and never replied, %lu targets in %lu tarpit prefixes were scanned last.\n",
+	     sc->nsilent, sc->deferred, sc->pfx.nflagged);
+   if (sc->opts->verbose >= 1 && sc->nspared > 0)
+     fprintf(stderr, "%lu passes weren't needed, a reply in another protocol settled them.\n", sc->nspared);
+   if (sc->opts->verbose >= 1 && sc->nunreach > 0)
+     fprintf(stderr, "%lu targets in %lu unreachable prefixes were written off without a probe.\n",
+	     sc->nunreach, sc->pfx.ndead);
+   if (sc->opts->verbose >= 1 && sc->nretries > 0)
+     fprintf(stderr, "retried %lu times, %lu of those connected.\n", sc->nretries, sc->nrescued);
+   if (sc->opts->verbose >= 1 && sc->pfx.npruned > 0)
+     fprintf(stderr, "the prefix table filled up %lu times, all but the tarpits were forgotten.\n", sc->pfx.npruned);
+   if (sc->opts->verbose >= 1)
+     cost_report(&sc->cost, stderr, sc->io->name);
+   if (sc->opts->stats)
+     (void) cost_write(&sc->cost, sc->opts->stats, sc->io->name);
+   pfx_free(&sc->pfx);
+}
+
+
+/*
+ * find a backend by name
+ */
+scanio_t *
+scan_backend(name)
+   char *name;
+{
+   unsigned int i;
+   
+   for (i = 0; backends[i]; i++)
+     if (!strcmp(backends[i]->name, name))
+       return backends[i];
+   return NULL;
+}
+
+
+/*
+ * print a result line, if this engine prints them
+ * 
+ * (varargs need a prototype style definition)
+ */
+void
+scan_print(scan_t *sc, char *fmt, ...)
+{
+   va_list ap;
+   
+   if (!sc->out)
+     return;
+   va_start(ap, fmt);
+   vfprintf(sc->out, fmt, ap);
+   va_end(ap);
+}
+
+
+/*
+ * the same, for the slot's target: into its job's output if it has one
+ */
+static void
+slot_print(scan_t *sc, scanslot_t *sl, char *fmt, ...)
+{
+   FILE *out = sl->job ? sl->job->out : sc->out;
+   va_list ap;
+   
+   if (!out)
+     return;
+   va_start(ap, fmt);
+   vfprintf(out, fmt, ap);
+   va_end(ap);
+}
+
+
+/*
+ * what time is it?  (the replay backend has its own idea)
+ */
+time_t
+scan_time(sc)
+   scan_t *sc;
+{
+   if (sc->vclock)
+     return sc->vbase + (time_t)(sc->vnow / 1000);
+   return time(NULL);
+}
+
+/*
+ * milliseconds, for measuring things
+ */
+unsigned long long
+scan_ms(sc)
+   scan_t *sc;
+{
+   struct timespec ts;
+   
+   if (sc->vclock)
+     return sc->vnow;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * write an event to the trace, when recording
+ */
+static void
+record(sc, sl, ev, res, err, data, dlen)
+   scan_t *sc;
+   scanslot_t *sl;
+   int ev, res, err;
+   char *data;
+   int dlen;
+{
+   if (!sc->opts->record)
+     return;
+   trace_event(&sl->targ->ip, sl->targ->port, ev, (unsigned int)(scan_ms(sc) - sl->op_ms),
+	       res, err, data, dlen);
+}
+
+
+/*
+ * give some status..
+ */
+void
+scan_status(sc)
+   scan_t *sc;
+{
+   fprintf(stderr, "[scanned %lu of %lu in %lu seconds]\n",
+	   sc->nt - sc->tleft, sc->nt, scan_time(sc) - sc->start_time);
+}
+
+
+/*
+ * the connection finished, one way or the other
+ */
+void
+scan_connected(sc, sl, err)
+   scan_t *sc;
+   scanslot_t *sl;
+   int err;
+{
+   target_t *t = sl->targ;
+   
+   record(sc, sl, TR_CONNECTED, 0, err, NULL, 0);
+   /* out of ports on that source address?  try the next one */
+   if (err == EADDRNOTAVAIL && ++sl->src_tries < sc->opts->nsources)
+     {
+	end_pass(sc, sl);
+	return;
+     }
+   if (err == ECONNREFUSED)
+     pfx_refused(&sc->pfx, &t->ip);
+   else if (err == EHOSTUNREACH || err == ENETUNREACH)
+     {
+	/* how much of it? */
+	unreachable(sc, &t->ip, net_unreach(sl->sd, err));
+	SCAN_SYS(sc, sl, 1);
+     }
+   if (err)
+     {
+	/* maybe a SYN got lost */
+	if ((err == ETIMEDOUT || err == ECONNRESET)
+	    && retry_slot(sc, sl, 1, strerror(err)))
+	  return;
+	slot_print(sc, sl, "%3d   %-18s %-4s unable to connect: %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), strerror(err));
+	clear_slot(sc, sl);
+	return;
+     }
+   /* cool it connected! */
+   if (sl->retry)
+     {
+	sc->nrescued++;
+	sl->retry = 0;
+     }
+   if (sc->opts->verbose >= 2)
+     slot_print(sc, sl, "%3d   %-18s %-4s connected!\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+   sl->src_tries = 0;
+   pfx_connected(&sc->pfx, &t->ip);
+   pfx_rtt_sample(&sc->pfx, &t->ip, PFX_RTT_NET, (unsigned int)(scan_ms(sc) - sl->op_ms));
+   
+   /* build the first request of this pass */
+   t->state |= sl->probe->connected;
+   if (!(sl->wlen = sl->probe->request(sc, sl)))
+     {
+	slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+	clear_slot(sc, sl);
+	return;
+     }
+   send_request(sc, sl);
+}
+
+
+/*
+ * the request in wbuf was written (or not)
+ */
+void
+scan_sent(sc, sl, wl, err)
+   scan_t *sc;
+   scanslot_t *sl;
+   int wl, err;
+{
+   target_t *t = sl->targ;
+   char *what = sl->step->name;
+   
+   record(sc, sl, TR_SENT, wl, err, NULL, 0);
+   if (wl > 0)
+     sl->nout += wl;
+   if (wl != sl->wlen)
+     {
+	if (wl == -1 && (err == ECONNRESET || err == EPIPE)
+	    && retry_slot(sc, sl, 0, strerror(err)))
+	  return;
+	if (wl == -1)
+	  slot_print(sc, sl, "%3d   %-18s %-4s error writing %s request: %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), what, strerror(err));
+	else
+	  slot_print(sc, sl, "%3d   %-18s %-4s only wrote %d bytes of %s request\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), wl, what);
+	clear_slot(sc, sl);
+	return;
+     }
+   /* cool we sent it!  set the write time and update the state */
+   t->state |= sl->step->sent;
+   if (sc->opts->verbose >= 2)
+     slot_print(sc, sl, "%3d   %-18s %-4s %s request sent!\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), what);
+   sl->deadline = scan_ms(sc) + sl->tmo;
+}
+
+
+/*
+ * a reply of rl bytes is in rbuf, rl <= 0 means the read failed with err
+ */
+void
+scan_received(sc, sl, rl, err)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl, err;
+{
+   target_t *t = sl->targ;
+   reach_t *r;
+   dest_t *d;
+   int v;
+   
+   record(sc, sl, TR_RECEIVED, rl, err, sl->rbuf, rl);
+   if (rl > 0)
+     sl->nin += rl;
+   if (rl > 0)
+     pfx_rtt_sample(&sc->pfx, &t->ip, sl->step->onward ? PFX_RTT_RELAY : PFX_RTT_NET,
+		    (unsigned int)(scan_ms(sc) - sl->op_ms));
+   if (rl == -1 && err == ECONNRESET && retry_slot(sc, sl, 0, strerror(err)))
+     return;
+   /* the parsers pick up read errors from errno */
+   errno = err;
+   sc->ebuf[0] = '\0';
+   v = sl->probe->reply(sc, sl, rl);
+   
+   /* more to say on this connection? */
+   if (v == PV_MORE)
+     {
+	if (sc->opts->verbose >= 2 && sc->ebuf[0])
+	  slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+	send_request(sc, sl);
+	return;
+     }
+   if (v == PV_UDP)
+     {
+	start_udp(sc, sl, rl);
+	return;
+     }
+   /* one of its --dest?  that's all this pass was for */
+   if (t->dest)
+     {
+	d = &SLOT_OPTS(sc, sl)->dests[t->dest - 1];
+	if (v == PV_OPEN)
+	  slot_print(sc, sl, "%3d   %-18s %-4s reaches %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), d->name);
+	else
+	  slot_print(sc, sl, "%3d   %-18s %-4s doesn't reach %s: %s\n", sl->idx, taddr_ntoa(&t->ip),
+		     SLOT_VSTR(sl), d->name, sc->ebuf);
+	if ((r = reach_find(sc, sl)) && (v == PV_OPEN || v == PV_REFUSED))
+	  r->res[t->dest] = v == PV_OPEN ? REACH_YES : REACH_NO;
+	clear_slot(sc, sl);
+	return;
+     }
+   /* cool it was successful! (or not) */
+   if (v == PV_OPEN)
+     slot_print(sc, sl, "%3d   %-18s %-4s connection successful!\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+   else
+     slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+   /* it relays, where else does it get to? */
+   if ((v == PV_OPEN || v == PV_REFUSED) && SLOT_OPTS(sc, sl)->ndests)
+     reach_add(sc, sl, v);
+   end_probe(sc, sl, rl);
+}
+
+
+/*
+ * it has been too long since we connected or sent our request..
+ */
+void
+scan_timeout(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   target_t *t = sl->targ;
+   char what[64] = "connect";
+   
+   record(sc, sl, TR_TIMEOUT, 0, 0, NULL, 0);
+   if (sl->io_state == SIO_UDP)
+     {
+	sl->timedout = 1;
+	slot_print(sc, sl, "%3d   %-18s %-4s udp associate granted, nothing came back through the relay\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+	clear_slot(sc, sl);
+	return;
+     }
+   if (sl->io_state == SIO_CONNECTING && retry_slot(sc, sl, 1, "connect timed out"))
+     return;
+   sl->timedout = 1;
+   if (sl->io_state != SIO_CONNECTING)
+     {
+	/* it took the connection and then sat on it (a proxy waiting
+	 * on a --dest that doesn't answer isn't a tarpit though) */
+	if (!t->dest)
+	  sc->nsilent++;
+	if (!t->dest && pfx_silent(&sc->pfx, &t->ip) && sc->opts->verbose >= 1)
+	  {
+	     taddr_t pfx;
+	     int bits = pfx_mask(&t->ip, &pfx);
+	     
+	     fprintf(stderr, "%s/%d looks like a tarpit, scanning the rest of it last.\n", taddr_ntoa(&pfx), bits);
+	  }
+	snprintf(what, sizeof(what), "read %s reply", sl->step->name);
+     }
+   slot_print(sc, sl, "%3d   %-18s %-4s unable to %s: %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), what, strerror(ETIMEDOUT));
+   clear_slot(sc, sl);
+}
+
+
+/*
+ * the datagram sent through the slot's relay came back
+ */
+void
+scan_udp_reply(sc, sl, len)
+   scan_t *sc;
+   scanslot_t *sl;
+   int len;
+{
+   target_t *t = sl->targ;
+   
+   sl->nin += len;
+   t->state |= SPSS_5_UDP_OK;
+   slot_print(sc, sl, "%3d   %-18s %-4s udp relay works!\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+   clear_slot(sc, sl);
+}
+
+
+/*
+ * check the slots for connections/replies that took too long, for
+ * backends that don't do it themselves, and for relayed datagrams
+ */
+static void
+check_timeouts(sc)
+   scan_t *sc;
+{
+   scanslot_t *sl;
+   unsigned long long now = scan_ms(sc);
+   unsigned int i;
+   
+   for (i = 0; i < sc->nslots; i++)
+     {
+	sl = &sc->slots[i];
+	if (!sl->targ)
+	  continue;
+	/* the backend may see to the tcp ones, never the udp ones */
+	if (sl->io_state != SIO_UDP
+	    && (sc->io->timeouts || (sl->io_state != SIO_CONNECTING && sl->io_state != SIO_RECVING)))
+	  continue;
+	if (now >= sl->deadline)
+	  scan_timeout(sc, sl);
+     }
+}
+
+
+/*
+ * create the socket for a slot's next connection
+ * 
+ * it is bound to the next source address of the right family (letting
+ * connect() pick the port, so ports are only unique per destination).
+ * net_socket() sets it to reset on close so it doesn't sit in TIME_WAIT.
+ */
+int
+scan_socket(sc, sl, flags)
+   scan_t *sc;
+   scanslot_t *sl;
+   int flags;
+{
+   struct sockaddr_storage *src;
+   unsigned int i;
+   int sd, one = 1;
+   
+   if ((sd = net_socket(sl->sa.ss_family, flags, SLOT_OPTS(sc, sl)->timeout)) == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "socket: %s", strerror(errno));
+	SCAN_SYS(sc, sl, 1);
+	return -1;
+     }
+   SCAN_SYS(sc, sl, net_socket_calls);
+   
+   for (i = 0; i < sc->opts->nsources; i++)
+     {
+	src = &sc->opts->sources[sc->next_source++ % sc->opts->nsources];
+	if (src->ss_family != sl->sa.ss_family)
+	  continue;
+#ifdef IP_BIND_ADDRESS_NO_PORT
+	(void) setsockopt(sd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+	SCAN_SYS(sc, sl, 1);
+#endif
+	SCAN_SYS(sc, sl, 1);
+	if (bind(sd, (struct sockaddr *)src, src->ss_family == AF_INET
+		 ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) == -1)
+	  {
+	     snprintf(sc->ebuf, sizeof(sc->ebuf), "bind: %s", strerror(errno));
+	     close(sd);
+	     SCAN_SYS(sc, sl, 1);
+	     return -1;
+	  }
+	break;
+     }
+   return sd;
+}
+
+
+/*
+ * how many milliseconds the slot's next connect (or reply) gets.  once
+ * its prefix has shown us some round trips that's what they suggest,
+ * between --min-timeout and the fixed timeouts.
+ */
+static unsigned int
+phase_timeout(sc, sl, connecting)
+   scan_t *sc;
+   scanslot_t *sl;
+   int connecting;
+{
+   target_t *t = sl->targ;
+   unsigned int ceil, rto;
+   int which = PFX_RTT_NET;
+   
+   if (connecting)
+     ceil = SLOT_OPTS(sc, sl)->timeout * 1000;
+   else
+     {
+	ceil = SLOT_RTO(sc, sl) * 1000;
+	if (sl->suspect && ceil > TARPIT_REPLY_TIMEOUT * 1000)
+	  ceil = TARPIT_REPLY_TIMEOUT * 1000;
+	/* connect replies wait on the proxy's own connect too */
+	if (sl->step->onward)
+	  which = PFX_RTT_RELAY;
+     }
+   if (sc->opts->fixed_timeouts
+       || !(rto = pfx_rto(&sc->pfx, &t->ip, which)))
+     return ceil;
+   if (rto < SLOT_OPTS(sc, sl)->min_timeout)
+     rto = SLOT_OPTS(sc, sl)->min_timeout;
+   return rto < ceil ? rto : ceil;
+}
+
+
+/*
+ * make sure we can have a descriptor for every slot, returns how many
+ * slots we can actually have
+ */
+static unsigned int
+raise_fd_limit(sc, nslots)
+   scan_t *sc;
+   unsigned int nslots;
+{
+   struct rlimit rl;
+   rlim_t need = (rlim_t)nslots + 64;
+   
+   if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur >= need)
+     return nslots;
+   rl.rlim_cur = rl.rlim_max != RLIM_INFINITY && rl.rlim_max < need ? rl.rlim_max : need;
+   (void) setrlimit(RLIMIT_NOFILE, &rl);
+   if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur >= need)
+     return nslots;
+   if (sc->opts->verbose >= 1)
+     fprintf(stderr, "only %lu file descriptors available, using %lu slots.\n",
+	     (unsigned long)rl.rlim_cur, (unsigned long)(rl.rlim_cur - 64));
+   return rl.rlim_cur > 64 ? rl.rlim_cur - 64 : 1;
+}
+
+
+/*
+ * no more slots than a share of --max-memory pays for
+ */
+static unsigned int
+budget_slots(sc, nslots)
+   scan_t *sc;
+   unsigned int nslots;
+{
+   unsigned long long n = sc->opts->max_memory / MEM_SLOT_SHARE / (sizeof(scanslot_t) + MEM_SLOT_EXTRA);
+   
+   if (n >= nslots)
+     return nslots;
+   if (n < 1)
+     n = 1;
+   fprintf(stderr, "only room for %llu slots in %lluMB of memory.\n", n, sc->opts->max_memory >> 20);
+   return (unsigned int)n;
+}
+
+/*
+ * once a second, see what we really use and take slots out of use (or
+ * put them back) to stay under --max-memory
+ */
+static void
+check_memory(sc)
+   scan_t *sc;
+{
+   unsigned long long used = anon_memory(), max = sc->opts->max_memory;
+   unsigned int lim = sc->slot_limit;
+   
+   sc->mem_checked = time(NULL);
+   if (!used)
+     return;
+   if (used > max / 100 * MEM_HIGH_PCT)
+     lim = sc->nbusy - sc->nbusy / 4;
+   else if (used < max / 100 * MEM_LOW_PCT && lim < sc->nslots)
+     lim = lim + sc->nslots / 16 + 1 < sc->nslots ? lim + sc->nslots / 16 + 1 : sc->nslots;
+   if (lim < 1)
+     lim = 1;
+   if (lim != sc->slot_limit && sc->opts->verbose >= 1)
+     fprintf(stderr, "%lluMB in use, %u slots now.\n", used >> 20, lim);
+   sc->slot_limit = lim;
+   if (used > max && !sc->mem_warned++)
+     fprintf(stderr, "over the memory budget (%lluMB of %lluMB), cutting back.\n", used >> 20, max >> 20);
+}
+
+/*
+ * our own memory in use, not counting mapped files (the cache, the
+ * ring, compiled targets) the kernel can always take back
+ */
+static unsigned long long
+anon_memory()
+{
+   unsigned long size, res, shared;
+   FILE *fp;
+   int n;
+   
+   if (!(fp = fopen("/proc/self/statm", "r")))
+     return 0;
+   n = fscanf(fp, "%lu %lu %lu", &size, &res, &shared);
+   fclose(fp);
+   if (n != 3 || res < shared)
+     return 0;
+   return (unsigned long long)(res - shared) * sysconf(_SC_PAGESIZE);
+}
+
+
+/*
+ * hand the request in wbuf to the backend
+ */
+static void
+send_request(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   sl->op_ms = scan_ms(sc);
+   sl->tmo = phase_timeout(sc, sl, 0);
+   if (sc->io->request(sc, sl) == -1)
+     {
+	record(sc, sl, TR_OPFAIL, 0, 0, sc->ebuf, strlen(sc->ebuf));
+	slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&sl->targ->ip), SLOT_VSTR(sl), sc->ebuf);
+	clear_slot(sc, sl);
+     }
+}
+
+
+/*
+ * the UDP ASSOCIATE reply of rl bytes is in rbuf.  send a datagram
+ * through the relay it names and wait for it to come back, keeping
+ * the connection (and so the association) open meanwhile.
+ */
+static void
+start_udp(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   target_t *t = sl->targ;
+   struct sockaddr_storage relay;
+   socklen_t rlen;
+   
+   if (!(rlen = socks5_parse_udp_rep(sl->rbuf, rl, &relay, sc->ebuf, sizeof(sc->ebuf))))
+     {
+	slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+	clear_slot(sc, sl);
+	return;
+     }
+   t->state |= SPSS_5_REP_RECVD;
+   t->state |= SPSS_5_SUCCESSFUL;
+   
+   /* no address means the one we're talking to */
+   if ((relay.ss_family == AF_INET && ((struct sockaddr_in *)&relay)->sin_addr.s_addr == INADDR_ANY)
+       || (relay.ss_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)&relay)->sin6_addr)))
+     rlen = taddr_to_sockaddr(&t->ip, ntohs(((struct sockaddr_in *)&relay)->sin_port), &relay);
+   
+   if (udp_send(sc, sl, &relay, rlen) == -1)
+     {
+	slot_print(sc, sl, "%3d   %-18s %-4s %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+	clear_slot(sc, sl);
+	return;
+     }
+   if (sc->opts->verbose >= 2)
+     slot_print(sc, sl, "%3d   %-18s %-4s udp associate granted, datagram sent\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+   if (sc->io->park)
+     sc->io->park(sc, sl);
+   sl->io_state = SIO_UDP;
+   sc->nudp++;
+   sl->op_ms = scan_ms(sc);
+   sl->tmo = phase_timeout(sc, sl, 0);
+   sl->deadline = sl->op_ms + sl->tmo;
+}
+
+
+/*
+ * ip (how, see net_unreach()) couldn't be reached, learn from it
+ */
+static void
+unreachable(sc, ip, how)
+   scan_t *sc;
+   taddr_t *ip;
+   int how;
+{
+   if (how && pfx_unreachable(&sc->pfx, ip, how == NET_UR_NET) && sc->opts->verbose >= 1)
+     fprintf(stderr, "%s's network is unreachable, writing off the rest of it.\n", taddr_ntoa(ip));
+}
+
+/*
+ * the next module to probe t with, NULL once it's had them all
+ */
+static probe_t *
+next_probe(o, t)
+   opts_t *o;
+   target_t *t;
+{
+   unsigned int i;
+   
+   for (i = 0; i < o->nprobes; i++)
+     if (!(t->state & probe_mods[o->probes[i]]->done))
+       return probe_mods[o->probes[i]];
+   return NULL;
+}
+
+/*
+ * start a pass (one per probe module) on a slot
+ */
+static void
+start_pass(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   target_t *t = sl->targ;
+   
+   /* nothing we can probe it for? */
+   if (!(sl->probe = next_probe(SLOT_OPTS(sc, sl), t)))
+     {
+	clear_slot(sc, sl);
+	return;
+     }
+   sl->salen = taddr_to_sockaddr(&t->ip, t->port, &sl->sa);
+   sl->op_ms = scan_ms(sc);
+   sl->tmo = phase_timeout(sc, sl, 1);
+   sc->eno = 0;
+   if (sc->io->connect(sc, sl) == -1)
+     {
+	/* our own routes say no, for all of it */
+	if (sc->eno == EHOSTUNREACH || sc->eno == ENETUNREACH)
+	  unreachable(sc, &t->ip, sc->eno == ENETUNREACH ? NET_UR_NET : NET_UR_HOST);
+	record(sc, sl, TR_OPFAIL, 0, 0, sc->ebuf, strlen(sc->ebuf));
+	slot_print(sc, sl, "%3d   %-18s %-4s connect failed: %s\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), sc->ebuf);
+	clear_slot(sc, sl);
+	return;
+     }
+   /* conneciton initiated, record the time and update the state */
+   if (sc->opts->verbose >= 2)
+     slot_print(sc, sl, "%3d   %-18s %-4s connecting...\n", sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl));
+   sl->deadline = sl->op_ms + sl->tmo;
+   t->state |= sl->probe->connecting;
+}
+
+
+/*
+ * the slot's probe has its answer.  a reply in some other protocol
+ * than the one asked in means the server speaks only that, so the
+ * probes for the rest are written off without a pass of their own.
+ * then on to the next pass, if there is one.
+ */
+static void
+end_probe(sc, sl, rl)
+   scan_t *sc;
+   scanslot_t *sl;
+   int rl;
+{
+   target_t *t = sl->targ;
+   opts_t *o = SLOT_OPTS(sc, sl);
+   probe_t *pr;
+   unsigned int i;
+   int fam;
+   
+   t->state |= sl->probe->done;
+   if (rl > 0 && (fam = probe_family(sl->rbuf, rl)) != PF_NONE && fam != sl->probe->family)
+     for (i = 0; i < o->nprobes; i++)
+       {
+	  pr = probe_mods[o->probes[i]];
+	  if (pr->family == fam || (t->state & pr->done))
+	    continue;
+	  t->state |= pr->done;
+	  sc->nspared++;
+	  if (sc->opts->verbose >= 2)
+	    slot_print(sc, sl, "%3d   %-18s %-4s answered in another protocol, no %s pass\n",
+		       sl->idx, taddr_ntoa(&t->ip), SLOT_VSTR(sl), pr->name);
+       }
+   if (next_probe(o, t))
+     end_pass(sc, sl);
+   else
+     clear_slot(sc, sl);
+}
+
+
+/*
+ * a pass is over but the target isn't, drop the socket.  the main
+ * loop will start the next pass.
+ */
+static void
+end_pass(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   sc->io->close(sc, sl);
+   sl->gen++;
+}
+
+
+/*
+ * clear a slot to be reused..
+ */
+static void
+clear_slot(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   int cls = cost_class(cache_outcome(sl->targ->state), sl->timedout);
+   
+   if (sl->targ->dest)
+     reach_done(sc, sl);
+   else
+     finish_target(sc, sl->job, sl->targ, (unsigned int)(scan_ms(sc) - sl->start_ms));
+   sl->targ = (target_t *)0;
+   sc->nbusy--;
+   if (sl->job)
+     sl->job->nbusy--;
+   if (sl->io_state == SIO_UDP)
+     sc->nudp--;
+   if (sl->io_state != SIO_IDLE)
+     sc->io->close(sc, sl);
+   sl->gen++;
+   charge_slot(sc, sl, cls);
+}
+
+
+/*
+ * a target (of job, if there are jobs) is done with, after ms
+ * milliseconds: write its result everywhere it goes
+ */
+static void
+finish_target(sc, job, t, ms)
+   scan_t *sc;
+   scanjob_t *job;
+   target_t *t;
+   unsigned int ms;
+{
+   unsigned int o = cache_outcome(t->state);
+   
+   t->state |= SPSS_FINISHED;
+   if (sc->opts->cache)
+     cache_update(&t->ip, t->port, o, scan_time(sc));
+   if (sc->opts->ring)
+     ring_put(t, o, scan_time(sc), ms);
+   if (sc->opts->done)
+     add_target_range(&sc->done, &t->ip, 1, t->port);
+   if (sc->opts->archive)
+     archive_add(t, o, scan_time(sc), ms);
+   if (sc->hook)
+     sc->hook->finished(sc, t);
+   target_gone(sc, job);
+}
+
+
+/*
+ * one less target to go, for the job too
+ */
+static void
+target_gone(sc, job)
+   scan_t *sc;
+   scanjob_t *job;
+{
+   sc->tleft--;
+   if (!job || --job->tleft > 0)
+     return;
+   if (sc->opts->verbose >= 1)
+     fprintf(stderr, "job %s: %lu targets done in %lu seconds.\n", job->name, job->nt,
+	     (unsigned long)(scan_time(sc) - job->start_time));
+   if (job->out)
+     fflush(job->out);
+}
+
+
+/*
+ * the slot is free, put what its target cost on the accounts
+ */
+static void
+charge_slot(sc, sl, cls)
+   scan_t *sc;
+   scanslot_t *sl;
+   int cls;
+{
+   cost_charge(&sc->cost, cls, sl->nsys, sl->nout, sl->nin,
+	       (unsigned int)(scan_ms(sc) - sl->start_ms));
+}
+
+
+/*
+ * the next target from the likeliest tier that has any left (--order)
+ */
+static int
+next_tier(sc, t)
+   scan_t *sc;
+   target_t *t;
+{
+   for (; sc->ntier < ORD_TIERS; sc->ntier++)
+     if (next_target(&sc->tier[sc->ntier], t))
+       return 1;
+   return 0;
+}
+
+/*
+ * a target from the job whose turn it is: the one with the fewest
+ * slots for its weight (then the fewest started), out of the ones with
+ * targets left, a slot to spare and the rate for another
+ * 
+ * returns 1 for a target, 2 for one it put off, 0 for none right now
+ */
+static int
+job_target(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   unsigned long long now = scan_ms(sc), due, a, b;
+   scanjob_t *j, *best = NULL;
+   unsigned int i;
+   
+   sc->job_due = 0;
+   for (i = 0; i < sc->njobs; i++)
+     {
+	j = &sc->jobs[i];
+	if ((j->max && j->nbusy >= j->max)
+	    || (!more_targets(&j->targets) && !more_targets(&j->later)))
+	  continue;
+	if (j->rate)
+	  {
+	     /* top up its allowance, up to a second's worth */
+	     j->tokens += (now - j->tok_ms) * j->rate;
+	     if (j->tokens > j->rate * 1000ULL)
+	       j->tokens = j->rate * 1000ULL;
+	     j->tok_ms = now;
+	     if (j->tokens < 1000)
+	       {
+		  due = now + (1000 - j->tokens + j->rate - 1) / j->rate;
+		  if (!sc->job_due || due < sc->job_due)
+		    sc->job_due = due;
+		  continue;
+	       }
+	  }
+	if (!best)
+	  {
+	     best = j;
+	     continue;
+	  }
+	a = (unsigned long long)j->nbusy * best->weight;
+	b = (unsigned long long)best->nbusy * j->weight;
+	if (a < b || (a == b && j->started * best->weight < best->started * j->weight))
+	  best = j;
+     }
+   if (!best)
+     return 0;
+   sl->job = best;
+   if (next_target(&best->targets, &sl->tgt))
+     return 1;
+   (void) next_target(&best->later, &sl->tgt);
+   return 2;
+}
+
+/*
+ * initialize a slot..
+ */
+static int
+init_slot(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   long n;
+   int prio, i;
+   
+   sl->suspect = 0;
+   sl->retry = 0;
+   for (;;)
+     {
+	sl->job = NULL;
+	/* retries that are due go ahead of everything */
+	if (sc->nrq > 0 && sc->rq[0].due <= scan_ms(sc))
+	  {
+	     rq_pop(sc, &sl->tgt, &sl->job);
+	     sl->retry = 1;
+	     sl->suspect = pfx_tarpit(&sc->pfx, &sl->tgt.ip);
+	     break;
+	  }
+	/* then the proxies found, so they're done with sooner */
+	if (sc->nreach > 0 && reach_target(sc, sl))
+	  break;
+	/* previously open proxies go first */
+	prio = next_target(&sc->prio, &sl->tgt);
+	if (!prio && sc->njobs)
+	  {
+	     /* the jobs take turns */
+	     if ((n = job_target(sc, sl)) == 0)
+	       return 0;
+	     if (n == 2)
+	       {
+		  sl->suspect = 1;
+		  break;
+	       }
+	  }
+	else if (!prio && !next_tier(sc, &sl->tgt) && !next_target(sc->targets, &sl->tgt))
+	  {
+	     /* then whatever was put off */
+	     if (next_target(&sc->later, &sl->tgt))
+	       {
+		  sl->suspect = 1;
+		  break;
+	       }
+	     /* all out, start it over for whatever the hook brings */
+	     free_targets(&sc->later);
+	     /* can we get some more? */
+	     if (!sc->hook || sc->hook_done)
+	       return 0;
+	     if ((n = sc->hook->refill(sc)) <= 0)
+	       {
+		  if (n == -1)
+		    sc->hook_done = 1;
+		  return 0;
+	       }
+	     sc->nt += n;
+	     sc->tleft += n;
+	     continue;
+	  }
+	/* already went out with the open ones? */
+	if (!prio && !TL_EMPTY(&sc->prio) && find_target(&sc->prio, &sl->tgt.ip, sl->tgt.port))
+	  continue;
+	if (sc->opts->cache && cache_check(&sl->tgt.ip, sl->tgt.port, scan_time(sc), sc->opts->cache_ttl) != CACHE_PROBE)
+	  {
+	     sc->skipped++;
+	     if (sc->hook)
+	       sc->hook->finished(sc, &sl->tgt);
+	     target_gone(sc, sl->job);
+	     continue;
+	  }
+	/* in a tarpit?  get to it when everything else is done */
+	if (!prio && pfx_tarpit(&sc->pfx, &sl->tgt.ip)
+	    && defer_target(sc, sl->job ? &sl->job->later : &sc->later, &sl->tgt))
+	  continue;
+	/* nothing there to reach?  it failed like the rest of them */
+	if (!prio && pfx_dead(&sc->pfx, &sl->tgt.ip))
+	  {
+	     slot_print(sc, sl, "%3d   %-18s      unable to connect: %s (skipped)\n", sl->idx,
+			taddr_ntoa(&sl->tgt.ip), strerror(EHOSTUNREACH));
+	     sc->nunreach++;
+	     finish_target(sc, sl->job, &sl->tgt, 0);
+	     continue;
+	  }
+	sc->started++;
+	break;
+     }
+   sl->targ = &sl->tgt;
+   sc->nbusy++;
+   if (sl->job)
+     {
+	sl->job->nbusy++;
+	if (!sl->retry && !sl->tgt.dest)
+	  {
+	     sl->job->started++;
+	     if (sl->job->rate)
+	       sl->job->tokens -= 1000;
+	  }
+     }
+   sl->targ->state |= SPSS_STARTED;
+   sl->start_ms = scan_ms(sc);
+   sl->src_tries = 0;
+   sl->timedout = 0;
+   sl->nsys = sl->nout = sl->nin = 0;
+   /* skip the modules that can't do anything here (v4 can't reach
+    * a non-IPv4 remote, only v5 does udp) */
+   for (i = 0; i < PR_COUNT; i++)
+     if (!probe_mods[i]->usable(SLOT_OPTS(sc, sl)))
+       sl->targ->state |= probe_mods[i]->done;
+   return 1;
+}
+
+
+/*
+ * put a target on a list (tl) of ones to scan last, returns 0 if it
+ * couldn't be
+ */
+static int
+defer_target(sc, tl, t)
+   scan_t *sc;
+   targlist_t *tl;
+   target_t *t;
+{
+   trange_t *r;
+   taddr_t end;
+   
+   /* they come in order, so usually this just grows the last range */
+   if (tl->nr > 0)
+     {
+	r = &tl->r[tl->nr - 1];
+	end = r->base;
+	taddr_add(&end, r->count);
+	if (r->port == t->port && r->count < TRANGE_MAX_COUNT
+	    && !memcmp(end.b, t->ip.b, 16))
+	  {
+	     r->count++;
+	     tl->total++;
+	     sc->deferred++;
+	     return 1;
+	  }
+     }
+   if (add_target_range(tl, &t->ip, 1, t->port) != 1)
+     return 0;
+   tl->total++;
+   sc->deferred++;
+   return 1;
+}
+
+
+/*
+ * write out everything finished so far
+ */
+static void
+save_done(sc)
+   scan_t *sc;
+{
+   (void) sort_targets(&sc->done);
+   if (save_targets(&sc->done, sc->opts->done) == 0 && sc->opts->verbose >= 2)
+     fprintf(stderr, "%llu finished targets saved to %s.\n", sc->done.total, sc->opts->done);
+   sc->done_saved = time(NULL);
+}
+
+
+/*
+ * the slot's pass failed in a way that might not happen again.  if it
+ * has tries left and the budget allows, free the slot and queue the
+ * target to start the pass over after a jittered, doubling delay.
+ * 
+ * returns 1 if it was queued
+ */
+static int
+retry_slot(sc, sl, connecting, why)
+   scan_t *sc;
+   scanslot_t *sl;
+   int connecting;
+   char *why;
+{
+   target_t t = *sl->targ;
+   unsigned int delay, tries = connecting ? t.ctries : t.rtries;
+   
+   if (tries >= (connecting ? sc->opts->connect_retries : sc->opts->reset_retries)
+       || tries >= 255)
+     return 0;
+   /* don't let retries crowd out targets that haven't had a go yet */
+   if ((unsigned long long)sc->nretries * 100 >= (unsigned long long)sc->started * sc->opts->retry_budget)
+     return 0;
+   
+   /* about retry_delay * 2^tries, give or take half */
+   delay = sc->opts->retry_delay << (tries < 10 ? tries : 10);
+   sc->seed = sc->seed * 1103515245 + 12345;
+   delay = delay / 2 + (sc->seed >> 8) % (delay + 1);
+   
+   /* start the pass over */
+   t.state &= ~sl->probe->all;
+   if (connecting)
+     t.ctries++;
+   else
+     t.rtries++;
+   if (rq_push(sc, &t, sl->job, scan_ms(sc) + delay) == -1)
+     return 0;
+   sc->nretries++;
+   if (sc->opts->verbose >= 2)
+     slot_print(sc, sl, "%3d   %-18s %-4s %s, retrying in %ums\n", sl->idx, taddr_ntoa(&t.ip), SLOT_VSTR(sl), why, delay);
+   
+   sl->targ = (target_t *)0;
+   sc->nbusy--;
+   if (sl->job)
+     sl->job->nbusy--;
+   if (sl->io_state != SIO_IDLE)
+     sc->io->close(sc, sl);
+   sl->gen++;
+   charge_slot(sc, sl, CC_RETRY);
+   return 1;
+}
+
+
+/*
+ * queue a target (of job) for retrying at due
+ */
+static int
+rq_push(sc, t, job, due)
+   scan_t *sc;
+   target_t *t;
+   scanjob_t *job;
+   unsigned long long due;
+{
+   unsigned long i, p;
+   
+   if (sc->nrq == sc->narq)
+     {
+	unsigned long na = sc->narq ? sc->narq * 2 : 256;
+	retry_t *rq = (retry_t *)realloc(sc->rq, na * sizeof(retry_t));
+	
+	if (!rq)
+	  return -1;
+	sc->rq = rq;
+	sc->narq = na;
+     }
+   /* sift it up */
+   for (i = sc->nrq++; i > 0; i = p)
+     {
+	p = (i - 1) / 2;
+	if (sc->rq[p].due <= due)
+	  break;
+	sc->rq[i] = sc->rq[p];
+     }
+   sc->rq[i].due = due;
+   sc->rq[i].tgt = *t;
+   sc->rq[i].job = job;
+   return 0;
+}
+
+/*
+ * take the soonest retry off the queue
+ */
+static void
+rq_pop(sc, t, job)
+   scan_t *sc;
+   target_t *t;
+   scanjob_t **job;
+{
+   unsigned long i, c;
+   retry_t last;
+   
+   *t = sc->rq[0].tgt;
+   *job = sc->rq[0].job;
+   last = sc->rq[--sc->nrq];
+   /* sift the last one down from the top */
+   for (i = 0; (c = i * 2 + 1) < sc->nrq; i = c)
+     {
+	if (c + 1 < sc->nrq && sc->rq[c + 1].due < sc->rq[c].due)
+	  c++;
+	if (last.due <= sc->rq[c].due)
+	  break;
+	sc->rq[i] = sc->rq[c];
+     }
+   sc->rq[i] = last;
+}
+
+
+/*
+ * the slot's proxy relayed (or said where it wouldn't), so it gets
+ * asked for the --dest destinations too: a record with -r's verdict
+ * (v) and a '?' for each one its protocol can ask for, see
+ * reach_target().  a row goes out once they're all answered.
+ */
+static void
+reach_add(sc, sl, v)
+   scan_t *sc;
+   scanslot_t *sl;
+   int v;
+{
+   opts_t *o = SLOT_OPTS(sc, sl);
+   reach_t *r;
+   unsigned int i;
+   
+   if (sc->nreach == sc->nareach)
+     {
+	unsigned int na = sc->nareach ? sc->nareach * 2 : 64;
+	reach_t **ra = (reach_t **)realloc(sc->reach, na * sizeof(reach_t *));
+	
+	if (!ra)
+	  {
+	     fprintf(stderr, "Unable to allocate memory to check %s's destinations.\n", taddr_ntoa(&sl->targ->ip));
+	     return;
+	  }
+	sc->reach = ra;
+	sc->nareach = na;
+     }
+   if (!(r = (reach_t *)calloc(1, sizeof(reach_t) + o->ndests + 2)))
+     {
+	fprintf(stderr, "Unable to allocate memory to check %s's destinations.\n", taddr_ntoa(&sl->targ->ip));
+	return;
+     }
+   r->ip = sl->targ->ip;
+   r->port = sl->targ->port;
+   r->probe = sl->probe;
+   r->job = sl->job;
+   r->res = (char *)(r + 1);
+   r->res[0] = v == PV_OPEN ? REACH_YES : REACH_NO;
+   for (i = 0; i < o->ndests; i++)
+     {
+	if (sl->probe->dests & DEST_KIND(&o->dests[i]))
+	  {
+	     r->res[i + 1] = REACH_UNKNOWN;
+	     r->left++;
+	  }
+	else
+	  r->res[i + 1] = REACH_CANT;
+     }
+   if (r->left == 0)
+     {
+	reach_write(sc, r);
+	free(r);
+	return;
+     }
+   sc->reach[sc->nreach++] = r;
+}
+
+/*
+ * the next --dest check into the slot, from the first proxy that has
+ * one to start and isn't at --dest-slots.  the check is a target of
+ * its own, t->dest saying which, with every other module's pass done.
+ * 
+ * returns 0 if none can go right now
+ */
+static int
+reach_target(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   opts_t *o;
+   reach_t *r;
+   unsigned int i, j;
+   
+   for (i = 0; i < sc->nreach; i++)
+     {
+	r = sc->reach[i];
+	o = r->job ? &r->job->opts : sc->opts;
+	while (r->next < o->ndests && r->res[r->next + 1] == REACH_CANT)
+	  r->next++;
+	if (r->next >= o->ndests || r->busy >= o->dest_slots)
+	  continue;
+	memset(&sl->tgt, 0, sizeof(sl->tgt));
+	sl->tgt.ip = r->ip;
+	sl->tgt.port = r->port;
+	for (j = 0; j < PR_COUNT; j++)
+	  if (probe_mods[j] != r->probe)
+	    sl->tgt.state |= probe_mods[j]->done;
+	sl->tgt.dest = ++r->next;
+	r->busy++;
+	sl->job = r->job;
+	return 1;
+     }
+   return 0;
+}
+
+/*
+ * the record the slot's --dest check is for
+ */
+static reach_t *
+reach_find(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   reach_t *r;
+   unsigned int i;
+   
+   for (i = 0; i < sc->nreach; i++)
+     {
+	r = sc->reach[i];
+	if (r->probe == sl->probe && r->job == sl->job && r->port == sl->targ->port
+	    && !memcmp(r->ip.b, sl->targ->ip.b, 16))
+	  return r;
+     }
+   return NULL;
+}
+
+/*
+ * the slot's --dest check is over, answered or not.  the last one
+ * writes out its proxy's row.
+ */
+static void
+reach_done(sc, sl)
+   scan_t *sc;
+   scanslot_t *sl;
+{
+   reach_t *r = reach_find(sc, sl);
+   unsigned int i;
+   
+   if (!r)
+     return;
+   r->busy--;
+   if (--r->left > 0)
+     return;
+   reach_write(sc, r);
+   for (i = 0; sc->reach[i] != r; i++)
+     ;
+   /* keep them in order, the oldest get their checks first */
+   memmove(&sc->reach[i], &sc->reach[i + 1], (sc->nreach - i - 1) * sizeof(reach_t *));
+   sc->nreach--;
+   free(r);
+}
+
+/*
+ * a proxy's row of the matrix: to the results, and --matrix
+ */
+static void
+reach_write(sc, r)
+   scan_t *sc;
+   reach_t *r;
+{
+   FILE *out = r->job ? r->job->out : sc->out;
+   
+   if (out)
+     fprintf(out, "      %-18s %-4s port %u reaches %s\n", taddr_ntoa(&r->ip), r->probe->name, r->port, r->res);
+   if (sc->matrix)
+     fprintf(sc->matrix, "%s %u %s %s\n", taddr_ntoa(&r->ip), r->port, r->probe->name, r->res);
+}
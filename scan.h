@@ -0,0 +1,289 @@
+/*
+ * scan.h: scan engine data types and i/o backend interface
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __scan_h
+#define __scan_h
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "targets.h"
+#include "args.h"
+#include "prefix.h"
+#include "cost.h"
+#include "order.h"
+
+/* what a slot's socket is waiting on */
+#define SIO_IDLE 		0	/* no socket, next pass not started */
+#define SIO_CONNECTING 		1	/* connection in progress */
+#define SIO_SENDING 		2	/* request queued in wbuf */
+#define SIO_RECVING 		3	/* waiting for a reply in rbuf */
+#define SIO_UDP 		4	/* udp associated, waiting on the relay */
+
+/* the backends count the system calls they make for a slot, and the
+ * ones for all of them at once (waiting), see cost.c */
+#define SCAN_SYS(sc, sl, n) 	((sl)->nsys += (n), (sc)->cost.nsys += (n))
+#define SCAN_SHARED_SYS(sc, n) 	((sc)->cost.nsys += (n), (sc)->cost.shared_sys += (n))
+
+/* how often --done is written out while scanning, in seconds */
+#define DONE_SAVE_INTERVAL 	60
+
+/*
+ * how --max-memory is shared out: at most a quarter for the slots and
+ * an eighth for the prefix table, and a target list (or --monitor's
+ * proxies) taking more than a quarter goes out to a file.  once a
+ * second the engine looks at what it really uses and cuts the slots in
+ * use when that gets near the limit, letting them back up well below.
+ */
+#define MEM_SLOT_SHARE 		4
+#define MEM_PFX_SHARE 		8
+#define MEM_TARGET_SHARE 	4
+#define MEM_HIGH_PCT 		90
+#define MEM_LOW_PCT 		75
+
+/* what a slot costs beyond the scanslot_t, backend and all */
+#define MEM_SLOT_EXTRA 		64
+
+/* what a slot's target is probed with */
+#define SLOT_OPTS(sc, sl) 	((sl)->job ? &(sl)->job->opts : (sc)->opts)
+#define SLOT_RTO(sc, sl) 	((sl)->job ? (sl)->job->rto : (sc)->rto)
+
+/*
+ * a scan job (--jobs): its own targets, relay destination, username,
+ * timeouts and output, sharing the engine's slots with the other jobs.
+ * slots go to the job with the fewest for its weight, at most max of
+ * them and rate new targets a second if it has those.
+ */
+typedef struct scanjob_stru
+{
+   char *name;
+   opts_t opts;			/* remote, username and the timeouts are used */
+   FILE *out;
+   targlist_t targets;
+   targlist_t later;		/* its targets in tarpits, scanned last */
+   unsigned int weight;
+   unsigned int max;		/* slots, 0 for no limit */
+   unsigned int rate;		/* targets started a second, 0 for no limit */
+   unsigned int rto;
+   unsigned int nbusy;		/* slots it has */
+   unsigned long nt, tleft;
+   unsigned long long started;
+   unsigned long long tokens;	/* thousandths of a target it may start */
+   unsigned long long tok_ms;	/* when they were topped up */
+   time_t start_time;
+} scanjob_t;
+
+/* one request of a probe, see probe.c */
+typedef struct
+{
+   char *name;			/* "%s request", "%s reply" */
+   unsigned long sent;		/* SPSS_* bit once it's written */
+   int onward;			/* the proxy connects on before it replies */
+} probestep_t;
+
+struct probe_stru;
+
+/* one parallel connection attempt */
+typedef struct
+{
+   int sd;
+   target_t *targ;
+   target_t tgt;
+   scanjob_t *job;		/* whose target it is, if there are jobs */
+   struct probe_stru *probe;	/* the module this pass is for */
+   probestep_t *step;		/* and its request in wbuf */
+   unsigned long long start_ms;	/* when the target got the slot */
+   unsigned long long op_ms;	/* when the connect/request started */
+   unsigned long long deadline;	/* give up on the connect/reply then */
+   unsigned int tmo;		/* milliseconds the connect/reply gets */
+   unsigned int idx;
+   unsigned int gen;		/* bumped each time the socket goes away */
+   unsigned int src_tries;	/* source addresses tried this pass */
+   int suspect;			/* in a tarpit prefix, short reply deadline */
+   int retry;			/* the target is being retried */
+   int io_state;
+   int timedout;		/* gave up waiting on it */
+   unsigned int nsys;		/* system calls made for the target */
+   unsigned int nout, nin;	/* bytes sent and received */
+   unsigned int cookie;		/* in the datagram sent through the relay */
+   struct sockaddr_storage sa;
+   socklen_t salen;
+   char wbuf[600];
+   int wlen;
+   char rbuf[512];
+} scanslot_t;
+
+/* a target waiting to be retried */
+typedef struct
+{
+   unsigned long long due;
+   target_t tgt;
+   scanjob_t *job;
+} retry_t;
+
+/*
+ * a proxy found relaying, being asked for the --dest destinations.
+ * res has a REACH_* for -r and then each of them, see reach_add().
+ */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   struct probe_stru *probe;	/* the protocol it relayed in */
+   scanjob_t *job;
+   unsigned int next;		/* --dest checks started */
+   unsigned int busy;		/* and going */
+   unsigned int left;		/* and not finished */
+   char *res;
+} reach_t;
+
+struct scanio_stru;
+struct scanhook_stru;
+struct udp_stru;
+
+/* the engine itself */
+typedef struct
+{
+   opts_t *opts;		/* the settings this engine runs with */
+   FILE *out;			/* where the results are printed, if anywhere */
+   int status_fd;		/* give status when this is readable, -1 for never */
+   targlist_t *targets;
+   targlist_t prio;		/* cached open targets, scanned first */
+   targlist_t tier[ORD_TIERS];	/* --order: the targets, likeliest first */
+   unsigned int ntier;		/* the one being scanned */
+   scanslot_t *slots;
+   unsigned int nslots;
+   unsigned int nbusy;		/* slots with a target */
+   unsigned int slot_limit;	/* how many may have one (--max-memory) */
+   time_t mem_checked;
+   int mem_warned;		/* said we went over it */
+   unsigned long nt, tleft;
+   unsigned long skipped;	/* recently scanned according to the cache */
+   unsigned int rto;		/* how long to wait for a reply */
+   pfxtab_t pfx;		/* tarpits and round trip times per prefix */
+   targlist_t later;		/* targets in those, scanned last */
+   unsigned long nsilent, deferred;
+   unsigned long nunreach;	/* written off in unreachable prefixes */
+   unsigned long nspared;	/* passes a reply in another protocol made moot */
+   retry_t *rq;			/* the retries, a heap on due */
+   unsigned long nrq, narq;
+   unsigned long started;	/* targets started, not counting retries */
+   unsigned long nretries, nrescued;
+   targlist_t done;		/* finished targets, for --done */
+   time_t done_saved;
+   cost_t cost;			/* what the probes cost */
+   unsigned int seed;		/* for jittering the retries */
+   time_t start_time;
+   int vclock;			/* the backend keeps the time (replay) */
+   unsigned long long vnow;	/* virtual ms since it started */
+   time_t vbase;
+   unsigned int next_source;	/* round robin over options.sources */
+   reach_t **reach;		/* proxies having their --dest checked */
+   unsigned int nreach, nareach;
+   FILE *matrix;		/* where their rows go (--matrix) */
+   struct udp_stru *udp;	/* the shared sockets for --udp */
+   unsigned long nudp;		/* slots waiting on a relay */
+   struct scanio_stru *io;
+   void *iop;			/* backend private data */
+   scanjob_t *jobs;		/* the jobs sharing it, if any */
+   unsigned int njobs;
+   unsigned long long job_due;	/* when a rate limited job may start another */
+   struct scanhook_stru *hook;	/* where more targets come from, if anywhere */
+   void *hook_arg;
+   int hook_done;		/* the hook has nothing more for us */
+   char ebuf[256];
+   int eno;			/* the errno behind ebuf, if there was one */
+} scan_t;
+
+/*
+ * an i/o backend.  it moves bytes and reports back through the
+ * scan_* event functions below, the protocol handling stays in scan.c
+ */
+typedef struct scanio_stru
+{
+   char *name;
+   int timeouts;		/* backend enforces the timeouts itself */
+   int (*init)(scan_t *);
+   void (*fini)(scan_t *);
+   int (*connect)(scan_t *, scanslot_t *);
+   int (*request)(scan_t *, scanslot_t *);
+   void (*close)(scan_t *, scanslot_t *);
+   /* stop watching the socket but leave it open (SIO_UDP), if the
+    * backend would otherwise keep on about it */
+   void (*park)(scan_t *, scanslot_t *);
+   int (*wait)(scan_t *, int);
+   int (*fd)(scan_t *);		/* one descriptor to poll on, if there is one */
+} scanio_t;
+
+/*
+ * a probe module.  it builds the requests for one protocol and judges
+ * the replies, the engine does everything else
+ */
+typedef struct probe_stru
+{
+   char *name;			/* for --probes and the results */
+   int family;			/* PF_*, see probe.h */
+   unsigned int dests;		/* PD_*, the destinations it can ask for */
+   unsigned long connecting;	/* its SPSS_* bits: for the pass starting, */
+   unsigned long connected;	/* the connection working, */
+   unsigned long done;		/* the pass being over, */
+   unsigned long all;		/* and everything to clear to start over */
+   int (*usable)(opts_t *);	/* can it do anything with these settings */
+   /* the first request into wbuf, returns its length or 0 (ebuf) */
+   int (*request)(scan_t *, scanslot_t *);
+   /* the reply of rl bytes in rbuf (rl <= 0 failed, see errno), PV_* */
+   int (*reply)(scan_t *, scanslot_t *, int);
+} probe_t;
+
+/*
+ * for feeding the engine targets as it goes instead of all up front
+ * (ie. a worker getting chunks from a coordinator)
+ */
+typedef struct scanhook_stru
+{
+   /* out of targets, put more in sc->targets.  returns how many were
+    * added, 0 for none right now, -1 for none ever again */
+   long (*refill)(scan_t *);
+   /* a target is done with, probed or not */
+   void (*finished)(scan_t *, target_t *);
+   /* called once per trip around the main loop */
+   void (*tick)(scan_t *);
+} scanhook_t;
+
+/* available backends */
+extern scanio_t scanio_epoll;
+extern scanio_t scanio_select;
+extern scanio_t scanio_uring;
+extern scanio_t scanio_replay;
+
+/* the probe modules, by PR_* */
+extern probe_t *probe_mods[];
+int probe_usable(opts_t *);
+
+/* prototypes */
+void scan_targets(targlist_t *, unsigned long, scanhook_t *);
+int scan_init(scan_t *, opts_t *, targlist_t *, unsigned long, scanhook_t *);
+void scan_jobs(scan_t *, scanjob_t *, unsigned int);
+int scan_step(scan_t *, int);
+void scan_fini(scan_t *);
+scanio_t *scan_backend(char *);
+void scan_print(scan_t *, char *, ...);
+time_t scan_time(scan_t *);
+unsigned long long scan_ms(scan_t *);
+
+/* for the backends */
+int scan_socket(scan_t *, scanslot_t *, int);
+
+/* events reported by the backends */
+void scan_connected(scan_t *, scanslot_t *, int);
+void scan_sent(scan_t *, scanslot_t *, int, int);
+void scan_received(scan_t *, scanslot_t *, int, int);
+void scan_timeout(scan_t *, scanslot_t *);
+void scan_udp_reply(scan_t *, scanslot_t *, int);
+void scan_status(scan_t *);
+
+#endif
@@ -1,6 +1,6 @@
 /*
  * socks4.c: SOCKS v4 proxy negotiation code
- *
+ * 
  * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
  * 
  * 1998-11-04 	started 
@@ -8,6 +8,9 @@
  * 2002-09-30	re-arranged for asyncronous use
  * 2002-10-02	added error buffer parameters
  * 		fixed some possible out of bounds writes
+ * 2026-10-19	take a generic sockaddr, refuse non-IPv4 destinations
+ * 		split building/parsing from the socket i/o
+ * 		SOCKS v4a requests
  */
 
 #include <stdio.h>
@@ -49,17 +52,33 @@ socks4_error(int cd)
 
 
 /*
- * send a socks4 connect request
+ * build a socks4 connect request into req
+ * 
+ * returns the length of the request, or 0 on error
  */
 int
-socks4_send_connect_req(s, srv, user, eb, ebl)
-   int s;
-   struct sockaddr_in srv;
+socks4_build_connect_req(req, rsz, dst, user, eb, ebl)
+   char *req;
+   int rsz;
+   struct sockaddr *dst;
    char *user, *eb;
    unsigned int ebl;
 {
-   char req[512], *p;
-   int wl, rl;
+   struct sockaddr_in srv;
+   char *p;
+   int rl;
+   
+   /* SOCKS v4 can only talk about IPv4 destinations */
+   if (dst->sa_family != AF_INET)
+     {
+	if (eb)
+	  {
+	     strncpy(eb, "SOCKS v4 cannot connect to non-IPv4 destinations", ebl-1);
+	     eb[ebl-1] = '\0';
+	  }
+	return 0;
+     }
+   memcpy(&srv, dst, sizeof(srv));
    
    p = req;
    *(p++) = SOCKS4_VERSION;
@@ -70,19 +89,76 @@ socks4_send_connect_req(s, srv, user, eb, ebl)
    p += 4;
    /* copy up to the remainder of the request buffer,
     * leaving space for a null.. */
-   rl = sizeof(req) - (int)(p - req) - 1;
+   rl = rsz - (int)(p - req) - 1;
    if (strlen(user) < rl)
      rl = strlen(user);
-   strncpy(p, user, rl);
+   memcpy(p, user, rl);
    p += rl;
    *p++ = '\0';
-   rl = (int)(p - req);
-
+   
 #ifdef SOCKS_DEBUG
    fprintf(stderr, "SOCKS4: Connecting through proxy to: %s:%u...\n",
 	  inet_ntoa(srv.sin_addr), ntohs(srv.sin_port));
 #endif
+   return (int)(p - req);
+}
+
+
+/*
+ * build a socks4a connect request for host (a name, resolved by the
+ * proxy) and port into req
+ * 
+ * returns the length of the request, or 0 on error
+ */
+int
+socks4a_build_connect_req(req, rsz, host, port, user, eb, ebl)
+   char *req;
+   int rsz;
+   char *host;
+   unsigned short port;
+   char *user, *eb;
+   unsigned int ebl;
+{
+   int ul = strlen(user), hl = strlen(host);
+   
+   if (8 + ul + 1 + hl + 1 > rsz)
+     {
+	if (eb)
+	  {
+	     strncpy(eb, "SOCKS v4a request too long", ebl-1);
+	     eb[ebl-1] = '\0';
+	  }
+	return 0;
+     }
+   
+   req[0] = SOCKS4_VERSION;
+   req[1] = SOCKS_CONNECT;
+   req[2] = port >> 8;
+   req[3] = port & 0xff;
+   /* 0.0.0.x, x != 0, means the name follows */
+   memcpy(req + 4, "\0\0\0\1", 4);
+   memcpy(req + 8, user, ul + 1);
+   memcpy(req + 8 + ul + 1, host, hl + 1);
+   return 8 + ul + 1 + hl + 1;
+}
+
 
+/*
+ * send a socks4 connect request
+ */
+int
+socks4_send_connect_req(s, dst, user, eb, ebl)
+   int s;
+   struct sockaddr *dst;
+   char *user, *eb;
+   unsigned int ebl;
+{
+   char req[512];
+   int wl, rl;
+   
+   if (!(rl = socks4_build_connect_req(req, sizeof(req), dst, user, eb, ebl)))
+     return 0;
+   
    if ((wl = write(s, req, rl)) != rl)
      {
 #ifdef SOCKS_DEBUG
@@ -110,26 +186,28 @@ socks4_send_connect_req(s, srv, user, eb, ebl)
 
 
 /*
- * read a socks4 connect reply
+ * check a socks4 connect reply of rl bytes
+ * 
+ * rl <= 0 means the read failed (errno is used when it is -1)
  */
 int
-socks4_recv_connect_rep(s, eb, ebl)
-   int s;
+socks4_parse_connect_rep(rep, rl, eb, ebl)
+   char *rep;
+   int rl;
    char *eb;
    unsigned int ebl;
 {
-   char rep[128];
-   int rl;
-   
 #ifdef SOCKS_DEBUG
+   char tb[128];
+   
    /* check the error buffer.. */
    if (!eb)
      {
-	eb = rep;
-	ebl = sizeof(rep);
+	eb = tb;
+	ebl = sizeof(tb);
      }
 #endif
-   if ((rl = read(s, rep, sizeof(rep))) <= 0)
+   if (rl <= 0)
      {
 	if (eb)
 	  {
@@ -142,11 +220,12 @@ socks4_recv_connect_rep(s, eb, ebl)
 #endif
 	return 0;
      }
-   if (rep[1] != 90)
+   if (rl < 2 || rep[1] != 90)
      {
 	if (eb)
 	  {
-	     snprintf(eb, ebl-1, "unable to connect through proxy: %s", socks4_error((int)rep[1]));
+	     snprintf(eb, ebl-1, "unable to connect through proxy: %s",
+		      rl < 2 ? "Short reply" : socks4_error((int)rep[1]));
 	     eb[ebl-1] = '\0';
 	  }
 #ifdef SOCKS_DEBUG
@@ -158,13 +237,28 @@ socks4_recv_connect_rep(s, eb, ebl)
 }
 
 
+/*
+ * read a socks4 connect reply
+ */
+int
+socks4_recv_connect_rep(s, eb, ebl)
+   int s;
+   char *eb;
+   unsigned int ebl;
+{
+   char rep[128];
+   
+   return socks4_parse_connect_rep(rep, read(s, rep, sizeof(rep)), eb, ebl);
+}
+
+
 /*
  * try to negotiate a SOCKS4 connection.
  */
 int
 socks4_connect(s, server, user, ebuf, ebl)
    int s;
-   struct sockaddr_in server;
+   struct sockaddr *server;
    char *user, *ebuf;
    unsigned int ebl;
 {
@@ -20,9 +20,13 @@
 
 /* function prototypes */
 	char	*socks4_error(int);
-	int	socks4_connect(int, struct sockaddr_in, char *, char *, unsigned int);
+	int	socks4_connect(int, struct sockaddr *, char *, char *, unsigned int);
 /* these are called by socks4_connect, but it blocks while using them */
-	int	socks4_send_connect_req(int, struct sockaddr_in, char *, char *, unsigned int);
+	int	socks4_send_connect_req(int, struct sockaddr *, char *, char *, unsigned int);
 	int	socks4_recv_connect_rep(int, char *, unsigned int);
+/* the buffer based halves of the above, for callers doing their own i/o */
+	int	socks4_build_connect_req(char *, int, struct sockaddr *, char *, char *, unsigned int);
+	int	socks4_parse_connect_rep(char *, int, char *, unsigned int);
+	int	socks4a_build_connect_req(char *, int, char *, unsigned short, char *, char *, unsigned int);
 
 #endif
@@ -2,7 +2,7 @@
  * socks5.c: SOCKS v5 proxy negotiation routines
  * 
  * currently supports AUTH_NONE and AUTH_PASSWD
- *
+ * 
  * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
  * 
  * 1998-11-04 	started
@@ -11,6 +11,10 @@
  * 2002-01-13	redesigned to be more asyncronous
  * 2002-10-02 	added error buffer parameters
  * 		added bounds checking to user/pass length
+ * 2026-10-19	added IPv6 destinations (ATYP_IPV6ADDR)
+ * 		split building/parsing from the socket i/o
+ * 		UDP ASSOCIATE requests and datagram headers
+ * 		connect requests by name (ATYP_HOSTNAME)
  */
 
 #include <stdio.h>
@@ -23,6 +27,9 @@
 
 #include "socks5.h"
 
+static int socks5_write(int, char *, int, char *, char *, unsigned int);
+static int socks5_put_addr(char *, struct sockaddr *);
+
 char *
 socks5_error(int cd)
 {
@@ -61,42 +68,33 @@ socks5_error(int cd)
 }
 
 /*
- * send a socks auth request
+ * write out a request that was built by one of the functions below
  */
-int
-socks5_send_auth_req(s, eb, ebl)
+static int
+socks5_write(s, req, rl, what, eb, ebl)
    int s;
-   char *eb;
+   char *req;
+   int rl;
+   char *what, *eb;
    unsigned int ebl;
 {
-   char req[512], *p;
-   int rl, wl;
-   
-#ifdef SOCKS_DEBUG
-   fprintf(stderr, "SOCKS5: sending supported auth type request\n");
-#endif
-   p = req;
-   *p++ = SOCKS5_VERSION;
-   *p++ = 2;
-   *p++ = SOCKS5_AUTH_NONE;
-   *p++ = SOCKS5_AUTH_PASSWD;
+   int wl;
    
-   rl = (int)(p - req);
    if ((wl = write(s, req, rl)) != rl)
      {
 #ifdef SOCKS_DEBUG
 	if (!eb)
 	  {
 	     eb = req;
-	     ebl = sizeof(req);
+	     ebl = rl;
 	  }
 #endif
 	if (eb)
 	  {
 	     if (wl == -1)
-	       snprintf(eb, ebl-1, "error writing auth proposal: %s", strerror(errno));
+	       snprintf(eb, ebl-1, "error writing %s: %s", what, strerror(errno));
 	     else
-	       snprintf(eb, ebl-1, "only wrote %d bytes of auth proposal", wl);
+	       snprintf(eb, ebl-1, "only wrote %d bytes of %s", wl, what);
 	     eb[ebl-1] = '\0';
 	  }
 #ifdef SOCKS_DEBUG
@@ -108,26 +106,64 @@ socks5_send_auth_req(s, eb, ebl)
 }
 
 /*
- * read/analyze a socks response
+ * build a socks auth request, returns its length
  */
 int
-socks5_recv_auth_rep(s, eb, ebl)
+socks5_build_auth_req(req, rsz)
+   char *req;
+   int rsz;
+{
+   char *p;
+   
+#ifdef SOCKS_DEBUG
+   fprintf(stderr, "SOCKS5: sending supported auth type request\n");
+#endif
+   p = req;
+   *p++ = SOCKS5_VERSION;
+   *p++ = 2;
+   *p++ = SOCKS5_AUTH_NONE;
+   *p++ = SOCKS5_AUTH_PASSWD;
+   return (int)(p - req);
+}
+
+/*
+ * send a socks auth request
+ */
+int
+socks5_send_auth_req(s, eb, ebl)
    int s;
    char *eb;
    unsigned int ebl;
 {
-   char rep[128];
-   int rl;
+   char req[512];
+   
+   return socks5_write(s, req, socks5_build_auth_req(req, sizeof(req)),
+		       "auth proposal", eb, ebl);
+}
 
+/*
+ * analyze a socks auth response of rl bytes
+ * 
+ * rl <= 0 means the read failed (errno is used when it is -1)
+ */
+int
+socks5_parse_auth_rep(rep, rl, eb, ebl)
+   char *rep;
+   int rl;
+   char *eb;
+   unsigned int ebl;
+{
 #ifdef SOCKS_DEBUG
+   char tb[128];
+   
    fprintf(stderr, "SOCKS5: reading supported auth type response\n");
    if (!eb)
      {
-	eb = rep;
-	ebl = sizeof(rep);
+	eb = tb;
+	ebl = sizeof(tb);
      }
 #endif
-   if ((rl = read(s, rep, sizeof(rep))) < 1)
+   if (rl < 1)
      {
 	if (eb)
 	  {
@@ -140,6 +176,15 @@ socks5_recv_auth_rep(s, eb, ebl)
 #endif
         return 0;
      }
+   if (rl < 2)
+     {
+	if (eb)
+	  {
+	     strncpy(eb, "short auth reply", ebl-1);
+	     eb[ebl-1] = '\0';
+	  }
+	return 0;
+     }
    if (rep[0] == 0 && rep[1] == 0x5b)
      {
 	if (eb)
@@ -180,27 +225,44 @@ socks5_recv_auth_rep(s, eb, ebl)
 }
 
 /*
- * send the username/password
+ * read/analyze a socks response
  */
 int
-socks5_send_userpass_req(s, user, pass, eb, ebl)
+socks5_recv_auth_rep(s, eb, ebl)
    int s;
+   char *eb;
+   unsigned int ebl;
+{
+   char rep[128];
+   
+   return socks5_parse_auth_rep(rep, read(s, rep, sizeof(rep)), eb, ebl);
+}
+
+/*
+ * build the username/password request, returns its length or 0
+ */
+int
+socks5_build_userpass_req(req, rsz, user, pass, eb, ebl)
+   char *req;
+   int rsz;
    char *user, *pass, *eb;
    unsigned int ebl;
 {
-   char req[768], *p;
-   int rl, wl;
+   char *p;
    
 #ifdef SOCKS_DEBUG
+   char tb[128];
+   
    if (!eb)
      {
-	eb = req;
-	ebl = sizeof(req);
+	eb = tb;
+	ebl = sizeof(tb);
      }
 #endif
    /* check out username and password */
    if (!user || !*user || strlen(user) > 255
-       || !pass || !*pass || strlen(pass) > 255)
+       || !pass || !*pass || strlen(pass) > 255
+       || 3 + strlen(user) + strlen(pass) > rsz)
      {
 	if (eb)
 	  {
@@ -218,52 +280,52 @@ socks5_send_userpass_req(s, user, pass, eb, ebl)
    p = req;
    *(p++) = 0x01;
    *(p++) = (char)strlen(user);
-   strcpy(p, user);
+   memcpy(p, user, strlen(user));
    p += strlen(user);
    *(p++) = strlen(pass);
-   strcpy(p, pass);
+   memcpy(p, pass, strlen(pass));
    p += strlen(pass);
-   rl = (int)(p - req);
-   
-   if ((wl = write(s, req, rl)) != rl)
-     {
-	if (eb)
-	  {
-	     if (wl == -1)
-	       snprintf(eb, ebl-1, "error writing user/pass request: %s", strerror(errno));
-	     else
-	       snprintf(eb, ebl-1, "only wrote %d bytes of user/pass request", wl);
-	     eb[ebl-1] = '\0';
-	  }
-#ifdef SOCKS_DEBUG
-	fprintf(stderr, "SOCKS5: %s\n", eb);
-#endif
-	return 0;
-     }
-   return 1;
+   return (int)(p - req);
 }
 
 /*
- * read the user/pass response
+ * send the username/password
  */
 int
-socks5_recv_userpass_rep(s, eb, ebl)
+socks5_send_userpass_req(s, user, pass, eb, ebl)
    int s;
-   char *eb;
+   char *user, *pass, *eb;
    unsigned int ebl;
 {
-   char rep[128];
+   char req[768];
    int rl;
    
+   if (!(rl = socks5_build_userpass_req(req, sizeof(req), user, pass, eb, ebl)))
+     return 0;
+   return socks5_write(s, req, rl, "user/pass request", eb, ebl);
+}
+
+/*
+ * check the user/pass response of rl bytes
+ */
+int
+socks5_parse_userpass_rep(rep, rl, eb, ebl)
+   char *rep;
+   int rl;
+   char *eb;
+   unsigned int ebl;
+{
 #ifdef SOCKS_DEBUG
+   char tb[128];
+   
    fprintf(stderr, "SOCKS5: reading user/pass response\n");
    if (!eb)
      {
-	eb = rep;
-	ebl = sizeof(rep);
+	eb = tb;
+	ebl = sizeof(tb);
      }
 #endif
-   if ((rl = read(s, rep, sizeof(rep))) == -1)
+   if (rl < 1)
      {
 	if (eb)
 	  {
@@ -276,7 +338,7 @@ socks5_recv_userpass_rep(s, eb, ebl)
 #endif
 	return 0;
      }
-   if (rep[1] != 0)
+   if (rl < 2 || rep[1] != 0)
      {
 	if (eb)
 	  {
@@ -294,70 +356,131 @@ socks5_recv_userpass_rep(s, eb, ebl)
    return 1;
 }
 
-
 /*
- * send a socks5 connect request...
+ * read the user/pass response
  */
 int
-socks5_send_connect_req(s, server, eb, ebl)
+socks5_recv_userpass_rep(s, eb, ebl)
    int s;
-   struct sockaddr_in server;
    char *eb;
    unsigned int ebl;
 {
-   char req[128], *p;
-   int wl, rl;
+   char rep[128];
+   
+   return socks5_parse_userpass_rep(rep, read(s, rep, sizeof(rep)), eb, ebl);
+}
+
+
+/*
+ * build a socks5 connect request, returns its length
+ */
+int
+socks5_build_connect_req(req, rsz, server)
+   char *req;
+   int rsz;
+   struct sockaddr *server;
+{
+   char *p;
+#ifdef SOCKS_DEBUG
+   char tb[INET6_ADDRSTRLEN];
+#endif
    
    p = req;
    *p++ = SOCKS5_VERSION;
    *p++ = SOCKS5_CMD_CONNECT;
    *p++ = 0;
-   *p++ = SOCKS5_ATYP_IPV4ADDR;
-   memcpy(p, &(server.sin_addr.s_addr), 4);
-   p += 4;
-   memcpy(p, &(server.sin_port), 2);
-   p += 2;
-   
-#ifdef SOCKS_DEBUG
-   fprintf(stderr, "SOCKS5: Connecting through proxy to: %s:%u...\n",
-	   inet_ntoa(server.sin_addr), ntohs(server.sin_port));
-   if (!eb)
+   if (server->sa_family == AF_INET6)
      {
-	eb = req;
-	ebl = sizeof(req);
-     }
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)server;
+	
+	*p++ = SOCKS5_ATYP_IPV6ADDR;
+	memcpy(p, &(sin6->sin6_addr), 16);
+	p += 16;
+	memcpy(p, &(sin6->sin6_port), 2);
+	p += 2;
+#ifdef SOCKS_DEBUG
+	inet_ntop(AF_INET6, &(sin6->sin6_addr), tb, sizeof(tb));
 #endif
-   rl = (int)(p - req);
-   if ((wl = write(s, req, rl)) != 10)
+     }
+   else
      {
-	if (eb)
-	  {
-	     if (wl == -1)
-	       snprintf(eb, ebl-1, "error writing connect request: %s", strerror(errno));
-	     else
-	       snprintf(eb, ebl-1, "only wrote %d bytes of connect request", wl);
-	     eb[ebl-1] = '\0';
-	  }
+	struct sockaddr_in *sin = (struct sockaddr_in *)server;
+	
+	*p++ = SOCKS5_ATYP_IPV4ADDR;
+	memcpy(p, &(sin->sin_addr.s_addr), 4);
+	p += 4;
+	memcpy(p, &(sin->sin_port), 2);
+	p += 2;
 #ifdef SOCKS_DEBUG
-	fprintf(stderr, "SOCKS5: %s\n", eb);
+	inet_ntop(AF_INET, &(sin->sin_addr), tb, sizeof(tb));
 #endif
-	return 0;
      }
-   return 1;
+   
+#ifdef SOCKS_DEBUG
+   fprintf(stderr, "SOCKS5: Connecting through proxy to: %s:%u...\n",
+	   tb, ntohs(((struct sockaddr_in *)server)->sin_port));
+#endif
+   return (int)(p - req);
 }
 
 
 /*
- * receive a socks5 connect response
+ * build a socks5 connect request for host (a name, resolved by the
+ * proxy) and port.  returns its length, or 0 if it doesn't fit.
  */
 int
-socks5_recv_connect_rep(s, eb, ebl)
+socks5_build_connect_name_req(req, rsz, host, port)
+   char *req;
+   int rsz;
+   char *host;
+   unsigned short port;
+{
+   int hl = strlen(host);
+   
+   if (hl > 255 || 7 + hl > rsz)
+     return 0;
+   req[0] = SOCKS5_VERSION;
+   req[1] = SOCKS5_CMD_CONNECT;
+   req[2] = 0;
+   req[3] = SOCKS5_ATYP_HOSTNAME;
+   req[4] = (char)hl;
+   memcpy(req + 5, host, hl);
+   req[5 + hl] = port >> 8;
+   req[6 + hl] = port & 0xff;
+#ifdef SOCKS_DEBUG
+   fprintf(stderr, "SOCKS5: Connecting through proxy to: %s:%u...\n", host, port);
+#endif
+   return 7 + hl;
+}
+
+
+/*
+ * send a socks5 connect request...
+ */
+int
+socks5_send_connect_req(s, server, eb, ebl)
    int s;
+   struct sockaddr *server;
    char *eb;
    unsigned int ebl;
 {
    char req[128];
+   
+   return socks5_write(s, req, socks5_build_connect_req(req, sizeof(req), server),
+		       "connect request", eb, ebl);
+}
+
+
+/*
+ * check a socks5 connect response of rl bytes
+ */
+int
+socks5_parse_connect_rep(req, rl, eb, ebl)
+   char *req;
    int rl;
+   char *eb;
+   unsigned int ebl;
+{
 #ifdef SOCKS_DEBUG
    char tb[256];
    struct sockaddr_in sin;
@@ -370,7 +493,7 @@ socks5_recv_connect_rep(s, eb, ebl)
 	ebl = sizeof(tb);
      }
 #endif
-   if ((rl = read(s, req, sizeof(req))) < 1)
+   if (rl < 1)
      {
 	if (eb)
 	  {
@@ -383,7 +506,7 @@ socks5_recv_connect_rep(s, eb, ebl)
 #endif
 	return 0;
      }
-   if (req[0] != SOCKS5_VERSION)
+   if (req[0] != SOCKS5_VERSION || rl < 4)
      {
 	if (eb)
 	  {
@@ -461,20 +584,176 @@ socks5_recv_connect_rep(s, eb, ebl)
 }
 
 
+/*
+ * receive a socks5 connect response
+ */
+int
+socks5_recv_connect_rep(s, eb, ebl)
+   int s;
+   char *eb;
+   unsigned int ebl;
+{
+   char req[128];
+   
+   return socks5_parse_connect_rep(req, read(s, req, sizeof(req)), eb, ebl);
+}
+
+
+/*
+ * put the ATYP, address and port of sa at p, returns how many bytes
+ * that took (at most 19)
+ */
+static int
+socks5_put_addr(p, sa)
+   char *p;
+   struct sockaddr *sa;
+{
+   if (sa->sa_family == AF_INET6)
+     {
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)sa;
+	
+	p[0] = SOCKS5_ATYP_IPV6ADDR;
+	memcpy(p + 1, &(sin6->sin6_addr), 16);
+	memcpy(p + 17, &(sin6->sin6_port), 2);
+	return 19;
+     }
+   else
+     {
+	struct sockaddr_in *sin = (struct sockaddr_in *)sa;
+	
+	p[0] = SOCKS5_ATYP_IPV4ADDR;
+	memcpy(p + 1, &(sin->sin_addr.s_addr), 4);
+	memcpy(p + 5, &(sin->sin_port), 2);
+	return 7;
+     }
+}
+
+
+/*
+ * build a socks5 UDP ASSOCIATE request, client is where our datagrams
+ * will come from (all zeros if we can't say).  returns its length.
+ */
+int
+socks5_build_udp_req(req, rsz, client)
+   char *req;
+   int rsz;
+   struct sockaddr *client;
+{
+   if (rsz < 22)
+     return 0;
+   req[0] = SOCKS5_VERSION;
+   req[1] = SOCKS5_CMD_UDP;
+   req[2] = 0;
+   return 3 + socks5_put_addr(req + 3, client);
+}
+
+/*
+ * check a socks5 UDP ASSOCIATE reply of rl bytes and get the address
+ * of the relay out of it.  returns the length of that address, or 0
+ * (with the reason in eb) if there isn't one.
+ */
+int
+socks5_parse_udp_rep(rep, rl, relay, eb, ebl)
+   char *rep;
+   int rl;
+   struct sockaddr_storage *relay;
+   char *eb;
+   unsigned int ebl;
+{
+   if (!socks5_parse_connect_rep(rep, rl, eb, ebl))
+     return 0;
+   memset(relay, 0, sizeof(*relay));
+   if (rep[3] == SOCKS5_ATYP_IPV4ADDR && rl >= 10)
+     {
+	struct sockaddr_in *sin = (struct sockaddr_in *)relay;
+	
+	sin->sin_family = AF_INET;
+	memcpy(&(sin->sin_addr.s_addr), rep + 4, 4);
+	memcpy(&(sin->sin_port), rep + 8, 2);
+	return sizeof(struct sockaddr_in);
+     }
+   if (rep[3] == SOCKS5_ATYP_IPV6ADDR && rl >= 22)
+     {
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)relay;
+	
+	sin6->sin6_family = AF_INET6;
+	memcpy(&(sin6->sin6_addr), rep + 4, 16);
+	memcpy(&(sin6->sin6_port), rep + 20, 2);
+	return sizeof(struct sockaddr_in6);
+     }
+   if (eb)
+     {
+	snprintf(eb, ebl-1, "no usable relay address in the udp associate reply");
+	eb[ebl-1] = '\0';
+     }
+   return 0;
+}
+
+
+/*
+ * put the header that goes in front of a datagram sent through a
+ * relay to dst in buf, returns its length
+ */
+int
+socks5_build_udp_header(buf, bsz, dst)
+   char *buf;
+   int bsz;
+   struct sockaddr *dst;
+{
+   if (bsz < 22)
+     return 0;
+   /* reserved and no fragmenting */
+   buf[0] = buf[1] = buf[2] = 0;
+   return 3 + socks5_put_addr(buf + 3, dst);
+}
+
+/*
+ * how long the header of a datagram from a relay is, 0 if it is bad
+ * or just a fragment
+ */
+int
+socks5_parse_udp_header(buf, len)
+   char *buf;
+   int len;
+{
+   int hl;
+   
+   if (len < 4 || buf[0] || buf[1] || buf[2])
+     return 0;
+   switch (buf[3])
+     {
+      case SOCKS5_ATYP_IPV4ADDR:
+	hl = 10;
+	break;
+      case SOCKS5_ATYP_IPV6ADDR:
+	hl = 22;
+	break;
+      case SOCKS5_ATYP_HOSTNAME:
+	if (len < 5)
+	  return 0;
+	hl = 7 + (unsigned char)buf[4];
+	break;
+      default:
+	return 0;
+     }
+   return hl <= len ? hl : 0;
+}
+
+
 /*
  * try to negotiate a SOCKS5 connection. (with the socket/username, to the server)
  */
 int
 socks5_connect(s, server, user, pass, eb, ebl)
    int s;
-   struct sockaddr_in server;
+   struct sockaddr *server;
    char *user, *pass, *eb;
    unsigned int ebl;
 {
    /* propose desired authentication */
    if (!socks5_send_auth_req(s, eb, ebl))
      return 0;
-
+   
    /* get response */
    switch (socks5_recv_auth_rep(s, eb, ebl))
      {
@@ -7,6 +7,8 @@
 #ifndef __socks5_h
 #define __socks5_h
 
+#include <sys/socket.h>
+
 #include "socks.h"
 
 /* defines for socks 5 stuff */
@@ -54,13 +56,25 @@
 
 /* function prototypes */
 	char	*socks5_error (int);
-	int	socks5_connect (int, struct sockaddr_in, char *, char *, char *, unsigned int);
+	int	socks5_connect (int, struct sockaddr *, char *, char *, char *, unsigned int);
 /* these are called by socks5_connect, but it blocks while using them */
 	int	socks5_send_auth_req (int, char *, unsigned int);
 	int	socks5_recv_auth_rep (int, char *, unsigned int);
 	int	socks5_send_userpass_req (int, char *, char *, char *, unsigned int);
 	int	socks5_recv_userpass_rep (int, char *, unsigned int);
-	int	socks5_send_connect_req (int, struct sockaddr_in, char *, unsigned int);
+	int	socks5_send_connect_req (int, struct sockaddr *, char *, unsigned int);
 	int	socks5_recv_connect_rep (int, char *, unsigned int);
+/* the buffer based halves of the above, for callers doing their own i/o */
+	int	socks5_build_auth_req (char *, int);
+	int	socks5_parse_auth_rep (char *, int, char *, unsigned int);
+	int	socks5_build_userpass_req (char *, int, char *, char *, char *, unsigned int);
+	int	socks5_parse_userpass_rep (char *, int, char *, unsigned int);
+	int	socks5_build_connect_req (char *, int, struct sockaddr *);
+	int	socks5_build_connect_name_req (char *, int, char *, unsigned short);
+	int	socks5_parse_connect_rep (char *, int, char *, unsigned int);
+	int	socks5_build_udp_req (char *, int, struct sockaddr *);
+	int	socks5_parse_udp_rep (char *, int, struct sockaddr_storage *, char *, unsigned int);
+	int	socks5_build_udp_header (char *, int, struct sockaddr *);
+	int	socks5_parse_udp_header (char *, int);
 
 #endif
@@ -0,0 +1,564 @@
+/*
+ * socks_query.c:
+ * 
+ * pick results out of a socks_scan --archive, compare scans with each
+ * other.  blocks whose index can't match the query are skipped without
+ * being decoded (or even paged in, past their header).
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ * 
+ * 2026-10-19 	started
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "targets.h"
+#include "exclude.h"
+#include "cache.h"
+#include "archive.h"
+
+/* what to do */
+#define Q_PRINT 		0
+#define Q_ALL 			1	/* in every selected scan */
+#define Q_DIFF 			2	/* in one of two scans but not the other */
+
+/* a scan found in the archive */
+typedef struct
+{
+   unsigned int id;
+   unsigned long long rows;
+   unsigned int first, last;
+} scaninfo_t;
+
+/* the query */
+static int mode = Q_PRINT;
+static int count_only = 0;
+static int verbose = 0;
+static unsigned int *sel = NULL;	/* selected scan ids, sorted */
+static unsigned int nsel = 0;
+static unsigned int want_out = 0;	/* any of these outcome bits */
+static int want_closed = 0;		/* or no connection at all */
+static int want_port = -1;
+static int want_net = 0;
+static taddr_t net_lo, net_hi;
+
+/* scans in the archive */
+static scaninfo_t *scans = NULL;
+static unsigned int nscans = 0, nsalloc = 0;
+
+/* matches kept for -a/-d */
+static arow_t *hits = NULL;
+static unsigned long nhits = 0, nhalloc = 0;
+
+static void show_usage(char *);
+static int parse_ids(char *);
+static int add_scan(unsigned int, unsigned long long, unsigned int, unsigned int);
+static int find_scans(archive_t *, arow_t *);
+static int block_wanted(abhdr_t *);
+static int row_wanted(arow_t *);
+static int selected(unsigned int);
+static int keep_hit(arow_t *);
+static char *outcome_str(unsigned int);
+static char *auth_str(unsigned int);
+static int cmp_uint(const void *, const void *);
+static int cmp_key(const void *, const void *);
+static int cmp_hit(const void *, const void *);
+
+
+int
+main(c, v)
+   int c;
+   char *v[];
+{
+   archive_t *a;
+   abhdr_t *h;
+   arow_t *rows;
+   unsigned long long matched = 0;
+   unsigned long blocks = 0, touched = 0, i, j;
+   unsigned int last_n = 0, k;
+   int ch, list = 0;
+   long n;
+   char *p;
+   
+   while ((ch = getopt(c, v, "s:L:o:p:n:ad:lcv")) != -1)
+     {
+	switch (ch)
+	  {
+	   case 's':
+	     if (parse_ids(optarg) == -1)
+	       {
+		  fprintf(stderr, "-%c: invalid scan id list: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     break;
+	   case 'L':
+	     last_n = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || last_n < 1)
+	       {
+		  fprintf(stderr, "-%c: invalid scan count: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     break;
+	   case 'o':
+	     if (!strcmp(optarg, "open"))
+	       want_out = CO_OPEN;
+	     else if (!strcmp(optarg, "v4"))
+	       want_out = CO_V4_OK;
+	     else if (!strcmp(optarg, "v4a"))
+	       want_out = CO_V4A_OK;
+	     else if (!strcmp(optarg, "v5"))
+	       want_out = CO_V5_OK | CO_V5_AUTH;
+	     else if (!strcmp(optarg, "http"))
+	       want_out = CO_HTTP_OK | CO_HTTP_AUTH;
+	     else if (!strcmp(optarg, "noauth"))
+	       want_out = CO_V4_OK | CO_V4A_OK | CO_V5_OK | CO_HTTP_OK;
+	     else if (!strcmp(optarg, "auth"))
+	       want_out = CO_V5_AUTH | CO_HTTP_AUTH;
+	     else if (!strcmp(optarg, "udp"))
+	       want_out = CO_UDP_OK;
+	     else if (!strcmp(optarg, "connected"))
+	       want_out = CO_CONNECTED;
+	     else if (!strcmp(optarg, "closed"))
+	       want_closed = 1;
+	     else
+	       {
+		  fprintf(stderr, "-%c: unknown outcome: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     break;
+	   case 'p':
+	     want_port = strtoul(optarg, &p, 0);
+	     if (*p || p == optarg || want_port < 1 || want_port > 65535)
+	       {
+		  fprintf(stderr, "-%c: invalid port: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     break;
+	   case 'n':
+	     if (!parse_cidr(optarg, &net_lo, &net_hi))
+	       {
+		  fprintf(stderr, "-%c: invalid ip/cidr: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     want_net = 1;
+	     break;
+	   case 'a':
+	     mode = Q_ALL;
+	     break;
+	   case 'd':
+	     mode = Q_DIFF;
+	     if (parse_ids(optarg) == -1 || nsel != 2)
+	       {
+		  fprintf(stderr, "-%c: need exactly two scan ids: %s\n", ch, optarg);
+		  return 1;
+	       }
+	     break;
+	   case 'l':
+	     list = 1;
+	     break;
+	   case 'c':
+	     count_only = 1;
+	     break;
+	   case 'v':
+	     verbose++;
+	     break;
+	   default:
+	     show_usage(v[0]);
+	     return 1;
+	  }
+     }
+   if (optind != c - 1)
+     {
+	show_usage(v[0]);
+	return 1;
+     }
+   if (!(a = archive_map(v[optind])))
+     return 1;
+   if (!(rows = (arow_t *)malloc(ARCH_BLOCK_ROWS * sizeof(arow_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for a block.\n");
+	return 1;
+     }
+   if (find_scans(a, rows) == -1)
+     return 1;
+   
+   if (list)
+     {
+	for (k = 0; k < nscans; k++)
+	  {
+	     time_t t = scans[k].first;
+	     char tb[32];
+   
+	     strftime(tb, sizeof(tb), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	     printf("%10u  %s  %5us  %llu results\n", scans[k].id, tb,
+		    scans[k].last - scans[k].first, scans[k].rows);
+	  }
+	return 0;
+     }
+   
+   /* the last n scans (by id) */
+   if (last_n > 0)
+     {
+	if (nsel > 0)
+	  {
+	     fprintf(stderr, "-L and -s/-d don't mix.\n");
+	     return 1;
+	  }
+	if (last_n > nscans)
+	  last_n = nscans;
+	for (k = nscans - last_n; k < nscans; k++)
+	  {
+	     char buf[16];
+   
+	     snprintf(buf, sizeof(buf), "%u", scans[k].id);
+	     parse_ids(buf);
+	  }
+     }
+   /* everything, then */
+   if (nsel == 0)
+     for (k = 0; k < nscans; k++)
+       {
+	  char buf[16];
+   
+	  snprintf(buf, sizeof(buf), "%u", scans[k].id);
+	  parse_ids(buf);
+       }
+   
+   for (h = archive_next(a, NULL); h; h = archive_next(a, h))
+     {
+	blocks++;
+	if (!block_wanted(h))
+	  continue;
+	touched++;
+	if ((n = archive_decode(h, rows)) == -1)
+	  {
+	     fprintf(stderr, "skipping a damaged block.\n");
+	     continue;
+	  }
+	for (i = 0; i < (unsigned long)n; i++)
+	  {
+	     if (!selected(rows[i].scan) || !row_wanted(&rows[i]))
+	       continue;
+	     if (mode != Q_PRINT)
+	       {
+		  if (keep_hit(&rows[i]) == -1)
+		    return 1;
+		  continue;
+	       }
+	     matched++;
+	     if (!count_only)
+	       printf("%-18s %5u %-9s %-9s %6ums  scan %u\n", taddr_ntoa(&rows[i].ip), rows[i].port,
+		      outcome_str(rows[i].outcome), auth_str(rows[i].auth), rows[i].ms, rows[i].scan);
+	  }
+     }
+   if (verbose >= 1)
+     fprintf(stderr, "decoded %lu of %lu blocks.\n", touched, blocks);
+   
+   /* group the hits by (ip, port), the scans of each come out in order */
+   if (mode != Q_PRINT)
+     {
+	qsort(hits, nhits, sizeof(arow_t), cmp_hit);
+	for (i = 0; i < nhits; i = j)
+	  {
+	     unsigned int seen = 1;
+	     char *tag = NULL;
+   
+	     for (j = i + 1; j < nhits && !cmp_key(&hits[i], &hits[j]); j++)
+	       if (hits[j].scan != hits[j - 1].scan)
+		 seen++;
+	     if (mode == Q_ALL && seen == nsel)
+	       tag = "";
+	     else if (mode == Q_DIFF && seen == 1)
+	       tag = hits[i].scan == sel[0] ? "- " : "+ ";
+	     if (!tag)
+	       continue;
+	     matched++;
+	     if (!count_only)
+	       printf("%s%-18s %5u\n", tag, taddr_ntoa(&hits[i].ip), hits[i].port);
+	  }
+     }
+   if (count_only)
+     printf("%llu\n", matched);
+   archive_unmap(a);
+   return 0;
+}
+
+
+/*
+ * show the help!
+ */
+static void
+show_usage(v0)
+   char *v0;
+{
+   fprintf(stderr,
+	   "usage: %s [<options>] <archive>\n"
+	   "\n"
+	   "valid options:\n"
+	   "  -l                  list the scans in the archive\n"
+	   "  -s <id>[,<id>..]    only look at these scans\n"
+	   "  -L <n>              only look at the last <n> scans\n"
+	   "  -o <outcome>        open, v4, v4a, v5, http, noauth, auth, udp,\n"
+	   "                      connected or closed\n"
+	   "  -p <port>           only targets on <port>\n"
+	   "  -n <ip/cidr>        only targets in <ip/cidr>\n"
+	   "  -a                  targets that match in every selected scan\n"
+	   "  -d <id>,<id>        targets that match in one scan but not the other,\n"
+	   "                      - only in the first, + only in the second\n"
+	   "  -c                  just count them\n"
+	   "  -v                  say how many blocks had to be decoded\n"
+	   , v0);
+}
+
+
+/*
+ * add a comma separated list of scan ids to the selection
+ */
+static int
+parse_ids(str)
+   char *str;
+{
+   unsigned int *t;
+   unsigned long id;
+   char *p;
+   
+   while (*str)
+     {
+	id = strtoul(str, &p, 0);
+	if (p == str || (*p && *p != ','))
+	  return -1;
+	if (!(t = (unsigned int *)realloc(sel, (nsel + 1) * sizeof(unsigned int))))
+	  return -1;
+	sel = t;
+	sel[nsel++] = id;
+	str = *p ? p + 1 : p;
+     }
+   /* -d keeps its order, the others are looked up */
+   if (mode != Q_DIFF)
+     qsort(sel, nsel, sizeof(unsigned int), cmp_uint);
+   return 0;
+}
+
+
+/*
+ * walk the block headers to see which scans are in there, only blocks
+ * holding more than one scan need decoding
+ */
+static int
+find_scans(a, rows)
+   archive_t *a;
+   arow_t *rows;
+{
+   abhdr_t *h;
+   long n, i;
+   
+   for (h = archive_next(a, NULL); h; h = archive_next(a, h))
+     {
+	if (h->scan_min == h->scan_max)
+	  {
+	     if (add_scan(h->scan_min, h->nrows, h->when_min, h->when_max) == -1)
+	       return -1;
+	     continue;
+	  }
+	if ((n = archive_decode(h, rows)) == -1)
+	  continue;
+	for (i = 0; i < n; i++)
+	  if (add_scan(rows[i].scan, 1, rows[i].when, rows[i].when) == -1)
+	    return -1;
+     }
+   return 0;
+}
+
+static int
+add_scan(id, rows, first, last)
+   unsigned int id;
+   unsigned long long rows;
+   unsigned int first, last;
+{
+   scaninfo_t *s;
+   unsigned int i;
+   
+   /* scans are appended in order, so look from the end */
+   for (i = nscans; i > 0 && scans[i - 1].id > id; i--)
+     ;
+   if (i > 0 && scans[i - 1].id == id)
+     {
+	s = &scans[i - 1];
+	s->rows += rows;
+	if (first < s->first)
+	  s->first = first;
+	if (last > s->last)
+	  s->last = last;
+	return 0;
+     }
+   if (nscans == nsalloc)
+     {
+	unsigned int na = nsalloc ? nsalloc * 2 : 64;
+   
+	if (!(s = (scaninfo_t *)realloc(scans, na * sizeof(scaninfo_t))))
+	  {
+	     fprintf(stderr, "Unable to allocate memory for %u scans.\n", na);
+	     return -1;
+	  }
+	scans = s;
+	nsalloc = na;
+     }
+   memmove(&scans[i + 1], &scans[i], (nscans - i) * sizeof(scaninfo_t));
+   scans[i].id = id;
+   scans[i].rows = rows;
+   scans[i].first = first;
+   scans[i].last = last;
+   nscans++;
+   return 0;
+}
+
+
+/*
+ * could anything in this block match?  only the header is read.
+ */
+static int
+block_wanted(h)
+   abhdr_t *h;
+{
+   unsigned int i;
+   
+   for (i = 0; i < nsel; i++)
+     if (sel[i] >= h->scan_min && sel[i] <= h->scan_max)
+       break;
+   if (i == nsel)
+     return 0;
+   if (want_port != -1 && (want_port < h->port_min || want_port > h->port_max))
+     return 0;
+   if (want_net && (memcmp(net_hi.b, h->ip_min.b, 16) < 0 || memcmp(net_lo.b, h->ip_max.b, 16) > 0))
+     return 0;
+   if (want_out && !(h->out_or & want_out))
+     return 0;
+   if (want_closed && (h->out_and & CO_CONNECTED))
+     return 0;
+   return 1;
+}
+
+static int
+row_wanted(r)
+   arow_t *r;
+{
+   if (want_port != -1 && r->port != want_port)
+     return 0;
+   if (want_net && (memcmp(r->ip.b, net_lo.b, 16) < 0 || memcmp(r->ip.b, net_hi.b, 16) > 0))
+     return 0;
+   if (want_out && !(r->outcome & want_out))
+     return 0;
+   if (want_closed && (r->outcome & CO_CONNECTED))
+     return 0;
+   return 1;
+}
+
+static int
+selected(id)
+   unsigned int id;
+{
+   unsigned int i;
+   
+   for (i = 0; i < nsel; i++)
+     if (sel[i] == id)
+       return 1;
+   return 0;
+}
+
+
+static int
+keep_hit(r)
+   arow_t *r;
+{
+   if (nhits == nhalloc)
+     {
+	unsigned long na = nhalloc ? nhalloc * 2 : 4096;
+	arow_t *t = (arow_t *)realloc(hits, na * sizeof(arow_t));
+   
+	if (!t)
+	  {
+	     fprintf(stderr, "Unable to allocate memory for %lu results.\n", na);
+	     return -1;
+	  }
+	hits = t;
+	nhalloc = na;
+     }
+   hits[nhits++] = *r;
+   return 0;
+}
+
+
+static char *
+outcome_str(o)
+   unsigned int o;
+{
+   if (o & CO_UDP_OK)
+     return "v5+udp";
+   if ((o & CO_V4_OK) && (o & (CO_V5_OK | CO_V5_AUTH)))
+     return "v4+v5";
+   if (o & CO_V4_OK)
+     return "v4";
+   if (o & (CO_V5_OK | CO_V5_AUTH))
+     return "v5";
+   if (o & CO_V4A_OK)
+     return "v4a";
+   if (o & (CO_HTTP_OK | CO_HTTP_AUTH))
+     return "http";
+   if (o & CO_CONNECTED)
+     return "connected";
+   return "closed";
+}
+
+static char *
+auth_str(a)
+   unsigned int a;
+{
+   if (a == 0)
+     return "none";
+   if (a == 2)
+     return "user/pass";
+   return "-";
+}
+
+
+static int
+cmp_uint(a, b)
+   const void *a, *b;
+{
+   unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+   
+   return x < y ? -1 : x > y;
+}
+
+/*
+ * by ip and port
+ */
+static int
+cmp_key(a, b)
+   const void *a, *b;
+{
+   const arow_t *ra = (const arow_t *)a, *rb = (const arow_t *)b;
+   int c;
+   
+   if ((c = memcmp(ra->ip.b, rb->ip.b, 16)))
+     return c;
+   return (int)ra->port - (int)rb->port;
+}
+
+/*
+ * then by scan
+ */
+static int
+cmp_hit(a, b)
+   const void *a, *b;
+{
+   const arow_t *ra = (const arow_t *)a, *rb = (const arow_t *)b;
+   int c;
+   
+   if ((c = cmp_key(a, b)))
+     return c;
+   return ra->scan < rb->scan ? -1 : ra->scan > rb->scan;
+}
@@ -0,0 +1,295 @@
+/*
+ * socksscan.c: the scan engine as a library (libsocksscan)
+ * 
+ * a thin layer over scan.c: targets added to an engine pile up in a
+ * pending list that the engine picks up whenever it runs dry.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <netdb.h>
+
+#include "args.h"
+#include "targets.h"
+#include "scan.h"
+#include "socksscan.h"
+
+struct ss_engine_stru
+{
+   scan_t sc;
+   opts_t opts;
+   targlist_t active;		/* what the engine is working through */
+   targlist_t pending;		/* added since */
+   ss_result_cb cb;
+   void *cb_arg;
+};
+
+/*
+ * process wide settings: verbosity, the cache and the exclusions come
+ * from here, as does everything else for the command line scanner
+ */
+opts_t options;
+
+static long lib_refill(scan_t *);
+static void lib_finished(scan_t *, target_t *);
+
+static scanhook_t lib_hook = { lib_refill, lib_finished, NULL };
+
+
+/*
+ * fill in the default settings
+ */
+int
+ss_options_init(o)
+   opts_t *o;
+{
+   struct passwd *pw;
+   char defremote[256];
+   
+   memset(o, 0, sizeof(*o));
+   o->timeout = DEFAULT_CONNECT_TIMEOUT;
+   o->min_timeout = DEFAULT_MIN_TIMEOUT;
+   o->connect_retries = DEFAULT_CONNECT_RETRIES;
+   o->reset_retries = DEFAULT_RESET_RETRIES;
+   o->retry_delay = DEFAULT_RETRY_DELAY;
+   o->retry_budget = DEFAULT_RETRY_BUDGET;
+   o->ring_size = DEFAULT_RING_SIZE;
+   o->connects = DEFAULT_PARALLEL_CONNECTS;
+   o->cache_ttl = DEFAULT_CACHE_TTL;
+   o->cache_size = DEFAULT_CACHE_SIZE;
+   o->chunk_size = DEFAULT_CHUNK_SIZE;
+   o->lease_time = DEFAULT_LEASE_TIME;
+   o->monitor_max = DEFAULT_MONITOR_MAX;
+   o->monitor_share = DEFAULT_MONITOR_SHARE;
+   o->nprobes = probe_list(DEFAULT_PROBES, o->probes);
+   o->dest_slots = DEFAULT_DEST_SLOTS;
+   snprintf(defremote, sizeof(defremote), "%s:%d", DEFAULT_TARGET_HOST, DEFAULT_TARGET_PORT);
+   if (!ss_resolve(defremote, &o->remote, DEFAULT_TARGET_PORT))
+     {
+	fprintf(stderr, "unable to resolve default target host/port\n");
+	return -1;
+     }
+   if (!(pw = getpwuid(getuid())))
+     {
+	fprintf(stderr, "unable to figure out who i am\n");
+	return -1;
+     }
+   o->username = strdup(pw->pw_name);
+   return 0;
+}
+
+
+/*
+ * resolve a <host>[:<port>] or [<ipv6>][:<port>] string.
+ * 
+ * the port defaults to defport.
+ */
+int
+ss_resolve(str, ss, defport)
+   char *str;
+   struct sockaddr_storage *ss;
+   unsigned short defport;
+{
+   char buf[512], *host = buf, *port = NULL, *p;
+   struct addrinfo hints, *res;
+   
+   strncpy(buf, str, sizeof(buf) - 1);
+   buf[sizeof(buf) - 1] = '\0';
+   if (*buf == '[')
+     {
+	host = buf + 1;
+	if (!(p = strchr(host, ']')))
+	  return 0;
+	*p++ = '\0';
+	if (*p == ':')
+	  port = p + 1;
+	else if (*p)
+	  return 0;
+     }
+   else if ((p = strrchr(buf, ':')) && p == strchr(buf, ':'))
+     {
+	*p++ = '\0';
+	port = p;
+     }
+   
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   if (getaddrinfo(host, NULL, &hints, &res) != 0)
+     return 0;
+   memset(ss, 0, sizeof(*ss));
+   memcpy(ss, res->ai_addr, res->ai_addrlen);
+   freeaddrinfo(res);
+   
+   /* both families keep the port in the same spot */
+   ((struct sockaddr_in *)ss)->sin_port = htons(port ? atoi(port) : defport);
+   return 1;
+}
+
+
+/*
+ * make an engine that runs with (a copy of) opts, or the defaults
+ */
+ss_engine_t *
+ss_engine_new(opts)
+   opts_t *opts;
+{
+   ss_engine_t *e;
+   
+   if (!(e = (ss_engine_t *)calloc(1, sizeof(ss_engine_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for a scan engine.\n");
+	return NULL;
+     }
+   if (opts)
+     e->opts = *opts;
+   else if (ss_options_init(&e->opts) == -1)
+     {
+	free(e);
+	return NULL;
+     }
+   if (scan_init(&e->sc, &e->opts, &e->active, 0, &lib_hook) == -1)
+     {
+	free(e);
+	return NULL;
+     }
+   e->sc.hook_arg = e;
+   return e;
+}
+
+/*
+ * queue up an ip/host/cidr (same forms as the command line)
+ */
+unsigned long
+ss_add_target(e, str)
+   ss_engine_t *e;
+   char *str;
+{
+   char buf[512];
+   
+   /* add_target() carves up its argument */
+   strncpy(buf, str, sizeof(buf) - 1);
+   buf[sizeof(buf) - 1] = '\0';
+   return add_target(&e->pending, buf);
+}
+
+void
+ss_set_result_cb(e, cb, arg)
+   ss_engine_t *e;
+   ss_result_cb cb;
+   void *arg;
+{
+   e->cb = cb;
+   e->cb_arg = arg;
+}
+
+/*
+ * print the usual result lines to fp (NULL for none, the default)
+ */
+void
+ss_set_output(e, fp)
+   ss_engine_t *e;
+   FILE *fp;
+{
+   e->sc.out = fp;
+}
+
+/*
+ * a descriptor that becomes readable when ss_step() has something to
+ * do, -1 if the backend doesn't have one (select)
+ */
+int
+ss_engine_fd(e)
+   ss_engine_t *e;
+{
+   return e->sc.io->fd ? e->sc.io->fd(&e->sc) : -1;
+}
+
+/*
+ * what the probes have cost so far, see cost.h
+ */
+cost_t *
+ss_engine_cost(e)
+   ss_engine_t *e;
+{
+   return &e->sc.cost;
+}
+
+
+/*
+ * start whatever can be started and handle whatever i/o is ready,
+ * waiting up to ms milliseconds for some
+ * 
+ * returns 1 while there is work left, 0 when idle, -1 on error
+ */
+int
+ss_step(e, ms)
+   ss_engine_t *e;
+   int ms;
+{
+   if (e->sc.tleft == 0 && TL_EMPTY(&e->pending))
+     return 0;
+   if (scan_step(&e->sc, ms) == -1)
+     return -1;
+   return e->sc.tleft > 0 || !TL_EMPTY(&e->pending);
+}
+
+/*
+ * run until everything added so far is done
+ */
+int
+ss_run(e)
+   ss_engine_t *e;
+{
+   int ret;
+   
+   while ((ret = ss_step(e, 500)) > 0)
+     ;
+   return ret;
+}
+
+void
+ss_engine_free(e)
+   ss_engine_t *e;
+{
+   scan_fini(&e->sc);
+   free_targets(&e->active);
+   free_targets(&e->pending);
+   free(e);
+}
+
+
+/*
+ * the engine ran dry, give it what has been added since
+ */
+static long
+lib_refill(sc)
+   scan_t *sc;
+{
+   ss_engine_t *e = sc->hook_arg;
+   
+   if (TL_EMPTY(&e->pending))
+     return 0;
+   (void) sort_targets(&e->pending);
+   free_targets(&e->active);
+   e->active = e->pending;
+   memset(&e->pending, 0, sizeof(e->pending));
+   return (long)e->active.total;
+}
+
+static void
+lib_finished(sc, t)
+   scan_t *sc;
+   target_t *t;
+{
+   ss_engine_t *e = sc->hook_arg;
+   
+   if (e->cb)
+     e->cb(e->cb_arg, t);
+}
@@ -0,0 +1,54 @@
+/*
+ * socksscan.h: the scan engine as a library (libsocksscan)
+ * 
+ * an engine is made with a copy of some settings, fed targets and
+ * driven either by ss_run() or from somebody else's event loop:
+ * 
+ *    opts_t o;
+ *    ss_engine_t *e;
+ * 
+ *    ss_options_init(&o);
+ *    ss_resolve("10.0.0.1:80", &o.remote, 80);
+ *    e = ss_engine_new(&o);
+ *    ss_set_result_cb(e, found_one, ctx);
+ *    ss_add_target(e, "192.168.1.0/24");
+ *    
+ *    ... wait for ss_engine_fd(e) to be readable (or 500ms) ...
+ *    ss_step(e, 0);
+ * 
+ * targets can be added at any time, the result callback gets every
+ * target once it is done with (check its state bits).  timeouts are
+ * only noticed inside ss_step(), so call it at least twice a second
+ * while it has work.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __socksscan_h
+#define __socksscan_h
+
+#include <stdio.h>
+
+#include "args.h"
+#include "targets.h"
+#include "cost.h"
+
+typedef struct ss_engine_stru ss_engine_t;
+
+/* called with every finished target */
+typedef void (*ss_result_cb)(void *, target_t *);
+
+/* prototypes */
+int ss_options_init(opts_t *);
+int ss_resolve(char *, struct sockaddr_storage *, unsigned short);
+ss_engine_t *ss_engine_new(opts_t *);
+unsigned long ss_add_target(ss_engine_t *, char *);
+void ss_set_result_cb(ss_engine_t *, ss_result_cb, void *);
+void ss_set_output(ss_engine_t *, FILE *);
+int ss_engine_fd(ss_engine_t *);
+cost_t *ss_engine_cost(ss_engine_t *);
+int ss_step(ss_engine_t *, int);
+int ss_run(ss_engine_t *);
+void ss_engine_free(ss_engine_t *);
+
+#endif
@@ -1,39 +1,56 @@
 /*
- * targets.c: scan target linked list implementation
+ * targets.c: scan target store implementation
  * 
  * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ * 
+ * targets are kept as a sorted array of address ranges rather than
+ * one node per address, so large CIDRs and IPv6 hitlists stay compact.
+ * 
+ * a compiled list (see compile_targets()) is scanned straight out of
+ * a read-only mapping of its file, shared by every process using it,
+ * and only copied out if something is going to change it.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
 
-#include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "socks.h"
 
 #include "args.h"
 #include "targets.h"
+#include "exclude.h"
+#include "scan.h"
 
-#include "nsock_resolve.h"
-
-// static void free_target(targlist_t **);
-static int add_target_ip(targlist_t **, unsigned long, unsigned short);
-static int find_in_list(targlist_t **, targlist_t **, unsigned long);
+static unsigned long add_target_cidr4(targlist_t *, unsigned long, unsigned long, unsigned short);
+static int add_target_v4(targlist_t *, unsigned int, unsigned int, unsigned short);
+static tport_t *find_port(targlist_t *, unsigned short, int);
+static void drop_empty_ports(targlist_t *);
+static int combine_ranges(targlist_t *, targlist_t *, int);
+static void taddr_set_v4(taddr_t *, unsigned long);
+static int own_targets(targlist_t *);
+static int own_ranges(targlist_t *);
+static int tc_write(FILE *, void *, size_t, unsigned long long *);
+static unsigned long long tc_sum(unsigned long long, void *, size_t);
 
 /*
  * load targets from a file (one per line expected) and
- * link them to the list
+ * add them to the store
  */
-unsigned int
+unsigned long
 load_targets_from_file(tl, fn)
-   targlist_t **tl;
+   targlist_t *tl;
    char *fn;
 {
    FILE *fp;
    char buf[512], *p;
-   unsigned int nts = 0;
+   unsigned long nts = 0, nl = 0;
    
    /* try to open the file for reading */
    if (!(fp = fopen(fn, "r")))
@@ -43,6 +60,17 @@ load_targets_from_file(tl, fn)
 	return 0;
      }
    
+   /* compiled?  then there's nothing to parse */
+   if (fread(buf, sizeof(TCOMP_MAGIC), 1, fp) == 1
+       && !memcmp(buf, TCOMP_MAGIC, sizeof(TCOMP_MAGIC)))
+     {
+	fclose(fp);
+	nts = (unsigned long)map_targets(tl, fn);
+	budget_targets(tl);
+	return nts;
+     }
+   rewind(fp);
+   
    /* look for targets.. */
    while (fgets(buf, sizeof(buf), fp))
      {
@@ -56,208 +84,1368 @@ load_targets_from_file(tl, fn)
 	if (!buf[0])
 	  continue;
 	
-	/* try to add it */
+	/* try to add it, and see it's not getting too big now and then */
 	nts += add_target(tl, buf);
+	if (!(++nl & 0xfff))
+	  budget_targets(tl);
      }
    fclose(fp);
+   budget_targets(tl);
    /* return the number of targets found */
    return nts;
 }
 
 
 /*
- * add a target to the linked list of targets to scan
+ * add a target to the store of targets to scan
  * 
- * targ can be an IP, Host, or cidr.. the appropriate
- * targets will be added..
+ * targ can be an IP, IPv6 address, Host, or cidr.. the appropriate
+ * targets will be added..  IPv6 addresses that need a port are
+ * written in brackets, ie. [::1]:1080
  */
-int
+unsigned long
 add_target(tl, targ)
-   targlist_t **tl;
+   targlist_t *tl;
    char *targ;
 {
-   struct in_addr ip;
    unsigned short port = SOCKS_PORT;
-   unsigned int ntargs = 0;
-   char *pport;
+   unsigned long ntargs = 0;
+   char *host = targ, *pport = NULL, *p;
+   struct in_addr in4;
+   struct in6_addr in6;
+   taddr_t ip;
    
    if (options.verbose >= 3)
      fprintf(stderr, "add_targ(tl, \"%s\");\n", targ);
-
+   
    /* see if there is a port number in it */
-   pport = strrchr(targ, ':');
-   if (pport) {
-       *pport++ = '\0';
-       port = atoi(pport);
-   }
-
+   if (*targ == '[')
+     {
+	host = targ + 1;
+	if (!(p = strchr(host, ']'))
+	    || (p[1] && p[1] != ':'))
+	  {
+	     fprintf(stderr, "Invalid target: %s\n", targ);
+	     return 0;
+	  }
+	*p++ = '\0';
+	if (*p == ':')
+	  pport = p + 1;
+     }
+   else if ((pport = strrchr(targ, ':')))
+     {
+	/* more than one colon is a bare IPv6 address */
+	if (pport != strchr(targ, ':'))
+	  pport = NULL;
+	else
+	  *pport++ = '\0';
+     }
+   if (pport)
+     port = atoi(pport);
+   
    /* what kind of target did we get? */
-   if (strchr(targ, '/'))
+   if ((p = strchr(host, '/')))
      {
 	/* we got a cidr! */
-	char *p = strchr(targ, '/'), *q;
-	unsigned long mask, tul;
-	struct in_addr base, end;
+	unsigned long tul, base, mask;
+	char *q;
+	int i;
 	
 	/* try to get the base ip */
 	*p++ = '\0';
-	if (!inet_aton(targ, &base))
+	if (inet_pton(AF_INET, host, &in4) == 1)
 	  {
-	     fprintf(stderr, "Invalid CIDR base: %s\n", targ);
+	     /* check the mask out */
+	     tul = strtoul(p, &q, 10);
+	     if (*q || q == p || tul > 32)
+	       {
+		  fprintf(stderr, "Invalid CIDR mask: %s\n", p);
+		  return 0;
+	       }
+	     /* mask off the host part of the base */
+	     mask = tul ? (0xffffffffUL << (32 - tul)) & 0xffffffffUL : 0;
+	     base = ntohl(in4.s_addr) & mask;
+	     return add_target_cidr4(tl, base, base | (~mask & 0xffffffffUL), port);
+	  }
+	if (inet_pton(AF_INET6, host, &in6) != 1)
+	  {
+	     fprintf(stderr, "Invalid CIDR base: %s\n", host);
 	     return 0;
 	  }
-	/* check the mask out */
-	tul = strtoul(p, &q, 0);
-	if (*q || tul < 0 || tul > 32)
+	tul = strtoul(p, &q, 10);
+	if (*q || q == p || tul > 128)
 	  {
 	     fprintf(stderr, "Invalid CIDR mask: %s\n", p);
 	     return 0;
 	  }
-	/* if the mask is less than we mask off the base */
-	if (tul < 32 && (tul == 0 || (tul % 8) == 0))
+	/* anything bigger than 2^32 addresses can't be swept anyway */
+	if (tul < 96)
 	  {
-	     mask = (unsigned long)pow(2.0, (double)tul) - 1;
-	     base.s_addr &= mask;
+	     fprintf(stderr, "CIDR too large to scan: %s/%lu (at least /96 is required)\n", host, tul);
+	     return 0;
 	  }
-	/* is the cidr base invalid? */
-	if (tul < 32 && (ntohl(base.s_addr) << tul) != 0)
+	memcpy(ip.b, &in6, 16);
+	for (i = tul; i < 128; i++)
+	  ip.b[i / 8] &= ~(0x80 >> (i % 8));
+	return add_target_range(tl, &ip, 1ULL << (128 - tul), port);
+     }
+   
+   /* an IP or a host name! */
+   if (inet_pton(AF_INET, host, &in4) == 1)
+     {
+	taddr_set_v4(&ip, ntohl(in4.s_addr));
+	ntargs += add_target_range(tl, &ip, 1, port);
+     }
+   else if (inet_pton(AF_INET6, host, &in6) == 1)
+     {
+	memcpy(ip.b, &in6, 16);
+	ntargs += add_target_range(tl, &ip, 1, port);
+     }
+   else
+     {
+	struct addrinfo hints, *res, *ai;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, NULL, &hints, &res) != 0)
 	  {
-	     fprintf(stderr, "Invalid CIDR base: %s\n", targ);
+	     fprintf(stderr, "Invalid host/ip: %s\n", host);
 	     return 0;
 	  }
-	/* setup the end ip */
-	end.s_addr = ntohl(base.s_addr) - 1;
-	end.s_addr += pow(2, 32 - tul);
-	end.s_addr = htonl(end.s_addr);
-	
-	/* add all the ips in this cidr block (excluding .0 and .255) */
-	for (ip = base;
-	     ntohl(ip.s_addr) <= ntohl(end.s_addr);
-	     ip.s_addr = htonl(ntohl(ip.s_addr) + 1))
+	for (ai = res; ai; ai = ai->ai_next)
 	  {
-	     tul = (ip.s_addr & 0xff000000) >> 24;
-	     if (tul == 0 || tul == 255)
-	       continue;
-	     ntargs += add_target_ip(tl, (unsigned long)ip.s_addr, port);
+	     taddr_from_sockaddr(&ip, ai->ai_addr);
+	     ntargs += add_target_range(tl, &ip, 1, port);
 	  }
+	freeaddrinfo(res);
      }
-   else
+   return ntargs;
+}
+
+
+/*
+ * add all the ips in an IPv4 cidr block (excluding .0 and .255)
+ * 
+ * base and end are in host byte order, one range is added per /24.
+ */
+static unsigned long
+add_target_cidr4(tl, base, end, port)
+   targlist_t *tl;
+   unsigned long base, end;
+   unsigned short port;
+{
+   unsigned long blk, s, e, ntargs = 0;
+   taddr_t ip;
+   
+   for (blk = base & 0xffffff00UL; ; blk += 256)
      {
-	/* an IP or a host name! */
-	if (!inet_aton(targ, &ip))
+	s = blk | 1;
+	if (s < base)
+	  s = base;
+	e = blk | 254;
+	if (e > end)
+	  e = end;
+	if (s <= e)
 	  {
-	     struct hostent *hp;
-	     int i;
+	     taddr_set_v4(&ip, s);
+	     ntargs += add_target_range(tl, &ip, e - s + 1, port);
+	  }
+	/* a /0 is a lot to hold before the end of it */
+	if ((blk & 0xffff00) == 0xffff00)
+	  budget_targets(tl);
+	if ((blk | 0xff) >= end)
+	  break;
+     }
+   return ntargs;
+}
+
+
+/*
+ * add a range of addresses to the store
+ * 
+ * IPv4 addresses go straight into the port's set, which drops any
+ * duplicates on the way in.  IPv6 ranges are appended and duplicates
+ * are dealt with by sort_targets() once everything is loaded.
+ */
+unsigned long
+add_target_range(tl, base, count, port)
+   targlist_t *tl;
+   taddr_t *base;
+   unsigned long long count;
+   unsigned short port;
+{
+   unsigned long long left = count, n;
+   unsigned int lo;
+   trange_t *r;
+   taddr_t ip = *base;
+   
+   if (options.verbose >= 4)
+     fprintf(stderr, "add_target_range(tl, %s, %llu, %u)\n", taddr_ntoa(base), count, port);
+   while (left > 0 && taddr_is_v4(&ip))
+     {
+	/* as far as the end of the IPv4 space */
+	lo = (ip.b[12] << 24) | (ip.b[13] << 16) | (ip.b[14] << 8) | ip.b[15];
+	n = 0x100000000ULL - lo;
+	if (n > left)
+	  n = left;
+	if (add_target_v4(tl, lo, (unsigned int)(lo + n - 1), port) == -1)
+	  return (unsigned long)(count - left);
+	taddr_add(&ip, n);
+	left -= n;
+     }
+   if (left > 0 && own_ranges(tl) == -1)
+     return (unsigned long)(count - left);
+   while (left > 0)
+     {
+	/* grow the array when needed */
+	if (tl->nr == tl->nalloc)
+	  {
+	     unsigned long na = tl->nalloc ? tl->nalloc * 2 : 1024;
 	     
-	     if (!(hp = gethostbyname(targ)))
+	     r = (trange_t *)realloc(tl->r, na * sizeof(trange_t));
+	     if (!r)
 	       {
-		  fprintf(stderr, "Invalid host/ip: %s\n", targ);
-		  return 0;
+		  fprintf(stderr, "Unable to allocate memory for %lu target ranges.\n", na);
+		  return (unsigned long)(count - left);
 	       }
-	     for (i = 0; hp->h_addr_list[i]; i++)
-	       ntargs += add_target_ip(tl, *(unsigned long *)hp->h_addr_list[i], port);
+	     tl->r = r;
+	     tl->nalloc = na;
 	  }
-	else
-	  ntargs += add_target_ip(tl, (unsigned long)ip.s_addr, port);
+	r = &tl->r[tl->nr++];
+	r->base = ip;
+	r->port = port;
+	r->count = left > TRANGE_MAX_COUNT ? TRANGE_MAX_COUNT : (unsigned int)left;
+	taddr_add(&ip, r->count);
+	left -= r->count;
      }
-   return ntargs;
+   return (unsigned long)count;
 }
 
 
 /*
- * free a target that is no longer in use
- * /
-static void
-free_target(tl)
-   targlist_t **tl;
+ * sort the ranges and merge overlapping/adjacent ones, which removes
+ * any duplicate targets, then take out any excluded addresses.
+ * resets the dispatch cursor.
+ * 
+ * returns the number of unique targets
+ */
+unsigned long long
+sort_targets(tl)
+   targlist_t *tl;
 {
-   targlist_t *t = *tl;
+   unsigned long i, n = 0;
+   unsigned long long dups = tl->dups, skip;
+   trange_t *o, r;
+   taddr_t oend, rend;
+   
+   tl->total = 0;
+   tl->dups = 0;
+   tl->cur = 0;
+   tl->off = 0;
+   tl->spos = tl->send = 0;
+   if (TL_EMPTY(tl))
+     return 0;
+   
+   /* compiled ranges are sorted already, unless more were added */
+   if (tl->map && !tl->nalloc)
+     n = tl->nr ? tl->nr - 1 : 0;
+   else if (tl->nr > 0)
+     qsort(tl->r, tl->nr, sizeof(trange_t), compare_ranges);
+   for (i = n + 1; i < tl->nr; i++)
+     {
+	o = &tl->r[n];
+	r = tl->r[i];
+	if (r.port == o->port)
+	  {
+	     /* the address just past the current range */
+	     oend = o->base;
+	     taddr_add(&oend, o->count);
+	     if (memcmp(r.base.b, oend.b, 16) <= 0)
+	       {
+		  /* entirely inside the current range? */
+		  rend = r.base;
+		  taddr_add(&rend, r.count);
+		  if (memcmp(rend.b, oend.b, 16) <= 0)
+		    {
+		       dups += r.count;
+		       continue;
+		    }
+		  /* trim the overlapping head off */
+		  skip = taddr_diff(&oend, &r.base);
+		  dups += skip;
+		  r.base = oend;
+		  r.count -= skip;
+		  if ((unsigned long long)o->count + r.count <= TRANGE_MAX_COUNT)
+		    {
+		       o->count += r.count;
+		       continue;
+		    }
+	       }
+	  }
+	tl->r[++n] = r;
+     }
+   if (tl->nr > 0)
+     tl->nr = n + 1;
+   
+   for (i = 0; i < tl->nr; i++)
+     tl->total += tl->r[i].count;
+   for (i = 0; i < tl->nv4; i++)
+     tl->total += tl->v4[i].set.card;
+   if (options.verbose >= 2 && dups > 0)
+     fprintf(stderr, "%llu duplicate targets removed.\n", dups);
+   subtract_excludes(tl);
+   
+   /* the sets won't change much from here on, compiled ones already
+    * have the best of them */
+   drop_empty_ports(tl);
+   for (i = 0; i < tl->nv4 && !tl->map; i++)
+     tset_optimize(&tl->v4[i].set);
    
-   free(t);
-   *tl = (targlist_t *)NULL;
+   /* give back what we don't need */
+   if (tl->nr > 0 && (!tl->map || tl->nalloc)
+       && (o = (trange_t *)realloc(tl->r, tl->nr * sizeof(trange_t))))
+     {
+	tl->r = o;
+	tl->nalloc = tl->nr;
+     }
+   return tl->total;
 }
+
+
+/*
+ * get the next target that has not started yet.
  */
+int
+next_target(tl, t)
+   targlist_t *tl;
+   target_t *t;
+{
+   unsigned int n;
+   
+   memset(t, 0, sizeof(*t));
+   return next_target_run(tl, &t->ip, &n, &t->port, 1);
+}
 
 
 /*
- * add a target ip to the list of ips to attack
+ * get the next (up to max) consecutive targets that have not started
+ * yet, on the same port.
  */
-static int
-add_target_ip(tl, ip, port)
-   targlist_t **tl;
-   unsigned long ip;
+int
+next_target_run(tl, base, count, port, max)
+   targlist_t *tl;
+   taddr_t *base;
+   unsigned int *count;
+   unsigned short *port;
+   unsigned int max;
+{
+   unsigned long long n;
+   unsigned int lo, hi;
+   trange_t *r;
+   tport_t *tp;
+   
+   while (tl->cur < tl->nr)
+     {
+	r = &tl->r[tl->cur];
+	if (tl->off < r->count)
+	  {
+	     n = r->count - tl->off;
+	     *count = n > max ? max : (unsigned int)n;
+	     *base = r->base;
+	     taddr_add(base, tl->off);
+	     *port = r->port;
+	     tl->off += *count;
+	     return 1;
+	  }
+	tl->cur++;
+	tl->off = 0;
+     }
+   while (tl->cur - tl->nr < tl->nv4)
+     {
+	tp = &tl->v4[tl->cur - tl->nr];
+	if (tl->spos >= tl->send)
+	  {
+	     if (!tset_next_run(&tp->set, tl->spos, &lo, &hi))
+	       {
+		  tl->cur++;
+		  tl->spos = tl->send = 0;
+		  continue;
+	       }
+	     tl->spos = lo;
+	     tl->send = (unsigned long long)hi + 1;
+	  }
+	n = tl->send - tl->spos;
+	*count = n > max ? max : (unsigned int)n;
+	taddr_set_v4(base, (unsigned long)tl->spos);
+	*port = tp->port;
+	tl->spos += *count;
+	return 1;
+     }
+   return 0;
+}
+
+
+/*
+ * is there anything left to hand out?
+ */
+int
+more_targets(tl)
+   targlist_t *tl;
+{
+   targlist_t peek = *tl;
+   unsigned short port;
+   unsigned int n;
+   taddr_t ip;
+   
+   return next_target_run(&peek, &ip, &n, &port, 1);
+}
+
+
+/*
+ * is ip:port in the (sorted) store?
+ */
+int
+find_target(tl, ip, port)
+   targlist_t *tl;
+   taddr_t *ip;
    unsigned short port;
 {
-   targlist_t *t, *tt = (targlist_t *)0;
-   struct in_addr ipn;
+   unsigned long lo = 0, hi = tl->nr, mid;
+   trange_t *r;
+   taddr_t end;
+   tport_t *tp;
    
-   ipn.s_addr = ip;
-   if (options.verbose >= 4)
-     fprintf(stderr, "add_target_ip(tl, %s, %u)\n", inet_ntoa(ipn), port);
+   if (taddr_is_v4(ip))
+     {
+	if (!(tp = find_port(tl, port, 0)))
+	  return 0;
+	return tset_contains(&tp->set, (ip->b[12] << 24) | (ip->b[13] << 16) | (ip->b[14] << 8) | ip->b[15]);
+     }
    
-   /* is it in the list already? */
-   if (find_in_list(tl, &tt, ip))
+   /* find the last range starting at or before ip:port */
+   while (lo < hi)
      {
-	if (options.verbose >= 2)
-	  fprintf(stderr, "IP %s already in the target list!\n", inet_ntoa(ipn));
+	mid = lo + (hi - lo) / 2;
+	r = &tl->r[mid];
+	if (r->port < port
+	    || (r->port == port && memcmp(r->base.b, ip->b, 16) <= 0))
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   if (lo == 0)
+     return 0;
+   r = &tl->r[lo - 1];
+   if (r->port != port)
+     return 0;
+   end = r->base;
+   taddr_add(&end, r->count);
+   return memcmp(ip->b, end.b, 16) < 0;
+}
+
+
+/*
+ * keep only the targets that are (inside != 0) or aren't in o, which
+ * has to be sorted already.
+ * 
+ * returns the number of targets left
+ */
+unsigned long long
+combine_targets(tl, o, inside)
+   targlist_t *tl, *o;
+   int inside;
+{
+   unsigned long i;
+   tport_t *op;
+   int ret = 0;
+   
+   if (own_targets(tl) == -1)
+     return tl->total;
+   for (i = 0; i < tl->nv4 && ret == 0; i++)
+     {
+	op = find_port(o, tl->v4[i].port, 0);
+	if (inside && !op)
+	  tset_free(&tl->v4[i].set);
+	else if (inside)
+	  ret = tset_and(&tl->v4[i].set, &op->set);
+	else if (op)
+	  ret = tset_andnot(&tl->v4[i].set, &op->set);
+     }
+   if (ret == -1 || combine_ranges(tl, o, inside) == -1)
+     fprintf(stderr, "Unable to allocate memory to combine target lists.\n");
+   drop_empty_ports(tl);
+   
+   tl->total = 0;
+   for (i = 0; i < tl->nr; i++)
+     tl->total += tl->r[i].count;
+   for (i = 0; i < tl->nv4; i++)
+     tl->total += tl->v4[i].set.card;
+   tl->cur = 0;
+   tl->off = 0;
+   tl->spos = tl->send = 0;
+   return tl->total;
+}
+
+
+/*
+ * write a (sorted) store to a file, by way of a temporary one so
+ * there's always a whole one there
+ */
+int
+save_targets(tl, fn)
+   targlist_t *tl;
+   char *fn;
+{
+   char tmp[1024];
+   tfhdr_t h;
+   unsigned int i, port;
+   FILE *fp;
+   
+   snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+   if (!(fp = fopen(tmp, "w")))
+     {
+	fprintf(stderr, "Unable to create \"%s\": %s\n", tmp, strerror(errno));
+	return -1;
+     }
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, TFILE_MAGIC, sizeof(TFILE_MAGIC));
+   h.version = TFILE_VERSION;
+   h.nv4 = tl->nv4;
+   h.nr = tl->nr;
+   if (fwrite(&h, sizeof(h), 1, fp) != 1)
+     goto fail;
+   for (i = 0; i < tl->nv4; i++)
+     {
+	port = tl->v4[i].port;
+	if (fwrite(&port, sizeof(port), 1, fp) != 1
+	    || tset_write(&tl->v4[i].set, fp) == -1)
+	  goto fail;
+     }
+   if (tl->nr > 0 && fwrite(tl->r, sizeof(trange_t), tl->nr, fp) != tl->nr)
+     goto fail;
+   if (fclose(fp) != 0)
+     {
+	fp = NULL;
+	goto fail;
+     }
+   if (rename(tmp, fn) == -1)
+     {
+	fprintf(stderr, "Unable to replace \"%s\": %s\n", fn, strerror(errno));
+	unlink(tmp);
+	return -1;
+     }
+   return 0;
+   
+ fail:
+   fprintf(stderr, "Unable to write \"%s\": %s\n", tmp, strerror(errno));
+   if (fp)
+     fclose(fp);
+   unlink(tmp);
+   return -1;
+}
+
+
+/*
+ * add the targets saved in a file to the store, a missing file counts
+ * as an empty one
+ */
+int
+load_targets(tl, fn)
+   targlist_t *tl;
+   char *fn;
+{
+   tfhdr_t h;
+   tset_t set;
+   trange_t r;
+   tport_t *tp;
+   unsigned long long i;
+   unsigned int port;
+   FILE *fp;
+   
+   if (!(fp = fopen(fn, "r")))
+     {
+	if (errno == ENOENT)
+	  return 0;
+	fprintf(stderr, "Unable to open \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   if (own_targets(tl) == -1)
+     {
+	fclose(fp);
+	return -1;
+     }
+   if (fread(&h, sizeof(h), 1, fp) != 1
+       || memcmp(h.magic, TFILE_MAGIC, sizeof(TFILE_MAGIC))
+       || h.version != TFILE_VERSION)
+     {
+	fprintf(stderr, "\"%s\" is not a saved target list.\n", fn);
+	fclose(fp);
+	return -1;
+     }
+   for (i = 0; i < h.nv4; i++)
+     {
+	if (fread(&port, sizeof(port), 1, fp) != 1 || port > 0xffff
+	    || tset_read(&set, fp) == -1)
+	  break;
+	if (!(tp = find_port(tl, port, 1)) || tset_union(&tp->set, &set) == -1)
+	  {
+	     tset_free(&set);
+	     break;
+	  }
+	tset_free(&set);
+     }
+   if (i == h.nv4)
+     for (; h.nr > 0; h.nr--)
+       if (fread(&r, sizeof(r), 1, fp) != 1
+	   || add_target_range(tl, &r.base, r.count, r.port) != r.count)
+	 break;
+   fclose(fp);
+   if (i < h.nv4 || h.nr > 0)
+     {
+	fprintf(stderr, "\"%s\" is damaged.\n", fn);
+	return -1;
+     }
+   return 0;
+}
+
+/*
+ * write a (sorted) store as a compiled target file, see targets.h.
+ * by way of a temporary one like save_targets().
+ */
+int
+compile_targets(tl, fn)
+   targlist_t *tl;
+   char *fn;
+{
+   static unsigned short zero[4];
+   unsigned long long sum = 0, off = 0;
+   unsigned int i, j, len;
+   char tmp[1024];
+   tchdr_t h;
+   tcport_t p;
+   tccont_t cc;
+   tcont_t *c;
+   FILE *fp;
+   
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, TCOMP_MAGIC, sizeof(TCOMP_MAGIC));
+   h.version = TCOMP_VERSION;
+   h.nv4 = tl->nv4;
+   h.nr = tl->nr;
+   h.total = tl->total;
+   for (i = 0; i < tl->nv4; i++)
+     for (j = 0; j < tl->v4[i].set.nc; j++)
+       {
+	  h.ncont++;
+	  h.nshorts += (TC_SHORTS(&tl->v4[i].set.c[j]) + 3) & ~3U;
+       }
+   
+   snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+   if (!(fp = fopen(tmp, "w")))
+     {
+	fprintf(stderr, "Unable to create \"%s\": %s\n", tmp, strerror(errno));
+	return -1;
+     }
+   /* the header goes in again at the end, with the sum */
+   if (fwrite(&h, sizeof(h), 1, fp) != 1
+       || tc_write(fp, tl->r, tl->nr * sizeof(trange_t), &sum) == -1)
+     goto fail;
+   for (i = 0; i < tl->nv4; i++)
+     {
+	memset(&p, 0, sizeof(p));
+	p.port = tl->v4[i].port;
+	p.nc = tl->v4[i].set.nc;
+	p.card = tl->v4[i].set.card;
+	if (tc_write(fp, &p, sizeof(p), &sum) == -1)
+	  goto fail;
+     }
+   for (i = 0; i < tl->nv4; i++)
+     for (j = 0; j < tl->v4[i].set.nc; j++)
+       {
+	  c = &tl->v4[i].set.c[j];
+	  memset(&cc, 0, sizeof(cc));
+	  cc.key = c->key;
+	  cc.type = c->type;
+	  cc.card = c->card;
+	  cc.n = c->n;
+	  cc.off = off;
+	  off += (TC_SHORTS(c) + 3) & ~3U;
+	  if (tc_write(fp, &cc, sizeof(cc), &sum) == -1)
+	    goto fail;
+       }
+   for (i = 0; i < tl->nv4; i++)
+     for (j = 0; j < tl->v4[i].set.nc; j++)
+       {
+	  c = &tl->v4[i].set.c[j];
+	  len = TC_SHORTS(c);
+	  if (tc_write(fp, c->data, (len & ~3U) * sizeof(unsigned short), &sum) == -1)
+	    goto fail;
+	  /* the odd end, padded */
+	  if (len & 3)
+	    {
+	       unsigned short last[4];
+	       
+	       memcpy(last, zero, sizeof(last));
+	       memcpy(last, c->data + (len & ~3U), (len & 3) * sizeof(unsigned short));
+	       if (tc_write(fp, last, sizeof(last), &sum) == -1)
+		 goto fail;
+	    }
+       }
+   h.sum = sum;
+   if (fseek(fp, 0, SEEK_SET) == -1 || fwrite(&h, sizeof(h), 1, fp) != 1)
+     goto fail;
+   if (fclose(fp) != 0)
+     {
+	fp = NULL;
+	goto fail;
+     }
+   if (rename(tmp, fn) == -1)
+     {
+	fprintf(stderr, "Unable to replace \"%s\": %s\n", fn, strerror(errno));
+	unlink(tmp);
+	return -1;
+     }
+   return 0;
+   
+ fail:
+   fprintf(stderr, "Unable to write \"%s\": %s\n", tmp, strerror(errno));
+   if (fp)
+     fclose(fp);
+   unlink(tmp);
+   return -1;
+}
+
+
+/*
+ * add the targets in a compiled file.  into an empty store they go as
+ * they are, read out of the mapping, otherwise they're copied in.
+ * 
+ * returns how many there were, 0 if the file is no good
+ */
+unsigned long long
+map_targets(tl, fn)
+   targlist_t *tl;
+   char *fn;
+{
+   unsigned long long size, k = 0, total;
+   unsigned int i, j, len, count;
+   unsigned short port;
+   targlist_t m;
+   struct stat st;
+   tchdr_t *h;
+   tcport_t *p;
+   tccont_t *cc;
+   unsigned short *data;
+   tcont_t *c;
+   taddr_t base;
+   char *map;
+   int fd;
+   
+   if ((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+     {
+	fprintf(stderr, "Unable to open \"%s\": %s\n", fn, strerror(errno));
+	if (fd != -1)
+	  close(fd);
 	return 0;
      }
-   /* allocate storage for this IP */
-   t = (targlist_t *)calloc(1, sizeof(targlist_t));
-   if (!t)
+   size = (unsigned long long)st.st_size;
+   map = size >= sizeof(tchdr_t) ? (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+   close(fd);
+   if (map == MAP_FAILED)
      {
-	fprintf(stderr, "Unable to allocate memory for a target list entry.\n");
+	fprintf(stderr, "\"%s\" is not a compiled target file.\n", fn);
 	return 0;
      }
-   t->ip.s_addr = ip;
-   t->port = port;
-   /* if tt is non-null then we have a nice indicator of where to link it. */
-   if (tt)
+   
+   /* everything has to add up, sizes and sum */
+   h = (tchdr_t *)map;
+   if (memcmp(h->magic, TCOMP_MAGIC, sizeof(TCOMP_MAGIC)) || h->version != TCOMP_VERSION
+       || h->nr > size / sizeof(trange_t) || h->ncont > size / sizeof(tccont_t)
+       || h->nshorts > size / sizeof(unsigned short)
+       || size != sizeof(tchdr_t) + h->nr * sizeof(trange_t) + h->nv4 * sizeof(tcport_t)
+		  + h->ncont * sizeof(tccont_t) + h->nshorts * sizeof(unsigned short)
+       || tc_sum(0, map + sizeof(tchdr_t), size - sizeof(tchdr_t)) != h->sum)
      {
-	t->next = tt->next;
-	tt->next = t;
+	fprintf(stderr, "\"%s\" is damaged.\n", fn);
+	munmap(map, size);
+	return 0;
      }
-   /* otherwise, the list must be empty */
-   else
+   
+   memset(&m, 0, sizeof(m));
+   m.map = map;
+   m.maplen = size;
+   m.nr = h->nr;
+   m.r = h->nr ? (trange_t *)(map + sizeof(tchdr_t)) : NULL;
+   p = (tcport_t *)(map + sizeof(tchdr_t) + h->nr * sizeof(trange_t));
+   cc = (tccont_t *)(p + h->nv4);
+   data = (unsigned short *)(cc + h->ncont);
+   if (h->nv4 > 0 && !(m.v4 = (tport_t *)calloc(h->nv4, sizeof(tport_t))))
+     goto nomem;
+   for (i = 0; i < h->nv4; i++)
      {
-	t->next = *tl;
-	*tl = t;
+	if (p[i].nc > 65536 || p[i].nc > h->ncont - k)
+	  goto damaged;
+	m.v4[i].port = p[i].port;
+	m.v4[i].set.card = p[i].card;
+	m.nv4++;
+	if (p[i].nc && !(m.v4[i].set.c = (tcont_t *)calloc(p[i].nc, sizeof(tcont_t))))
+	  goto nomem;
+	m.v4[i].set.nc = m.v4[i].set.nalloc = p[i].nc;
+	for (j = 0; j < p[i].nc; j++, k++)
+	  {
+	     c = &m.v4[i].set.c[j];
+	     c->key = cc[k].key;
+	     c->type = cc[k].type;
+	     c->card = cc[k].card;
+	     c->n = cc[k].n;
+	     len = TC_SHORTS(c);
+	     if (c->type > TC_RUN || len > TC_BITMAP_SHORTS * 2
+		 || cc[k].off > h->nshorts || len > h->nshorts - cc[k].off)
+	       goto damaged;
+	     c->data = data + cc[k].off;
+	  }
+     }
+   total = m.total = h->total;
+   
+   /* have some already?  then they're copied in with them */
+   if (!TL_EMPTY(tl) || tl->map)
+     {
+	while (next_target_run(&m, &base, &count, &port, TRANGE_MAX_COUNT))
+	  if (add_target_range(tl, &base, count, port) != count)
+	    {
+	       total = 0;
+	       break;
+	     }
+	free_targets(&m);
+	return total;
      }
-   return 1;
+   *tl = m;
+   return total;
+   
+ damaged:
+   fprintf(stderr, "\"%s\" is damaged.\n", fn);
+   free_targets(&m);
+   return 0;
+ nomem:
+   fprintf(stderr, "Unable to allocate memory for the targets in \"%s\".\n", fn);
+   free_targets(&m);
+   return 0;
 }
 
+/*
+ * move a (sorted) store out to a temporary compiled file and read it
+ * from there, where it's the kernel's to page in and out instead of
+ * ours to keep.  one that's read from a file already gets whatever
+ * was added to it since moved out with it.
+ */
+int
+spill_targets(tl)
+   targlist_t *tl;
+{
+   targlist_t m;
+   char fn[1024], *dir;
+   int fd;
+   
+   if (!(dir = getenv("TMPDIR")) || !*dir)
+     dir = "/tmp";
+   snprintf(fn, sizeof(fn), "%s/socks_scan.XXXXXX", dir);
+   if ((fd = mkstemp(fn)) == -1)
+     {
+	fprintf(stderr, "Unable to create a file in %s for the targets: %s\n", dir, strerror(errno));
+	return -1;
+     }
+   close(fd);
+   memset(&m, 0, sizeof(m));
+   if (compile_targets(tl, fn) == -1 || map_targets(&m, fn) != tl->total)
+     {
+	free_targets(&m);
+	unlink(fn);
+	return -1;
+     }
+   /* the mapping keeps it around */
+   unlink(fn);
+   free_targets(tl);
+   *tl = m;
+   tl->kept = targets_bytes(tl);
+   return 0;
+}
 
 /*
- * find a target ip in the list..
- * 
- * if it is not found we return a pointer to the place before it should be
- * 
+ * keep a store that's being loaded inside the targets' share of
+ * --max-memory, moving it out to a file each time it gets over.  what
+ * stays in memory either way (the sets' indexes) has to double before
+ * it's worth doing again.
+ */
+void
+budget_targets(tl)
+   targlist_t *tl;
+{
+   unsigned long long b;
+   
+   if (!options.max_memory
+       || (b = targets_bytes(tl)) <= options.max_memory / MEM_TARGET_SHARE
+       || b <= 2 * tl->kept)
+     return;
+   sort_targets(tl);
+   if (spill_targets(tl) == -1)
+     {
+	fprintf(stderr, "keeping the targets (%lluMB) in memory for now.\n", b >> 20);
+	tl->kept = b;
+     }
+   else if (options.verbose >= 2)
+     fprintf(stderr, "moved %lluMB of targets out to a temporary file.\n", b >> 20);
+}
+
+/*
+ * the memory a store takes
+ */
+unsigned long long
+targets_bytes(tl)
+   targlist_t *tl;
+{
+   unsigned long long b = tl->nalloc * sizeof(trange_t) + tl->nv4 * sizeof(tport_t);
+   unsigned int i;
+   
+   /* a compiled one only has what was copied out of the mapping */
+   for (i = 0; i < tl->nv4; i++)
+     b += tset_bytes(&tl->v4[i].set);
+   return b;
+}
+
+/*
+ * copy a store out of its mapping, it's about to change
  */
 static int
-find_in_list(tl, tt, ip)
-   targlist_t **tl, **tt;
-   unsigned long ip;
+own_targets(tl)
+   targlist_t *tl;
 {
-   targlist_t *t;
+   unsigned int i;
    
-   for (t = *tl; t; t = t->next)
+   if (!tl->map)
+     return 0;
+   for (i = 0; i < tl->nv4; i++)
+     if (tset_own(&tl->v4[i].set, 0, 0xffffffffU) == -1)
+       {
+	  fprintf(stderr, "Unable to allocate memory to change the compiled targets.\n");
+	  return -1;
+       }
+   if (own_ranges(tl) == -1)
+     return -1;
+   munmap(tl->map, tl->maplen);
+   tl->map = NULL;
+   tl->maplen = 0;
+   tl->kept = 0;
+   return 0;
+}
+
+/*
+ * copy just the ranges out of the mapping, more are being added
+ */
+static int
+own_ranges(tl)
+   targlist_t *tl;
+{
+   trange_t *r;
+   
+   if (!tl->map || tl->nalloc || tl->nr == 0)
+     return 0;
+   if (!(r = (trange_t *)malloc(tl->nr * sizeof(trange_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory to change the compiled targets.\n");
+	return -1;
+     }
+   memcpy(r, tl->r, tl->nr * sizeof(trange_t));
+   tl->r = r;
+   tl->nalloc = tl->nr;
+   return 0;
+}
+
+/*
+ * write len bytes (a multiple of 8) and sum them up
+ */
+static int
+tc_write(fp, p, len, sum)
+   FILE *fp;
+   void *p;
+   size_t len;
+   unsigned long long *sum;
+{
+   if (len == 0)
+     return 0;
+   if (fwrite(p, len, 1, fp) != 1)
+     return -1;
+   *sum = tc_sum(*sum, p, len);
+   return 0;
+}
+
+/*
+ * a word at a time, every step can be undone so no change to a single
+ * word goes unnoticed
+ */
+static unsigned long long
+tc_sum(h, p, len)
+   unsigned long long h;
+   void *p;
+   size_t len;
+{
+   unsigned long long w;
+   size_t i;
+   
+   for (i = 0; i + 8 <= len; i += 8)
      {
-	/* is this it?? */
-	if (t->ip.s_addr == ip)
-	  return 1;
+	memcpy(&w, (char *)p + i, 8);
+	h = (h ^ w) * 0x100000001b3ULL;
+	h ^= h >> 32;
+     }
+   return h;
+}
+
+
+void
+free_targets(tl)
+   targlist_t *tl;
+{
+   unsigned int i, j;
+   
+   for (i = 0; i < tl->nv4; i++)
+     {
+	if (!tl->map)
+	  {
+	     tset_free(&tl->v4[i].set);
+	     continue;
+	  }
+	/* the data is in the mapping unless it was copied out */
+	for (j = 0; j < tl->v4[i].set.nc; j++)
+	  if (tl->v4[i].set.c[j].alloc)
+	    free(tl->v4[i].set.c[j].data);
+	free(tl->v4[i].set.c);
+     }
+   free(tl->v4);
+   if (tl->map)
+     munmap(tl->map, tl->maplen);
+   /* the ranges too, if they were copied out */
+   if (!tl->map || tl->nalloc)
+     free(tl->r);
+   memset(tl, 0, sizeof(*tl));
+}
+
+
+/*
+ * put lo through hi (host order) in port's set
+ */
+static int
+add_target_v4(tl, lo, hi, port)
+   targlist_t *tl;
+   unsigned int lo, hi;
+   unsigned short port;
+{
+   tport_t *tp;
+   long long n;
+   
+   /* a compiled set has the containers it touches copied out first */
+   if (!(tp = find_port(tl, port, 1))
+       || (tl->map && tset_own(&tp->set, lo, hi) == -1)
+       || (n = tset_add_range(&tp->set, lo, hi)) < 0)
+     {
+	fprintf(stderr, "Unable to allocate memory for IPv4 targets on port %u.\n", port);
+	return -1;
+     }
+   tl->dups += (unsigned long long)(hi - lo) + 1 - n;
+   return 0;
+}
+
+
+/*
+ * the set for port, making one if asked
+ */
+static tport_t *
+find_port(tl, port, create)
+   targlist_t *tl;
+   unsigned short port;
+   int create;
+{
+   unsigned int lo = 0, hi = tl->nv4, mid;
+   tport_t *tp;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	if (tl->v4[mid].port < port)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   if (lo < tl->nv4 && tl->v4[lo].port == port)
+     return &tl->v4[lo];
+   if (!create)
+     return NULL;
+   if (!(tp = (tport_t *)realloc(tl->v4, (tl->nv4 + 1) * sizeof(tport_t))))
+     return NULL;
+   tl->v4 = tp;
+   memmove(&tl->v4[lo + 1], &tl->v4[lo], (tl->nv4 - lo) * sizeof(tport_t));
+   tl->nv4++;
+   memset(&tl->v4[lo], 0, sizeof(tport_t));
+   tl->v4[lo].port = port;
+   return &tl->v4[lo];
+}
+
+
+static void
+drop_empty_ports(tl)
+   targlist_t *tl;
+{
+   unsigned int i, n = 0;
+   
+   for (i = 0; i < tl->nv4; i++)
+     {
+	if (tl->v4[i].set.card == 0)
+	  {
+	     tset_free(&tl->v4[i].set);
+	     continue;
+	  }
+	tl->v4[n++] = tl->v4[i];
+     }
+   tl->nv4 = n;
+   if (n == 0)
+     {
+	free(tl->v4);
+	tl->v4 = NULL;
+     }
+}
+
+
+/*
+ * the range part of combine_targets(), both are sorted and merged
+ */
+static int
+combine_ranges(tl, o, inside)
+   targlist_t *tl, *o;
+   int inside;
+{
+   targlist_t out;
+   unsigned long i, j = 0, k;
+   unsigned long long left, n;
+   trange_t *r, *q;
+   taddr_t cur, end, qend;
+   
+   memset(&out, 0, sizeof(out));
+   for (i = 0; i < tl->nr; i++)
+     {
+	r = &tl->r[i];
+	cur = r->base;
+	left = r->count;
 	
-	/* are we there yet? */
-	if (ntohl(t->ip.s_addr) < ntohl(ip))
+	/* skip o's ranges that end before this one starts */
+	while (j < o->nr)
 	  {
-	     /* end of list? */
-	     if (!t->next)
+	     q = &o->r[j];
+	     if (q->port > r->port)
 	       break;
-	     /* the next one is bigger? */
-	     if (ntohl(t->next->ip.s_addr) > ntohl(ip))
+	     if (q->port == r->port)
+	       {
+		  qend = q->base;
+		  taddr_add(&qend, q->count);
+		  if (memcmp(qend.b, cur.b, 16) > 0)
+		    break;
+	       }
+	     j++;
+	  }
+	
+	/* then split this one up along the ones that overlap it */
+	for (k = j; left > 0 && k < o->nr && o->r[k].port == r->port; k++)
+	  {
+	     q = &o->r[k];
+	     end = cur;
+	     taddr_add(&end, left);
+	     if (memcmp(q->base.b, end.b, 16) >= 0)
 	       break;
+	     if (memcmp(q->base.b, cur.b, 16) > 0)
+	       {
+		  n = taddr_diff(&q->base, &cur);
+		  if (!inside && add_target_range(&out, &cur, n, r->port) != n)
+		    goto fail;
+		  taddr_add(&cur, n);
+		  left -= n;
+	       }
+	     qend = q->base;
+	     taddr_add(&qend, q->count);
+	     n = taddr_diff(&qend, &cur);
+	     if (n > left)
+	       n = left;
+	     if (inside && add_target_range(&out, &cur, n, r->port) != n)
+	       goto fail;
+	     taddr_add(&cur, n);
+	     left -= n;
 	  }
+	if (left > 0 && !inside && add_target_range(&out, &cur, left, r->port) != left)
+	  goto fail;
      }
-   /* save the reference parameter and tell caller we didn't find it */
-   *tt = t;
+   free(tl->r);
+   tl->r = out.r;
+   tl->nr = out.nr;
+   tl->nalloc = out.nalloc;
    return 0;
+   
+ fail:
+   free_targets(&out);
+   return -1;
+}
+
+
+/*
+ * sort by port, then by address
+ */
+int
+compare_ranges(a, b)
+   const void *a, *b;
+{
+   const trange_t *ra = a, *rb = b;
+   
+   if (ra->port != rb->port)
+     return ra->port < rb->port ? -1 : 1;
+   return memcmp(ra->base.b, rb->base.b, 16);
+}
+
+
+/*
+ * address helpers
+ */
+static const unsigned char v4mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+
+int
+taddr_is_v4(a)
+   taddr_t *a;
+{
+   return memcmp(a->b, v4mapped, sizeof(v4mapped)) == 0;
+}
+
+/* ip is in host byte order */
+static void
+taddr_set_v4(a, ip)
+   taddr_t *a;
+   unsigned long ip;
+{
+   memcpy(a->b, v4mapped, sizeof(v4mapped));
+   a->b[12] = (ip >> 24) & 0xff;
+   a->b[13] = (ip >> 16) & 0xff;
+   a->b[14] = (ip >> 8) & 0xff;
+   a->b[15] = ip & 0xff;
+}
+
+/*
+ * like inet_ntoa, but a few calls can be used in the same printf
+ */
+char *
+taddr_ntoa(a)
+   taddr_t *a;
+{
+   static char bufs[4][INET6_ADDRSTRLEN];
+   static int idx = 0;
+   char *p = bufs[idx++ % 4];
+   
+   if (taddr_is_v4(a))
+     inet_ntop(AF_INET, a->b + 12, p, INET6_ADDRSTRLEN);
+   else
+     inet_ntop(AF_INET6, a->b, p, INET6_ADDRSTRLEN);
+   return p;
+}
+
+socklen_t
+taddr_to_sockaddr(a, port, ss)
+   taddr_t *a;
+   unsigned short port;
+   struct sockaddr_storage *ss;
+{
+   memset(ss, 0, sizeof(*ss));
+   if (taddr_is_v4(a))
+     {
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+	
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+	memcpy(&sin->sin_addr, a->b + 12, 4);
+	return sizeof(*sin);
+     }
+   else
+     {
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+	
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_port = htons(port);
+	memcpy(&sin6->sin6_addr, a->b, 16);
+	return sizeof(*sin6);
+     }
+}
+
+void
+taddr_from_sockaddr(a, sa)
+   taddr_t *a;
+   struct sockaddr *sa;
+{
+   if (sa->sa_family == AF_INET)
+     taddr_set_v4(a, ntohl(((struct sockaddr_in *)sa)->sin_addr.s_addr));
+   else
+     memcpy(a->b, &((struct sockaddr_in6 *)sa)->sin6_addr, 16);
+}
+
+/* 128-bit add */
+void
+taddr_add(a, n)
+   taddr_t *a;
+   unsigned long long n;
+{
+   unsigned long long c = 0;
+   int i;
+   
+   for (i = 15; i >= 0 && (n || c); i--)
+     {
+	c += a->b[i] + (n & 0xff);
+	a->b[i] = c & 0xff;
+	c >>= 8;
+	n >>= 8;
+     }
+}
+
+/* a - b, only valid when the difference fits in 64 bits */
+unsigned long long
+taddr_diff(a, b)
+   taddr_t *a, *b;
+{
+   unsigned long long d = 0;
+   int i, borrow = 0, v;
+   
+   for (i = 15; i >= 8; i--)
+     {
+	v = a->b[i] - b->b[i] - borrow;
+	borrow = v < 0;
+	d |= (unsigned long long)(v & 0xff) << ((15 - i) * 8);
+     }
+   return d;
+}
+
+/*
+ * mix an address (and whatever else goes in the key, as seed) down to
+ * 64 bits for the hash tables
+ */
+unsigned long long
+taddr_hash(a, seed)
+   taddr_t *a;
+   unsigned long long seed;
+{
+   unsigned long long h = seed, k;
+   int i, j;
+   
+   for (i = 0; i < 16; i += 8)
+     {
+	for (k = 0, j = 0; j < 8; j++)
+	  k = (k << 8) | a->b[i + j];
+	h ^= k;
+	/* splitmix64 finalizer */
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+     }
+   return h;
 }
@@ -7,8 +7,12 @@
 #ifndef __targets_h
 #define __targets_h
 
+#include <sys/types.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 
+#include "tset.h"
+
 
 /* connection states */
 #define SPSS_STARTED 		0x00000001
@@ -20,6 +24,15 @@
 #define SPSS_4_DONE 		0x00000100
 #define SPSS_4_SUCCESSFUL 	0x00000200
 
+#define SPSS_4A_CONNECTED 	0x00000400
+#define SPSS_4A_DONE 		0x00000800
+#define SPSS_4A_SUCCESSFUL 	0x00001000
+
+#define SPSS_H_CONNECTED 	0x00002000
+#define SPSS_H_DONE 		0x00004000
+#define SPSS_H_SUCCESSFUL 	0x00008000
+#define SPSS_H_AUTH 		0x08000000	/* http, but wants a password (407) */
+
 #define SPSS_5_CONNECTING 	0x00010000
 #define SPSS_5_CONNECTED 	0x00020000
 #define SPSS_5_AUTH_REQ_SENT 	0x00040000
@@ -30,21 +43,177 @@
 #define SPSS_5_REP_RECVD 	0x00800000
 #define SPSS_5_DONE 		0x01000000
 #define SPSS_5_SUCCESSFUL 	0x02000000
+#define SPSS_5_UDP_OK 		0x04000000	/* a datagram made it through and back */
+
+/* all of the v4 pass states, for starting it over */
+#define SPSS_4_ALL		(SPSS_4_CONNECTING | SPSS_4_CONNECTED \
+				 | SPSS_4_REQ_SENT | SPSS_4_REP_RECVD \
+				 | SPSS_4_DONE)
+
+/* and the v5 ones, for starting it over */
+#define SPSS_5_ALL		(SPSS_5_CONNECTING | SPSS_5_CONNECTED \
+				 | SPSS_5_AUTH_REQ_SENT | SPSS_5_AUTH_REP_RECVD \
+				 | SPSS_5_AUTH_NONE_OK | SPSS_5_AUTH_PASS_OK \
+				 | SPSS_5_REQ_SENT | SPSS_5_REP_RECVD \
+				 | SPSS_5_DONE | SPSS_5_SUCCESSFUL \
+				 | SPSS_5_UDP_OK)
+
+/* the v4a and http ones */
+#define SPSS_4A_ALL		(SPSS_4A_CONNECTED | SPSS_4A_DONE)
+#define SPSS_H_ALL		(SPSS_H_CONNECTED | SPSS_H_DONE)
+
+/* connected on some pass, and open to some protocol */
+#define SPSS_ANY_CONNECTED 	(SPSS_4_CONNECTED | SPSS_4A_CONNECTED \
+				 | SPSS_5_CONNECTED | SPSS_H_CONNECTED)
+#define SPSS_ANY_OPEN 		(SPSS_4_SUCCESSFUL | SPSS_4A_SUCCESSFUL \
+				 | SPSS_5_SUCCESSFUL | SPSS_5_AUTH_PASS_OK \
+				 | SPSS_H_SUCCESSFUL | SPSS_H_AUTH)
 
 #define SPSS_FINISHED 		0x80000000
 
-/* data types */
-typedef struct __target_stru
+/* largest number of addresses kept in a single range */
+#define TRANGE_MAX_COUNT	0x80000000U
+
+/* 
+ * data types
+ * 
+ * addresses are always kept as 128 bits, IPv4 addresses are stored
+ * v4-mapped (::ffff:a.b.c.d) so both families sort and merge together.
+ */
+typedef struct
+{
+   unsigned char b[16];
+} taddr_t;
+
+/* a run of consecutive addresses to be scanned on the same port */
+typedef struct
 {
-   struct __target_stru *next;
-   struct in_addr ip;
+   taddr_t base;
+   unsigned int count;
    unsigned short port;
-   unsigned long state;
+} trange_t;
+
+/* the IPv4 targets on one port */
+typedef struct
+{
+   unsigned short port;
+   tset_t set;
+} tport_t;
+
+/*
+ * the target store: IPv4 targets in a compressed set per port, IPv6
+ * ones in a sorted array of ranges, and a dispatch cursor that goes
+ * through the ranges and then the sets.
+ */
+typedef struct
+{
+   trange_t *r;
+   unsigned long nr, nalloc;
+   tport_t *v4;			/* sorted by port */
+   unsigned int nv4;
+   unsigned long long total;
+   unsigned long long dups;	/* duplicates dropped on the way in */
+   unsigned long cur;		/* range, or set past the ranges */
+   unsigned int off;		/* into the range */
+   unsigned long long spos, send; /* into the set, and its current run */
+   char *map;			/* compiled file it's read from, see map_targets() */
+   size_t maplen;
+   unsigned long long kept;	/* bytes still in memory after spill_targets() */
 } targlist_t;
 
+/* save_targets() files */
+#define TFILE_MAGIC 		"SSTARGS"
+#define TFILE_VERSION 		1
+
+typedef struct
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int nv4;		/* port sets, then */
+   unsigned long long nr;	/* ranges */
+} tfhdr_t;
+
+/*
+ * compile_targets() files, used as they are by map_targets().  the
+ * header, the ranges, a tcport_t per port set, a tccont_t per set
+ * container (all of the sets', in order) and then the containers'
+ * data, each padded out to 8 bytes.  native byte order like the cache.
+ */
+#define TCOMP_MAGIC 		"SSTCOMP"
+#define TCOMP_VERSION 		1
+
+typedef struct
+{
+   char magic[8];
+   unsigned int version;
+   unsigned int nv4;		/* port sets */
+   unsigned long long nr;	/* ranges */
+   unsigned long long ncont;	/* set containers */
+   unsigned long long nshorts;	/* their data */
+   unsigned long long total;	/* targets */
+   unsigned long long sum;	/* of everything after the header */
+} tchdr_t;
+
+typedef struct
+{
+   unsigned short port;
+   unsigned short pad;
+   unsigned int nc;		/* containers */
+   unsigned long long card;
+} tcport_t;
+
+typedef struct
+{
+   unsigned short key;
+   unsigned char type;
+   unsigned char pad;
+   unsigned int card;
+   unsigned int n;
+   unsigned int pad2;
+   unsigned long long off;	/* into the data, in shorts */
+} tccont_t;
+
+/* nothing added? */
+#define TL_EMPTY(tl) 		((tl)->nr == 0 && (tl)->nv4 == 0)
+
+/* a single target that is being scanned */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   unsigned long state;
+   unsigned char ctries;	/* connects retried */
+   unsigned char rtries;	/* passes retried after a reset */
+   unsigned short dest;		/* the --dest being checked, 0 for -r */
+} target_t;
+
 
 /* prototypes */
-unsigned int load_targets_from_file(targlist_t **, char *);
-int add_target(targlist_t **, char *);
+unsigned long load_targets_from_file(targlist_t *, char *);
+unsigned long add_target(targlist_t *, char *);
+unsigned long long sort_targets(targlist_t *);
+int next_target(targlist_t *, target_t *);
+int next_target_run(targlist_t *, taddr_t *, unsigned int *, unsigned short *, unsigned int);
+int more_targets(targlist_t *);
+unsigned long add_target_range(targlist_t *, taddr_t *, unsigned long long, unsigned short);
+int find_target(targlist_t *, taddr_t *, unsigned short);
+unsigned long long combine_targets(targlist_t *, targlist_t *, int);
+int save_targets(targlist_t *, char *);
+int load_targets(targlist_t *, char *);
+int compile_targets(targlist_t *, char *);
+unsigned long long map_targets(targlist_t *, char *);
+int spill_targets(targlist_t *);
+void budget_targets(targlist_t *);
+unsigned long long targets_bytes(targlist_t *);
+void free_targets(targlist_t *);
+int compare_ranges(const void *, const void *);
+
+int taddr_is_v4(taddr_t *);
+char *taddr_ntoa(taddr_t *);
+socklen_t taddr_to_sockaddr(taddr_t *, unsigned short, struct sockaddr_storage *);
+void taddr_from_sockaddr(taddr_t *, struct sockaddr *);
+void taddr_add(taddr_t *, unsigned long long);
+unsigned long long taddr_diff(taddr_t *, taddr_t *);
+unsigned long long taddr_hash(taddr_t *, unsigned long long);
 
 #endif
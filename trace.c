@@ -0,0 +1,247 @@
+/*
+ * trace.c: recording scans and playing them back
+ * 
+ * --record writes every event the engine gets from its backend to a
+ * file, --replay feeds them back to it through io_replay.c, so changes
+ * to the engine can be timed against the exact same responses.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "args.h"
+#include "targets.h"
+#include "trace.h"
+
+static FILE *tfp = NULL;
+static trace_t *loaded = NULL;
+static char *loaded_fn = NULL;
+
+static int compare_recs(const void *, const void *);
+
+
+/*
+ * start recording to fn
+ */
+int
+trace_open(fn)
+   char *fn;
+{
+   char hdr[12];
+   unsigned int v = TRACE_VERSION;
+   
+   if (!(tfp = fopen(fn, "w")))
+     {
+	fprintf(stderr, "Unable to open trace \"%s\": %s\n", fn, strerror(errno));
+	return -1;
+     }
+   /* the events are small, let stdio batch them up */
+   (void) setvbuf(tfp, NULL, _IOFBF, 1 << 20);
+   memcpy(hdr, TRACE_MAGIC, 8);
+   memcpy(hdr + 8, &v, sizeof(v));
+   if (fwrite(hdr, sizeof(hdr), 1, tfp) != 1)
+     {
+	fprintf(stderr, "Unable to write trace \"%s\": %s\n", fn, strerror(errno));
+	fclose(tfp);
+	tfp = NULL;
+	return -1;
+     }
+   return 0;
+}
+
+/*
+ * record an event
+ */
+void
+trace_event(ip, port, ev, ms, res, err, data, dlen)
+   taddr_t *ip;
+   unsigned short port;
+   int ev;
+   unsigned int ms;
+   int res, err;
+   char *data;
+   int dlen;
+{
+   static char zero[4];
+   trec_t r;
+   
+   if (!tfp)
+     return;
+   memset(&r, 0, sizeof(r));
+   r.ip = *ip;
+   r.port = port;
+   r.ev = ev;
+   r.ms = ms;
+   r.res = res;
+   r.err = err;
+   r.dlen = dlen > 0 ? dlen : 0;
+   if (fwrite(&r, sizeof(r), 1, tfp) != 1
+       || (r.dlen > 0 && fwrite(data, r.dlen, 1, tfp) != 1)
+       || (TR_PADDED(r.dlen) > r.dlen && fwrite(zero, TR_PADDED(r.dlen) - r.dlen, 1, tfp) != 1))
+     {
+	fprintf(stderr, "Unable to write trace: %s, recording stopped.\n", strerror(errno));
+	fclose(tfp);
+	tfp = NULL;
+     }
+}
+
+void
+trace_close()
+{
+   if (tfp && fclose(tfp) != 0)
+     fprintf(stderr, "Unable to write trace: %s\n", strerror(errno));
+   tfp = NULL;
+}
+
+
+/*
+ * read a whole trace in and group it by target
+ * 
+ * it is only read once, later calls get the same one back
+ */
+trace_t *
+trace_load(fn)
+   char *fn;
+{
+   struct stat st;
+   trace_t *t;
+   trec_t *r;
+   FILE *fp;
+   char *p, *end;
+   unsigned long n = 0;
+   
+   if (loaded && !strcmp(fn, loaded_fn))
+     return loaded;
+   if (!(fp = fopen(fn, "r")) || fstat(fileno(fp), &st) == -1)
+     {
+	fprintf(stderr, "Unable to open trace \"%s\": %s\n", fn, strerror(errno));
+	if (fp)
+	  fclose(fp);
+	return NULL;
+     }
+   if (!(t = (trace_t *)calloc(1, sizeof(trace_t)))
+       || !(t->buf = (char *)malloc(st.st_size + 1)))
+     {
+	fprintf(stderr, "Unable to allocate memory for the trace.\n");
+	fclose(fp);
+	free(t);
+	return NULL;
+     }
+   if (fread(t->buf, 1, st.st_size, fp) != (size_t)st.st_size
+       || st.st_size < 12 || memcmp(t->buf, TRACE_MAGIC, 8)
+       || *(unsigned int *)(t->buf + 8) != TRACE_VERSION)
+     {
+	fprintf(stderr, "\"%s\" is not a usable trace.\n", fn);
+	fclose(fp);
+	free(t->buf);
+	free(t);
+	return NULL;
+     }
+   fclose(fp);
+   
+   /* count the events, then index them */
+   end = t->buf + st.st_size;
+   for (p = t->buf + 12; p + sizeof(trec_t) <= end; p += sizeof(trec_t) + TR_PADDED(((trec_t *)p)->dlen))
+     n++;
+   if (!(t->recs = (trec_t **)malloc((n ? n : 1) * sizeof(trec_t *))))
+     {
+	fprintf(stderr, "Unable to allocate memory for %lu trace events.\n", n);
+	free(t->buf);
+	free(t);
+	return NULL;
+     }
+   for (p = t->buf + 12; p + sizeof(trec_t) <= end; p += sizeof(trec_t) + TR_PADDED(r->dlen))
+     {
+	r = (trec_t *)p;
+	if (p + sizeof(trec_t) + r->dlen > end)
+	  break;
+	t->recs[t->nrecs++] = r;
+     }
+   if (t->nrecs < n)
+     fprintf(stderr, "the trace is cut short, using the first %lu events.\n", t->nrecs);
+   
+   /* the records are in file order, so this keeps each target's in order */
+   qsort(t->recs, t->nrecs, sizeof(trec_t *), compare_recs);
+   loaded = t;
+   loaded_fn = strdup(fn);
+   if (options.verbose >= 1)
+     fprintf(stderr, "loaded %lu events from trace \"%s\".\n", t->nrecs, fn);
+   return t;
+}
+
+
+/*
+ * add every target in the trace to tl
+ */
+unsigned long
+trace_targets(fn, tl)
+   char *fn;
+   targlist_t *tl;
+{
+   trace_t *t;
+   unsigned long i, n = 0;
+   
+   if (!(t = trace_load(fn)))
+     return 0;
+   for (i = 0; i < t->nrecs; i++)
+     {
+	if (i > 0 && t->recs[i]->port == t->recs[i - 1]->port
+	    && !memcmp(t->recs[i]->ip.b, t->recs[i - 1]->ip.b, 16))
+	  continue;
+	n += add_target_range(tl, &t->recs[i]->ip, 1, t->recs[i]->port);
+     }
+   return n;
+}
+
+
+/*
+ * find a target's first event, -1 if it has none
+ */
+long
+trace_find(t, ip, port)
+   trace_t *t;
+   taddr_t *ip;
+   unsigned short port;
+{
+   unsigned long lo = 0, hi = t->nrecs, mid;
+   trec_t *r;
+   int c;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	r = t->recs[mid];
+	c = r->port != port ? (r->port < port ? -1 : 1) : memcmp(r->ip.b, ip->b, 16);
+	if (c < 0)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   if (lo < t->nrecs && t->recs[lo]->port == port && !memcmp(t->recs[lo]->ip.b, ip->b, 16))
+     return (long)lo;
+   return -1;
+}
+
+
+/*
+ * by target, then by where they are in the file
+ */
+static int
+compare_recs(a, b)
+   const void *a, *b;
+{
+   const trec_t *ra = *(const trec_t **)a, *rb = *(const trec_t **)b;
+   int c;
+   
+   if (ra->port != rb->port)
+     return ra->port < rb->port ? -1 : 1;
+   if ((c = memcmp(ra->ip.b, rb->ip.b, 16)))
+     return c;
+   return ra < rb ? -1 : ra > rb;
+}
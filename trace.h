@@ -0,0 +1,56 @@
+/*
+ * trace.h: recording scans and playing them back
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __trace_h
+#define __trace_h
+
+#include "targets.h"
+
+#define TRACE_MAGIC 		"SSTRACE"
+#define TRACE_VERSION 		1
+
+/* what happened */
+#define TR_CONNECTED 		1	/* err */
+#define TR_SENT 		2	/* res bytes written, err */
+#define TR_RECEIVED 		3	/* res bytes read (the data follows), err */
+#define TR_TIMEOUT 		4
+#define TR_OPFAIL 		5	/* the backend refused outright, message follows */
+
+/* one event, as it is in the file.  ms counts from when the connect or
+ * request it answers was started */
+typedef struct
+{
+   taddr_t ip;
+   unsigned short port;
+   unsigned char ev;
+   unsigned char pad;
+   unsigned int ms;
+   int res;
+   int err;
+   unsigned short dlen;		/* bytes of data following (padded) */
+   unsigned short pad2;
+} trec_t;
+
+/* data is padded so the records stay aligned */
+#define TR_PADDED(n) 		(((n) + 3) & ~3)
+
+/* a loaded trace, events are grouped by target in the order they happened */
+typedef struct
+{
+   trec_t **recs;
+   unsigned long nrecs;
+   char *buf;
+} trace_t;
+
+/* prototypes */
+int trace_open(char *);
+void trace_event(taddr_t *, unsigned short, int, unsigned int, int, int, char *, int);
+void trace_close(void);
+trace_t *trace_load(char *);
+unsigned long trace_targets(char *, targlist_t *);
+long trace_find(trace_t *, taddr_t *, unsigned short);
+
+#endif
@@ -0,0 +1,892 @@
+/*
+ * tset.c: compressed sets of IPv4 addresses
+ * 
+ * containers start out as arrays, become runs as soon as a range goes
+ * in (cidrs mostly) and bitmaps once either of those would be bigger.
+ * tset_optimize() picks the smallest form for each of them once the
+ * set stops changing.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tset.h"
+
+#define BM_WORDS 		(TC_BITMAP_SHORTS / 4)
+#define RUN_START(c, i) 	((int)(c)->data[2 * (i)])
+#define RUN_END(c, i) 		((int)(c)->data[2 * (i)] + (int)(c)->data[2 * (i) + 1])
+
+static tcont_t *ts_find(tset_t *, unsigned int, int);
+static unsigned int ts_lower(tset_t *, unsigned int);
+static void ts_drop_empty(tset_t *);
+static int cont_grow(tcont_t *, unsigned int);
+static int cont_add_range(tcont_t *, int, int);
+static int cont_remove_range(tcont_t *, int, int);
+static int cont_contains(tcont_t *, int);
+static int cont_next_run(tcont_t *, int, int *, int *);
+static unsigned int cont_nruns(tcont_t *);
+static int cont_convert(tcont_t *, int);
+static unsigned int arr_lower(tcont_t *, int);
+static unsigned int run_lower(tcont_t *, int);
+static int run_add_range(tcont_t *, int, int);
+static int run_remove_range(tcont_t *, int, int);
+static int run_replace(tcont_t *, unsigned int, unsigned int, int *, unsigned int);
+static int bm_range(tcont_t *, int, int, int);
+
+
+/*
+ * add lo through hi (inclusive)
+ * 
+ * returns how many weren't already in there, -1 when out of memory
+ */
+long long
+tset_add_range(ts, lo, hi)
+   tset_t *ts;
+   unsigned int lo, hi;
+{
+   unsigned int k;
+   long long added = 0;
+   tcont_t *c;
+   int n;
+   
+   if (lo > hi)
+     return 0;
+   for (k = lo >> 16; ; k++)
+     {
+	if (!(c = ts_find(ts, k, 1)))
+	  return -1;
+	n = cont_add_range(c, k == lo >> 16 ? (int)(lo & 0xffff) : 0,
+			   k == hi >> 16 ? (int)(hi & 0xffff) : 0xffff);
+	if (n < 0)
+	  return -1;
+	added += n;
+	ts->card += n;
+	if (k == hi >> 16)
+	  break;
+     }
+   return added;
+}
+
+
+/*
+ * take lo through hi (inclusive) out
+ * 
+ * returns how many were in there, -1 when out of memory
+ */
+long long
+tset_remove_range(ts, lo, hi)
+   tset_t *ts;
+   unsigned int lo, hi;
+{
+   unsigned int i;
+   long long removed = 0;
+   tcont_t *c;
+   int n;
+   
+   /* only the containers that exist */
+   for (i = ts_lower(ts, lo >> 16); i < ts->nc && ts->c[i].key <= hi >> 16; i++)
+     {
+	c = &ts->c[i];
+	n = cont_remove_range(c, c->key == lo >> 16 ? (int)(lo & 0xffff) : 0,
+			      c->key == hi >> 16 ? (int)(hi & 0xffff) : 0xffff);
+	if (n < 0)
+	  return -1;
+	removed += n;
+	ts->card -= n;
+     }
+   if (removed > 0)
+     ts_drop_empty(ts);
+   return removed;
+}
+
+
+int
+tset_contains(ts, v)
+   tset_t *ts;
+   unsigned int v;
+{
+   tcont_t *c;
+   
+   if (!(c = ts_find(ts, v >> 16, 0)))
+     return 0;
+   return cont_contains(c, v & 0xffff);
+}
+
+
+/*
+ * find the first run of consecutive members at or after from
+ * 
+ * returns 0 if there aren't any
+ */
+int
+tset_next_run(ts, from, lo, hi)
+   tset_t *ts;
+   unsigned long long from;
+   unsigned int *lo, *hi;
+{
+   unsigned int i, k;
+   int l, h;
+   
+   if (from > 0xffffffffULL)
+     return 0;
+   k = (unsigned int)(from >> 16);
+   for (i = ts_lower(ts, k); i < ts->nc; i++)
+     {
+	if (!cont_next_run(&ts->c[i], ts->c[i].key == k ? (int)(from & 0xffff) : 0, &l, &h))
+	  continue;
+	*lo = ((unsigned int)ts->c[i].key << 16) | l;
+	*hi = ((unsigned int)ts->c[i].key << 16) | h;
+   
+	/* it may carry on into the next container */
+	while (h == 0xffff && i + 1 < ts->nc && ts->c[i + 1].key == ts->c[i].key + 1
+	       && cont_next_run(&ts->c[i + 1], 0, &l, &h) && l == 0)
+	  {
+	     i++;
+	     *hi = ((unsigned int)ts->c[i].key << 16) | h;
+	  }
+	return 1;
+     }
+   return 0;
+}
+
+
+/*
+ * dst |= src, dst &= ~src and dst &= src.  0 or -1 if out of memory
+ */
+int
+tset_union(dst, src)
+   tset_t *dst, *src;
+{
+   unsigned long long pos = 0;
+   unsigned int lo, hi;
+   
+   while (tset_next_run(src, pos, &lo, &hi))
+     {
+	if (tset_add_range(dst, lo, hi) < 0)
+	  return -1;
+	pos = (unsigned long long)hi + 1;
+     }
+   return 0;
+}
+
+int
+tset_andnot(dst, src)
+   tset_t *dst, *src;
+{
+   unsigned long long pos = 0;
+   unsigned int lo, hi;
+   
+   while (dst->card > 0 && tset_next_run(src, pos, &lo, &hi))
+     {
+	if (tset_remove_range(dst, lo, hi) < 0)
+	  return -1;
+	pos = (unsigned long long)hi + 1;
+     }
+   return 0;
+}
+
+int
+tset_and(dst, src)
+   tset_t *dst, *src;
+{
+   unsigned long long pos = 0;
+   unsigned int lo, hi;
+   
+   /* take out the gaps between src's runs */
+   while (dst->card > 0 && tset_next_run(src, pos, &lo, &hi))
+     {
+	if (lo > pos && tset_remove_range(dst, (unsigned int)pos, lo - 1) < 0)
+	  return -1;
+	pos = (unsigned long long)hi + 1;
+     }
+   if (dst->card > 0 && pos <= 0xffffffffULL
+       && tset_remove_range(dst, (unsigned int)pos, 0xffffffffU) < 0)
+     return -1;
+   return 0;
+}
+
+
+/*
+ * put every container in its smallest form and give back spare room
+ */
+void
+tset_optimize(ts)
+   tset_t *ts;
+{
+   unsigned int i, sz[3], best;
+   tcont_t *c;
+   unsigned short *d;
+   
+   for (i = 0; i < ts->nc; i++)
+     {
+	c = &ts->c[i];
+	sz[TC_ARRAY] = c->card <= TC_ARRAY_MAX ? c->card : TC_BITMAP_SHORTS + 1;
+	sz[TC_BITMAP] = TC_BITMAP_SHORTS;
+	sz[TC_RUN] = 2 * cont_nruns(c);
+	best = c->type;
+	if (sz[TC_ARRAY] < sz[best])
+	  best = TC_ARRAY;
+	if (sz[TC_RUN] < sz[best])
+	  best = TC_RUN;
+	if (sz[TC_BITMAP] < sz[best])
+	  best = TC_BITMAP;
+	if (best != c->type && cont_convert(c, best) == -1)
+	  continue;
+	if (c->alloc > sz[c->type] && sz[c->type] > 0
+	    && (d = (unsigned short *)realloc(c->data, sz[c->type] * sizeof(unsigned short))))
+	  {
+	     c->data = d;
+	     c->alloc = sz[c->type];
+	  }
+     }
+   if (ts->nalloc > ts->nc && ts->nc > 0)
+     {
+	tcont_t *nc = (tcont_t *)realloc(ts->c, ts->nc * sizeof(tcont_t));
+   
+	if (nc)
+	  {
+	     ts->c = nc;
+	     ts->nalloc = ts->nc;
+	  }
+     }
+}
+
+
+/*
+ * memory in use
+ */
+unsigned long long
+tset_bytes(ts)
+   tset_t *ts;
+{
+   unsigned long long b = (unsigned long long)ts->nalloc * sizeof(tcont_t);
+   unsigned int i;
+   
+   for (i = 0; i < ts->nc; i++)
+     b += ts->c[i].alloc * sizeof(unsigned short);
+   return b;
+}
+
+
+/*
+ * save/load a set, in native byte order like the cache
+ */
+int
+tset_write(ts, fp)
+   tset_t *ts;
+   FILE *fp;
+{
+   unsigned int i, hdr[4], len;
+   tcont_t *c;
+   
+   if (fwrite(&ts->nc, sizeof(ts->nc), 1, fp) != 1)
+     return -1;
+   for (i = 0; i < ts->nc; i++)
+     {
+	c = &ts->c[i];
+	hdr[0] = c->key;
+	hdr[1] = c->type;
+	hdr[2] = c->card;
+	hdr[3] = c->n;
+	len = TC_SHORTS(c);
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1
+	    || fwrite(c->data, sizeof(unsigned short), len, fp) != len)
+	  return -1;
+     }
+   return 0;
+}
+
+int
+tset_read(ts, fp)
+   tset_t *ts;
+   FILE *fp;
+{
+   unsigned int nc, i, hdr[4], len;
+   tcont_t *c;
+   
+   memset(ts, 0, sizeof(*ts));
+   if (fread(&nc, sizeof(nc), 1, fp) != 1 || nc > 65536)
+     return -1;
+   if (nc == 0)
+     return 0;
+   if (!(ts->c = (tcont_t *)calloc(nc, sizeof(tcont_t))))
+     return -1;
+   ts->nalloc = nc;
+   for (i = 0; i < nc; i++)
+     {
+	c = &ts->c[i];
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1
+	    || hdr[0] > 0xffff || hdr[1] > TC_RUN || hdr[2] == 0 || hdr[2] > 65536
+	    || (i > 0 && hdr[0] <= ts->c[i - 1].key))
+	  break;
+	c->key = hdr[0];
+	c->type = hdr[1];
+	c->card = hdr[2];
+	c->n = hdr[3];
+	len = TC_SHORTS(c);
+	if (len > TC_BITMAP_SHORTS * 2 || !(c->data = (unsigned short *)malloc((len ? len : 1) * sizeof(unsigned short))))
+	  break;
+	c->alloc = len;
+	ts->nc++;
+	if (fread(c->data, sizeof(unsigned short), len, fp) != len)
+	  break;
+	ts->card += c->card;
+     }
+   if (i < nc)
+     {
+	tset_free(ts);
+	return -1;
+     }
+   return 0;
+}
+
+
+void
+tset_free(ts)
+   tset_t *ts;
+{
+   unsigned int i;
+   
+   for (i = 0; i < ts->nc; i++)
+     free(ts->c[i].data);
+   free(ts->c);
+   memset(ts, 0, sizeof(*ts));
+}
+
+
+/*
+ * copy the containers lo through hi reach out of wherever a compiled
+ * set has them, so they can be changed
+ * 
+ * returns -1 when out of memory
+ */
+int
+tset_own(ts, lo, hi)
+   tset_t *ts;
+   unsigned int lo, hi;
+{
+   unsigned int i, len;
+   unsigned short *d;
+   tcont_t *c;
+   
+   for (i = ts_lower(ts, lo >> 16); i < ts->nc && ts->c[i].key <= hi >> 16; i++)
+     {
+	c = &ts->c[i];
+	if (c->alloc)
+	  continue;
+	len = TC_SHORTS(c);
+	if (!(d = (unsigned short *)malloc((len ? len : 1) * sizeof(unsigned short))))
+	  return -1;
+	memcpy(d, c->data, len * sizeof(unsigned short));
+	c->data = d;
+	c->alloc = len ? len : 1;
+     }
+   return 0;
+}
+
+
+/*
+ * the container for key, making an empty one if asked
+ */
+static tcont_t *
+ts_find(ts, key, create)
+   tset_t *ts;
+   unsigned int key;
+   int create;
+{
+   unsigned int i = ts_lower(ts, key);
+   tcont_t *c;
+   
+   if (i < ts->nc && ts->c[i].key == key)
+     return &ts->c[i];
+   if (!create)
+     return NULL;
+   if (ts->nc == ts->nalloc)
+     {
+	unsigned int na = ts->nalloc ? ts->nalloc * 2 : 16;
+   
+	if (!(c = (tcont_t *)realloc(ts->c, na * sizeof(tcont_t))))
+	  {
+	     fprintf(stderr, "Unable to allocate memory for %u address containers.\n", na);
+	     return NULL;
+	  }
+	ts->c = c;
+	ts->nalloc = na;
+     }
+   memmove(&ts->c[i + 1], &ts->c[i], (ts->nc - i) * sizeof(tcont_t));
+   ts->nc++;
+   c = &ts->c[i];
+   memset(c, 0, sizeof(*c));
+   c->key = key;
+   c->type = TC_ARRAY;
+   return c;
+}
+
+/*
+ * index of the first container with a key >= key
+ */
+static unsigned int
+ts_lower(ts, key)
+   tset_t *ts;
+   unsigned int key;
+{
+   unsigned int lo = 0, hi = ts->nc, mid;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	if (ts->c[mid].key < key)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   return lo;
+}
+
+static void
+ts_drop_empty(ts)
+   tset_t *ts;
+{
+   unsigned int i, n = 0;
+   
+   for (i = 0; i < ts->nc; i++)
+     {
+	if (ts->c[i].card == 0)
+	  {
+	     free(ts->c[i].data);
+	     continue;
+	  }
+	ts->c[n++] = ts->c[i];
+     }
+   ts->nc = n;
+}
+
+
+/*
+ * make sure c has room for need shorts
+ */
+static int
+cont_grow(c, need)
+   tcont_t *c;
+   unsigned int need;
+{
+   unsigned int na;
+   unsigned short *d;
+   
+   if (need <= c->alloc)
+     return 0;
+   na = c->alloc ? c->alloc : 4;
+   while (na < need)
+     na *= 2;
+   if (!(d = (unsigned short *)realloc(c->data, na * sizeof(unsigned short))))
+     {
+	fprintf(stderr, "Unable to allocate memory for an address container.\n");
+	return -1;
+     }
+   c->data = d;
+   c->alloc = na;
+   return 0;
+}
+
+
+/*
+ * returns how many were added, -1 if out of memory
+ */
+static int
+cont_add_range(c, lo, hi)
+   tcont_t *c;
+   int lo, hi;
+{
+   unsigned int i;
+   int n;
+   
+   if (c->type == TC_ARRAY)
+     {
+	if (lo < hi)
+	  {
+	     /* ranges go in as runs */
+	     if (cont_convert(c, TC_RUN) == -1)
+	       return -1;
+	     return cont_add_range(c, lo, hi);
+	  }
+	i = arr_lower(c, lo);
+	if (i < c->n && c->data[i] == lo)
+	  return 0;
+	if (c->card == TC_ARRAY_MAX)
+	  {
+	     if (cont_convert(c, TC_BITMAP) == -1)
+	       return -1;
+	     return cont_add_range(c, lo, hi);
+	  }
+	if (cont_grow(c, c->n + 1) == -1)
+	  return -1;
+	memmove(&c->data[i + 1], &c->data[i], (c->n - i) * sizeof(unsigned short));
+	c->data[i] = lo;
+	c->n++;
+	c->card++;
+	return 1;
+     }
+   if (c->type == TC_RUN)
+     {
+	if ((n = run_add_range(c, lo, hi)) < 0)
+	  return -1;
+	if (c->n > TC_RUN_MAX && cont_convert(c, TC_BITMAP) == -1)
+	  return -1;
+	return n;
+     }
+   return bm_range(c, lo, hi, 1);
+}
+
+/*
+ * returns how many were removed, -1 if out of memory
+ */
+static int
+cont_remove_range(c, lo, hi)
+   tcont_t *c;
+   int lo, hi;
+{
+   unsigned int i, j;
+   int n;
+   
+   if (c->type == TC_ARRAY)
+     {
+	i = arr_lower(c, lo);
+	j = arr_lower(c, hi + 1);
+	memmove(&c->data[i], &c->data[j], (c->n - j) * sizeof(unsigned short));
+	c->n -= j - i;
+	c->card -= j - i;
+	return j - i;
+     }
+   if (c->type == TC_RUN)
+     {
+	if ((n = run_remove_range(c, lo, hi)) < 0)
+	  return -1;
+	if (c->n > TC_RUN_MAX && cont_convert(c, TC_BITMAP) == -1)
+	  return -1;
+	return n;
+     }
+   return bm_range(c, lo, hi, 0);
+}
+
+static int
+cont_contains(c, v)
+   tcont_t *c;
+   int v;
+{
+   unsigned int i;
+   
+   if (c->type == TC_ARRAY)
+     {
+	i = arr_lower(c, v);
+	return i < c->n && c->data[i] == v;
+     }
+   if (c->type == TC_RUN)
+     {
+	i = run_lower(c, v);
+	return i < c->n && RUN_START(c, i) <= v;
+     }
+   return (((unsigned long long *)c->data)[v >> 6] >> (v & 63)) & 1;
+}
+
+/*
+ * the first run of members at or after from, within this container
+ */
+static int
+cont_next_run(c, from, lo, hi)
+   tcont_t *c;
+   int from, *lo, *hi;
+{
+   unsigned long long *w, m;
+   unsigned int i;
+   int b;
+   
+   if (c->type == TC_ARRAY)
+     {
+	if ((i = arr_lower(c, from)) >= c->n)
+	  return 0;
+	*lo = *hi = c->data[i];
+	while (i + 1 < c->n && c->data[i + 1] == *hi + 1)
+	  {
+	     i++;
+	     (*hi)++;
+	  }
+	return 1;
+     }
+   if (c->type == TC_RUN)
+     {
+	if ((i = run_lower(c, from)) >= c->n)
+	  return 0;
+	*lo = RUN_START(c, i) > from ? RUN_START(c, i) : from;
+	*hi = RUN_END(c, i);
+	return 1;
+     }
+   
+   /* the first set bit, then the first clear one after it */
+   w = (unsigned long long *)c->data;
+   i = from >> 6;
+   m = w[i] & (~0ULL << (from & 63));
+   while (!m)
+     {
+	if (++i == BM_WORDS)
+	  return 0;
+	m = w[i];
+     }
+   b = i * 64 + __builtin_ctzll(m);
+   *lo = b;
+   m = ~w[i] & (~0ULL << (b & 63));
+   while (!m)
+     {
+	if (++i == BM_WORDS)
+	  {
+	     *hi = 0xffff;
+	     return 1;
+	  }
+	m = ~w[i];
+     }
+   *hi = i * 64 + __builtin_ctzll(m) - 1;
+   return 1;
+}
+
+static unsigned int
+cont_nruns(c)
+   tcont_t *c;
+{
+   unsigned long long *w;
+   unsigned int i, n = 0;
+   
+   if (c->type == TC_RUN)
+     return c->n;
+   if (c->type == TC_ARRAY)
+     {
+	for (i = 0; i < c->n; i++)
+	  if (i == 0 || c->data[i] != c->data[i - 1] + 1)
+	    n++;
+	return n;
+     }
+   /* a run starts wherever a bit is set and the one before it isn't */
+   w = (unsigned long long *)c->data;
+   for (i = 0; i < BM_WORDS; i++)
+     n += __builtin_popcountll(w[i] & ~((w[i] << 1) | (i > 0 ? w[i - 1] >> 63 : 0)));
+   return n;
+}
+
+/*
+ * switch c over to another form
+ */
+static int
+cont_convert(c, type)
+   tcont_t *c;
+   int type;
+{
+   tcont_t nc;
+   int lo, hi, from = 0, v;
+   
+   memset(&nc, 0, sizeof(nc));
+   nc.key = c->key;
+   nc.type = type;
+   if (type == TC_BITMAP)
+     {
+	if (!(nc.data = (unsigned short *)calloc(TC_BITMAP_SHORTS, sizeof(unsigned short))))
+	  {
+	     fprintf(stderr, "Unable to allocate memory for an address bitmap.\n");
+	     return -1;
+	  }
+	nc.alloc = TC_BITMAP_SHORTS;
+     }
+   while (from <= 0xffff && cont_next_run(c, from, &lo, &hi))
+     {
+	if (type == TC_BITMAP)
+	  bm_range(&nc, lo, hi, 1);
+	else if (type == TC_RUN)
+	  {
+	     if (cont_grow(&nc, 2 * nc.n + 2) == -1)
+	       {
+		  free(nc.data);
+		  return -1;
+	       }
+	     nc.data[2 * nc.n] = lo;
+	     nc.data[2 * nc.n + 1] = hi - lo;
+	     nc.n++;
+	  }
+	else
+	  {
+	     if (cont_grow(&nc, nc.n + hi - lo + 1) == -1)
+	       {
+		  free(nc.data);
+		  return -1;
+	       }
+	     for (v = lo; v <= hi; v++)
+	       nc.data[nc.n++] = v;
+	  }
+	from = hi + 1;
+     }
+   nc.card = c->card;
+   free(c->data);
+   *c = nc;
+   return 0;
+}
+
+
+/*
+ * first array value >= v
+ */
+static unsigned int
+arr_lower(c, v)
+   tcont_t *c;
+   int v;
+{
+   unsigned int lo = 0, hi = c->n, mid;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	if (c->data[mid] < v)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   return lo;
+}
+
+/*
+ * first run ending at or after v
+ */
+static unsigned int
+run_lower(c, v)
+   tcont_t *c;
+   int v;
+{
+   unsigned int lo = 0, hi = c->n, mid;
+   
+   while (lo < hi)
+     {
+	mid = lo + (hi - lo) / 2;
+	if (RUN_END(c, mid) < v)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+     }
+   return lo;
+}
+
+static int
+run_add_range(c, lo, hi)
+   tcont_t *c;
+   int lo, hi;
+{
+   unsigned int i, j;
+   int had = 0, nr[2];
+   
+   /* the runs it touches or sits right next to */
+   i = run_lower(c, lo > 0 ? lo - 1 : 0);
+   for (j = i; j < c->n && RUN_START(c, j) <= hi + 1; j++)
+     {
+	had += RUN_END(c, j) - RUN_START(c, j) + 1;
+	if (RUN_START(c, j) < lo)
+	  lo = RUN_START(c, j);
+	if (RUN_END(c, j) > hi)
+	  hi = RUN_END(c, j);
+     }
+   nr[0] = lo;
+   nr[1] = hi;
+   if (run_replace(c, i, j, nr, 1) == -1)
+     return -1;
+   c->card += (hi - lo + 1) - had;
+   return (hi - lo + 1) - had;
+}
+
+static int
+run_remove_range(c, lo, hi)
+   tcont_t *c;
+   int lo, hi;
+{
+   unsigned int i, j, np = 0;
+   int gone = 0, nr[4], s, e;
+   
+   i = run_lower(c, lo);
+   for (j = i; j < c->n && RUN_START(c, j) <= hi; j++)
+     {
+	s = RUN_START(c, j) > lo ? RUN_START(c, j) : lo;
+	e = RUN_END(c, j) < hi ? RUN_END(c, j) : hi;
+	gone += e - s + 1;
+     }
+   if (gone == 0)
+     return 0;
+   /* whatever sticks out either side survives */
+   if (RUN_START(c, i) < lo)
+     {
+	nr[np++] = RUN_START(c, i);
+	nr[np++] = lo - 1;
+     }
+   if (RUN_END(c, j - 1) > hi)
+     {
+	nr[np++] = hi + 1;
+	nr[np++] = RUN_END(c, j - 1);
+     }
+   if (run_replace(c, i, j, nr, np / 2) == -1)
+     return -1;
+   c->card -= gone;
+   return gone;
+}
+
+/*
+ * swap runs i up to j for the n (start, end) pairs in nr
+ */
+static int
+run_replace(c, i, j, nr, n)
+   tcont_t *c;
+   unsigned int i, j;
+   int *nr;
+   unsigned int n;
+{
+   unsigned int k, nn = c->n - (j - i) + n;
+   
+   if (cont_grow(c, 2 * nn) == -1)
+     return -1;
+   memmove(&c->data[2 * (i + n)], &c->data[2 * j], 2 * (c->n - j) * sizeof(unsigned short));
+   for (k = 0; k < n; k++)
+     {
+	c->data[2 * (i + k)] = nr[2 * k];
+	c->data[2 * (i + k) + 1] = nr[2 * k + 1] - nr[2 * k];
+     }
+   c->n = nn;
+   return 0;
+}
+
+/*
+ * set (or clear) bits lo through hi, returns how many changed
+ */
+static int
+bm_range(c, lo, hi, set)
+   tcont_t *c;
+   int lo, hi, set;
+{
+   unsigned long long *w = (unsigned long long *)c->data, m;
+   int i, n = 0;
+   
+   for (i = lo >> 6; i <= hi >> 6; i++)
+     {
+	m = ~0ULL;
+	if (i == lo >> 6)
+	  m &= ~0ULL << (lo & 63);
+	if (i == hi >> 6 && (hi & 63) != 63)
+	  m &= (1ULL << ((hi & 63) + 1)) - 1;
+	if (set)
+	  {
+	     n += __builtin_popcountll(m & ~w[i]);
+	     w[i] |= m;
+	  }
+	else
+	  {
+	     n += __builtin_popcountll(m & w[i]);
+	     w[i] &= ~m;
+	  }
+     }
+   if (set)
+     c->card += n;
+   else
+     c->card -= n;
+   return n;
+}
@@ -0,0 +1,68 @@
+/*
+ * tset.h: compressed sets of IPv4 addresses
+ *
+ * roaring style: the top 16 bits of an address pick a container and
+ * each container holds its low 16 bits as whichever of a sorted array,
+ * a bitmap or a list of runs is smallest.  a few scattered hosts cost
+ * 2 bytes each, a swept /16 costs a run per /24 (or 4 bytes for the
+ * lot), so the whole IPv4 space fits in tens of megabytes.
+ *
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __tset_h
+#define __tset_h
+
+#include <stdio.h>
+
+/* container types */
+#define TC_ARRAY 		0	/* sorted values */
+#define TC_BITMAP 		1	/* 65536 bits */
+#define TC_RUN 			2	/* sorted (start, length - 1) pairs */
+
+/* past this many values an array is bigger than a bitmap */
+#define TC_ARRAY_MAX 		4096
+
+/* shorts in a bitmap, and the most runs worth keeping as runs */
+#define TC_BITMAP_SHORTS 	4096
+#define TC_RUN_MAX 		(TC_BITMAP_SHORTS / 2)
+
+/* shorts of data a container has in use */
+#define TC_SHORTS(c) 		((c)->type == TC_BITMAP ? TC_BITMAP_SHORTS \
+				 : (c)->type == TC_RUN ? 2 * (c)->n : (c)->n)
+
+/* one container */
+typedef struct
+{
+   unsigned short key;		/* the top 16 bits */
+   unsigned char type;
+   unsigned int card;		/* values in it */
+   unsigned int n;		/* array values or runs */
+   unsigned int alloc;		/* shorts data has room for */
+   unsigned short *data;
+} tcont_t;
+
+/* a set */
+typedef struct
+{
+   tcont_t *c;			/* sorted by key */
+   unsigned int nc, nalloc;
+   unsigned long long card;
+} tset_t;
+
+/* prototypes */
+long long tset_add_range(tset_t *, unsigned int, unsigned int);
+long long tset_remove_range(tset_t *, unsigned int, unsigned int);
+int tset_contains(tset_t *, unsigned int);
+int tset_next_run(tset_t *, unsigned long long, unsigned int *, unsigned int *);
+int tset_union(tset_t *, tset_t *);
+int tset_andnot(tset_t *, tset_t *);
+int tset_and(tset_t *, tset_t *);
+void tset_optimize(tset_t *);
+unsigned long long tset_bytes(tset_t *);
+int tset_write(tset_t *, FILE *);
+int tset_read(tset_t *, FILE *);
+void tset_free(tset_t *);
+int tset_own(tset_t *, unsigned int, unsigned int);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * udp.c: shared sockets for SOCKS v5 UDP ASSOCIATE probes
+ * 
+ * every association gets a datagram sent through its relay to the echo
+ * endpoint, and passes when it comes back.  the datagrams for all of
+ * them go out and come in on a couple of shared sockets (one per
+ * address family), a batch per sendmmsg()/recvmmsg(), and find their
+ * slot again by what they carry.  if the echo endpoint's address is
+ * ours we answer on it too.
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "socks5.h"
+
+#include "args.h"
+#include "scan.h"
+#include "udp.h"
+
+/* the queues */
+#define UQ_V4 			0	/* client socket for IPv4 relays */
+#define UQ_V6 			1	/* and IPv6 ones */
+#define UQ_ECHO 		2	/* the echo endpoint, if it is ours */
+#define UQ_COUNT 		3
+
+/* datagrams waiting to go out on one socket (or just read from it) */
+typedef struct
+{
+   int fd;
+   unsigned int n;
+   struct mmsghdr msg[UDP_BATCH];
+   struct iovec iov[UDP_BATCH];
+   struct sockaddr_storage to[UDP_BATCH];
+   char buf[UDP_BATCH][UDP_DGRAM_MAX];
+} udpq_t;
+
+typedef struct udp_stru
+{
+   udpq_t q[UQ_COUNT];
+   udpq_t rx;			/* what came in, fd unused */
+} udp_t;
+
+static int udp_socket(int);
+static int q_add(udpq_t *, struct sockaddr_storage *, socklen_t, char *, int);
+static void q_link(udpq_t *, unsigned int, socklen_t, int);
+static void q_flush(scan_t *, udpq_t *);
+static void q_drain(scan_t *, udp_t *, int);
+static void got_reply(scan_t *, char *, int);
+
+
+/*
+ * open the shared sockets, and the echo endpoint if it's ours
+ */
+int
+udp_init(sc)
+   scan_t *sc;
+{
+   struct sockaddr_storage *echo = &sc->opts->udp_echo;
+   udp_t *u;
+   int i, fd;
+   
+   if (!(u = (udp_t *)calloc(1, sizeof(udp_t))))
+     {
+	fprintf(stderr, "Unable to allocate memory for the udp queues.\n");
+	return -1;
+     }
+   for (i = 0; i < UQ_COUNT; i++)
+     u->q[i].fd = -1;
+   u->q[UQ_V4].fd = udp_socket(AF_INET);
+   u->q[UQ_V6].fd = udp_socket(AF_INET6);
+   if (u->q[UQ_V4].fd == -1 && u->q[UQ_V6].fd == -1)
+     {
+	fprintf(stderr, "Unable to create a udp socket: %s\n", strerror(errno));
+	free(u);
+	return -1;
+     }
+   
+   /* an echo endpoint of our own?  then we answer it */
+   if ((fd = udp_socket(echo->ss_family)) != -1)
+     {
+	if (bind(fd, (struct sockaddr *)echo, echo->ss_family == AF_INET
+		 ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) == 0)
+	  u->q[UQ_ECHO].fd = fd;
+	else
+	  {
+	     if (sc->opts->verbose >= 1)
+	       fprintf(stderr, "not answering the udp echo endpoint here (%s), something else has to.\n", strerror(errno));
+	     close(fd);
+	  }
+     }
+   sc->udp = u;
+   return 0;
+}
+
+void
+udp_fini(sc)
+   scan_t *sc;
+{
+   udp_t *u = sc->udp;
+   int i;
+   
+   if (!u)
+     return;
+   for (i = 0; i < UQ_COUNT; i++)
+     if (u->q[i].fd != -1)
+       close(u->q[i].fd);
+   free(u);
+   sc->udp = NULL;
+}
+
+
+/*
+ * queue a datagram through the relay for the slot
+ */
+int
+udp_send(sc, sl, relay, rlen)
+   scan_t *sc;
+   scanslot_t *sl;
+   struct sockaddr_storage *relay;
+   socklen_t rlen;
+{
+   udpq_t *q = &sc->udp->q[relay->ss_family == AF_INET6 ? UQ_V6 : UQ_V4];
+   char dg[64];
+   int hl;
+   
+   if (q->fd == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "no udp socket for the relay's address family");
+	return -1;
+     }
+   if (q->n == UDP_BATCH)
+     q_flush(sc, q);
+   
+   hl = socks5_build_udp_header(dg, sizeof(dg), (struct sockaddr *)&sc->opts->udp_echo);
+   sc->seed = sc->seed * 1103515245 + 12345;
+   sl->cookie = sc->seed;
+   memcpy(dg + hl, UDP_MAGIC, 4);
+   memcpy(dg + hl + 4, &sl->idx, 4);
+   memcpy(dg + hl + 8, &sl->gen, 4);
+   memcpy(dg + hl + 12, &sl->cookie, 4);
+   if (q_add(q, relay, rlen, dg, hl + UDP_PROBE_LEN) == -1)
+     {
+	snprintf(sc->ebuf, sizeof(sc->ebuf), "udp send queue full");
+	return -1;
+     }
+   sl->nout += hl + UDP_PROBE_LEN;
+   return 0;
+}
+
+/*
+ * send everything queued
+ */
+void
+udp_flush(sc)
+   scan_t *sc;
+{
+   int i;
+   
+   for (i = 0; i < UQ_COUNT; i++)
+     if (sc->udp->q[i].n > 0)
+       q_flush(sc, &sc->udp->q[i]);
+}
+
+/*
+ * read whatever has come in, handing replies to the engine and
+ * echoing what came to our echo endpoint
+ */
+void
+udp_poll(sc)
+   scan_t *sc;
+{
+   int i;
+   
+   for (i = 0; i < UQ_COUNT; i++)
+     if (sc->udp->q[i].fd != -1)
+       q_drain(sc, sc->udp, i);
+}
+
+
+/*
+ * a non-blocking udp socket with room for a lot of replies
+ */
+static int
+udp_socket(family)
+   int family;
+{
+   int fd, v = UDP_RCVBUF;
+   
+   if ((fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+     return -1;
+   (void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+   return fd;
+}
+
+/*
+ * put a datagram on a queue, -1 if it is full
+ */
+static int
+q_add(q, to, tolen, data, len)
+   udpq_t *q;
+   struct sockaddr_storage *to;
+   socklen_t tolen;
+   char *data;
+   int len;
+{
+   if (q->n == UDP_BATCH)
+     return -1;
+   if (len > UDP_DGRAM_MAX)
+     len = UDP_DGRAM_MAX;
+   memcpy(&q->to[q->n], to, tolen);
+   memcpy(q->buf[q->n], data, len);
+   q_link(q, q->n, tolen, len);
+   q->n++;
+   return 0;
+}
+
+/*
+ * point entry i's header at its address and buffer
+ */
+static void
+q_link(q, i, tolen, len)
+   udpq_t *q;
+   unsigned int i;
+   socklen_t tolen;
+   int len;
+{
+   struct msghdr *mh = &q->msg[i].msg_hdr;
+   
+   memset(mh, 0, sizeof(*mh));
+   mh->msg_name = &q->to[i];
+   mh->msg_namelen = tolen;
+   mh->msg_iov = &q->iov[i];
+   mh->msg_iovlen = 1;
+   q->iov[i].iov_base = q->buf[i];
+   q->iov[i].iov_len = len;
+}
+
+/*
+ * send a queue, keeping what the socket has no room for right now
+ */
+static void
+q_flush(sc, q)
+   scan_t *sc;
+   udpq_t *q;
+{
+   unsigned int done = 0, i;
+   int n;
+   
+   while (done < q->n)
+     {
+	n = sendmmsg(q->fd, q->msg + done, q->n - done, 0);
+	SCAN_SHARED_SYS(sc, 1);
+	if (n > 0)
+	  {
+	     done += n;
+	     continue;
+	  }
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+	  break;
+	/* that one can't be sent at all, its slot will time out */
+	if (sc->opts->verbose >= 2)
+	  fprintf(stderr, "sendmmsg: %s\n", strerror(errno));
+	done++;
+     }
+   if (done == 0)
+     return;
+   
+   /* move the rest up front */
+   for (i = 0; done + i < q->n; i++)
+     {
+	q->to[i] = q->to[done + i];
+	memcpy(q->buf[i], q->buf[done + i], q->iov[done + i].iov_len);
+	q_link(q, i, q->msg[done + i].msg_hdr.msg_namelen, q->iov[done + i].iov_len);
+     }
+   q->n = i;
+}
+
+/*
+ * read a socket's datagrams, a batch at a time
+ */
+static void
+q_drain(sc, u, which)
+   scan_t *sc;
+   udp_t *u;
+   int which;
+{
+   udpq_t *rx = &u->rx;
+   unsigned int i;
+   int n, round;
+   
+   for (round = 0; round < UDP_MAX_ROUNDS; round++)
+     {
+	for (i = 0; i < UDP_BATCH; i++)
+	  q_link(rx, i, sizeof(rx->to[i]), UDP_DGRAM_MAX);
+	n = recvmmsg(u->q[which].fd, rx->msg, UDP_BATCH, MSG_DONTWAIT, NULL);
+	SCAN_SHARED_SYS(sc, 1);
+	if (n <= 0)
+	  return;
+	for (i = 0; i < (unsigned int)n; i++)
+	  {
+	     if (which != UQ_ECHO)
+	       {
+		  got_reply(sc, rx->buf[i], rx->msg[i].msg_len);
+		  continue;
+	       }
+	     /* send it right back */
+	     if (u->q[UQ_ECHO].n == UDP_BATCH)
+	       q_flush(sc, &u->q[UQ_ECHO]);
+	     (void) q_add(&u->q[UQ_ECHO], &rx->to[i], rx->msg[i].msg_hdr.msg_namelen,
+			  rx->buf[i], rx->msg[i].msg_len);
+	  }
+	if (n < UDP_BATCH)
+	  return;
+     }
+}
+
+/*
+ * a datagram came back from a relay, is it one of ours?
+ */
+static void
+got_reply(sc, buf, len)
+   scan_t *sc;
+   char *buf;
+   int len;
+{
+   unsigned int idx, gen, cookie;
+   scanslot_t *sl;
+   int hl;
+   
+   if (!(hl = socks5_parse_udp_header(buf, len)) || len - hl < UDP_PROBE_LEN
+       || memcmp(buf + hl, UDP_MAGIC, 4))
+     return;
+   memcpy(&idx, buf + hl + 4, 4);
+   memcpy(&gen, buf + hl + 8, 4);
+   memcpy(&cookie, buf + hl + 12, 4);
+   if (idx >= sc->nslots)
+     return;
+   sl = &sc->slots[idx];
+   if (!sl->targ || sl->io_state != SIO_UDP || sl->gen != gen || sl->cookie != cookie)
+     return;
+   scan_udp_reply(sc, sl, len);
+}
@@ -0,0 +1,40 @@
+/*
+ * udp.h: shared sockets for SOCKS v5 UDP ASSOCIATE probes
+ * 
+ * written by Joshua J. Drake (jduck@EFNet, socks_scan@qoop.org)
+ */
+
+#ifndef __udp_h
+#define __udp_h
+
+#include <sys/socket.h>
+
+#include "scan.h"
+
+/* datagrams per sendmmsg()/recvmmsg() */
+#define UDP_BATCH 		256
+
+/* room for a datagram, ours are tiny, echoes of others get cut off */
+#define UDP_DGRAM_MAX 		512
+
+/* the longest the main loop sleeps while datagrams are out */
+#define UDP_TICK_MS 		10
+
+/* batches read from one socket per trip around the loop, at most */
+#define UDP_MAX_ROUNDS 		16
+
+/* the shared sockets can have a lot queued */
+#define UDP_RCVBUF 		(4 << 20)
+
+/* what goes through the relay: magic, slot, generation and cookie */
+#define UDP_MAGIC 		"SSUD"
+#define UDP_PROBE_LEN 		16
+
+/* prototypes */
+int udp_init(scan_t *);
+void udp_fini(scan_t *);
+int udp_send(scan_t *, scanslot_t *, struct sockaddr_storage *, socklen_t);
+void udp_flush(scan_t *);
+void udp_poll(scan_t *);
+
+#endif